@@ -0,0 +1,476 @@
+//
+// Access log written by a background thread from records queued by the
+// workers.
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Workers never format nor write anything. Each worker copies a fixed-size
+// binary record of every response in its own ring, which is drained by the
+// logging thread. When the ring of a worker is full, the record is dropped and
+// counted, so a slow disk never stalls a worker.
+//
+// Lines are written in a format close to the Common Log Format:
+//
+//     <raddr>:<rport> <laddr>:<lport> [<date>] "GET /<path> HTTP/1.<x>"
+//     <status> <bytes> <service time in us>
+//
+
+#ifndef __RUSTY_APP_ACCESS_LOG_HPP__
+#define __RUSTY_APP_ACCESS_LOG_HPP__
+
+#include <algorithm>            // min()
+#include <atomic>
+#include <cerrno>
+#include <cinttypes>            // PRIu16, PRIu64
+#include <cstdint>
+#include <cstdio>
+#include <cstring>              // strerror()
+#include <ctime>                // clock_gettime(), gmtime_r(), strftime()
+#include <vector>
+
+#include <arpa/inet.h>          // inet_ntop()
+#include <limits.h>             // IOV_MAX
+#include <pthread.h>            // pthread_mutex_*
+#include <sys/uio.h>            // struct iovec, writev()
+#include <unistd.h>             // usleep()
+
+#include <arch/cycle.h>         // get_cycle_count()
+
+#include "driver/cpu.hpp"       // CYCLES_PER_SECOND, cycles_t
+#include "util/macros.hpp"      // LIKELY(), UNLIKELY(), RUSTY_*
+
+using namespace std;
+
+using namespace rusty::driver::cpu;
+
+namespace rusty {
+namespace app {
+
+#define ACCESS_LOG_COLOR     COLOR_YEL
+#define ACCESS_LOG_ERROR(MSG, ...)                                             \
+    RUSTY_ERROR("ACCESS_LOG", ACCESS_LOG_COLOR, MSG, ##__VA_ARGS__)
+
+// Paths are truncated to this number of bytes in the records.
+static constexpr size_t MAX_LOGGED_PATH     = 86;
+
+// Record of a response, copied by the worker which sent it.
+struct access_record_t {
+    // Cycle count when the request was received.
+    cycles_t    received;
+
+    // Size of the response, header included.
+    uint64_t    bytes;
+
+    // In network byte order.
+    uint32_t    raddr;
+    uint32_t    laddr;
+
+    // Cycles between the reception of the request and the queuing of its
+    // response, saturated to 'UINT32_MAX'.
+    uint32_t    service_cycles;
+
+    // In host byte order.
+    uint16_t    rport;
+    uint16_t    lport;
+
+    // Status code of the response.
+    uint16_t    status;
+
+    // Version of the request, as in 'http_request_t'. 'minor_version' is set
+    // to '\0' if the request was invalid.
+    char        major_version;
+    char        minor_version;
+
+    uint8_t     path_len;
+    char        path[MAX_LOGGED_PATH];
+};
+
+// Lock-free ring of records, written by a single worker and read by the
+// logging thread.
+struct access_ring_t {
+    //
+    // Static fields
+    //
+
+    // Must be a power of two.
+    static constexpr size_t CAPACITY    = 4096;
+
+    // Size of an L2 cache line. Indexes written by different threads are kept
+    // on different lines.
+    static constexpr size_t LINE_SIZE   = 64;
+
+    //
+    // Fields
+    //
+
+    // Written by the worker.
+    atomic<size_t>      tail;               // Index of the next record.
+    size_t              cached_head;        // Last read value of 'head'.
+    atomic<uint64_t>    n_dropped;
+
+    char                _pad0[LINE_SIZE];
+
+    // Written by the logging thread.
+    atomic<size_t>      head;               // Index of the first record.
+
+    char                _pad1[LINE_SIZE];
+
+    access_record_t     records[CAPACITY];
+
+    //
+    // Methods
+    //
+
+    inline access_ring_t(void)
+        : tail(0), cached_head(0), n_dropped(0), head(0)
+    {
+    }
+
+    // Returns the record to fill, or 'nullptr' if the ring is full, in which
+    // case the record is counted as dropped.
+    //
+    // The record is only visible to the logging thread once 'commit()' has
+    // been called. Worker only.
+    inline access_record_t *reserve(void);
+
+    // Worker only.
+    inline void commit(void);
+
+    // Returns the number of records which can be read. Logging thread only.
+    inline size_t available(void) const;
+
+    // Returns the 'i'th readable record. Logging thread only.
+    inline const access_record_t *peek(size_t i) const;
+
+    // Frees the 'n' first readable records. Logging thread only.
+    inline void release(size_t n);
+};
+
+// Rings of the workers and the file they are written to.
+struct access_log_t {
+    //
+    // Static fields
+    //
+
+    // Duration of the sleep of the logging thread when every ring is empty, in
+    // microseconds.
+    static constexpr useconds_t IDLE_SLEEP      = 10000;
+
+    // Maximum number of bytes formatted for a ring before writing them.
+    static constexpr size_t     BUFFER_SIZE     = 64 * 1024;
+
+    // Maximum length of a formatted line.
+    static constexpr size_t     MAX_LINE_LEN    = 4 * MAX_LOGGED_PATH + 128;
+
+    //
+    // Fields
+    //
+
+    int                     fd;
+
+    // Rings of the registered workers, protected by 'rings_lock'.
+    pthread_mutex_t         rings_lock;
+    vector<access_ring_t *> rings;
+
+    // Reference used to convert cycle counts to dates.
+    cycles_t                base_cycles;
+    struct timespec         base_time;
+
+    //
+    // Methods
+    //
+
+    // Logs to the file descriptor, which must be opened for writing.
+    access_log_t(int _fd);
+
+    // Registers the calling worker and returns its ring. Must be called once
+    // by each worker.
+    access_ring_t *register_worker(void);
+
+    // Returns the number of records dropped by all the workers.
+    uint64_t n_dropped(void);
+};
+
+// Body of the logging thread. Writes the records queued by the workers, and
+// never returns.
+static void *access_logger_main(void *access_log);
+
+// Writes the formatted line of the record in 'buffer', which must be able to
+// hold 'MAX_LINE_LEN' bytes. Returns the length of the line.
+//
+// 'date' caches the formatted date of the previous record. 'date_sec' is the
+// second it was formatted for.
+static size_t _format_record(
+    const access_log_t *access_log, const access_record_t *record,
+    char *buffer, time_t *date_sec, char *date
+);
+
+// Writes the buffers, retrying on short writes.
+static void _write_buffers(int fd, struct iovec *iov, size_t n_iov);
+
+inline access_record_t *access_ring_t::reserve(void)
+{
+    size_t tail = this->tail.load(memory_order_relaxed);
+
+    // Only reads the index of the logging thread when the ring seems full.
+    if (UNLIKELY(tail - this->cached_head == CAPACITY)) {
+        this->cached_head = this->head.load(memory_order_acquire);
+
+        if (tail - this->cached_head == CAPACITY) {
+            this->n_dropped.store(
+                this->n_dropped.load(memory_order_relaxed) + 1,
+                memory_order_relaxed
+            );
+            return nullptr;
+        }
+    }
+
+    return &this->records[tail & (CAPACITY - 1)];
+}
+
+inline void access_ring_t::commit(void)
+{
+    this->tail.store(
+        this->tail.load(memory_order_relaxed) + 1, memory_order_release
+    );
+}
+
+inline size_t access_ring_t::available(void) const
+{
+    return   this->tail.load(memory_order_acquire)
+           - this->head.load(memory_order_relaxed);
+}
+
+inline const access_record_t *access_ring_t::peek(size_t i) const
+{
+    size_t head = this->head.load(memory_order_relaxed);
+    return &this->records[(head + i) & (CAPACITY - 1)];
+}
+
+inline void access_ring_t::release(size_t n)
+{
+    this->head.store(
+        this->head.load(memory_order_relaxed) + n, memory_order_release
+    );
+}
+
+inline access_log_t::access_log_t(int _fd) : fd(_fd)
+{
+    pthread_mutex_init(&this->rings_lock, nullptr);
+
+    clock_gettime(CLOCK_REALTIME, &this->base_time);
+    this->base_cycles = get_cycle_count();
+}
+
+inline access_ring_t *access_log_t::register_worker(void)
+{
+    access_ring_t *ring = new access_ring_t();
+
+    pthread_mutex_lock(&this->rings_lock);
+    this->rings.push_back(ring);
+    pthread_mutex_unlock(&this->rings_lock);
+
+    return ring;
+}
+
+inline uint64_t access_log_t::n_dropped(void)
+{
+    uint64_t n = 0;
+
+    pthread_mutex_lock(&this->rings_lock);
+    for (access_ring_t *ring : this->rings)
+        n += ring->n_dropped.load(memory_order_relaxed);
+    pthread_mutex_unlock(&this->rings_lock);
+
+    return n;
+}
+
+static void *access_logger_main(void *access_log_void)
+{
+    access_log_t *access_log = (access_log_t *) access_log_void;
+
+    // Each ring is formatted in its own buffer. The buffers of all the rings
+    // are then written by a single system call.
+    vector<access_ring_t *> rings;
+    vector<vector<char>>    buffers;
+    vector<struct iovec>    iov;
+
+    time_t  date_sec = 0;
+    char    date[32];
+
+    uint64_t n_reported_dropped = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&access_log->rings_lock);
+        rings = access_log->rings;
+        pthread_mutex_unlock(&access_log->rings_lock);
+
+        while (buffers.size() < rings.size())
+            buffers.push_back(vector<char>(access_log_t::BUFFER_SIZE));
+
+        size_t n_records = 0;
+
+        // Drains the records which were in the rings, in chunks which fit in
+        // the buffers.
+        bool remaining;
+        do {
+            remaining = false;
+            iov.clear();
+
+            for (size_t i = 0; i < rings.size(); i++) {
+                access_ring_t   *ring   = rings[i];
+                char            *buffer = buffers[i].data();
+
+                size_t n = min(
+                    ring->available(),
+                    access_log_t::BUFFER_SIZE / access_log_t::MAX_LINE_LEN
+                );
+
+                if (n == 0)
+                    continue;
+
+                size_t len = 0;
+                for (size_t j = 0; j < n; j++) {
+                    len += _format_record(
+                        access_log, ring->peek(j), buffer + len, &date_sec,
+                        date
+                    );
+                }
+
+                ring->release(n);
+
+                iov.push_back((struct iovec) { buffer, len });
+
+                n_records += n;
+                remaining |= ring->available() > 0;
+
+                if (iov.size() == (size_t) IOV_MAX) {
+                    _write_buffers(access_log->fd, iov.data(), iov.size());
+                    iov.clear();
+                }
+            }
+
+            _write_buffers(access_log->fd, iov.data(), iov.size());
+        } while (remaining && n_records < access_ring_t::CAPACITY * 64);
+
+        uint64_t n_dropped = access_log->n_dropped();
+        if (UNLIKELY(n_dropped > n_reported_dropped)) {
+            ACCESS_LOG_ERROR(
+                "%" PRIu64 " access record(s) dropped (%" PRIu64 " in total)",
+                n_dropped - n_reported_dropped, n_dropped
+            );
+            n_reported_dropped = n_dropped;
+        }
+
+        if (n_records == 0)
+            usleep(access_log_t::IDLE_SLEEP);
+    }
+
+    return nullptr;
+}
+
+static size_t _format_record(
+    const access_log_t *access_log, const access_record_t *record,
+    char *buffer, time_t *date_sec, char *date
+)
+{
+    // Dates are only formatted once per second.
+    int64_t elapsed = record->received - access_log->base_cycles;
+    time_t  sec     =   access_log->base_time.tv_sec
+                      + elapsed / (int64_t) CYCLES_PER_SECOND;
+
+    if (sec != *date_sec) {
+        struct tm tm;
+        strftime(date, 32, "%d/%b/%Y:%H:%M:%S +0000", gmtime_r(&sec, &tm));
+        *date_sec = sec;
+    }
+
+    char raddr[INET_ADDRSTRLEN], laddr[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &record->raddr, raddr, sizeof (raddr));
+    inet_ntop(AF_INET, &record->laddr, laddr, sizeof (laddr));
+
+    char *p = buffer;
+
+    p += sprintf(
+        p, "%s:%" PRIu16 " %s:%" PRIu16 " [%s] ",
+        raddr, record->rport, laddr, record->lport, date
+    );
+
+    if (record->minor_version == '\0') {
+        p += sprintf(p, "\"-\"");
+    } else {
+        p += sprintf(p, "\"GET /");
+
+        // Escapes the quotes and the non-printable characters of the path.
+        for (size_t i = 0; i < record->path_len; i++) {
+            unsigned char c = record->path[i];
+
+            if (c < 0x20 || c >= 0x7F || c == '"' || c == '\\')
+                p += sprintf(p, "\\x%02X", c);
+            else
+                *p++ = c;
+        }
+
+        p += sprintf(
+            p, " HTTP/%c.%c\"", record->major_version, record->minor_version
+        );
+    }
+
+    p += sprintf(
+        p, " %" PRIu16 " %" PRIu64 " %" PRIu64 "\n",
+        record->status, record->bytes,
+        (uint64_t) record->service_cycles * 1000000 / CYCLES_PER_SECOND
+    );
+
+    return p - buffer;
+}
+
+static void _write_buffers(int fd, struct iovec *iov, size_t n_iov)
+{
+    while (n_iov > 0) {
+        ssize_t written = writev(fd, iov, n_iov);
+
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+
+            ACCESS_LOG_ERROR(
+                "Unable to write the access log (%s)", strerror(errno)
+            );
+            return;
+        }
+
+        // Skips the written buffers, and retries with the remaining bytes.
+        while (n_iov > 0 && (size_t) written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            n_iov--;
+        }
+
+        if (n_iov > 0) {
+            iov->iov_base = (char *) iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+}
+
+#undef ACCESS_LOG_COLOR
+#undef ACCESS_LOG_ERROR
+
+} } /* namespace rusty::app */
+
+#endif /* __RUSTY_APP_ACCESS_LOG_HPP__ */
@@ -0,0 +1,819 @@
+//
+// Served files and their precomputed HTTP responses.
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __RUSTY_APP_CONTENT_HPP__
+#define __RUSTY_APP_CONTENT_HPP__
+
+#include <algorithm>            // lower_bound(), max(), min(), sort()
+#include <atomic>
+#include <cassert>
+#include <cinttypes>            // PRIx64
+#include <cstdint>              // SIZE_MAX
+#include <cstdio>
+#include <cstdlib>              // free()
+#include <cstring>
+#include <ctime>                // gmtime_r(), strftime(), time_t
+#include <string>
+#include <utility>              // move()
+#include <vector>
+
+#include <dirent.h>             // struct dirent, opendir(), readdir()
+#include <pthread.h>            // pthread_create(), pthread_join()
+#include <sys/mman.h>           // madvise(), mmap(), munmap()
+#include <sys/stat.h>           // struct stat, lstat(), stat()
+#include <unistd.h>             // usleep()
+
+#include "app/file_index.hpp"   // file_index_t
+#include "http/parser.hpp"      // http_parser_t, http_request_t, str_ref_t
+#include "http/static_response.hpp" // free_static_response(),
+                                    // init_static_response(),
+                                    // static_response_t
+#include "net/checksum.hpp"     // precomputed_sums_t
+#include "util/macros.hpp"      // RUSTY_*
+
+using namespace std;
+
+using namespace rusty::http;
+using namespace rusty::net;
+
+namespace rusty {
+namespace app {
+
+#define CONTENT_COLOR     COLOR_CYN
+#define CONTENT_DEBUG(MSG, ...)                                                \
+    RUSTY_DEBUG("CONTENT", CONTENT_COLOR, MSG, ##__VA_ARGS__)
+#define CONTENT_DIE(MSG, ...)                                                  \
+    RUSTY_DIE(  "CONTENT", CONTENT_COLOR, MSG, ##__VA_ARGS__)
+
+// Maximum size of the HTTP header of a response.
+static constexpr size_t MAX_RESPONSE_HEADER_LEN = 256;
+
+// Maximum size of the HTTP header of a partial response.
+static constexpr size_t MAX_PARTIAL_HEADER_LEN  = MAX_RESPONSE_HEADER_LEN + 64;
+
+// Content codings of the precompressed variants of the files, by order of
+// preference.
+//
+// A variant is loaded from the file with the same path and the coding suffix
+// (e.g. "index.html.gz" for the gzip variant of "index.html").
+enum content_encoding_t {
+    ENCODING_BR     = 0,
+    ENCODING_GZIP   = 1
+};
+
+static constexpr size_t N_ENCODINGS             = 2;
+
+static constexpr const char *ENCODING_NAMES[]    = { "br", "gzip" };
+static constexpr const char *ENCODING_SUFFIXES[] = { ".br", ".gz" };
+
+// 'preload_files()' checks if the files are loaded every 'LOAD_POLL_US' µs,
+// and reports the progress every 'LOAD_REPORT_POLLS' checks.
+static constexpr useconds_t LOAD_POLL_US        = 10000;
+static constexpr size_t     LOAD_REPORT_POLLS   = 25;
+
+// Precomputed HTTP header of a response of a file. The file is the body of the
+// response (see 'http/static_response.hpp').
+typedef static_response_t           response_t;
+
+// Served file, with its content and its precomputed responses.
+//
+// The referenced memory is either owned by the file, or by a memory-mapped
+// content pack. The content of a streamed file is a private memory mapping of
+// the file, backed by the page cache.
+//
+// Has the fields of 'static_body_t', and is the body of its responses.
+struct file_t {
+    const char                      *content;
+    size_t                          content_len;
+
+    #ifdef USE_PRECOMPUTED_CHECKSUMS
+        precomputed_sums_t              precomputed_sums;
+    #endif /* USE_PRECOMPUTED_CHECKSUMS */
+
+    // Responses with a 'Connection: close' header (index 0) and with a
+    // 'Connection: keep-alive' header (index 1). Both share the content.
+    response_t                      responses[2];
+
+    // Strong entity tag (with its quotes) and modification date of the file,
+    // as sent in the 'ETag' and 'Last-Modified' headers. Empty if the file has
+    // no validators.
+    str_ref_t                       etag;
+    str_ref_t                       last_modified;
+
+    // Header-only '304 Not Modified' responses, with the same validators and
+    // content headers as 'responses'. Only initialized if the file has
+    // validators.
+    response_t                      not_modified[2];
+
+    // Precompressed variants of the file, indexed by 'content_encoding_t', or
+    // 'nullptr'. Variants are stored in the same index, but are not reachable
+    // by a key.
+    const file_t                    *variants[N_ENCODINGS];
+
+    // Set for large files which are memory-mapped instead of being read. They
+    // have no precomputed checksums, which would be as large as the content,
+    // and their checksums are computed when sending them.
+    bool                            streamed;
+};
+
+// Served files, indexed by their paths relative to the root directory.
+typedef file_index_t<file_t>        files_t;
+
+// Loads the content in a new file and precomputes its responses with the given
+// HTTP status.
+//
+// 'headers' are added to the responses and must be empty or made of complete
+// header lines (e.g. "Vary: Accept-Encoding\r\n").
+//
+// If 'mtime' is not zero, the file gets an entity tag computed from its
+// content and a modification date, sent with its responses, and its
+// '304 Not Modified' responses are precomputed.
+//
+// The content must never be de-allocated.
+static file_t *new_file(
+    const char *status, const char *content, size_t content_len,
+    const char *headers = "", time_t mtime = 0
+);
+
+// Loads all the files of the directory tree in the index, keyed by their path
+// relative to the root directory (e.g. "img/logo.png").
+//
+// Files having the path of another file followed by one of the
+// 'ENCODING_SUFFIXES' are loaded as precompressed variants of this file.
+//
+// Files are read and their responses precomputed by 'n_threads' threads. The
+// progress is reported on 'stderr'.
+//
+// Files larger than 'stream_threshold' bytes are streamed.
+static void preload_files(
+    files_t *files, const char *root_dir, size_t n_threads,
+    size_t stream_threshold = SIZE_MAX
+);
+
+// Releases the memory of the files and of the paths loaded by
+// 'preload_files()'.
+static inline void free_files(files_t *files);
+
+// Writes in 'buffer' the header of a '206 Partial Content' response with the
+// bytes [begin, end[ of the content, which is the precomputed header of the
+// file with a 'Content-Range' header.
+//
+// 'buffer' must be able to hold 'MAX_PARTIAL_HEADER_LEN' bytes. Returns the
+// length of the header.
+static inline size_t partial_header(
+    const file_t *file, bool keep_alive, size_t begin, size_t end,
+    char *buffer
+);
+
+// Same as 'partial_header()' for a content-less '416 Range Not Satisfiable'
+// response.
+static inline size_t unsatisfiable_header(
+    const file_t *file, bool keep_alive, char *buffer
+);
+
+// Returns the preferred precompressed variant of the file accepted by the
+// client, or the file itself.
+static inline const file_t *select_variant(
+    const file_t *file, str_ref_t accept_encoding
+);
+
+// Returns 'true' if the conditional headers of the request match the
+// validators of the file, i.e. if the client already has the file.
+//
+// 'If-Modified-Since' must be exactly the 'Last-Modified' date of the file, and
+// is ignored when the request has an 'If-None-Match' header.
+static inline bool is_not_modified(
+    const file_t *file, const http_request_t *request
+);
+
+// State shared by the threads of 'preload_files()'.
+struct _loader_t {
+    const char              *root_dir;
+
+    // Paths of the files to load, relative to 'root_dir', and the additional
+    // headers of their responses.
+    const vector<string>    *paths;
+    const vector<string>    *headers;
+
+    // Loaded files, in the order of 'paths'.
+    vector<file_t *>        *loaded;
+
+    size_t                  stream_threshold;
+
+    // Index in 'paths' of the next file to load.
+    atomic<size_t>          next;
+
+    atomic<size_t>          n_loaded;
+    atomic<size_t>          n_bytes;
+};
+
+// Appends the paths of the regular files of the directory 'root_dir/rel_dir'
+// and of its sub-directories to 'paths'.
+static void _list_files(
+    const string &root_dir, const string &rel_dir, vector<string> *paths
+);
+
+// Loads files from 'loader->paths' until all files are loaded.
+static void *_loader_main(void *loader);
+
+// Reads or maps the file and precomputes its responses.
+static file_t *_load_file(
+    const char *path, const char *headers, size_t stream_threshold
+);
+
+// Creates a file and precomputes its responses. See 'new_file()'.
+//
+// The entity tag of a streamed file is computed from its size and its
+// modification date, not to read the entire file.
+static file_t *_new_file(
+    const char *status, const char *content, size_t content_len,
+    const char *headers, time_t mtime, bool streamed
+);
+
+// Returns the offset of the first header line following the 'Content-Length'
+// header in the precomputed header of the response.
+static size_t _header_tail(const response_t *response);
+
+// Returns the path of the file the given path is a variant of, and sets
+// 'encoding', or returns an empty string if the path doesn't end with one of
+// the 'ENCODING_SUFFIXES'.
+static string _variant_of(const string &path, content_encoding_t *encoding);
+
+// Precomputes the header and the segment checksums of one of the responses
+// of the file.
+//
+// Header-only responses have no 'Content-Type' nor 'Content-Length' header.
+static void _init_response(
+    file_t *file, const char *status, const char *headers, bool keep_alive,
+    bool header_only, response_t *response
+);
+
+// Returns a copy of the string, which must be released with 'delete[]'.
+static str_ref_t _copy_str(const char *str, size_t len);
+
+static file_t *new_file(
+    const char *status, const char *content, size_t content_len,
+    const char *headers, time_t mtime
+)
+{
+    return _new_file(status, content, content_len, headers, mtime, false);
+}
+
+static file_t *_new_file(
+    const char *status, const char *content, size_t content_len,
+    const char *headers, time_t mtime, bool streamed
+)
+{
+    // The responses are initialized below. The file has no variant.
+    #ifdef USE_PRECOMPUTED_CHECKSUMS
+        file_t *file = new file_t {
+            content, content_len,
+              streamed
+            ? precomputed_sums_t(content, content_len, nullptr)
+            : precomputed_sums_t(content, content_len),
+            { }, str_ref_t(), str_ref_t(), { }, { }, streamed
+        };
+    #else
+        file_t *file = new file_t {
+            content, content_len,
+            { }, str_ref_t(), str_ref_t(), { }, { }, streamed
+        };
+    #endif /* USE_PRECOMPUTED_CHECKSUMS */
+
+    string all_headers;
+
+    if (mtime != 0) {
+        char buffer[64];
+
+        uint64_t tag =   streamed
+                       ? (uint64_t) mtime
+                       : files_t::hash(content, content_len);
+
+        size_t len = snprintf(
+            buffer, sizeof (buffer), "\"%016" PRIx64 "-%zx\"", tag, content_len
+        );
+        file->etag = _copy_str(buffer, len);
+
+        struct tm tm;
+        len = strftime(
+            buffer, sizeof (buffer), "%a, %d %b %Y %H:%M:%S GMT",
+            gmtime_r(&mtime, &tm)
+        );
+        file->last_modified = _copy_str(buffer, len);
+
+        all_headers =   "ETag: " + string(file->etag.data, file->etag.len)
+                      + "\r\nLast-Modified: " + buffer + "\r\n";
+    }
+
+    all_headers += headers;
+
+    for (int keep_alive = 0; keep_alive < 2; keep_alive++) {
+        _init_response(
+            file, status, all_headers.c_str(), keep_alive, false,
+            &file->responses[keep_alive]
+        );
+
+        if (mtime != 0) {
+            _init_response(
+                file, "304 Not Modified", all_headers.c_str(), keep_alive,
+                true, &file->not_modified[keep_alive]
+            );
+        }
+    }
+
+    return file;
+}
+
+static void preload_files(
+    files_t *files, const char *root_dir, size_t n_threads,
+    size_t stream_threshold
+)
+{
+    vector<string> paths;
+    _list_files(root_dir, "", &paths);
+
+    // Loads the files in a deterministic order.
+    sort(paths.begin(), paths.end());
+
+    // Finds the variants, which are loaded with a 'Content-Encoding' header.
+    // Files with variants get a 'Vary' header, as caches must not serve them
+    // to clients which don't accept the same codings.
+
+    vector<string>              headers(paths.size());
+    vector<size_t>              bases(paths.size(), SIZE_MAX);
+    vector<content_encoding_t>  encodings(paths.size());
+
+    for (size_t i = 0; i < paths.size(); i++) {
+        string base = _variant_of(paths[i], &encodings[i]);
+
+        if (base.empty())
+            continue;
+
+        auto it = lower_bound(paths.begin(), paths.end(), base);
+        if (it == paths.end() || *it != base)
+            continue;
+
+        // Variants of variants (e.g. "a.gz.gz") are served as regular files.
+        // Bases are sorted before their variants.
+        size_t base_index = it - paths.begin();
+        if (bases[base_index] != SIZE_MAX)
+            continue;
+
+        bases[i] = base_index;
+
+        headers[i]        =   string("Content-Encoding: ")
+                            + ENCODING_NAMES[encodings[i]] + "\r\n"
+                            + "Vary: Accept-Encoding\r\n";
+        headers[bases[i]] = "Vary: Accept-Encoding\r\n";
+    }
+
+    vector<file_t *> loaded(paths.size());
+
+    _loader_t loader;
+    loader.root_dir = root_dir;
+    loader.paths    = &paths;
+    loader.headers  = &headers;
+    loader.loaded   = &loaded;
+    loader.stream_threshold = stream_threshold;
+    loader.next     = 0;
+    loader.n_loaded = 0;
+    loader.n_bytes  = 0;
+
+    n_threads = max(min(n_threads, paths.size()), (size_t) 1);
+
+    vector<pthread_t> threads(n_threads);
+
+    for (pthread_t &thread : threads) {
+        if (pthread_create(&thread, nullptr, _loader_main, &loader) != 0)
+            CONTENT_DIE("Unable to start a loading thread");
+    }
+
+    // Reports the progress until all files are loaded. The files are checked
+    // more often than the progress is reported, so that a short load doesn't
+    // wait for the next report.
+    for (size_t n_polls = 0; ; n_polls++) {
+        size_t n_loaded = loader.n_loaded;
+
+        if (n_loaded == paths.size() || n_polls % LOAD_REPORT_POLLS == 0) {
+            fprintf(
+                stderr, "\rLoading %s: %zu/%zu file(s), %zu MB", root_dir,
+                n_loaded, paths.size(),
+                (size_t) loader.n_bytes / (1024 * 1024)
+            );
+        }
+
+        if (n_loaded == paths.size())
+            break;
+
+        usleep(LOAD_POLL_US);
+    }
+
+    fprintf(stderr, "\n");
+
+    for (pthread_t &thread : threads)
+        pthread_join(thread, nullptr);
+
+    // Indexes the files, and then appends the variants, so the variants can
+    // reference stable addresses once 'files->values' stops growing.
+
+    for (size_t i = 0; i < paths.size(); i++) {
+        if (bases[i] != SIZE_MAX)
+            continue;
+
+        // The index references the path, which must never be freed.
+        const char *path = strdup(paths[i].c_str());
+
+        files->insert(path, paths[i].size(), move(*loaded[i]));
+
+        delete loaded[i];
+    }
+
+    vector<size_t> variant_values(paths.size());
+
+    for (size_t i = 0; i < paths.size(); i++) {
+        if (bases[i] != SIZE_MAX) {
+            variant_values[i] = files->append(move(*loaded[i]));
+            delete loaded[i];
+        }
+    }
+
+    for (size_t i = 0; i < paths.size(); i++) {
+        if (bases[i] == SIZE_MAX)
+            continue;
+
+        const string &base = paths[bases[i]];
+
+        file_t *file = const_cast<file_t *>(
+            files->find(base.c_str(), base.size())
+        );
+        file->variants[encodings[i]] = &files->values[variant_values[i]];
+    }
+
+    CONTENT_DEBUG(
+        "%zu file(s) preloaded with %zu thread(s)", files->size(), n_threads
+    );
+}
+
+static inline void free_files(files_t *files)
+{
+    for (const files_t::slot_t &slot : files->slots)
+        free((void *) slot.key);
+
+    // Releases the precomputed header and checksums of a response.
+    auto free_response = [](const response_t &response)
+    {
+        delete[] response.header;
+        free_static_response(&response);
+    };
+
+    for (const file_t &file : files->values) {
+        if (file.streamed)
+            munmap((void *) file.content, file.content_len);
+        else
+            delete[] file.content;
+
+        #ifdef USE_PRECOMPUTED_CHECKSUMS
+            delete[] file.precomputed_sums.table;
+        #endif /* USE_PRECOMPUTED_CHECKSUMS */
+
+        for (const response_t &response : file.responses)
+            free_response(response);
+
+        if (!file.etag.empty()) {
+            delete[] file.etag.data;
+            delete[] file.last_modified.data;
+
+            for (const response_t &response : file.not_modified)
+                free_response(response);
+        }
+    }
+
+    *files = files_t();
+}
+
+static inline size_t partial_header(
+    const file_t *file, bool keep_alive, size_t begin, size_t end,
+    char *buffer
+)
+{
+    assert(begin < end && end <= file->content_len);
+
+    const response_t *response = &file->responses[keep_alive];
+    size_t tail = _header_tail(response);
+
+    size_t len = snprintf(
+        buffer, MAX_PARTIAL_HEADER_LEN,
+        "HTTP/1.1 206 Partial Content\r\n"
+        "Content-Type: text/html\r\n"
+        "Content-Length: %zu\r\n"
+        "Content-Range: bytes %zu-%zu/%zu\r\n",
+        end - begin, begin, end - 1, file->content_len
+    );
+
+    assert(len + response->header_len - tail <= MAX_PARTIAL_HEADER_LEN);
+
+    memcpy(buffer + len, response->header + tail, response->header_len - tail);
+
+    return len + response->header_len - tail;
+}
+
+static inline size_t unsatisfiable_header(
+    const file_t *file, bool keep_alive, char *buffer
+)
+{
+    const response_t *response = &file->responses[keep_alive];
+    size_t tail = _header_tail(response);
+
+    size_t len = snprintf(
+        buffer, MAX_PARTIAL_HEADER_LEN,
+        "HTTP/1.1 416 Range Not Satisfiable\r\n"
+        "Content-Length: 0\r\n"
+        "Content-Range: bytes */%zu\r\n",
+        file->content_len
+    );
+
+    assert(len + response->header_len - tail <= MAX_PARTIAL_HEADER_LEN);
+
+    memcpy(buffer + len, response->header + tail, response->header_len - tail);
+
+    return len + response->header_len - tail;
+}
+
+static inline const file_t *select_variant(
+    const file_t *file, str_ref_t accept_encoding
+)
+{
+    if (accept_encoding.empty())
+        return file;
+
+    for (size_t i = 0; i < N_ENCODINGS; i++) {
+        const file_t *variant = file->variants[i];
+
+        if (
+               variant != nullptr
+            && http_parser_t::accepts_coding(accept_encoding, ENCODING_NAMES[i])
+        )
+            return variant;
+    }
+
+    return file;
+}
+
+static inline bool is_not_modified(
+    const file_t *file, const http_request_t *request
+)
+{
+    if (LIKELY(
+           request->if_none_match.empty()
+        && request->if_modified_since.empty()
+    ))
+        return false;
+
+    if (file->etag.empty())
+        return false;
+
+    if (!request->if_none_match.empty()) {
+        return http_parser_t::matches_etag(
+            request->if_none_match, file->etag
+        );
+    }
+
+    return    request->if_modified_since.len == file->last_modified.len
+           && memcmp(
+                  request->if_modified_since.data, file->last_modified.data,
+                  file->last_modified.len
+              ) == 0;
+}
+
+static void _list_files(
+    const string &root_dir, const string &rel_dir, vector<string> *paths
+)
+{
+    string dir_path = rel_dir.empty() ? root_dir : root_dir + '/' + rel_dir;
+
+    DIR *dir;
+    if (!(dir = opendir(dir_path.c_str())))
+        CONTENT_DIE("Unable to open the directory (%s)", dir_path.c_str());
+
+    struct dirent *entry;
+
+    while ((entry = readdir(dir))) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+
+        string rel_path =   rel_dir.empty()
+                          ? string(entry->d_name)
+                          : rel_dir + '/' + entry->d_name;
+        string path     = root_dir + '/' + rel_path;
+
+        struct stat stat_buffer;
+        if (lstat(path.c_str(), &stat_buffer) != 0)
+            CONTENT_DIE("Unable to get info on a file (%s)", path.c_str());
+
+        // Follows symbolic links to files, but not to directories, which
+        // could create loops.
+        if (S_ISLNK(stat_buffer.st_mode)) {
+            if (stat(path.c_str(), &stat_buffer) != 0)
+                CONTENT_DIE("Broken symbolic link (%s)", path.c_str());
+
+            if (S_ISDIR(stat_buffer.st_mode))
+                continue;
+        }
+
+        if (S_ISDIR(stat_buffer.st_mode))
+            _list_files(root_dir, rel_path, paths);
+        else if (S_ISREG(stat_buffer.st_mode))
+            paths->push_back(rel_path);
+    }
+
+    closedir(dir);
+}
+
+static void *_loader_main(void *loader_void)
+{
+    _loader_t *loader = (_loader_t *) loader_void;
+
+    const vector<string> &paths = *loader->paths;
+
+    size_t i;
+    while ((i = loader->next++) < paths.size()) {
+        string path = string(loader->root_dir) + '/' + paths[i];
+
+        file_t *file = _load_file(
+            path.c_str(), (*loader->headers)[i].c_str(),
+            loader->stream_threshold
+        );
+
+        (*loader->loaded)[i] = file;
+
+        loader->n_bytes += file->content_len;
+        loader->n_loaded++;
+    }
+
+    return nullptr;
+}
+
+static file_t *_load_file(
+    const char *path, const char *headers, size_t stream_threshold
+)
+{
+    FILE *file;
+    if (!(file = fopen(path, "r")))
+        CONTENT_DIE("Unable to open a file (%s)", path);
+
+    // Obtains the size of the file
+    fseek(file, 0, SEEK_END);
+    size_t content_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    if (content_size > stream_threshold) {
+        // Maps the file instead of reading it. Pages are only read when sent.
+
+        struct stat stat_buffer;
+        if (fstat(fileno(file), &stat_buffer) != 0)
+            CONTENT_DIE("Unable to get info on a file (%s)", path);
+
+        void *content = mmap(
+            nullptr, content_size, PROT_READ, MAP_PRIVATE, fileno(file), 0
+        );
+        if (content == MAP_FAILED)
+            CONTENT_DIE("Unable to map a file (%s)", path);
+
+        madvise(content, content_size, MADV_SEQUENTIAL);
+
+        fclose(file);
+
+        return _new_file(
+            "200 OK", (const char *) content, content_size, headers,
+            stat_buffer.st_mtime, true
+        );
+    }
+
+    // Reads the file content
+
+    char *content = new char[content_size + 1];
+    size_t read = fread(content, 1, content_size, file);
+
+    if (read != content_size)
+        CONTENT_DIE("Unable to read a file %zu %zu", read, content_size);
+
+    content[content_size] = '\0';
+
+    struct stat stat_buffer;
+    if (fstat(fileno(file), &stat_buffer) != 0)
+        CONTENT_DIE("Unable to get info on a file (%s)", path);
+
+    fclose(file);
+
+    return new_file(
+        "200 OK", content, content_size, headers, stat_buffer.st_mtime
+    );
+}
+
+static size_t _header_tail(const response_t *response)
+{
+    // The precomputed header starts with the status line, the 'Content-Type'
+    // and the 'Content-Length' headers.
+
+    const char  *p   = response->header,
+                *end = response->header + response->header_len;
+
+    for (int i = 0; i < 3; i++) {
+        p = (const char *) memchr(p, '\n', end - p);
+        assert(p != nullptr);
+        p++;
+    }
+
+    return p - response->header;
+}
+
+static string _variant_of(const string &path, content_encoding_t *encoding)
+{
+    for (size_t i = 0; i < N_ENCODINGS; i++) {
+        size_t suffix_len = strlen(ENCODING_SUFFIXES[i]);
+
+        if (
+               path.size() > suffix_len
+            && path.compare(
+                   path.size() - suffix_len, suffix_len, ENCODING_SUFFIXES[i]
+               ) == 0
+        ) {
+            *encoding = (content_encoding_t) i;
+            return path.substr(0, path.size() - suffix_len);
+        }
+    }
+
+    return string();
+}
+
+static void _init_response(
+    file_t *file, const char *status, const char *headers, bool keep_alive,
+    bool header_only, response_t *response
+)
+{
+    char buffer[MAX_RESPONSE_HEADER_LEN];
+
+    size_t header_len;
+    const char *connection = keep_alive ? "keep-alive" : "close";
+
+    if (header_only) {
+        header_len = snprintf(
+            buffer, sizeof (buffer),
+            "HTTP/1.1 %s\r\n"
+            "%s"
+            "Connection: %s\r\n"
+            "\r\n",
+            status, headers, connection
+        );
+    } else {
+        header_len = snprintf(
+            buffer, sizeof (buffer),
+            "HTTP/1.1 %s\r\n"
+            "Content-Type: text/html\r\n"
+            "Content-Length: %zu\r\n"
+            "%s"
+            "Connection: %s\r\n"
+            "\r\n",
+            status, file->content_len, headers, connection
+        );
+    }
+
+    assert(header_len < sizeof (buffer));
+
+    init_static_response(
+        file, _copy_str(buffer, header_len).data, header_len, header_only,
+        response
+    );
+}
+
+static str_ref_t _copy_str(const char *str, size_t len)
+{
+    char *copy = new char[len];
+    memcpy(copy, str, len);
+    return str_ref_t(copy, len);
+}
+
+#undef CONTENT_COLOR
+#undef CONTENT_DEBUG
+#undef CONTENT_DIE
+
+} } /* namespace rusty::app */
+
+#endif /* __RUSTY_APP_CONTENT_HPP__ */
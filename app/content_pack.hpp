@@ -0,0 +1,574 @@
+//
+// Content packs: files with their precomputed responses and checksum tables,
+// packed offline in a single file which is memory-mapped by the server.
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// A pack is made of, in this order:
+//
+// * a 'pack_header_t' ;
+// * the 'pack_header_t::n_slots' slots of the filename index, in the layout
+//   used by 'file_index_t', so the index is not rebuilt when loading ;
+// * the 'pack_header_t::n_entries' file entries ('pack_entry_t'), including
+//   the entries of the precompressed variants, which are not referenced by the
+//   slots ;
+// * the data area, starting on a 'PACK_DATA_ALIGNMENT' boundary, which
+//   contains the filenames, the contents, the response headers and the
+//   checksum tables referenced by the entries.
+//
+// Offsets are relative to the beginning of the pack. Integers and checksum
+// tables are stored in the byte order of the packer, which must be the one
+// of the server.
+//
+
+#ifndef __RUSTY_APP_CONTENT_PACK_HPP__
+#define __RUSTY_APP_CONTENT_PACK_HPP__
+
+#include <cassert>
+#include <cinttypes>            // PRIu32
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <utility>              // move()
+#include <vector>
+
+#include <fcntl.h>              // open(), O_RDONLY
+#include <sys/mman.h>           // madvise(), mmap(), munmap()
+#include <sys/stat.h>           // struct stat, fstat()
+#include <unistd.h>             // close(), ftruncate(), getpagesize()
+
+#include "app/content.hpp"      // file_t, files_t, response_t
+#include "net/checksum.hpp"     // partial_sum_t, precomputed_sums_t
+#include "util/macros.hpp"      // RUSTY_*
+
+using namespace std;
+
+using namespace rusty::net;
+
+namespace rusty {
+namespace app {
+
+#define PACK_COLOR     COLOR_CYN
+#define PACK_DEBUG(MSG, ...)                                                   \
+    RUSTY_DEBUG("PACK", PACK_COLOR, MSG, ##__VA_ARGS__)
+#define PACK_DIE(MSG, ...)                                                     \
+    RUSTY_DIE(  "PACK", PACK_COLOR, MSG, ##__VA_ARGS__)
+
+static constexpr char       PACK_MAGIC[8]           = "RUSTYPK";
+static constexpr uint32_t   PACK_VERSION            = 3;
+
+// Written by the packer in its own byte order.
+static constexpr uint32_t   PACK_BYTE_ORDER_MARK    = 0x01020304;
+
+// Alignment of the data area in the pack, and of the contents in the data
+// area.
+static constexpr size_t     PACK_DATA_ALIGNMENT     = 64 * 1024;
+static constexpr size_t     PACK_CONTENT_ALIGNMENT  = 64;
+
+// The pack is mapped on a boundary of this size (a TILE-Gx huge page), so
+// the kernel can back it with huge pages.
+static constexpr size_t     PACK_MAP_ALIGNMENT      = 16 * 1024 * 1024;
+
+// 'pack_slot_t::entry' value of empty slots, and 'pack_entry_t::variants'
+// value of missing variants.
+static constexpr uint64_t   PACK_NO_ENTRY           = UINT64_MAX;
+
+struct pack_header_t {
+    char        magic[8];
+    uint32_t    version;
+    uint32_t    byte_order_mark;
+
+    // 'SEGMENT_SIZES' of the packer.
+    uint64_t    segment_sizes[N_SEGMENT_SIZES];
+
+    // Size of the pack, in bytes.
+    uint64_t    size;
+
+    uint64_t    n_slots;
+    uint64_t    slots_offset;
+
+    uint64_t    n_entries;
+    uint64_t    entries_offset;
+};
+
+struct pack_slot_t {
+    uint64_t    hash;
+    uint64_t    entry;
+};
+
+struct pack_response_t {
+    uint64_t    header_offset;
+    uint64_t    header_len;
+
+    // Tables of 'partial_sum_t', one for each segment size.
+    uint64_t    segment_sums_offsets[N_SEGMENT_SIZES];
+};
+
+struct pack_entry_t {
+    uint64_t        filename_offset;
+    uint64_t        filename_len;
+
+    uint64_t        content_offset;
+    uint64_t        content_len;
+
+    // Table of 'precomputed_sums_t::table_size(content_len)' 16 bits sums.
+    uint64_t        sums_table_offset;
+
+    // Responses with 'Connection: close' and 'Connection: keep-alive'.
+    pack_response_t responses[2];
+
+    // Entries of the precompressed variants, indexed by 'content_encoding_t'.
+    uint64_t        variants[N_ENCODINGS];
+
+    // Validators. 'etag_len' is zero if the file has no validators, in which
+    // case 'not_modified' is not set.
+    uint64_t        etag_offset;
+    uint64_t        etag_len;
+    uint64_t        last_modified_offset;
+    uint64_t        last_modified_len;
+
+    // Header-only '304 Not Modified' responses.
+    pack_response_t not_modified[2];
+};
+
+// Memory mapping of a loaded pack.
+struct pack_mapping_t {
+    char        *base;
+    size_t      size;
+};
+
+// Maps the pack read-only and loads its files in the index.
+//
+// Only references the memory of the pack, which is shared with the other
+// processes mapping the same pack, and never copies nor hashes its content.
+static pack_mapping_t load_pack(const char *path, files_t *files);
+
+// Unmaps a pack. The files loaded from the pack must not be used anymore.
+static void unload_pack(pack_mapping_t mapping);
+
+#ifdef USE_PRECOMPUTED_CHECKSUMS
+    // Writes the indexed files, with their responses and checksum tables, in a
+    // new pack.
+    //
+    // The files must not be streamed, as the pack contains their checksum
+    // tables.
+    static void write_pack(const char *path, const files_t *files);
+#endif /* USE_PRECOMPUTED_CHECKSUMS */
+
+// Returns 'offset' rounded up to a multiple of 'alignment'.
+static inline size_t _pack_align(size_t offset, size_t alignment);
+
+static pack_mapping_t load_pack(const char *path, files_t *files)
+{
+    //
+    // Maps the pack.
+    //
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        PACK_DIE("Unable to open the pack (%s)", path);
+
+    struct stat stat_buffer;
+    if (fstat(fd, &stat_buffer) != 0)
+        PACK_DIE("Unable to get info on the pack (%s)", path);
+
+    size_t size = stat_buffer.st_size;
+
+    if (size < sizeof (pack_header_t))
+        PACK_DIE("Truncated pack (%s)", path);
+
+    // Reserves an address range large enough to map the pack on an aligned
+    // boundary, and releases the unused parts once mapped.
+
+    size_t reserved_size = size + PACK_MAP_ALIGNMENT;
+
+    char *reserved = (char *) mmap(
+        nullptr, reserved_size, PROT_NONE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0
+    );
+    if (reserved == MAP_FAILED)
+        PACK_DIE("Unable to reserve memory for the pack");
+
+    char *base = reserved + (
+        _pack_align((uintptr_t) reserved, PACK_MAP_ALIGNMENT)
+        - (uintptr_t) reserved
+    );
+
+    if (
+        mmap(base, size, PROT_READ, MAP_SHARED | MAP_FIXED, fd, 0)
+        == MAP_FAILED
+    )
+        PACK_DIE("Unable to map the pack (%s)", path);
+
+    close(fd);
+
+    char    *mapped_end = base + _pack_align(size, getpagesize()),
+            *reserved_end = reserved + reserved_size;
+
+    if (base > reserved)
+        munmap(reserved, base - reserved);
+    if (reserved_end > mapped_end)
+        munmap(mapped_end, reserved_end - mapped_end);
+
+    #ifdef MADV_HUGEPAGE
+        madvise(base, size, MADV_HUGEPAGE);
+    #endif /* MADV_HUGEPAGE */
+
+    //
+    // Checks the header.
+    //
+
+    const pack_header_t *header = (const pack_header_t *) base;
+
+    if (memcmp(header->magic, PACK_MAGIC, sizeof (PACK_MAGIC)) != 0)
+        PACK_DIE("Not a content pack (%s)", path);
+
+    if (header->version != PACK_VERSION)
+        PACK_DIE("Unsupported pack version (%" PRIu32 ")", header->version);
+
+    if (header->byte_order_mark != PACK_BYTE_ORDER_MARK)
+        PACK_DIE("The pack has been built on a different byte order");
+
+    for (size_t i = 0; i < N_SEGMENT_SIZES; i++) {
+        if (header->segment_sizes[i] != SEGMENT_SIZES[i])
+            PACK_DIE("The pack has been built for different segment sizes");
+    }
+
+    if (
+           header->size != size
+        || header->slots_offset + header->n_slots * sizeof (pack_slot_t) > size
+        ||   header->entries_offset
+           + header->n_entries * sizeof (pack_entry_t) > size
+    )
+        PACK_DIE("Truncated pack (%s)", path);
+
+    //
+    // Loads the entries and the index.
+    //
+
+    const pack_slot_t  *pack_slots =
+        (const pack_slot_t *) (base + header->slots_offset);
+    const pack_entry_t *pack_entries =
+        (const pack_entry_t *) (base + header->entries_offset);
+
+    vector<file_t> values;
+    values.reserve(header->n_entries);
+
+    for (size_t i = 0; i < header->n_entries; i++) {
+        const pack_entry_t *entry = &pack_entries[i];
+
+        const char *content = base + entry->content_offset;
+
+        str_ref_t etag(base + entry->etag_offset, entry->etag_len);
+        str_ref_t last_modified(
+            base + entry->last_modified_offset, entry->last_modified_len
+        );
+
+        // The responses are referenced below. Packed files are never
+        // streamed.
+        #ifdef USE_PRECOMPUTED_CHECKSUMS
+            const uint16_t *table =
+                (const uint16_t *) (base + entry->sums_table_offset);
+
+            file_t file = {
+                content, entry->content_len,
+                precomputed_sums_t(content, entry->content_len, table),
+                { }, etag, last_modified, { }, { }, false
+            };
+        #else
+            file_t file = {
+                content, (size_t) entry->content_len,
+                { }, etag, last_modified, { }, { }, false
+            };
+        #endif /* USE_PRECOMPUTED_CHECKSUMS */
+
+        // References the header and the checksums of a response in the pack.
+        auto load_response = [base](
+            const pack_response_t *pack_response, size_t content_len,
+            response_t *response
+        ) {
+            response->header     = base + pack_response->header_offset;
+            response->header_len = pack_response->header_len;
+            response->len        = response->header_len + content_len;
+
+            #ifdef USE_PRECOMPUTED_CHECKSUMS
+                for (size_t j = 0; j < N_SEGMENT_SIZES; j++) {
+                    response->segment_sums[j] = (const partial_sum_t *) (
+                        base + pack_response->segment_sums_offsets[j]
+                    );
+                }
+            #endif /* USE_PRECOMPUTED_CHECKSUMS */
+        };
+
+        for (int keep_alive = 0; keep_alive < 2; keep_alive++) {
+            load_response(
+                &entry->responses[keep_alive], file.content_len,
+                &file.responses[keep_alive]
+            );
+
+            if (!file.etag.empty()) {
+                load_response(
+                    &entry->not_modified[keep_alive], 0,
+                    &file.not_modified[keep_alive]
+                );
+            }
+        }
+
+        // Variants are referenced once all the entries have been loaded.
+        for (size_t j = 0; j < N_ENCODINGS; j++) {
+            if (
+                   entry->variants[j] != PACK_NO_ENTRY
+                && entry->variants[j] >= header->n_entries
+            )
+                PACK_DIE("Invalid variant in the pack (%s)", path);
+        }
+
+        values.push_back(move(file));
+    }
+
+    vector<files_t::slot_t> slots;
+    slots.reserve(header->n_slots);
+
+    for (size_t i = 0; i < header->n_slots; i++) {
+        const pack_slot_t *pack_slot = &pack_slots[i];
+
+        if (pack_slot->entry == PACK_NO_ENTRY) {
+            slots.push_back((files_t::slot_t) { 0, nullptr, 0, 0 });
+        } else {
+            const pack_entry_t *entry = &pack_entries[pack_slot->entry];
+            slots.push_back((files_t::slot_t) {
+                pack_slot->hash, base + entry->filename_offset,
+                entry->filename_len, pack_slot->entry
+            });
+        }
+    }
+
+    files->assign(move(slots), move(values));
+
+    for (size_t i = 0; i < header->n_entries; i++) {
+        for (size_t j = 0; j < N_ENCODINGS; j++) {
+            uint64_t variant = pack_entries[i].variants[j];
+
+            if (variant != PACK_NO_ENTRY)
+                files->values[i].variants[j] = &files->values[variant];
+        }
+    }
+
+    PACK_DEBUG(
+        "%zu file(s) loaded from the pack (%zu bytes)", files->size(), size
+    );
+
+    return (pack_mapping_t) { base, size };
+}
+
+static void unload_pack(pack_mapping_t mapping)
+{
+    munmap(mapping.base, _pack_align(mapping.size, getpagesize()));
+}
+
+#ifdef USE_PRECOMPUTED_CHECKSUMS
+    // Writes 'size' bytes at the given offset of the pack.
+    static void _pack_write_at(
+        FILE *file, size_t offset, const void *data, size_t size
+    )
+    {
+        if (
+               fseeko(file, offset, SEEK_SET) != 0
+            || fwrite(data, 1, size, file) != size
+        )
+            PACK_DIE("Unable to write the pack");
+    }
+
+    static void write_pack(const char *path, const files_t *files)
+    {
+        static_assert(
+            sizeof (partial_sum_t) == 4, "Unexpected partial_sum_t layout"
+        );
+
+        FILE *file = fopen(path, "wb");
+        if (file == nullptr)
+            PACK_DIE("Unable to create the pack (%s)", path);
+
+        pack_header_t header;
+        memset(&header, 0, sizeof (header));
+
+        memcpy(header.magic, PACK_MAGIC, sizeof (PACK_MAGIC));
+        header.version          = PACK_VERSION;
+        header.byte_order_mark  = PACK_BYTE_ORDER_MARK;
+
+        for (size_t i = 0; i < N_SEGMENT_SIZES; i++)
+            header.segment_sizes[i] = SEGMENT_SIZES[i];
+
+        header.n_slots          = files->slots.size();
+        header.slots_offset     = _pack_align(sizeof (header), 64);
+        header.n_entries        = files->values.size();
+        header.entries_offset   = _pack_align(
+            header.slots_offset + header.n_slots * sizeof (pack_slot_t), 64
+        );
+
+        size_t data_offset = _pack_align(
+            header.entries_offset + header.n_entries * sizeof (pack_entry_t),
+            PACK_DATA_ALIGNMENT
+        );
+
+        vector<pack_entry_t> entries(header.n_entries);
+
+        // Appends the buffer to the data area and returns its offset.
+        auto append = [file, &data_offset](
+            const void *data, size_t size, size_t alignment
+        ) {
+            size_t offset = _pack_align(data_offset, alignment);
+            _pack_write_at(file, offset, data, size);
+            data_offset = offset + size;
+            return offset;
+        };
+
+        // Appends the header and the checksums of the response to the data
+        // area.
+        auto write_response = [&append](
+            const response_t *response, pack_response_t *pack_response
+        ) {
+            pack_response->header_offset = append(
+                response->header, response->header_len, 1
+            );
+            pack_response->header_len = response->header_len;
+
+            for (size_t j = 0; j < N_SEGMENT_SIZES; j++) {
+                size_t n_segs =   (response->len + SEGMENT_SIZES[j] - 1)
+                                / SEGMENT_SIZES[j];
+
+                pack_response->segment_sums_offsets[j] = append(
+                    response->segment_sums[j],
+                    n_segs * sizeof (partial_sum_t), sizeof (partial_sum_t)
+                );
+            }
+        };
+
+        //
+        // Index and filenames.
+        //
+
+        vector<pack_slot_t> slots(header.n_slots);
+
+        for (size_t i = 0; i < header.n_slots; i++) {
+            const files_t::slot_t *slot = &files->slots[i];
+
+            if (slot->key == nullptr) {
+                slots[i] = (pack_slot_t) { 0, PACK_NO_ENTRY };
+                continue;
+            }
+
+            slots[i] = (pack_slot_t) { slot->hash, slot->value };
+
+            pack_entry_t *entry     = &entries[slot->value];
+            entry->filename_offset  = append(slot->key, slot->key_len, 1);
+            entry->filename_len     = slot->key_len;
+        }
+
+        //
+        // Contents, response headers and checksum tables.
+        //
+
+        for (size_t i = 0; i < header.n_entries; i++) {
+            const file_t    *value = &files->values[i];
+            pack_entry_t    *entry = &entries[i];
+
+            assert(!value->streamed);
+
+            entry->content_offset   = append(
+                value->content, value->content_len, PACK_CONTENT_ALIGNMENT
+            );
+            entry->content_len      = value->content_len;
+
+            entry->sums_table_offset = append(
+                value->precomputed_sums.table,
+                   precomputed_sums_t::table_size(value->content_len)
+                 * sizeof (uint16_t),
+                sizeof (uint16_t)
+            );
+
+            for (size_t j = 0; j < N_ENCODINGS; j++) {
+                const file_t *variant = value->variants[j];
+
+                entry->variants[j] =   variant != nullptr
+                                     ? variant - files->values.data()
+                                     : PACK_NO_ENTRY;
+            }
+
+            entry->etag_offset = append(
+                value->etag.data, value->etag.len, 1
+            );
+            entry->etag_len = value->etag.len;
+
+            entry->last_modified_offset = append(
+                value->last_modified.data, value->last_modified.len, 1
+            );
+            entry->last_modified_len = value->last_modified.len;
+
+            for (int keep_alive = 0; keep_alive < 2; keep_alive++) {
+                write_response(
+                    &value->responses[keep_alive],
+                    &entry->responses[keep_alive]
+                );
+
+                if (!value->etag.empty()) {
+                    write_response(
+                        &value->not_modified[keep_alive],
+                        &entry->not_modified[keep_alive]
+                    );
+                }
+            }
+        }
+
+        header.size = data_offset;
+
+        _pack_write_at(
+            file, header.slots_offset, slots.data(),
+            slots.size() * sizeof (pack_slot_t)
+        );
+        _pack_write_at(
+            file, header.entries_offset, entries.data(),
+            entries.size() * sizeof (pack_entry_t)
+        );
+        _pack_write_at(file, 0, &header, sizeof (header));
+
+        // The data area could end with a hole.
+        if (fflush(file) != 0 || ftruncate(fileno(file), header.size) != 0)
+            PACK_DIE("Unable to write the pack");
+
+        if (fclose(file) != 0)
+            PACK_DIE("Unable to write the pack");
+
+        PACK_DEBUG(
+            "%zu file(s) written in the pack (%zu bytes)", files->size(),
+            (size_t) header.size
+        );
+    }
+#endif /* USE_PRECOMPUTED_CHECKSUMS */
+
+static inline size_t _pack_align(size_t offset, size_t alignment)
+{
+    return (offset + alignment - 1) / alignment * alignment;
+}
+
+#undef PACK_COLOR
+#undef PACK_DEBUG
+#undef PACK_DIE
+
+} } /* namespace rusty::app */
+
+#endif /* __RUSTY_APP_CONTENT_PACK_HPP__ */
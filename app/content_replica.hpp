@@ -0,0 +1,276 @@
+//
+// Copies of the small served files, homed on the Tile of a worker.
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// With a single copy of the content, the cache lines of the most requested
+// files are homed on a few Tiles, and every worker reads them through the
+// on-chip network. A replica copies the paths, the contents, the precomputed
+// headers and the checksum tables of the small files to memory homed on the
+// Tile of the worker which uses it, so these reads hit its own L2 cache.
+// Larger files are still read from the replicated files.
+//
+// The copy is made by the thread which loads the content, not by the worker,
+// whose Tile is only the home of the memory.
+//
+// The replicated data is copied in a single memory mapping, which uses huge
+// pages when available, so a replica only requires a few TLB entries.
+//
+
+#ifndef __RUSTY_APP_CONTENT_REPLICA_HPP__
+#define __RUSTY_APP_CONTENT_REPLICA_HPP__
+
+#include <algorithm>            // max()
+#include <cassert>
+#include <cstring>              // memcpy()
+#include <utility>              // move()
+#include <vector>
+
+#include <tmc/alloc.h>          // tmc_alloc_map(), tmc_alloc_set_home(),
+                                // tmc_alloc_set_pagesize(), tmc_alloc_unmap()
+
+#include "app/content.hpp"      // file_t, files_t, response_t
+#include "net/checksum.hpp"     // partial_sum_t, precomputed_sums_t
+#include "util/macros.hpp"      // RUSTY_*
+
+using namespace std;
+
+using namespace rusty::net;
+
+namespace rusty {
+namespace app {
+
+#define REPLICA_COLOR     COLOR_CYN
+#define REPLICA_DEBUG(MSG, ...)                                                \
+    RUSTY_DEBUG("REPLICA", REPLICA_COLOR, MSG, ##__VA_ARGS__)
+#define REPLICA_ERROR(MSG, ...)                                                \
+    RUSTY_ERROR("REPLICA", REPLICA_COLOR, MSG, ##__VA_ARGS__)
+
+// Copy of a set of files.
+struct replica_t {
+    // Same index as the replicated files. Replicated files reference 'mem',
+    // the other files reference the memory of the replicated files, which must
+    // outlive the replica.
+    files_t     files;
+
+    // Memory mapping holding the replicated data.
+    char        *mem;
+    size_t      mem_size;
+};
+
+// Replicates the files which are not streamed and which are at most
+// 'max_file_size' bytes long to memory homed on the 'home' Tile.
+//
+// Can be called from any Tile. Returns 'nullptr' if the memory could not be
+// allocated.
+static replica_t *replicate_files(
+    const files_t *files, size_t max_file_size, int home
+);
+
+// Releases the memory of the replica. The replicated files are left
+// unchanged.
+static void free_replica(replica_t *replica);
+
+// Bump allocator on the memory mapping of a replica.
+struct _replica_arena_t {
+    // Only counts the allocated bytes when 'nullptr'.
+    char        *mem;
+    size_t      used;
+
+    // Copies the data in the arena, aligned on 8 bytes.
+    //
+    // Returns 'nullptr' if the arena only counts the allocated bytes.
+    inline const void *copy(const void *data, size_t size);
+};
+
+// Returns the index with the given files, where the files which are at most
+// 'max_file_size' bytes long reference copies allocated in the arena.
+static files_t _replicate(
+    const files_t *files, size_t max_file_size, _replica_arena_t *arena
+);
+
+// Makes the file reference copies of its data allocated in the arena.
+static void _replicate_file(_replica_arena_t *arena, file_t *file);
+
+// Makes the response reference copies of its header and of its segment
+// checksums allocated in the arena.
+static void _replicate_response(
+    _replica_arena_t *arena, response_t *response
+);
+
+static replica_t *replicate_files(
+    const files_t *files, size_t max_file_size, int home
+)
+{
+    // Computes the size of the mapping with a first pass which doesn't copy
+    // anything.
+    _replica_arena_t arena = { nullptr, 0 };
+    _replicate(files, max_file_size, &arena);
+
+    size_t mem_size = max(arena.used, (size_t) 1);
+
+    // Uses the smallest page size which holds the entire replica. If huge
+    // pages are not available, falls back to the default page size.
+
+    tmc_alloc_t alloc = TMC_ALLOC_INIT;
+    tmc_alloc_set_home(&alloc, home);
+    tmc_alloc_set_pagesize(&alloc, mem_size);
+
+    char *mem = (char *) tmc_alloc_map(&alloc, mem_size);
+
+    if (mem == nullptr) {
+        alloc = TMC_ALLOC_INIT;
+        tmc_alloc_set_home(&alloc, home);
+
+        mem = (char *) tmc_alloc_map(&alloc, mem_size);
+
+        if (mem == nullptr) {
+            REPLICA_ERROR(
+                "Unable to allocate %zu bytes for a replica", mem_size
+            );
+            return nullptr;
+        }
+    }
+
+    replica_t *replica = new replica_t;
+    replica->mem        = mem;
+    replica->mem_size   = mem_size;
+
+    arena = { mem, 0 };
+    replica->files = _replicate(files, max_file_size, &arena);
+
+    assert(arena.used <= mem_size);
+
+    REPLICA_DEBUG("%zu bytes replicated", arena.used);
+
+    return replica;
+}
+
+static void free_replica(replica_t *replica)
+{
+    tmc_alloc_unmap(replica->mem, replica->mem_size);
+    delete replica;
+}
+
+inline const void *_replica_arena_t::copy(const void *data, size_t size)
+{
+    size_t offset = (this->used + 7) & ~(size_t) 7;
+    this->used = offset + size;
+
+    if (this->mem == nullptr)
+        return nullptr;
+
+    memcpy(this->mem + offset, data, size);
+    return this->mem + offset;
+}
+
+static files_t _replicate(
+    const files_t *files, size_t max_file_size, _replica_arena_t *arena
+)
+{
+    vector<files_t::slot_t> slots = files->slots;
+
+    for (files_t::slot_t &slot : slots) {
+        if (slot.key != nullptr)
+            slot.key = (const char *) arena->copy(slot.key, slot.key_len);
+    }
+
+    // Reserves the values so variants can reference stable addresses.
+    vector<file_t> values;
+    values.reserve(files->size());
+
+    for (const file_t &value : files->values) {
+        file_t file = value;
+
+        if (!file.streamed && file.content_len <= max_file_size)
+            _replicate_file(arena, &file);
+
+        values.push_back(move(file));
+    }
+
+    for (file_t &file : values) {
+        for (size_t i = 0; i < N_ENCODINGS; i++) {
+            if (file.variants[i] != nullptr) {
+                size_t index = file.variants[i] - &files->values[0];
+                file.variants[i] = &values[index];
+            }
+        }
+    }
+
+    files_t replicated;
+    replicated.assign(move(slots), move(values));
+    return replicated;
+}
+
+static void _replicate_file(_replica_arena_t *arena, file_t *file)
+{
+    file->content = (const char *) arena->copy(
+        file->content, file->content_len
+    );
+
+    #ifdef USE_PRECOMPUTED_CHECKSUMS
+        file->precomputed_sums.data  = file->content;
+        file->precomputed_sums.table = (const uint16_t *) arena->copy(
+            file->precomputed_sums.table,
+              precomputed_sums_t::table_size(file->content_len)
+            * sizeof (uint16_t)
+        );
+    #endif /* USE_PRECOMPUTED_CHECKSUMS */
+
+    for (response_t &response : file->responses)
+        _replicate_response(arena, &response);
+
+    if (!file->etag.empty()) {
+        file->etag.data = (const char *) arena->copy(
+            file->etag.data, file->etag.len
+        );
+        file->last_modified.data = (const char *) arena->copy(
+            file->last_modified.data, file->last_modified.len
+        );
+
+        for (response_t &response : file->not_modified)
+            _replicate_response(arena, &response);
+    }
+}
+
+static void _replicate_response(
+    _replica_arena_t *arena, response_t *response
+)
+{
+    response->header = (const char *) arena->copy(
+        response->header, response->header_len
+    );
+
+    #ifdef USE_PRECOMPUTED_CHECKSUMS
+        for (size_t i = 0; i < N_SEGMENT_SIZES; i++) {
+            size_t seg_size = SEGMENT_SIZES[i];
+            size_t n_segs   = (response->len + seg_size - 1) / seg_size;
+
+            response->segment_sums[i] = (const partial_sum_t *) arena->copy(
+                response->segment_sums[i], n_segs * sizeof (partial_sum_t)
+            );
+        }
+    #endif /* USE_PRECOMPUTED_CHECKSUMS */
+}
+
+#undef REPLICA_COLOR
+#undef REPLICA_DEBUG
+#undef REPLICA_ERROR
+
+} } /* namespace rusty::app */
+
+#endif /* __RUSTY_APP_CONTENT_REPLICA_HPP__ */
@@ -0,0 +1,429 @@
+//
+// Versions of the served content, which can be replaced while the workers are
+// serving requests.
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// A single version is published at a time. Each worker holds a reference on
+// the version it serves new connections from, and on the older versions
+// still used by some of its connections. A connection only moves to a newer
+// version between two responses, once all the responses it sent have been
+// acknowledged, so the data of a response can always be retransmitted.
+//
+// Workers only touch the shared reference counters when the published
+// version changes. Otherwise, checking for a new version is a single load of
+// a pointer which stays in the cache of the worker.
+//
+// The reloading thread can't free the previously published version as soon
+// as it has been replaced, as a worker could be about to take a reference on
+// it. Workers increment an epoch counter when entering and leaving the short
+// section during which they take their reference. A replaced version is only
+// released after every worker has left the section it was in, if any, when
+// the version was replaced. Versions are freed by the reloading thread, once
+// their last reference is released, so workers never free shared memory.
+//
+// Each worker can use a replica of the small files of its version, homed on
+// its Tile (see 'app/content_replica.hpp'). The replicas of every worker are
+// built with the version, before it is published, and are freed with it, so
+// workers never copy nor map memory when the content changes. Building the
+// replicas copies the replicated files once per version and per worker.
+//
+
+#ifndef __RUSTY_APP_CONTENT_VERSIONS_HPP__
+#define __RUSTY_APP_CONTENT_VERSIONS_HPP__
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+#include <sched.h>              // sched_yield()
+#include <sys/stat.h>           // struct stat, stat()
+
+#include "app/content.hpp"      // files_t, free_files(), preload_files()
+#include "app/content_pack.hpp" // load_pack(), pack_mapping_t, unload_pack()
+#include "app/content_replica.hpp" // free_replica(), replica_t,
+                                   // replicate_files()
+#include "util/macros.hpp"      // LIKELY(), UNLIKELY()
+
+using namespace std;
+
+namespace rusty {
+namespace app {
+
+// Version of the served content.
+struct content_t {
+    files_t             files;
+
+    // Set if the files reference a memory-mapped pack. Otherwise, the files
+    // own their memory.
+    bool                is_pack;
+    pack_mapping_t      pack;
+
+    // Replica of the files of each worker, in the order of the workers of
+    // 'content_versions_t'. Entries are 'nullptr' for the workers which don't
+    // replicate the files. Empty until the version is replicated.
+    vector<replica_t *> replicas;
+
+    // Number of workers which use this version, plus one while the version is
+    // published.
+    atomic<size_t>      n_refs;
+};
+
+// Loads a new version of the content from a directory or from a content pack.
+//
+// Files of a directory larger than 'stream_threshold' bytes are streamed.
+//
+// Returns 'nullptr' if the root doesn't exist.
+static content_t *load_content(
+    const char *root, size_t n_loading_threads, size_t stream_threshold
+);
+
+// Releases the memory of a version which is not referenced anymore, with its
+// replicas.
+static void free_content(content_t *content);
+
+// Publishes the versions of the content to the workers.
+//
+// 'publish()' and 'collect()' must be called by a single thread, which is not
+// a worker. The versions are replicated and freed by this thread.
+struct content_versions_t {
+    //
+    // Member types
+    //
+
+    // Version used by a worker.
+    struct worker_version_t {
+        content_t           *content;
+
+        // Files used by the connections: the files of the replica of the
+        // worker, if any, or the files of the version.
+        const files_t       *files;
+
+        // Number of connections of the worker which use this version.
+        size_t              n_conns;
+    };
+
+    // State of a worker. Only accessed by its worker, except 'epoch' and the
+    // constant fields.
+    struct worker_t {
+        // Index of the worker in 'workers' and in the replicas of the versions.
+        size_t              index;
+
+        // Tile the worker runs on, which is the home of its replicas.
+        int                 cpu;
+
+        // Odd while the worker is taking a reference on the published version.
+        atomic<uint64_t>    epoch;
+
+        // Version used by new connections.
+        worker_version_t    *current;
+    };
+
+    //
+    // Fields
+    //
+
+    atomic<content_t *>     published;
+
+    // Files which are at most this number of bytes long are replicated on
+    // the Tile of each worker. Zero disables the replicas.
+    size_t                  replicated_file_size;
+
+    // Workers, fixed when the versions are created, before any worker runs.
+    vector<worker_t *>      workers;
+
+    // Replaced versions which are still referenced by some workers. Only
+    // accessed by the reloading thread.
+    vector<content_t *>     retired;
+
+    //
+    // Methods
+    //
+
+    // Publishes the initial version to the workers running on the given
+    // Tiles, one worker per Tile.
+    //
+    // Replicates the initial version on the calling thread.
+    content_versions_t(
+        content_t *initial, const vector<int> &worker_cpus,
+        size_t _replicated_file_size = 0
+    );
+
+    // Returns the worker running on the given Tile, which must be one of the
+    // Tiles given to the constructor. Must be called once by each worker
+    // before it uses the other methods.
+    worker_t *register_worker(int cpu);
+
+    // Returns the version the connections of the worker must use from now on.
+    //
+    // Takes a reference on the published version if it changed since the
+    // last call.
+    inline worker_version_t *refresh(worker_t *worker);
+
+    // Makes a connection of the worker move from its version (which can be
+    // 'nullptr' for a new connection) to the current version of the worker.
+    inline worker_version_t *move_conn(
+        worker_t *worker, worker_version_t *version
+    );
+
+    // Releases the version of a closed connection.
+    inline void release_conn(worker_t *worker, worker_version_t *version);
+
+    // Replicates the version for the workers, then replaces the published
+    // version, and retires the previous one.
+    //
+    // Waits for the workers which could be taking a reference on the previous
+    // version, which only takes a few instructions.
+    void publish(content_t *content);
+
+    // Frees the retired versions which are not referenced anymore, with their
+    // replicas.
+    //
+    // Returns the number of freed versions.
+    size_t collect(void);
+
+private:
+
+    // Builds the replicas of the content for every worker, on the calling
+    // thread.
+    void _replicate(content_t *content);
+
+    // Creates the version of the worker which references the content, and its
+    // replica if any.
+    worker_version_t *_new_version(worker_t *worker, content_t *content);
+
+    // Releases the worker's reference on the version.
+    inline void _release(worker_version_t *version);
+};
+
+static content_t *load_content(
+    const char *root, size_t n_loading_threads, size_t stream_threshold
+)
+{
+    struct stat root_stat;
+    if (stat(root, &root_stat) != 0)
+        return nullptr;
+
+    content_t *content = new content_t;
+    content->n_refs = 1;
+
+    if (S_ISDIR(root_stat.st_mode)) {
+        content->is_pack = false;
+        preload_files(
+            &content->files, root, n_loading_threads, stream_threshold
+        );
+    } else {
+        content->is_pack = true;
+        content->pack    = load_pack(root, &content->files);
+    }
+
+    return content;
+}
+
+static void free_content(content_t *content)
+{
+    assert(content->n_refs == 0);
+
+    // The replicas can reference the memory of the version.
+    for (replica_t *replica : content->replicas) {
+        if (replica != nullptr)
+            free_replica(replica);
+    }
+
+    if (content->is_pack)
+        unload_pack(content->pack);
+    else
+        free_files(&content->files);
+
+    delete content;
+}
+
+inline content_versions_t::content_versions_t(
+    content_t *initial, const vector<int> &worker_cpus,
+    size_t _replicated_file_size
+) : published(initial), replicated_file_size(_replicated_file_size)
+{
+    for (int cpu : worker_cpus) {
+        worker_t *worker = new worker_t;
+        worker->index    = this->workers.size();
+        worker->cpu      = cpu;
+        worker->epoch    = 0;
+        worker->current  = nullptr;
+
+        this->workers.push_back(worker);
+    }
+
+    this->_replicate(initial);
+}
+
+inline content_versions_t::worker_t *content_versions_t::register_worker(
+    int cpu
+)
+{
+    worker_t *worker = nullptr;
+
+    for (worker_t *candidate : this->workers) {
+        if (candidate->cpu == cpu) {
+            worker = candidate;
+            break;
+        }
+    }
+
+    assert(worker != nullptr);
+
+    this->refresh(worker);
+
+    return worker;
+}
+
+inline content_versions_t::worker_version_t *content_versions_t::refresh(
+    worker_t *worker
+)
+{
+    worker_version_t *current = worker->current;
+
+    if (LIKELY(
+           current != nullptr
+        && current->content == this->published.load(memory_order_relaxed)
+    ))
+        return current;
+
+    // The published version can only be freed once the worker left this
+    // section.
+    worker->epoch.fetch_add(1, memory_order_seq_cst);
+
+    content_t *content = this->published.load(memory_order_seq_cst);
+    content->n_refs.fetch_add(1, memory_order_relaxed);
+
+    worker->epoch.fetch_add(1, memory_order_release);
+
+    worker->current = this->_new_version(worker, content);
+
+    // Connections using the previous version keep it until they move to the
+    // new one.
+    if (current != nullptr && current->n_conns == 0)
+        this->_release(current);
+
+    return worker->current;
+}
+
+inline content_versions_t::worker_version_t *content_versions_t::move_conn(
+    worker_t *worker, worker_version_t *version
+)
+{
+    worker_version_t *current = this->refresh(worker);
+
+    if (LIKELY(version == current))
+        return version;
+
+    current->n_conns++;
+
+    if (version != nullptr)
+        this->release_conn(worker, version);
+
+    return current;
+}
+
+inline void content_versions_t::release_conn(
+    worker_t *worker, worker_version_t *version
+)
+{
+    assert(version->n_conns > 0);
+
+    if (--version->n_conns == 0 && version != worker->current)
+        this->_release(version);
+}
+
+inline void content_versions_t::publish(content_t *content)
+{
+    // Workers can use the replicas as soon as the version is published.
+    this->_replicate(content);
+
+    content_t *previous = this->published.exchange(
+        content, memory_order_seq_cst
+    );
+
+    // Waits for the workers which were taking a reference when the version
+    // has been replaced. They could have loaded the previous version.
+
+    for (worker_t *worker : this->workers) {
+        uint64_t epoch = worker->epoch.load(memory_order_seq_cst);
+
+        if (epoch % 2 == 0)
+            continue;
+
+        while (worker->epoch.load(memory_order_acquire) == epoch)
+            sched_yield();
+    }
+
+    this->retired.push_back(previous);
+    previous->n_refs.fetch_sub(1, memory_order_release);
+}
+
+inline size_t content_versions_t::collect(void)
+{
+    size_t n_freed = 0;
+
+    for (auto it = this->retired.begin(); it != this->retired.end(); ) {
+        content_t *content = *it;
+
+        if (content->n_refs.load(memory_order_acquire) == 0) {
+            free_content(content);
+            it = this->retired.erase(it);
+            n_freed++;
+        } else
+            it++;
+    }
+
+    return n_freed;
+}
+
+inline void content_versions_t::_replicate(content_t *content)
+{
+    content->replicas.assign(this->workers.size(), nullptr);
+
+    if (this->replicated_file_size == 0)
+        return;
+
+    // Workers serve the shared files if their replica can't be allocated.
+    for (const worker_t *worker : this->workers) {
+        content->replicas[worker->index] = replicate_files(
+            &content->files, this->replicated_file_size, worker->cpu
+        );
+    }
+}
+
+inline content_versions_t::worker_version_t *
+content_versions_t::_new_version(worker_t *worker, content_t *content)
+{
+    const replica_t *replica = content->replicas[worker->index];
+
+    return new worker_version_t {
+        content, replica != nullptr ? &replica->files : &content->files, 0
+    };
+}
+
+inline void content_versions_t::_release(worker_version_t *version)
+{
+    version->content->n_refs.fetch_sub(1, memory_order_release);
+    delete version;
+}
+
+} } /* namespace rusty::app */
+
+#endif /* __RUSTY_APP_CONTENT_VERSIONS_HPP__ */
@@ -0,0 +1,274 @@
+//
+// Static hash table which indexes served files by their filenames.
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __RUSTY_APP_FILE_INDEX_HPP__
+#define __RUSTY_APP_FILE_INDEX_HPP__
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>              // memcmp(), memcpy()
+#include <utility>              // move()
+#include <vector>
+
+#include "util/macros.hpp"      // LIKELY(), UNLIKELY()
+
+using namespace std;
+
+namespace rusty {
+namespace app {
+
+// Open-addressing hash table mapping filenames to 'value_t' values.
+//
+// The table is filled once when the files are loaded, and is then only read.
+// Each slot stores the full 64 bits hash of its key, so a probe only compares
+// the keys when the hashes are equal. The table is kept at most half full and
+// uses linear probing, so most lookups read a single slot.
+//
+// Keys are *not* copied and are not required to be null-terminated. They must
+// live as long as the index.
+template <typename value_t>
+struct file_index_t {
+    //
+    // Member types
+    //
+
+    struct slot_t {
+        uint64_t    hash;
+
+        // 'nullptr' if the slot is empty.
+        const char  *key;
+        size_t      key_len;
+
+        // Index of the value in 'values'.
+        size_t      value;
+    };
+
+    //
+    // Static fields
+    //
+
+    // Initial number of slots. Must be a power of two.
+    static constexpr size_t INITIAL_SIZE    = 64;
+
+    //
+    // Fields
+    //
+
+    vector<slot_t>      slots;
+
+    // 'slots.size() - 1'.
+    size_t              mask;
+
+    vector<value_t>     values;
+
+    //
+    // Methods
+    //
+
+    inline file_index_t(void)
+        : slots(INITIAL_SIZE, (slot_t) { 0, nullptr, 0, 0 }),
+          mask(INITIAL_SIZE - 1)
+    {
+    }
+
+    // Number of values, including the values which are not reachable by a
+    // key.
+    inline size_t size(void) const
+    {
+        return this->values.size();
+    }
+
+    // Adds a new entry.
+    //
+    // Returns 'false' and leaves the index unchanged if the key was already
+    // indexed.
+    bool insert(const char *key, size_t key_len, value_t value);
+
+    // Adds a value which is not reachable by a key, such as a variant of an
+    // indexed value.
+    //
+    // Returns the index of the value in 'values'.
+    size_t append(value_t value);
+
+    // Replaces the content of the index with slots which have already been
+    // computed, such as slots loaded from a file.
+    //
+    // The number of slots must be a power of two, and every slot must be at
+    // the position 'insert()' would have given to it.
+    void assign(vector<slot_t> &&_slots, vector<value_t> &&_values);
+
+    // Returns the value associated with the key, or 'nullptr'.
+    inline const value_t *find(const char *key, size_t key_len) const;
+
+    // Returns the 64 bits hash of the key (MurmurHash64A).
+    static inline uint64_t hash(const char *key, size_t key_len);
+
+private:
+
+    // Returns the slot containing the key, or the empty slot where it should
+    // be inserted.
+    inline const slot_t *_probe(
+        uint64_t hash, const char *key, size_t key_len
+    ) const;
+
+    // Doubles the number of slots.
+    void _grow(void);
+};
+
+template <typename value_t>
+bool file_index_t<value_t>::insert(
+    const char *key, size_t key_len, value_t value
+)
+{
+    // Keeps the load factor under 50%. Values which are not reachable by a key
+    // are counted too, which only makes the table sparser.
+    if ((this->values.size() + 1) * 2 > this->slots.size())
+        this->_grow();
+
+    uint64_t key_hash = hash(key, key_len);
+
+    slot_t *slot = const_cast<slot_t *>(this->_probe(key_hash, key, key_len));
+
+    if (slot->key != nullptr)
+        return false;
+
+    *slot = (slot_t) { key_hash, key, key_len, this->values.size() };
+    this->values.push_back(move(value));
+
+    return true;
+}
+
+template <typename value_t>
+size_t file_index_t<value_t>::append(value_t value)
+{
+    this->values.push_back(move(value));
+    return this->values.size() - 1;
+}
+
+template <typename value_t>
+void file_index_t<value_t>::assign(
+    vector<slot_t> &&_slots, vector<value_t> &&_values
+)
+{
+    assert(_slots.size() > 0 && (_slots.size() & (_slots.size() - 1)) == 0);
+
+    this->slots  = move(_slots);
+    this->mask   = this->slots.size() - 1;
+    this->values = move(_values);
+}
+
+template <typename value_t>
+inline const value_t *file_index_t<value_t>::find(
+    const char *key, size_t key_len
+) const
+{
+    const slot_t *slot = this->_probe(hash(key, key_len), key, key_len);
+
+    if (LIKELY(slot->key != nullptr))
+        return &this->values[slot->value];
+    else
+        return nullptr;
+}
+
+template <typename value_t>
+inline uint64_t file_index_t<value_t>::hash(const char *key, size_t key_len)
+{
+    constexpr uint64_t  seed    = 0x9E3779B97F4A7C15ULL;
+    constexpr uint64_t  m       = 0xC6A4A7935BD1E995ULL;
+    constexpr int       r       = 47;
+
+    uint64_t h = seed ^ (key_len * m);
+
+    const char *end = key + (key_len & ~(size_t) 7);
+
+    for (const char *p = key; p != end; p += sizeof (uint64_t)) {
+        uint64_t k;
+        memcpy(&k, p, sizeof (uint64_t));
+
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+
+        h ^= k;
+        h *= m;
+    }
+
+    const uint8_t *tail = (const uint8_t *) end;
+
+    // Remaining bytes, the first one being the least significant.
+    size_t tail_len = key_len & 7;
+    if (tail_len > 0) {
+        for (size_t i = 0; i < tail_len; i++)
+            h ^= (uint64_t) tail[i] << (8 * i);
+        h *= m;
+    }
+
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+
+    return h;
+}
+
+template <typename value_t>
+inline const typename file_index_t<value_t>::slot_t *
+file_index_t<value_t>::_probe(
+    uint64_t key_hash, const char *key, size_t key_len
+) const
+{
+    for (size_t i = key_hash & this->mask; ; i = (i + 1) & this->mask) {
+        const slot_t *slot = &this->slots[i];
+
+        if (slot->key == nullptr)
+            return slot;
+
+        if (
+               slot->hash == key_hash && slot->key_len == key_len
+            && memcmp(slot->key, key, key_len) == 0
+        )
+            return slot;
+    }
+}
+
+template <typename value_t>
+void file_index_t<value_t>::_grow(void)
+{
+    vector<slot_t> old_slots(
+        this->slots.size() * 2, (slot_t) { 0, nullptr, 0, 0 }
+    );
+    old_slots.swap(this->slots);
+
+    this->mask = this->slots.size() - 1;
+
+    for (const slot_t &old_slot : old_slots) {
+        if (old_slot.key == nullptr)
+            continue;
+
+        size_t i = old_slot.hash & this->mask;
+        while (this->slots[i].key != nullptr)
+            i = (i + 1) & this->mask;
+
+        this->slots[i] = old_slot;
+    }
+}
+
+} } /* namespace rusty::app */
+
+#endif /* __RUSTY_APP_FILE_INDEX_HPP__ */
@@ -1,7 +1,25 @@
 //
-// Very simple HTTP server. Preload files from the given directory.
+// Very simple HTTP server. Preload files from the given directory, or maps the
+// given content pack (see 'app/httpd_pack.cpp').
 //
-// Usage: ./app/httpd <link> <ipv4> <TCP port> <root dir> <n workers>
+// The content is reloaded from the same root, without interrupting the
+// server, when the process receives a SIGHUP signal.
+//
+// With '-r', each worker serves the small files from its own copy, homed on its
+// Tile.
+//
+// With '-l', the requests are logged to a file by a background thread.
+//
+// With '-S', the workers answer requests to '/__status' from the given network
+// with their counters, in JSON. With '-C', the counters also report the
+// hardware events of the workers.
+//
+// Usage: ./app/httpd [-k <max requests>] [-t <idle timeout>] [-j <threads>]
+//                    [-s <stream threshold>] [-r <replicated size>]
+//                    [-l <access log>] [-S <status network>]
+//                    [-P <status path>] [-C]
+//                    <TCP port> <root dir or pack> <n links>
+//                    [<link> <ipv4s> <n workers>]...
 //
 // Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
 // University of Liege.
@@ -20,28 +38,41 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
 
-#include <algorithm>            // min()
+#include <algorithm>            // max(), min()
+#include <atomic>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
-#include <unordered_map>
+#include <ctime>                // clock_gettime(), struct timespec
+#include <string>
 #include <vector>
 
-#include <alloca.h>             // alloca()
-#include <dirent.h>             // struct dirent, opendir(), readdir()
-#include <sys/stat.h>           // struct stat, stat()
+#include <fcntl.h>              // open()
+#include <pthread.h>            // pthread_create(), pthread_sigmask()
+#include <signal.h>             // sigtimedwait(), SIGHUP
+#include <unistd.h>             // getopt(), optarg, optind, sysconf()
 
-#include <tmc/mem.h>            // tmc_mem_prefetch()
+#include <arch/cycle.h>         // get_cycle_count()
+#include <tmc/cpus.h>           // tmc_cpus_get_my_cpu()
 
 #include "driver/cpu.hpp"
 #include "driver/mpipe.hpp"
-#include "net/checksum.hpp"     // partial_sum_t, precomputed_sums_t
+#include "app/access_log.hpp"   // access_log_t, access_logger_main(),
+                                // access_record_t, access_ring_t
+#include "app/content.hpp"      // file_t, files_t, is_not_modified(),
+                                // select_variant()
+#include "app/content_versions.hpp" // content_versions_t, load_content()
+#include "app/worker_stats.hpp" // stats_registry_t, worker_stats_t
+#include "http/parser.hpp"      // http_parser_t, http_request_t, str_ref_t
+#include "http/server.hpp"      // server_t
 #include "net/endian.hpp"       // net_t
 #include "util/macros.hpp"      // LIKELY(), UNLIKELY, RUSTY_*
 
 using namespace std;
 
+using namespace rusty::app;
 using namespace rusty::driver;
+using namespace rusty::http;
 using namespace rusty::net;
 
 static mpipe_t::arp_ipv4_t::static_entry_t
@@ -69,66 +100,115 @@ static vector<mpipe_t::arp_ipv4_t::static_entry_t> static_arp_entries {
 #define HTTPD_DIE(MSG, ...)                                                    \
     RUSTY_DIE(  "HTTPD", HTTPD_COLOR, MSG, ##__VA_ARGS__)
 
+// Default values of the '-k', '-t', '-s', '-r' and '-P' CLI options. '-j'
+// defaults to the number of online CPUs.
+static constexpr size_t DEFAULT_MAX_REQUESTS        = 0;  // No limit.
+static constexpr size_t DEFAULT_IDLE_TIMEOUT        = 15; // In seconds.
+static constexpr size_t DEFAULT_STREAM_THRESHOLD    = 4;  // In MB.
+static constexpr size_t DEFAULT_REPLICATED_SIZE     = 0;  // In KB. Disabled.
+static constexpr char   DEFAULT_STATUS_PATH[]       = "/__status";
+
 // Parsed CLI arguments.
 struct args_t {
     struct interface_t {
-        char                            *link_name;
-        net_t<mpipe_t::ipv4_t::addr_t>  ipv4_addr;
-        size_t                          n_workers;
+        char                                    *link_name;
+
+        // The first address is the primary address of the interface.
+        vector<net_t<mpipe_t::ipv4_t::addr_t>>  ipv4_addrs;
+
+        size_t                                  n_workers;
     };
 
     mpipe_t::tcp_t::port_t          tcp_port;
     char                            *root_dir;
     vector<interface_t>             interfaces;
-};
 
-// Type used to index file by their filename. Different from 'std::string', so
-// we can initialize it without having to reallocate and copy the string.
-struct filename_t {
-    const char                      *value;
-};
+    // Maximum number of requests served on a single connection before closing
+    // it. Zero means no limit.
+    size_t                          max_requests;
 
-namespace std {
+    // Number of seconds a connection can stay without receiving any data
+    // before being closed. Zero disables the timeout.
+    size_t                          idle_timeout;
 
-// 'std::hash<>' and 'std::equal_to<>' instances are required to index
-// files by their filenames.
+    // Number of threads loading the files of the root directory before the
+    // server starts.
+    size_t                          n_loading_threads;
 
-template <>
-struct hash<filename_t> {
-    inline size_t operator()(filename_t filename) const
-    {
-        const char *str = filename.value;
+    // Files larger than this number of bytes are memory-mapped and streamed
+    // instead of being read in memory.
+    size_t                          stream_threshold;
 
-        size_t sum = 0;
-        while (*str != '\0') {
-            sum += hash<char>()(*str);
-            str++;
-        }
+    // Files which are at most this number of bytes long are replicated on the
+    // Tile of each worker. Zero disables the replicas.
+    size_t                          replicated_size;
 
-        return sum;
-    }
-};
+    // File the requests are logged to. 'nullptr' if they are not logged.
+    char                            *access_log_path;
 
-template <>
-struct equal_to<filename_t> {
-    inline bool operator()(filename_t a, filename_t b) const
-    {
-        return strcmp(a.value, b.value) == 0;
-    }
+    // Path of the status endpoint.
+    const char                      *status_path;
+
+    // Only the clients whose address matches 'status_addr' on the bits of
+    // 'status_mask' can query the status endpoint. Both in network byte
+    // order.
+    bool                            has_status;
+    uint32_t                        status_addr;
+    uint32_t                        status_mask;
+
+    // Set if the workers count their hardware events, which are reported by
+    // the status endpoint.
+    bool                            has_perf;
 };
 
-} /* namespace std */
+// Interval at which the reloading thread frees the versions of the content
+// which are not used anymore, in seconds.
+static constexpr time_t COLLECT_INTERVAL = 1;
+
+// Interval at which each worker copies its hardware events to its counters, in
+// milliseconds.
+static constexpr uint64_t PERF_SNAPSHOT_INTERVAL = 100;
+
+// Versions of the served content, initialized by 'main()'.
+static content_versions_t *content_versions;
+
+// State of the worker running on the current thread, registered on its first
+// connection.
+static __thread content_versions_t::worker_t *current_worker = nullptr;
 
-// Served file and its content.
-struct file_t {
-    const char                      *content;
-    size_t                          content_len;
+// Access log, initialized by 'main()'. 'nullptr' if requests are not logged.
+static access_log_t *access_log = nullptr;
 
-    #ifdef USE_PRECOMPUTED_CHECKSUMS
-        precomputed_sums_t              precomputed_sums;
-    #endif /* USE_PRECOMPUTED_CHECKSUMS */
+// Ring of access records of the worker running on the current thread,
+// registered on its first logged response.
+static __thread access_ring_t *current_ring = nullptr;
+
+// Counters of the workers, initialized by 'main()'. 'nullptr' if the status
+// endpoint is disabled.
+static stats_registry_t *stats = nullptr;
+
+// Counters of the worker running on the current thread, registered on its first
+// connection.
+static __thread worker_stats_t *current_stats = nullptr;
+
+// mPIPE instances, of which the 'n_running_instances' first ones have been
+// started. Read by the workers to report the levels of the buffer stacks.
+static vector<mpipe_t> *mpipe_instances;
+static atomic<size_t> n_running_instances(0);
+
+// State of the server on each HTTP connection.
+struct httpd_conn_t {
+    // Version of the content the requests are served from. 'nullptr' until the
+    // first request, and once the connection has been released.
+    content_versions_t::worker_version_t *version;
 };
 
+typedef server_t<mpipe_t::tcp_t, httpd_conn_t>  http_server_t;
+typedef http_server_t::connection_t             http_conn_t;
+typedef http_server_t::response_t               http_response_t;
+
+typedef mpipe_t::instance_t::timer_manager_t    timer_manager_t;
+
 static void _print_usage(char **argv);
 
 // Parses CLI arguments.
@@ -136,28 +216,97 @@ static void _print_usage(char **argv);
 // Fails on a malformed command.
 static bool _parse_args(int argc, char **argv, args_t *args);
 
-// Loads all the file contents from the directory in the hash-table.
-static void _preload_files(
-    unordered_map<filename_t, file_t> *files, const char *dir
+// Reloads the content when the process receives a SIGHUP signal, and frees the
+// versions of the content which are not used anymore.
+//
+// SIGHUP must be blocked in every thread.
+static void *_reloader_main(void *args);
+
+// Returns the state of the worker running on the current thread.
+static inline content_versions_t::worker_t *_worker(void);
+
+// Returns the ring of access records of the worker running on the current
+// thread.
+static inline access_ring_t *_access_ring(void);
+
+// Returns the counters of the worker running on the current thread.
+//
+// Registers them on the first call and, if the hardware events are counted,
+// starts copying them periodically with the timers of the connection.
+static inline worker_stats_t *_stats(http_conn_t *http_conn);
+
+// Copies the hardware events of the worker to its counters, and reschedules
+// itself.
+static void _snapshot_perf(
+    worker_stats_t *worker_stats, timer_manager_t *timers
+);
+
+// Returns the version of the content the next response of the connection must
+// be served from.
+//
+// Moves to the latest version of the content once the previous responses have
+// been acknowledged. Their data must remain available for retransmissions.
+static inline content_versions_t::worker_version_t *_version(
+    http_conn_t *http_conn
+);
+
+// Releases the version of the content used by the connection, if any.
+//
+// The connection must not be able to retransmit any response.
+static void _release_version(http_conn_t *http_conn);
+
+// Serves the requested file, or responds with '404 Not Found'.
+static void _serve_file(
+    const http_request_t *request, http_response_t *response
+);
+
+// Returns 'true' if the client of the connection can query the status
+// endpoint.
+static inline bool _is_status_client(
+    const args_t *args, const http_conn_t *http_conn
 );
 
-// Used to define empty event handlers.
-static void _do_nothing(void);
+// Responds with the counters of the workers, the number of served files and
+// the levels of the buffer stacks, in JSON.
+static void _respond_with_status(
+    const args_t *args, http_response_t *response
+);
 
-// Interprets an HTTP request and serves the requested content.
-static void _on_received_data(
-    unordered_map<filename_t, file_t> *files, mpipe_t::tcp_t::conn_t conn,
-    mpipe_t::cursor_t in
+// Responds with the entire file, or with the requested range of the file.
+static void _respond_with_content(
+    const file_t *file, const http_request_t *request,
+    http_response_t *response
 );
 
 // Responds to the client with a 200 OK HTTP response containing the given file.
-void _respond_with_200(mpipe_t::tcp_t::conn_t conn, const file_t *file);
+static void _respond_with_200(const file_t *file, http_response_t *response);
 
-// Responds to the client with a 400 Bad Request HTTP response.
-void _respond_with_400(mpipe_t::tcp_t::conn_t conn);
+// Responds to the client with a header-only 304 Not Modified HTTP response
+// for the given file.
+static void _respond_with_304(const file_t *file, http_response_t *response);
 
-// Responds to the client with a 404 Not Found HTTP response.
-void _respond_with_404(mpipe_t::tcp_t::conn_t conn);
+// Responds to the client with a 206 Partial Content HTTP response containing
+// the bytes [begin, end[ of the file.
+static void _respond_with_206(
+    const file_t *file, size_t begin, size_t end, http_response_t *response
+);
+
+// Responds to the client with a 416 Range Not Satisfiable HTTP response.
+static void _respond_with_416(const file_t *file, http_response_t *response);
+
+// Counts a response which has just been queued on the connection, and queues
+// its access record, if enabled.
+static void _on_responded(
+    http_conn_t *http_conn, const http_request_t *request, unsigned int status,
+    size_t len
+);
+
+// Queues the access record of a response, or drops it if the ring of the worker
+// is full.
+static void _log_access(
+    http_conn_t *http_conn, const http_request_t *request, unsigned int status,
+    size_t len, cycles_t service
+);
 
 int main(int argc, char **argv)
 {
@@ -165,56 +314,97 @@ int main(int argc, char **argv)
     if (!_parse_args(argc, argv, &args))
         return EXIT_FAILURE;
 
-    unordered_map<filename_t, file_t> files { };
-    _preload_files(&files, args.root_dir);
+    // The root can either be a directory or a content pack.
+    content_t *content = load_content(
+        args.root_dir, args.n_loading_threads, args.stream_threshold
+    );
+    if (content == nullptr)
+        HTTPD_DIE("Unable to get info on the root (%s)", args.root_dir);
+
+    // SIGHUP is only received by the reloading thread. Blocks it before
+    // starting the workers, which inherit the signal mask.
+
+    sigset_t reload_signals;
+    sigemptyset(&reload_signals);
+    sigaddset(&reload_signals, SIGHUP);
+
+    if (pthread_sigmask(SIG_BLOCK, &reload_signals, nullptr) != 0)
+        HTTPD_DIE("Unable to block SIGHUP");
+
+    if (args.access_log_path != nullptr) {
+        int fd = open(
+            args.access_log_path, O_WRONLY | O_CREAT | O_APPEND, 0644
+        );
+        if (fd < 0) {
+            HTTPD_DIE(
+                "Unable to open the access log (%s)", args.access_log_path
+            );
+        }
+
+        access_log = new access_log_t(fd);
+
+        pthread_t logger;
+        if (pthread_create(&logger, nullptr, access_logger_main, access_log))
+            HTTPD_DIE("Unable to start the logging thread");
+    }
+
+    if (args.has_status)
+        stats = new stats_registry_t(get_cycle_count(), args.has_perf);
 
     //
-    // Handler executed on new connections.
+    // Routes the requests.
     //
 
-    auto on_new_connection =
-        [&files](mpipe_t::tcp_t::conn_t conn)
-        {
-            HTTPD_DEBUG(
-                "New connection from %s:%" PRIu16 " on port %" PRIu16,
-                mpipe_t::ipv4_t::addr_t::to_alpha(conn.tcb_id.raddr),
-                conn.tcb_id.rport.host(), conn.tcb_id.lport.host()
-            );
+    http_server_t server(args.max_requests, args.idle_timeout);
 
-            mpipe_t::tcp_t::conn_handlers_t handlers;
+    server.fallback = _serve_file;
 
-            handlers.new_data =
-                [&files, conn](mpipe_t::cursor_t in) mutable
-                {
-                    if (conn.can_send())
-                        _on_received_data(&files, conn, in);
-                };
+    if (args.has_status) {
+        server.route(
+            args.status_path,
+            [&args](const http_request_t *request, http_response_t *response)
+            {
+                if (_is_status_client(&args, response->connection.get())) {
+                    HTTPD_DEBUG("200 OK - Status");
+                    _respond_with_status(&args, response);
+                } else
+                    _serve_file(request, response);
+            }
+        );
+    }
 
-            handlers.remote_close =
-                [conn]() mutable
-                {
-                    // Closes when the remote closes the connection.
-                    conn.close();
-                };
+    server.hooks.released = _release_version;
 
-            handlers.close = _do_nothing;
+    if (stats != nullptr) {
+        server.hooks.open =
+            [](http_conn_t *http_conn)
+            {
+                worker_stats_t::add(&_stats(http_conn)->n_accepted);
+            };
 
-            handlers.reset = _do_nothing;
+        server.hooks.close =
+            [](http_conn_t *http_conn)
+            {
+                worker_stats_t::add(&_stats(http_conn)->n_closed);
+            };
+    }
 
-            return handlers;
-        };
+    if (access_log != nullptr || stats != nullptr)
+        server.hooks.responded = _on_responded;
 
     //
-    // Starts an mpipe instance for each interface.
+    // Creates an mpipe instance for each interface.
     //
 
+    // Instances are never moved, as the workers can read them.
     vector<mpipe_t> instances;
     instances.reserve(args.interfaces.size());
+    mpipe_instances = &instances;
 
     int first_dataplane_cpu = 0;
     for (args_t::interface_t &interface : args.interfaces) {
         instances.emplace_back(
-            interface.link_name, interface.ipv4_addr, interface.n_workers,
+            interface.link_name, interface.ipv4_addrs, interface.n_workers,
             first_dataplane_cpu, static_arp_entries
         );
 
@@ -222,20 +412,49 @@ int main(int argc, char **argv)
 
         HTTPD_DEBUG(
             "Starts the HTTP server on interface %s (%s) with %s as IPv4 "
-            "address on port %d serving %s",
+            "address (and %zu other addresses) on port %d serving %s",
             interface.link_name,
             mpipe_t::ethernet_t::addr_t::to_alpha(mpipe.ether_addr),
-            mpipe_t::ipv4_t::addr_t::to_alpha(interface.ipv4_addr),
-            args.tcp_port, args.root_dir
+            mpipe_t::ipv4_t::addr_t::to_alpha(interface.ipv4_addrs[0]),
+            interface.ipv4_addrs.size() - 1, args.tcp_port, args.root_dir
         );
 
-        mpipe.tcp_listen(args.tcp_port, on_new_connection);
-
-        mpipe.run();
+        mpipe.tcp_listen(
+            args.tcp_port,
+            [&server](mpipe_t::tcp_t::conn_t conn)
+            {
+                return server.accept(conn);
+            }
+        );
 
         first_dataplane_cpu += interface.n_workers;
     }
 
+    // The content is replicated on the Tiles of the workers before they start.
+
+    vector<int> worker_cpus;
+    for (mpipe_t &mpipe : instances) {
+        for (mpipe_t::instance_t *instance : mpipe.instances)
+            worker_cpus.push_back(instance->cpu_id);
+    }
+
+    content_versions = new content_versions_t(
+        content, worker_cpus, args.replicated_size
+    );
+
+    pthread_t reloader;
+    if (pthread_create(&reloader, nullptr, _reloader_main, &args) != 0)
+        HTTPD_DIE("Unable to start the reloading thread");
+
+    //
+    // Starts the instances.
+    //
+
+    for (mpipe_t &mpipe : instances) {
+        mpipe.run();
+        n_running_instances.fetch_add(1, memory_order_release);
+    }
+
     printf("HTTPD started\n");
 
     // Wait for all instances to finish (will not happen).
@@ -266,26 +485,144 @@ static void _print_usage(char **argv)
 {
     fprintf(
         stderr,
-        "Usage: %s <TCP port> <root dir> <n links> "
-        "[<link> <ipv4 of this link> <n workers on this link>]...\n",
-        argv[0]
+        "Usage: %s [-k <max requests>] [-t <idle timeout>] [-j <threads>]\n"
+        "       [-s <stream threshold>] [-r <replicated size>] "
+        "[-l <access log>]\n"
+        "       [-S <status network>] [-P <status path>] [-C]\n"
+        "       <TCP port> <root dir or pack> <n links>\n"
+        "       [<link> <ipv4s of this link> <n workers on this link>]...\n"
+        "\n"
+        "<root dir or pack> is either a directory of files or a content pack "
+        "built with\n"
+        "httpd_pack. Files in sub-directories are served with their relative "
+        "path.\n"
+        "\n"
+        "<ipv4s of this link> is a comma-separated list of IPv4 addresses. "
+        "The first one is\n"
+        "the primary address of the link.\n"
+        "\n"
+        "-k <max requests>   closes connections after this number of "
+        "requests (0 = no\n"
+        "                    limit, default: %zu).\n"
+        "-t <idle timeout>   closes connections which did not receive any "
+        "data during\n"
+        "                    this number of seconds (0 = no timeout, "
+        "default: %zu).\n"
+        "-j <threads>        number of threads loading the root directory "
+        "(default: the\n"
+        "                    number of online CPUs).\n"
+        "-s <stream threshold>\n"
+        "                    streams the files larger than this number of "
+        "MB from the\n"
+        "                    page cache instead of loading them in memory "
+        "(default: %zu).\n"
+        "-r <replicated size>\n"
+        "                    copies the files of at most this number of KB "
+        "in the memory\n"
+        "                    of each worker (0 = a single copy, default: "
+        "%zu).\n"
+        "-l <access log>     appends a line to this file for each "
+        "response.\n"
+        "-S <status network> answers the requests to the status path from "
+        "this network\n"
+        "                    (e.g. 10.0.0.0/8) with the counters of the "
+        "workers in JSON.\n"
+        "-P <status path>    path of the status endpoint (default: %s).\n"
+        "-C                  counts the hardware events of the workers and "
+        "reports them\n"
+        "                    on the status endpoint (requires -S).\n",
+        argv[0], DEFAULT_MAX_REQUESTS, DEFAULT_IDLE_TIMEOUT,
+        DEFAULT_STREAM_THRESHOLD, DEFAULT_REPLICATED_SIZE, DEFAULT_STATUS_PATH
     );
 }
 
 static bool _parse_args(int argc, char **argv, args_t *args)
 {
-    if (argc < 4) {
+    args->max_requests = DEFAULT_MAX_REQUESTS;
+    args->idle_timeout = DEFAULT_IDLE_TIMEOUT;
+    args->n_loading_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    args->stream_threshold = DEFAULT_STREAM_THRESHOLD * 1024 * 1024;
+    args->replicated_size = DEFAULT_REPLICATED_SIZE * 1024;
+    args->access_log_path = nullptr;
+    args->has_status = false;
+    args->has_perf = false;
+
+    args->status_path = DEFAULT_STATUS_PATH;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "k:t:j:s:r:l:S:P:C")) != -1) {
+        switch (opt) {
+        case 'k':
+            args->max_requests = atol(optarg);
+            break;
+        case 't':
+            args->idle_timeout = atol(optarg);
+            break;
+        case 'j':
+            args->n_loading_threads = atol(optarg);
+            break;
+        case 's':
+            args->stream_threshold = atol(optarg) * 1024 * 1024;
+            break;
+        case 'r':
+            args->replicated_size = atol(optarg) * 1024;
+            break;
+        case 'l':
+            args->access_log_path = optarg;
+            break;
+        case 'S': {
+            char *prefix_len = strchr(optarg, '/');
+            int len = prefix_len != nullptr ? atoi(prefix_len + 1) : 32;
+
+            if (prefix_len != nullptr)
+                *prefix_len = '\0';
+
+            struct in_addr in_addr;
+            if (inet_aton(optarg, &in_addr) != 1 || len < 0 || len > 32) {
+                fprintf(stderr, "Failed to parse the status network.\n");
+                _print_usage(argv);
+                return false;
+            }
+
+            args->has_status  = true;
+            args->status_mask = len == 0 ? 0 : htonl(~0U << (32 - len));
+            args->status_addr = in_addr.s_addr & args->status_mask;
+            break;
+        }
+        case 'P':
+            args->status_path = optarg;
+            break;
+        case 'C':
+            args->has_perf = true;
+            break;
+        default:
+            _print_usage(argv);
+            return false;
+        }
+    }
+
+    if (args->has_perf && !args->has_status) {
+        fprintf(stderr, "The hardware events are only reported with -S.\n");
         _print_usage(argv);
         return false;
     }
 
-    args->tcp_port = atoi(argv[1]);
+    // Positional arguments.
+    int n_args      = argc - optind;
+    char **arg      = argv + optind;
 
-    args->root_dir = argv[2];
+    if (n_args < 3) {
+        _print_usage(argv);
+        return false;
+    }
+
+    args->tcp_port = atoi(arg[0]);
+
+    args->root_dir = arg[1];
 
-    int n_links = atoi(argv[3]);
+    int n_links = atoi(arg[2]);
 
-    if (argc != 4 + n_links * 3){
+    if (n_args != 3 + n_links * 3){
         _print_usage(argv);
         return false;
     }
@@ -295,17 +632,30 @@ static bool _parse_args(int argc, char **argv, args_t *args)
     for (int i = 0; i < n_links; i++) {
         args_t::interface_t interface;
 
-        interface.link_name = argv[4 + 3 * i];
+        interface.link_name = arg[3 + 3 * i];
+
+        char *saveptr;
+        for (
+            char *addr_str = strtok_r(arg[4 + 3 * i], ",", &saveptr);
+            addr_str != nullptr;
+            addr_str = strtok_r(nullptr, ",", &saveptr)
+        ) {
+            struct in_addr in_addr;
+            if (inet_aton(addr_str, &in_addr) != 1) {
+                fprintf(stderr, "Failed to parse the IPv4.\n");
+                _print_usage(argv);
+                return false;
+            }
+            interface.ipv4_addrs.push_back(ipv4_addr_t::from_in_addr(in_addr));
+        }
 
-        struct in_addr in_addr;
-        if (inet_aton(argv[5 + 3 * i], &in_addr) != 1) {
-            fprintf(stderr, "Failed to parse the IPv4.\n");
+        if (interface.ipv4_addrs.empty()) {
+            fprintf(stderr, "No IPv4 given for the link.\n");
             _print_usage(argv);
             return false;
         }
-        interface.ipv4_addr = ipv4_addr_t::from_in_addr(in_addr);
 
-        interface.n_workers = atoi(argv[6 + 3 * i]);
+        interface.n_workers = atoi(arg[5 + 3 * i]);
 
         args->interfaces.push_back(interface);
     }
@@ -313,248 +663,361 @@ static bool _parse_args(int argc, char **argv, args_t *args)
     return true;
 }
 
-static void _preload_files(
-    unordered_map<filename_t, file_t> *files, const char *root_dir
-)
+static void *_reloader_main(void *args_void)
 {
-    DIR *dir;
+    const args_t *args = (const args_t *) args_void;
 
-    if (!(dir = opendir(root_dir)))
-        HTTPD_DIE("Unable to open the directory");
+    sigset_t reload_signals;
+    sigemptyset(&reload_signals);
+    sigaddset(&reload_signals, SIGHUP);
 
-    struct dirent *entry;
+    for (;;) {
+        struct timespec timeout = { COLLECT_INTERVAL, 0 };
 
-    size_t root_dir_len = strlen(root_dir);
+        if (sigtimedwait(&reload_signals, nullptr, &timeout) == SIGHUP) {
+            struct timespec begin, end;
+            clock_gettime(CLOCK_MONOTONIC, &begin);
 
-    while ((entry = readdir(dir))) {
-        filename_t filename = { strdup(entry->d_name) };
+            // The workers keep serving the current version while the new one
+            // is being loaded.
+            content_t *content = load_content(
+                args->root_dir, args->n_loading_threads, args->stream_threshold
+            );
 
-        // Filename with the directory path.
-        char *filepath = new char[root_dir_len + strlen(filename.value) + 2];
-        strcpy(filepath, root_dir);
-        filepath[root_dir_len] = '/';
-        strcpy(filepath + root_dir_len + 1, filename.value);
+            if (content == nullptr) {
+                HTTPD_ERROR(
+                    "Unable to get info on the root (%s), the content has "
+                    "not been reloaded", args->root_dir
+                );
+                continue;
+            }
 
-        // Skips directories.
-        struct stat stat_buffer;
-        if (stat(filepath, &stat_buffer) != 0)
-            HTTPD_DIE("Unable to get info on a file (%s)", filename.value);
-        if (S_ISDIR(stat_buffer.st_mode))
-            continue;
+            content_versions->publish(content);
 
-        FILE *file;
-        if (!(file = fopen(filepath, "r")))
-            HTTPD_DIE("Unable to open a file");
+            clock_gettime(CLOCK_MONOTONIC, &end);
 
-        // Obtains the size of the file
-        fseek(file, 0, SEEK_END);
-        size_t content_size = ftell(file);
-        fseek(file, 0, SEEK_SET);
+            fprintf(
+                stderr, "Content reloaded from %s in %ld ms (%zu file(s))\n",
+                args->root_dir,
+                  (end.tv_sec - begin.tv_sec) * 1000
+                + (end.tv_nsec - begin.tv_nsec) / 1000000,
+                content->files.size()
+            );
+        }
 
-        // Reads the file content
+        size_t n_freed = content_versions->collect();
+        if (n_freed > 0)
+            HTTPD_DEBUG("%zu previous content version(s) freed", n_freed);
+    }
 
-        char *content = new char[content_size + 1];
-        size_t read = fread(content, 1, content_size, file);
+    return nullptr;
+}
 
-        if (read != content_size)
-            HTTPD_DIE("Unable to read a file %zu %zu", read, content_size);
+static inline content_versions_t::worker_t *_worker(void)
+{
+    if (UNLIKELY(current_worker == nullptr))
+        current_worker = content_versions->register_worker(
+            tmc_cpus_get_my_cpu()
+        );
 
-        content[content_size] = '\0';
+    return current_worker;
+}
 
-        fclose(file);
+static inline access_ring_t *_access_ring(void)
+{
+    if (UNLIKELY(current_ring == nullptr))
+        current_ring = access_log->register_worker();
 
-        #ifdef USE_PRECOMPUTED_CHECKSUMS
-            file_t entry = {
-                content, content_size, precomputed_sums_t(content, content_size)
-            };
-        #else
-            file_t entry = { content, content_size };
-        #endif /* USE_PRECOMPUTED_CHECKSUMS */
+    return current_ring;
+}
+
+static inline worker_stats_t *_stats(http_conn_t *http_conn)
+{
+    if (UNLIKELY(current_stats == nullptr)) {
+        current_stats = stats->register_worker();
 
-        files->emplace(filename, entry);
+        if (stats->count_perf) {
+            _snapshot_perf(
+                current_stats, http_conn->conn.tcp_instance->timers
+            );
+        }
     }
 
-    HTTPD_DEBUG("%zu file(s) preloaded", files->size());
+    return current_stats;
 }
 
-static void _do_nothing(void)
+static void _snapshot_perf(
+    worker_stats_t *worker_stats, timer_manager_t *timers
+)
 {
+    worker_stats->snapshot_perf();
+
+    timers->schedule(
+        cpu_clock_t::interval_t(PERF_SNAPSHOT_INTERVAL * 1000),
+        [worker_stats, timers]() { _snapshot_perf(worker_stats, timers); }
+    );
 }
 
-static void _on_received_data(
-    unordered_map<filename_t, file_t> *files, mpipe_t::tcp_t::conn_t conn,
-    mpipe_t::cursor_t in
+static inline content_versions_t::worker_version_t *_version(
+    http_conn_t *http_conn
 )
 {
-    // Expects that the first received segment contains the entire request.
+    // The unacknowledged data of a new connection can be the 101 response or
+    // the SETTINGS frame of HTTP/2, which reference no content.
+    if (http_conn->n_unacked == 0 || http_conn->data.version == nullptr) {
+        http_conn->data.version = content_versions->move_conn(
+            _worker(), http_conn->data.version
+        );
+    }
 
-    size_t size = in.size();
+    return http_conn->data.version;
+}
 
-    #define BAD_REQUEST(WHY, ...)                                              \
-        do {                                                                   \
-            HTTPD_ERROR("400 Bad Request (" WHY ")", ##__VA_ARGS__);           \
-            _respond_with_400(conn);                                           \
-            conn.close();                                                      \
-            return;                                                            \
-        } while (0)
+static void _release_version(http_conn_t *http_conn)
+{
+    if (http_conn->data.version != nullptr) {
+        content_versions->release_conn(_worker(), http_conn->data.version);
+        http_conn->data.version = nullptr;
+    }
+}
 
-    if (UNLIKELY(size < sizeof ("XXX / HTTP/X.X\n")))
-        BAD_REQUEST("Not enough received data for the HTTP header");
+static void _serve_file(
+    const http_request_t *request, http_response_t *response
+)
+{
+    const file_t *file = _version(response->connection.get())->files->find(
+        request->path.data, request->path.len
+    );
 
-    in.read_with(
-        [files, conn](const char *buffer) mutable
-        {
-            //
-            // Extracts the filename from the HTTP header
-            //
+    if (UNLIKELY(file == nullptr)) {
+        HTTPD_ERROR(
+            "404 Not Found - \"%.*s\"", (int) request->path.len,
+            request->path.data
+        );
+        response->send_not_found();
+        return;
+    }
 
-            size_t      get_len         = sizeof ("GET /") - sizeof ('\0');
+    file = select_variant(file, request->accept_encoding);
 
-            if (UNLIKELY(strncmp(buffer, "GET /", get_len) != 0))
-                BAD_REQUEST("Not a GET request");
+    if (is_not_modified(file, request)) {
+        HTTPD_DEBUG(
+            "304 Not Modified - \"%.*s\"", (int) request->path.len,
+            request->path.data
+        );
+        _respond_with_304(file, response);
+    } else
+        _respond_with_content(file, request, response);
+}
 
-            const char  *path_begin     = buffer + get_len;
-            const char  *path_end       = strchr(path_begin, ' ');
+static inline bool _is_status_client(
+    const args_t *args, const http_conn_t *http_conn
+)
+{
+    uint32_t raddr = http_conn->conn.tcb_id.raddr.net.value;
+    return (raddr & args->status_mask) == args->status_addr;
+}
 
-            const char  *http11_begin   = path_end + 1;
-            size_t      http11_len      = sizeof ("HTTP/1.1") - sizeof ('\0');
-            const char  *http11_end     = http11_begin + http11_len;
+static void _respond_with_status(
+    const args_t *args, http_response_t *response
+)
+{
+    string json;
+    json.reserve(16 * 1024);
 
+    cycles_t uptime = get_cycle_count() - stats->started;
 
-            if (UNLIKELY(strncmp(http11_begin, "HTTP/1.1", http11_len) != 0))
-                BAD_REQUEST("Not HTTP 1.1");
+    _append(
+        &json, "{ \"uptime_s\": %.3f, \"files\": %zu, ",
+          (double) uptime / CYCLES_PER_SECOND,
+        _version(response->connection.get())->files->size()
+    );
 
-            if (UNLIKELY(http11_end[0] != '\n' && http11_end[0] != '\r'))
-                BAD_REQUEST("Invalid header");
+    stats->write_json(&json);
 
-            size_t  path_len    = (intptr_t) path_end - (intptr_t) path_begin;
-            char    *path       = (char *) alloca(path_len);
+    // Number of free buffers in each buffer stack of each link.
 
-            strncpy(path, path_begin, path_len);
-            path[path_len] = '\0';
+    json += ", \"buffers\": [";
 
-            //
-            // Responds to the request.
-            //
+    size_t n_instances = n_running_instances.load(memory_order_acquire);
 
-            auto file_it = files->find({ path });
+    for (size_t i = 0; i < n_instances; i++) {
+        mpipe_t *mpipe = &(*mpipe_instances)[i];
 
-            if (LIKELY(file_it != files->end())) {
-                HTTPD_DEBUG("200 OK - \"%s\"", path);
-                _respond_with_200(conn, &file_it->second);
-            } else {
-                HTTPD_ERROR("404 Not Found - \"%s\"", path);
-                _respond_with_404(conn);
-            }
+        for (size_t j = 0; j < mpipe->buffer_stacks.size(); j++) {
+            const mpipe_t::buffer_stack_t *stack = &mpipe->buffer_stacks[j];
+
+            int n_free = gxio_mpipe_get_buffer_count(
+                &mpipe->context, stack->id
+            );
 
-            conn.close();
-        }, size
+            _append(
+                &json,
+                "%s { \"link\": \"%s\", \"buffer_size\": %zu, "
+                "\"free\": %d, \"total\": %lu }",
+                i + j == 0 ? "" : ",", args->interfaces[i].link_name,
+                stack->buffer_size, n_free, stack->info->count
+            );
+        }
+    }
+
+    json += " ] }\n";
+
+    char header[MAX_RESPONSE_HEADER_LEN];
+    size_t header_len = snprintf(
+        header, sizeof (header),
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: application/json\r\n"
+        "Content-Length: %zu\r\n"
+        "Cache-Control: no-store\r\n"
+        "Connection: %s\r\n"
+        "\r\n",
+        json.size(), response->keep_alive ? "keep-alive" : "close"
     );
 
-    #undef BAD_REQUEST
+    response->send(string(header, header_len) + json);
 }
 
-void _respond_with_200(mpipe_t::tcp_t::conn_t conn, const file_t *file)
+static void _respond_with_content(
+    const file_t *file, const http_request_t *request,
+    http_response_t *response
+)
 {
-    constexpr char header[]     = "HTTP/1.1 200 OK\r\n"
-                                  "Content-Type: text/html\r\n"
-                                  "Content-Length: %10zu\r\n"
-                                  "\r\n";
-
-    constexpr size_t header_len =   sizeof (header) - sizeof ('\0')
-                                  - sizeof ("%10zu")
-                                  + sizeof ("4294967295");
-
-    size_t total_len = header_len + file->content_len;
-
-    #ifdef USE_PRECOMPUTED_CHECKSUMS
-        mpipe_t::tcp_t::writer_sum_t writer =
-    #else
-        mpipe_t::tcp_t::writer_t writer =
-    #endif /* USE_PRECOMPUTED_CHECKSUMS */
-        [file](size_t offset, mpipe_t::cursor_t out)
-        {
-            size_t content_offset;
-
-            #ifdef USE_PRECOMPUTED_CHECKSUMS
-                partial_sum_t partial_sum;
-            #endif /* USE_PRECOMPUTED_CHECKSUMS */
+    if (LIKELY(request->range.empty())) {
+        HTTPD_DEBUG(
+            "200 OK - \"%.*s\"", (int) request->path.len, request->path.data
+        );
+        _respond_with_200(file, response);
+        return;
+    }
 
-            // Writes the HTTP header if required.
-            if (offset < header_len) {
-                tmc_mem_prefetch(header, sizeof (header));
+    // 'If-Range' only applies the range if the file has not changed, using
+    // the strong comparison of the entity tags.
+    str_ref_t if_range = request->if_range;
+    if (
+           !if_range.empty()
+        && !(   if_range.len == file->etag.len
+             && memcmp(if_range.data, file->etag.data, if_range.len) == 0)
+        && !(   if_range.len == file->last_modified.len
+             && memcmp(
+                    if_range.data, file->last_modified.data, if_range.len
+                ) == 0)
+    ) {
+        _respond_with_200(file, response);
+        return;
+    }
 
-                char buffer[header_len + 1];
+    size_t begin, end;
 
-                snprintf(buffer, sizeof (buffer), header, file->content_len);
+    switch (http_parser_t::parse_range(
+        request->range, file->content_len, &begin, &end
+    )) {
+    case http_parser_t::RANGE_SATISFIABLE:
+        HTTPD_DEBUG(
+            "206 Partial Content - \"%.*s\" (%zu-%zu)",
+            (int) request->path.len, request->path.data, begin, end - 1
+        );
+        _respond_with_206(file, begin, end, response);
+        break;
+    case http_parser_t::RANGE_UNSATISFIABLE:
+        HTTPD_ERROR(
+            "416 Range Not Satisfiable - \"%.*s\"", (int) request->path.len,
+            request->path.data
+        );
+        _respond_with_416(file, response);
+        break;
+    default:
+        _respond_with_200(file, response);
+    }
+}
 
-                size_t to_write = min(out.size(), header_len - offset);
+static void _respond_with_200(const file_t *file, http_response_t *response)
+{
+    response->send_static(file, &file->responses[response->keep_alive]);
+}
 
-                out            = out.write(buffer + offset, to_write);
-                content_offset = 0;
+static void _respond_with_304(const file_t *file, http_response_t *response)
+{
+    response->send_static(file, &file->not_modified[response->keep_alive]);
+}
 
-                #ifdef USE_PRECOMPUTED_CHECKSUMS
-                    partial_sum = partial_sum_t(buffer + offset, to_write);
-                #endif /* USE_PRECOMPUTED_CHECKSUMS */
-            } else {
-                content_offset = offset - header_len;
+static void _respond_with_206(
+    const file_t *file, size_t begin, size_t end, http_response_t *response
+)
+{
+    char header[MAX_PARTIAL_HEADER_LEN];
+    size_t header_len = partial_header(
+        file, response->keep_alive, begin, end, header
+    );
 
-                #ifdef USE_PRECOMPUTED_CHECKSUMS
-                    partial_sum = partial_sum_t::ZERO;
-                #endif /* USE_PRECOMPUTED_CHECKSUMS */
-            }
+    response->send(string(header, header_len), file, begin, end - begin);
+}
 
-            size_t out_size     = out.size();
+static void _respond_with_416(const file_t *file, http_response_t *response)
+{
+    char header[MAX_PARTIAL_HEADER_LEN];
+    size_t header_len = unsatisfiable_header(
+        file, response->keep_alive, header
+    );
 
-            tmc_mem_prefetch(file->content + content_offset, out_size);
+    response->send(string(header, header_len));
+}
 
-            #ifdef USE_PRECOMPUTED_CHECKSUMS
-                size_t content_end  = content_offset + out_size;
-                file->precomputed_sums.prefetch(content_offset, content_end);
-            #endif /* USE_PRECOMPUTED_CHECKSUMS */
+static void _on_responded(
+    http_conn_t *http_conn, const http_request_t *request, unsigned int status,
+    size_t len
+)
+{
+    cycles_t service = get_cycle_count() - http_conn->received;
 
-            // Writes the file content if required.
-            if (out_size > 0) {
-                assert(out_size <= file->content_len - content_offset);
-                out.write(file->content + content_offset, out_size);
-            }
+    if (stats != nullptr) {
+        worker_stats_t *worker_stats = _stats(http_conn);
 
-            #ifdef USE_PRECOMPUTED_CHECKSUMS
-                // Returns the precomputed checksum sums.
-                return (partial_sum_t) partial_sum.append(
-                    file->precomputed_sums.sum(content_offset, content_end)
-                );
-            #endif /* USE_PRECOMPUTED_CHECKSUMS */
-        };
+        worker_stats_t::add(&worker_stats->n_requests);
+        worker_stats->count_response(status, len, service);
+    }
 
-    conn.send(total_len, writer, _do_nothing /* Does nothing on ACK */);
+    if (access_log != nullptr)
+        _log_access(http_conn, request, status, len, service);
 }
 
-#define RESPOND_WITH_CONTENT(CONTENT)                                          \
-    do {                                                                       \
-        constexpr char status[] = CONTENT;                                     \
-                                                                               \
-        conn.send(                                                             \
-            sizeof (status) - 1,                                               \
-            [](size_t offset, mpipe_t::cursor_t out)                           \
-            {                                                                  \
-                out.write(status + offset, out.size());                        \
-            }, _do_nothing                                                     \
-        );                                                                     \
-    } while (0);
-
-void _respond_with_400(mpipe_t::tcp_t::conn_t conn)
+static void _log_access(
+    http_conn_t *http_conn, const http_request_t *request, unsigned int status,
+    size_t len, cycles_t service
+)
 {
-    RESPOND_WITH_CONTENT("HTTP/1.1 400 Bad Request\r\n\r\n");
-}
+    access_ring_t *ring = _access_ring();
+
+    access_record_t *record = ring->reserve();
+    if (UNLIKELY(record == nullptr))
+        return;
+
+    const auto &tcb_id = http_conn->conn.tcb_id;
+
+    record->received        = http_conn->received;
+    record->bytes           = len;
+    record->raddr           = tcb_id.raddr.net.value;
+    record->laddr           = tcb_id.laddr.net.value;
+    record->service_cycles  = (uint32_t) min(service, (cycles_t) UINT32_MAX);
+    record->rport           = tcb_id.rport.host();
+    record->lport           = tcb_id.lport.host();
+    record->status          = status;
+
+    if (request != nullptr) {
+        size_t path_len = min(request->path.len, MAX_LOGGED_PATH);
+
+        record->major_version   = request->major_version;
+        record->minor_version   = request->minor_version;
+        record->path_len        = path_len;
+        memcpy(record->path, request->path.data, path_len);
+    } else {
+        record->minor_version   = '\0';
+        record->path_len        = 0;
+    }
 
-void _respond_with_404(mpipe_t::tcp_t::conn_t conn)
-{
-    RESPOND_WITH_CONTENT("HTTP/1.1 404 Not Found\r\n\r\n");
+    ring->commit();
 }
 
-#undef RESPOND_WITH_CONTENT
-
 #undef HTTPD_COLOR
 #undef HTTPD_DEBUG
 #undef HTTPD_DIE
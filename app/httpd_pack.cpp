@@ -0,0 +1,55 @@
+//
+// Builds a content pack from the files of a directory, to be served by
+// 'httpd'.
+//
+// Usage: ./app/httpd_pack <root dir> <pack>
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <unistd.h>             // sysconf()
+
+#include "app/content.hpp"      // files_t, preload_files()
+#include "app/content_pack.hpp" // write_pack()
+
+#ifndef USE_PRECOMPUTED_CHECKSUMS
+    #error "httpd_pack requires USE_PRECOMPUTED_CHECKSUMS"
+#endif /* USE_PRECOMPUTED_CHECKSUMS */
+
+using namespace std;
+
+using namespace rusty::app;
+
+int main(int argc, char **argv)
+{
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <root dir> <pack>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    files_t files;
+    preload_files(&files, argv[1], sysconf(_SC_NPROCESSORS_ONLN));
+
+    write_pack(argv[2], &files);
+
+    printf("%zu file(s) packed in %s\n", files.size(), argv[2]);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,1112 @@
+//
+// HTTP load generator. Opens connections to a web-server from every worker and
+// measures the throughput and the latency of its responses.
+//
+// By default, each connection sends its next request as soon as it received
+// the previous response (closed loop). With '-R', requests are issued at a
+// constant rate, whether or not the previous ones have been answered (open
+// loop). The latency of a request is then measured from the time it should
+// have been sent, so a stalled server is not hidden by the requests the
+// generator failed to send (coordinated omission).
+//
+// Usage: ./app/loadgen [-c <connections>] [-d <duration>] [-w <warm-up>]
+//                      [-R <rate>] [-C] [-p <pages>] [-T <connect timeout>]
+//                      [-m <server ether>] [-J]
+//                      <link> <ipv4> <n workers> <server ipv4> <server port>
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <algorithm>            // find(), max()
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <utility>              // pair
+#include <vector>
+
+#include <dirent.h>             // struct dirent, opendir(), readdir()
+#include <sys/stat.h>           // struct stat, lstat(), stat()
+#include <unistd.h>             // getopt(), optarg, optind, sleep()
+
+#include <arch/cycle.h>         // get_cycle_count()
+
+#include "app/loadgen_stats.hpp" // loadgen_registry_t, loadgen_snapshot_t,
+                                 // loadgen_stats_t
+#include "app/port_owners.hpp"  // port_owners_t
+#include "app/worker_stats.hpp" // worker_stats_t
+#include "driver/cpu.hpp"       // CYCLES_PER_SECOND, cycles_t
+#include "driver/mpipe.hpp"     // mpipe_t
+#include "http/response_parser.hpp" // http_response_parser_t
+#include "net/endian.hpp"       // net_t
+#include "util/macros.hpp"      // LIKELY(), UNLIKELY(), RUSTY_*
+
+using namespace std;
+
+using namespace rusty::app;
+using namespace rusty::driver;
+using namespace rusty::http;
+using namespace rusty::net;
+
+#define LOADGEN_COLOR   COLOR_GRN
+#define LOADGEN_DEBUG(MSG, ...)                                                \
+    RUSTY_DEBUG("LOADGEN", LOADGEN_COLOR, MSG, ##__VA_ARGS__)
+#define LOADGEN_DIE(MSG, ...)                                                  \
+    RUSTY_DIE(  "LOADGEN", LOADGEN_COLOR, MSG, ##__VA_ARGS__)
+
+typedef mpipe_t::instance_t::timer_manager_t            timer_manager_t;
+
+// Default values of the '-c', '-d', '-w' and '-T' CLI options.
+static constexpr size_t DEFAULT_CONNECTIONS         = 1000;
+static constexpr size_t DEFAULT_DURATION            = 30; // In seconds.
+static constexpr size_t DEFAULT_WARMUP              = 5;  // In seconds.
+static constexpr size_t DEFAULT_CONNECT_TIMEOUT     = 3000; // In ms.
+
+// Local ports used by the connections, from 'FIRST_PORT' to 65535.
+static constexpr mpipe_t::tcp_t::port_t FIRST_PORT = 1024;
+
+// Number of ports a worker tries to probe before giving up until one of its
+// connections is released.
+static constexpr size_t MAX_PORTS_SCAN              = 64;
+
+// Interval at which the workers check the state of the connections which are
+// probing a port, in ms.
+static constexpr size_t PROBE_INTERVAL              = 10;
+
+// Delay before a worker uses a port it learned from a stray SYN/ACK, in ms.
+//
+// Leaves the time to the probing worker to abandon its connection.
+static constexpr size_t LEARNED_PORT_DELAY          = 100;
+
+// Maximum number of requests of the open-loop mode which can wait for a
+// connection on each worker.
+static constexpr size_t MAX_BACKLOG                 = 1 << 20;
+
+// Parsed CLI arguments.
+struct args_t {
+    char                            *link_name;
+    net_t<mpipe_t::ipv4_t::addr_t>  ipv4_addr;
+    size_t                          n_workers;
+
+    net_t<mpipe_t::ipv4_t::addr_t>  server_addr;
+    mpipe_t::tcp_t::port_t          server_port;
+
+    // The server is resolved with a static ARP entry if 'has_server_ether'.
+    bool                            has_server_ether;
+    net_t<mpipe_t::ethernet_t::addr_t> server_ether;
+
+    // Maximum number of concurrent connections, shared between the workers.
+    size_t                          n_conns;
+
+    // Durations of the warm-up and of the measured run, in seconds.
+    size_t                          warmup;
+    size_t                          duration;
+
+    // Requests per second of the open-loop mode. Zero in the closed-loop mode.
+    double                          rate;
+
+    // Opens a new connection for each request if 'true'.
+    bool                            conn_per_request;
+
+    // Directory of the requested pages, or file with one path per line.
+    // 'nullptr' to request '/'.
+    const char                      *pages;
+
+    // Delay after which a connection which probes a port is given up, in ms.
+    size_t                          connect_timeout;
+
+    // Writes the report in JSON.
+    bool                            json;
+};
+
+// State of a client connection.
+struct client_conn_t;
+
+// State of a worker, only accessed by its thread once started.
+struct worker_t {
+    size_t                          id;
+
+    mpipe_t::tcp_t                  *tcp;
+    timer_manager_t                 *timers;
+
+    loadgen_stats_t                 *stats;
+
+    // Maximum and current number of opened connections.
+    size_t                          max_conns;
+    size_t                          n_conns;
+
+    // State of the xorshift generator which chooses the requested pages.
+    uint64_t                        rand_state;
+
+    // Next port to probe.
+    mpipe_t::tcp_t::port_t          next_port;
+
+    // Owned ports without any connection, least recently used first.
+    deque<mpipe_t::tcp_t::port_t>   free_ports;
+
+    // Ports learned from stray SYN/ACK segments, with the cycle count from
+    // which they can be used.
+    deque<pair<cycles_t, mpipe_t::tcp_t::port_t>>
+                                    learned_ports;
+
+    // Connections waiting for a request, and connections probing their port.
+    vector<client_conn_t *>         idle_conns;
+    vector<client_conn_t *>         probing_conns;
+
+    // Start times of the requests waiting for a connection.
+    deque<cycles_t>                 backlog;
+
+    // Open-loop mode: time at which the next request should be issued, and
+    // interval between two requests, in cycles.
+    double                          next_request;
+    double                          request_interval;
+};
+
+struct client_conn_t {
+    //
+    // Member types
+    //
+
+    enum state_t {
+        BUSY,           // Waits for the response to a request.
+        IDLE,           // Waits for a request to send.
+        CLOSING,        // Closed, waits for the end of the connection.
+        ABANDONED       // Closed while probing its port.
+    };
+
+    //
+    // Fields
+    //
+
+    worker_t                        *worker;
+    mpipe_t::tcp_t::conn_t          conn;
+    mpipe_t::tcp_t::port_t          port;
+
+    state_t                         state;
+
+    // 'true' if the connection is in 'worker_t::probing_conns'.
+    bool                            is_probing;
+
+    // 'true' once the three-way handshake has been completed.
+    bool                            is_established;
+
+    cycles_t                        connect_start;
+
+    // Cycle count from which the latency of the current request is measured.
+    cycles_t                        request_start;
+
+    http_response_parser_t          parser;
+};
+
+static args_t args;
+
+// Precomputed requests, one for each page.
+static vector<string> requests;
+
+static port_owners_t *port_owners;
+
+static loadgen_registry_t *stats;
+
+static void _print_usage(char **argv);
+
+// Parses CLI arguments.
+//
+// Fails on a malformed command.
+static bool _parse_args(int argc, char **argv, args_t *args);
+
+// Appends the paths of the regular files of the directory and of its
+// sub-directories, relative to 'root_dir', to 'paths'.
+static void _list_pages(
+    const string &root_dir, const string &rel_dir, vector<string> *paths
+);
+
+// Builds the request of each page of 'args.pages'.
+static void _init_requests(void);
+
+// Registers the worker and issues its first requests. Executed on the thread
+// of the worker.
+static void _start_worker(worker_t *worker);
+
+// Issues the requests of the open-loop mode which are due, and reschedules
+// itself at the time of the next one.
+static void _pace_requests(worker_t *worker);
+
+// Sends the requests of the backlog on idle connections, or on new connections
+// while the worker is below its maximum.
+static void _dispatch(worker_t *worker);
+
+// Opens a new connection which will send a request started at 'start'.
+//
+// Returns 'false' if no local port is available.
+static bool _open(worker_t *worker, cycles_t start);
+
+// Returns a port owned by the worker, or a new port to probe.
+//
+// Returns 'false' if no port is available.
+static bool _take_port(
+    worker_t *worker, mpipe_t::tcp_t::port_t *port, bool *is_probing
+);
+
+// Returns 'true' if a connection of the worker, possibly closing, uses the
+// local port.
+static inline bool _is_port_used(
+    worker_t *worker, mpipe_t::tcp_t::port_t port
+);
+
+// Sends a request for a random page on the connection.
+static void _send_request(client_conn_t *conn, cycles_t start);
+
+static mpipe_t::tcp_t::conn_handlers_t _conn_handlers(client_conn_t *conn);
+
+// Marks the connection as established, and its port as owned by its worker.
+static void _established(client_conn_t *conn);
+
+// Counts the received response and reuses or closes the connection.
+static void _response_received(client_conn_t *conn);
+
+// Counts a failed request. In the closed-loop mode, replaces it with a new
+// one.
+static void _request_failed(worker_t *worker);
+
+// Closes the connection. Its resources are released by the 'close()' or
+// 'reset()' handler.
+static void _close(client_conn_t *conn);
+
+// Releases the connection once it has been closed or reset.
+static void _release(client_conn_t *conn);
+
+// Removes the connection from the vector.
+static void _remove_conn(vector<client_conn_t *> *conns, client_conn_t *conn);
+
+// Abandons the probing connections whose port is owned by another worker or
+// which did not get established in time. Reschedules itself.
+static void _check_probes(worker_t *worker);
+
+// Learns the owner of a port from a SYN/ACK which doesn't belong to any
+// connection of the worker.
+static void _on_stray_syn_ack(
+    worker_t *worker, mpipe_t::tcp_t::tcb_id_t tcb_id
+);
+
+static mpipe_t::arp_ipv4_t::static_entry_t _server_arp_entry(void);
+
+static inline cycles_t _ms_to_cycles(size_t ms)
+{
+    return CYCLES_PER_SECOND / 1000 * ms;
+}
+
+int main(int argc, char **argv)
+{
+    if (!_parse_args(argc, argv, &args))
+        return EXIT_FAILURE;
+
+    _init_requests();
+
+    port_owners = new port_owners_t();
+    stats       = new loadgen_registry_t();
+
+    vector<mpipe_t::arp_ipv4_t::static_entry_t> static_arp_entries;
+    if (args.has_server_ether)
+        static_arp_entries.push_back(_server_arp_entry());
+
+    mpipe_t mpipe(
+        args.link_name, args.ipv4_addr, args.n_workers, 0, static_arp_entries
+    );
+
+    LOADGEN_DEBUG(
+        "Starts %zu workers on interface %s (%s) with %s as IPv4 address",
+        args.n_workers, args.link_name,
+        mpipe_t::ethernet_t::addr_t::to_alpha(mpipe.ether_addr),
+        mpipe_t::ipv4_t::addr_t::to_alpha(args.ipv4_addr)
+    );
+
+    //
+    // Starts each worker with a timer executed on its thread.
+    //
+
+    mpipe_t::tcp_t::port_t n_ports = port_owners_t::N_PORTS - FIRST_PORT;
+
+    for (size_t i = 0; i < mpipe.instances.size(); i++) {
+        mpipe_t::instance_t *instance = mpipe.instances[i];
+
+        worker_t *worker = new worker_t();
+
+        worker->id          = i;
+        worker->tcp         = &instance->ethernet.ipv4.tcp;
+        worker->timers      = &instance->timers;
+        worker->stats       = nullptr;
+
+        // Shares the connections between the workers.
+        worker->max_conns   =   args.n_conns / args.n_workers
+                              + (i < args.n_conns % args.n_workers);
+        worker->n_conns     = 0;
+
+        worker->rand_state  = 0x9E3779B97F4A7C15ULL * (i + 1);
+
+        // Workers start probing from different ports.
+        worker->next_port   = FIRST_PORT + n_ports / args.n_workers * i;
+
+        worker->tcp->stray_syn_ack =
+            [worker](mpipe_t::tcp_t::tcb_id_t tcb_id)
+            {
+                _on_stray_syn_ack(worker, tcb_id);
+            };
+
+        worker->timers->schedule(
+            cpu_clock_t::interval_t(0), [worker]() { _start_worker(worker); }
+        );
+    }
+
+    mpipe.run();
+
+    printf("LOADGEN started\n");
+
+    //
+    // Reports the counters of the run, without the warm-up.
+    //
+
+    loadgen_snapshot_t *begin   = new loadgen_snapshot_t(),
+                       *end     = new loadgen_snapshot_t();
+
+    sleep(args.warmup);
+    stats->snapshot(begin, get_cycle_count());
+
+    sleep(args.duration);
+    stats->snapshot(end, get_cycle_count());
+
+    end->subtract(begin);
+
+    string report;
+    if (args.json) {
+        end->write_json(&report);
+        report += '\n';
+    } else
+        end->write_text(&report);
+
+    fputs(report.c_str(), stdout);
+    fflush(stdout);
+
+    mpipe.stop();
+    mpipe.join();
+
+    return EXIT_SUCCESS;
+}
+
+static void _print_usage(char **argv)
+{
+    fprintf(
+        stderr,
+        "Usage: %s [-c <connections>] [-d <duration>] [-w <warm-up>] "
+        "[-R <rate>] [-C]\n"
+        "       [-p <pages>] [-T <connect timeout>] [-m <server ether>] "
+        "[-J]\n"
+        "       <link> <ipv4> <n workers> <server ipv4> <server port>\n"
+        "\n"
+        "-c <connections>    maximum number of concurrent connections "
+        "(default: %zu).\n"
+        "-d <duration>       measures the responses during this number of "
+        "seconds\n"
+        "                    (default: %zu).\n"
+        "-w <warm-up>        sends requests during this number of seconds "
+        "before the\n"
+        "                    measures (default: %zu).\n"
+        "-R <rate>           sends this number of requests per second, "
+        "whether or not\n"
+        "                    the previous ones have been answered (default: "
+        "a new request\n"
+        "                    is sent once the previous one has been "
+        "answered).\n"
+        "-C                  opens a new connection for each request "
+        "(default: keep-alive).\n"
+        "-p <pages>          requests the files of this directory with their "
+        "relative\n"
+        "                    path, or the paths listed in this file, one per "
+        "line,\n"
+        "                    uniformly (default: '/').\n"
+        "-T <connect timeout>\n"
+        "                    gives up connections which are not established "
+        "after this\n"
+        "                    number of ms (default: %zu).\n"
+        "-m <server ether>   Ethernet address of the server, instead of "
+        "resolving it with\n"
+        "                    ARP.\n"
+        "-J                  writes the report in JSON.\n",
+        argv[0], DEFAULT_CONNECTIONS, DEFAULT_DURATION, DEFAULT_WARMUP,
+        DEFAULT_CONNECT_TIMEOUT
+    );
+}
+
+static bool _parse_args(int argc, char **argv, args_t *args)
+{
+    args->n_conns = DEFAULT_CONNECTIONS;
+    args->duration = DEFAULT_DURATION;
+    args->warmup = DEFAULT_WARMUP;
+    args->rate = 0.0;
+    args->conn_per_request = false;
+    args->pages = nullptr;
+    args->connect_timeout = DEFAULT_CONNECT_TIMEOUT;
+    args->has_server_ether = false;
+    args->json = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:d:w:R:Cp:T:m:J")) != -1) {
+        switch (opt) {
+        case 'c':
+            args->n_conns = atol(optarg);
+            break;
+        case 'd':
+            args->duration = atol(optarg);
+            break;
+        case 'w':
+            args->warmup = atol(optarg);
+            break;
+        case 'R':
+            args->rate = atof(optarg);
+            break;
+        case 'C':
+            args->conn_per_request = true;
+            break;
+        case 'p':
+            args->pages = optarg;
+            break;
+        case 'T':
+            args->connect_timeout = atol(optarg);
+            break;
+        case 'm': {
+            struct ether_addr *ether_addr = ether_aton(optarg);
+            if (ether_addr == nullptr) {
+                fprintf(stderr, "Failed to parse the Ethernet address.\n");
+                _print_usage(argv);
+                return false;
+            }
+
+            args->has_server_ether = true;
+            args->server_ether =
+                mpipe_t::ethernet_t::addr_t::from_ether_addr(ether_addr);
+            break;
+        }
+        case 'J':
+            args->json = true;
+            break;
+        default:
+            _print_usage(argv);
+            return false;
+        }
+    }
+
+    // Positional arguments.
+    int n_args      = argc - optind;
+    char **arg      = argv + optind;
+
+    if (n_args != 5) {
+        _print_usage(argv);
+        return false;
+    }
+
+    args->link_name = arg[0];
+
+    struct in_addr in_addr;
+    if (inet_aton(arg[1], &in_addr) != 1) {
+        fprintf(stderr, "Failed to parse the IPv4.\n");
+        _print_usage(argv);
+        return false;
+    }
+    args->ipv4_addr = ipv4_addr_t::from_in_addr(in_addr);
+
+    args->n_workers = atoi(arg[2]);
+
+    if (inet_aton(arg[3], &in_addr) != 1) {
+        fprintf(stderr, "Failed to parse the IPv4 of the server.\n");
+        _print_usage(argv);
+        return false;
+    }
+    args->server_addr = ipv4_addr_t::from_in_addr(in_addr);
+
+    args->server_port = atoi(arg[4]);
+
+    if (
+           args->n_workers == 0
+        || args->n_workers > port_owners_t::MAX_WORKERS
+        || args->n_conns < args->n_workers
+    ) {
+        fprintf(
+            stderr, "Requires at least one connection per worker.\n"
+        );
+        _print_usage(argv);
+        return false;
+    }
+
+    return true;
+}
+
+static void _list_pages(
+    const string &root_dir, const string &rel_dir, vector<string> *paths
+)
+{
+    string dir_path = rel_dir.empty() ? root_dir : root_dir + '/' + rel_dir;
+
+    DIR *dir;
+    if (!(dir = opendir(dir_path.c_str())))
+        LOADGEN_DIE("Unable to open the directory (%s)", dir_path.c_str());
+
+    struct dirent *entry;
+
+    while ((entry = readdir(dir))) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+
+        string rel_path =   rel_dir.empty()
+                          ? string(entry->d_name)
+                          : rel_dir + '/' + entry->d_name;
+        string path     = root_dir + '/' + rel_path;
+
+        // Doesn't follow symbolic links to directories, which could create
+        // loops.
+        struct stat stat_buffer;
+        if (lstat(path.c_str(), &stat_buffer) != 0)
+            LOADGEN_DIE("Unable to get info on a file (%s)", path.c_str());
+
+        if (S_ISDIR(stat_buffer.st_mode))
+            _list_pages(root_dir, rel_path, paths);
+        else
+            paths->push_back('/' + rel_path);
+    }
+
+    closedir(dir);
+}
+
+static void _init_requests(void)
+{
+    vector<string> paths;
+
+    if (args.pages == nullptr)
+        paths.push_back("/");
+    else {
+        struct stat stat_buffer;
+        if (stat(args.pages, &stat_buffer) != 0)
+            LOADGEN_DIE("Unable to get info on the pages (%s)", args.pages);
+
+        if (S_ISDIR(stat_buffer.st_mode))
+            _list_pages(args.pages, "", &paths);
+        else {
+            FILE *file = fopen(args.pages, "r");
+            if (file == nullptr)
+                LOADGEN_DIE("Unable to open the pages (%s)", args.pages);
+
+            char line[4096];
+            while (fgets(line, sizeof (line), file) != nullptr) {
+                size_t len = strcspn(line, "\r\n");
+
+                if (len > 0)
+                    paths.push_back(string(line, len));
+            }
+
+            fclose(file);
+        }
+    }
+
+    if (paths.empty())
+        LOADGEN_DIE("No page to request (%s)", args.pages);
+
+    string host = mpipe_t::ipv4_t::addr_t::to_alpha(args.server_addr);
+
+    for (const string &path : paths) {
+        string request = "GET " + path + " HTTP/1.1\r\nHost: " + host + "\r\n";
+
+        if (args.conn_per_request)
+            request += "Connection: close\r\n";
+
+        request += "\r\n";
+
+        requests.push_back(request);
+    }
+
+    LOADGEN_DEBUG("%zu page(s) to request", requests.size());
+}
+
+static void _start_worker(worker_t *worker)
+{
+    worker->stats = stats->register_worker();
+
+    cycles_t now = get_cycle_count();
+
+    if (args.rate > 0.0) {
+        worker->request_interval =
+            CYCLES_PER_SECOND * (double) args.n_workers / args.rate;
+        worker->next_request = now;
+
+        _pace_requests(worker);
+    } else {
+        // Each connection starts with a request.
+        for (size_t i = 0; i < worker->max_conns; i++)
+            worker->backlog.push_back(now);
+
+        _dispatch(worker);
+    }
+
+    worker->timers->schedule(
+        cpu_clock_t::interval_t(PROBE_INTERVAL * 1000),
+        [worker]() { _check_probes(worker); }
+    );
+}
+
+static void _pace_requests(worker_t *worker)
+{
+    cycles_t now = get_cycle_count();
+
+    while (worker->next_request <= now) {
+        if (LIKELY(worker->backlog.size() < MAX_BACKLOG))
+            worker->backlog.push_back((cycles_t) worker->next_request);
+        else
+            worker_stats_t::add(&worker->stats->n_dropped);
+
+        worker->next_request += worker->request_interval;
+    }
+
+    _dispatch(worker);
+
+    uint64_t delay_us =
+        (uint64_t) ((worker->next_request - now) * 1000000.0
+                    / CYCLES_PER_SECOND);
+
+    worker->timers->schedule(
+        cpu_clock_t::interval_t(max(delay_us, (uint64_t) 1)),
+        [worker]() { _pace_requests(worker); }
+    );
+}
+
+static void _dispatch(worker_t *worker)
+{
+    while (!worker->backlog.empty()) {
+        cycles_t start = worker->backlog.front();
+
+        if (!worker->idle_conns.empty()) {
+            client_conn_t *conn = worker->idle_conns.back();
+            worker->idle_conns.pop_back();
+
+            _send_request(conn, start);
+        } else if (
+               worker->n_conns >= worker->max_conns
+            || !_open(worker, start)
+        )
+            return;
+
+        worker->backlog.pop_front();
+    }
+}
+
+static bool _open(worker_t *worker, cycles_t start)
+{
+    mpipe_t::tcp_t::port_t  port;
+    bool                    is_probing;
+
+    if (!_take_port(worker, &port, &is_probing))
+        return false;
+
+    client_conn_t *conn = new client_conn_t();
+
+    conn->worker            = worker;
+    conn->port              = port;
+    conn->is_probing        = is_probing;
+    conn->is_established    = false;
+    conn->connect_start     = get_cycle_count();
+
+    if (UNLIKELY(
+        !worker->tcp->connect(
+            args.ipv4_addr, port, args.server_addr, args.server_port,
+            _conn_handlers(conn), &conn->conn
+        )
+    )) {
+        // The port is still used by a closing connection.
+        if (is_probing)
+            port_owners->forget(port, worker->id);
+        else
+            worker->free_ports.push_back(port);
+
+        delete conn;
+        return false;
+    }
+
+    worker->n_conns++;
+
+    if (is_probing)
+        worker->probing_conns.push_back(conn);
+
+    // The request is sent once the connection is established.
+    _send_request(conn, start);
+
+    return true;
+}
+
+static bool _take_port(
+    worker_t *worker, mpipe_t::tcp_t::port_t *port, bool *is_probing
+)
+{
+    *is_probing = false;
+
+    // The connections closed by the client leave their port in TIME-WAIT for
+    // a while. These ports are skipped.
+    for (size_t i = worker->free_ports.size(); i > 0; i--) {
+        mpipe_t::tcp_t::port_t candidate = worker->free_ports.front();
+        worker->free_ports.pop_front();
+
+        if (!_is_port_used(worker, candidate)) {
+            *port = candidate;
+            return true;
+        }
+
+        worker->free_ports.push_back(candidate);
+    }
+
+    if (
+           !worker->learned_ports.empty()
+        && worker->learned_ports.front().first <= get_cycle_count()
+    ) {
+        *port = worker->learned_ports.front().second;
+        worker->learned_ports.pop_front();
+        return true;
+    }
+
+    *is_probing = true;
+
+    for (size_t i = 0; i < MAX_PORTS_SCAN; i++) {
+        mpipe_t::tcp_t::port_t candidate = worker->next_port;
+
+        worker->next_port =   candidate == port_owners_t::N_PORTS - 1
+                            ? FIRST_PORT
+                            : candidate + 1;
+
+        if (port_owners->probe(candidate, worker->id)) {
+            *port = candidate;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static inline bool _is_port_used(
+    worker_t *worker, mpipe_t::tcp_t::port_t port
+)
+{
+    mpipe_t::tcp_t::tcb_id_t tcb_id = {
+        args.server_addr, args.server_port, args.ipv4_addr, port
+    };
+
+    return worker->tcp->tcbs.count(tcb_id) > 0;
+}
+
+static void _send_request(client_conn_t *conn, cycles_t start)
+{
+    worker_t *worker = conn->worker;
+
+    // xorshift64.
+    worker->rand_state ^= worker->rand_state << 13;
+    worker->rand_state ^= worker->rand_state >> 7;
+    worker->rand_state ^= worker->rand_state << 17;
+
+    const string *request = &requests[worker->rand_state % requests.size()];
+
+    conn->state         = client_conn_t::BUSY;
+    conn->request_start = start;
+    conn->parser.reset();
+
+    conn->conn.send(
+        request->size(),
+        [request](size_t offset, mpipe_t::tcp_t::cursor_t out)
+        {
+            out.write(request->data() + offset, out.size());
+        },
+        []() { }
+    );
+
+    worker_stats_t::add(&worker->stats->n_requests);
+}
+
+static mpipe_t::tcp_t::conn_handlers_t _conn_handlers(client_conn_t *conn)
+{
+    mpipe_t::tcp_t::conn_handlers_t handlers;
+
+    handlers.new_data =
+        [conn](mpipe_t::tcp_t::cursor_t in)
+        {
+            if (!conn->is_established)
+                _established(conn);
+
+            if (UNLIKELY(conn->state != client_conn_t::BUSY)) {
+                // Data received without any request.
+                if (conn->state == client_conn_t::IDLE) {
+                    _remove_conn(&conn->worker->idle_conns, conn);
+                    worker_stats_t::add(&conn->worker->stats->n_errors);
+                    _close(conn);
+                }
+                return;
+            }
+
+            http_response_parser_t::status_t status =
+                http_response_parser_t::INCOMPLETE;
+
+            in.for_each(
+                [conn, &status](const char *data, size_t size)
+                {
+                    status = conn->parser.feed(data, size);
+                }
+            );
+
+            if (status == http_response_parser_t::COMPLETE)
+                _response_received(conn);
+            else if (UNLIKELY(status == http_response_parser_t::INVALID)) {
+                worker_t *worker = conn->worker;
+
+                LOADGEN_DEBUG("Invalid response");
+                _request_failed(worker);
+
+                // Can release the connection.
+                _close(conn);
+                _dispatch(worker);
+            }
+        };
+
+    handlers.remote_close =
+        [conn]()
+        {
+            worker_t *worker = conn->worker;
+
+            if (conn->state == client_conn_t::BUSY) {
+                // The response can be delimited by the end of the connection.
+                if (
+                       conn->parser.end_of_stream()
+                    == http_response_parser_t::COMPLETE
+                ) {
+                    _response_received(conn);
+                    return;
+                }
+
+                _request_failed(worker);
+            } else if (conn->state == client_conn_t::IDLE)
+                _remove_conn(&worker->idle_conns, conn);
+            else
+                return;
+
+            // Releases the connection, as both ends are now closed.
+            _close(conn);
+            _dispatch(worker);
+        };
+
+    handlers.close =
+        [conn]()
+        {
+            _release(conn);
+        };
+
+    handlers.reset =
+        [conn]()
+        {
+            worker_t *worker = conn->worker;
+
+            if (!conn->is_established)
+                worker_stats_t::add(&worker->stats->n_connect_errors);
+
+            if (conn->state == client_conn_t::BUSY)
+                _request_failed(worker);
+            else if (conn->state == client_conn_t::IDLE)
+                _remove_conn(&worker->idle_conns, conn);
+
+            _release(conn);
+        };
+
+    return handlers;
+}
+
+static void _established(client_conn_t *conn)
+{
+    worker_t *worker = conn->worker;
+
+    conn->is_established = true;
+    worker_stats_t::add(&worker->stats->n_connects);
+
+    if (conn->is_probing) {
+        port_owners->own(conn->port, worker->id);
+
+        _remove_conn(&worker->probing_conns, conn);
+        conn->is_probing = false;
+    }
+}
+
+static void _response_received(client_conn_t *conn)
+{
+    worker_t *worker = conn->worker;
+
+    cycles_t now = get_cycle_count();
+
+    worker->stats->count_response(
+        conn->parser.status, conn->parser.size, now - conn->request_start
+    );
+
+    // The closed-loop mode immediately replaces the request.
+    if (args.rate == 0.0)
+        worker->backlog.push_back(now);
+
+    if (args.conn_per_request || !conn->parser.keep_alive)
+        _close(conn);
+    else {
+        conn->state = client_conn_t::IDLE;
+        worker->idle_conns.push_back(conn);
+    }
+
+    _dispatch(worker);
+}
+
+static void _request_failed(worker_t *worker)
+{
+    worker_stats_t::add(&worker->stats->n_errors);
+
+    if (args.rate == 0.0)
+        worker->backlog.push_back(get_cycle_count());
+}
+
+static void _close(client_conn_t *conn)
+{
+    conn->state = client_conn_t::CLOSING;
+    conn->conn.close();
+}
+
+static void _release(client_conn_t *conn)
+{
+    worker_t                *worker     = conn->worker;
+    mpipe_t::tcp_t::port_t  port        = conn->port;
+
+    // The port of an abandoned connection is owned by another worker, or is
+    // unknown.
+    bool                    is_owned    =
+        conn->state != client_conn_t::ABANDONED;
+
+    if (conn->is_probing) {
+        _remove_conn(&worker->probing_conns, conn);
+
+        // The segments of the probing connection have been received by its
+        // worker.
+        port_owners->own(port, worker->id);
+    }
+
+    worker->n_conns--;
+
+    delete conn;
+
+    // The TCB of the connection is only removed once the handler returns.
+    // '_take_port()' skips the port until then.
+    if (is_owned)
+        worker->free_ports.push_back(port);
+
+    _dispatch(worker);
+}
+
+static void _remove_conn(vector<client_conn_t *> *conns, client_conn_t *conn)
+{
+    auto it = find(conns->begin(), conns->end(), conn);
+    assert(it != conns->end());
+
+    // Order doesn't matter.
+    *it = conns->back();
+    conns->pop_back();
+}
+
+static void _check_probes(worker_t *worker)
+{
+    cycles_t now        = get_cycle_count();
+    cycles_t timeout    = _ms_to_cycles(args.connect_timeout);
+
+    vector<client_conn_t *> abandoned;
+
+    for (size_t i = 0; i < worker->probing_conns.size();) {
+        client_conn_t *conn = worker->probing_conns[i];
+
+        if (conn->conn.is_established()) {
+            // Removes the connection from 'probing_conns'.
+            _established(conn);
+            continue;
+        }
+
+        size_t owner;
+        port_owners_t::state_t state = port_owners->state(conn->port, &owner);
+
+        if (state == port_owners_t::OWNED && owner != worker->id) {
+            worker_stats_t::add(&worker->stats->n_misrouted);
+
+            // The request is sent on another connection.
+            worker->backlog.push_front(conn->request_start);
+        } else if (now - conn->connect_start > timeout) {
+            worker_stats_t::add(&worker->stats->n_connect_errors);
+            _request_failed(worker);
+
+            port_owners->forget(conn->port, worker->id);
+        } else {
+            i++;
+            continue;
+        }
+
+        conn->state = client_conn_t::ABANDONED;
+        abandoned.push_back(conn);
+
+        worker->probing_conns[i] = worker->probing_conns.back();
+        worker->probing_conns.pop_back();
+        conn->is_probing = false;
+    }
+
+    // Closing a connection in the SYN-SENT state immediately releases it.
+    for (client_conn_t *conn : abandoned)
+        conn->conn.close();
+
+    _dispatch(worker);
+
+    worker->timers->schedule(
+        cpu_clock_t::interval_t(PROBE_INTERVAL * 1000),
+        [worker]() { _check_probes(worker); }
+    );
+}
+
+static void _on_stray_syn_ack(
+    worker_t *worker, mpipe_t::tcp_t::tcb_id_t tcb_id
+)
+{
+    if (
+           tcb_id.raddr != args.server_addr
+        || tcb_id.rport != args.server_port
+    )
+        return;
+
+    mpipe_t::tcp_t::port_t port = tcb_id.lport.host();
+
+    if (port < FIRST_PORT || !port_owners->learn(port, worker->id))
+        return;
+
+    LOADGEN_DEBUG("Port %u learned by worker %zu", port, worker->id);
+
+    worker->learned_ports.emplace_back(
+        get_cycle_count() + _ms_to_cycles(LEARNED_PORT_DELAY), port
+    );
+}
+
+static mpipe_t::arp_ipv4_t::static_entry_t _server_arp_entry(void)
+{
+    return (mpipe_t::arp_ipv4_t::static_entry_t) {
+        args.server_addr, args.server_ether
+    };
+}
@@ -0,0 +1,440 @@
+//
+// Counters and latency histograms of the load generator workers.
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Counters are updated like the ones of 'worker_stats_t': each worker only
+// writes its own counters, with relaxed loads and stores. The main thread
+// takes a snapshot of the sums at the end of the warm-up and another one at the
+// end of the run, and reports their difference.
+//
+
+#ifndef __RUSTY_APP_LOADGEN_STATS_HPP__
+#define __RUSTY_APP_LOADGEN_STATS_HPP__
+
+#include <algorithm>            // max(), min()
+#include <atomic>
+#include <cinttypes>            // PRIu64
+#include <cstdint>
+#include <cstring>              // memset()
+#include <string>
+
+#include "app/worker_stats.hpp" // _append(), worker_stats_t
+#include "driver/cpu.hpp"       // CYCLES_PER_SECOND, cycles_t
+#include "util/macros.hpp"      // LIKELY(), RUSTY_*
+
+using namespace std;
+
+using namespace rusty::driver::cpu;
+
+namespace rusty {
+namespace app {
+
+#define LOADGEN_STATS_COLOR     COLOR_YEL
+#define LOADGEN_STATS_DIE(MSG, ...)                                            \
+    RUSTY_DIE("LOADGEN STATS", LOADGEN_STATS_COLOR, MSG, ##__VA_ARGS__)
+
+// Counters of a single load generator worker.
+struct loadgen_stats_t {
+    //
+    // Static fields
+    //
+
+    // Latencies are counted in buckets which split each power of two in
+    // 'SUB_BUCKETS' intervals, as in 'worker_stats_t', but with a finer
+    // resolution: a percentile is never more than about 3% above the actual
+    // value.
+    static constexpr size_t SUB_BUCKETS_LOG2    = 5;
+    static constexpr size_t SUB_BUCKETS         = 1 << SUB_BUCKETS_LOG2;
+    static constexpr size_t N_BUCKETS           =
+        (64 - SUB_BUCKETS_LOG2 + 1) * SUB_BUCKETS;
+
+    //
+    // Fields
+    //
+
+    // Established connections.
+    atomic<uint64_t>    n_connects;
+
+    // Connections which were refused, or which didn't get established before
+    // the connect timeout.
+    atomic<uint64_t>    n_connect_errors;
+
+    // Connections abandoned because the answer to their SYN was steered to
+    // another worker.
+    atomic<uint64_t>    n_misrouted;
+
+    // Sent requests. The requests of the connections abandoned because of a
+    // misrouted SYN/ACK are sent again, and counted twice.
+    atomic<uint64_t>    n_requests;
+
+    // Responses by status class, from '1xx' (index 0) to '5xx' (index 4).
+    atomic<uint64_t>    n_responses[5];
+
+    // Malformed responses, and requests whose connection has been reset or
+    // closed before the end of the response.
+    atomic<uint64_t>    n_errors;
+
+    // Requests of the open-loop mode which have been dropped because too many
+    // of them were waiting for a connection.
+    atomic<uint64_t>    n_dropped;
+
+    // Bytes of the received responses, headers included.
+    atomic<uint64_t>    n_bytes;
+
+    // Sum of the latencies of the responses, in cycles.
+    atomic<uint64_t>    latency_sum;
+
+    // Number of responses by latency, in cycles. See 'bucket()'.
+    atomic<uint64_t>    latencies[N_BUCKETS];
+
+    //
+    // Methods
+    //
+
+    loadgen_stats_t(void);
+
+    // Counts a received response.
+    inline void count_response(
+        unsigned int status, uint64_t bytes, cycles_t latency
+    );
+
+    // Returns the bucket of a latency.
+    static inline size_t bucket(uint64_t cycles);
+
+    // Returns the exclusive upper bound of the bucket.
+    static inline uint64_t bucket_end(size_t bucket);
+};
+
+// Sums of the counters of every worker at a given time.
+struct loadgen_snapshot_t {
+    // Cycle count when the snapshot has been taken, or duration once a
+    // previous snapshot has been subtracted.
+    cycles_t    taken;
+
+    uint64_t    n_connects;
+    uint64_t    n_connect_errors;
+    uint64_t    n_misrouted;
+    uint64_t    n_requests;
+    uint64_t    n_responses[5];
+    uint64_t    n_errors;
+    uint64_t    n_dropped;
+    uint64_t    n_bytes;
+    uint64_t    latency_sum;
+    uint64_t    latencies[loadgen_stats_t::N_BUCKETS];
+
+    // Subtracts the counters of a previous snapshot, so the snapshot only
+    // counts the events which happened in between.
+    void subtract(const loadgen_snapshot_t *previous);
+
+    // Returns the upper bound of the bucket which contains the given
+    // percentile of the latencies, in microseconds.
+    double latency_percentile(double percentile) const;
+
+    // Appends a human readable report of the counters to 'text'.
+    void write_text(string *text) const;
+
+    // Appends the JSON object of the counters to 'json'.
+    void write_json(string *json) const;
+};
+
+// Counters of all the workers. Workers register once, as in
+// 'stats_registry_t'.
+struct loadgen_registry_t {
+    //
+    // Static fields
+    //
+
+    static constexpr size_t MAX_WORKERS         = 256;
+
+    //
+    // Fields
+    //
+
+    atomic<size_t>              n_workers;
+    atomic<loadgen_stats_t *>   workers[MAX_WORKERS];
+
+    //
+    // Methods
+    //
+
+    loadgen_registry_t(void);
+
+    // Allocates and returns the counters of the calling worker. Must be called
+    // once by each worker.
+    loadgen_stats_t *register_worker(void);
+
+    // Sums the counters of every registered worker. 'now' is the current
+    // cycle count.
+    void snapshot(loadgen_snapshot_t *snapshot, cycles_t now) const;
+};
+
+// Percentiles of the latencies given in the reports.
+static constexpr double LOADGEN_PERCENTILES[] = {
+    50.0, 90.0, 99.0, 99.9, 99.99
+};
+
+inline loadgen_stats_t::loadgen_stats_t(void)
+    : n_connects(0), n_connect_errors(0), n_misrouted(0), n_requests(0),
+      n_errors(0), n_dropped(0), n_bytes(0), latency_sum(0)
+{
+    for (atomic<uint64_t> &n : this->n_responses)
+        n = 0;
+
+    for (atomic<uint64_t> &n : this->latencies)
+        n = 0;
+}
+
+inline void loadgen_stats_t::count_response(
+    unsigned int status, uint64_t bytes, cycles_t latency
+)
+{
+    if (LIKELY(status >= 100 && status < 600))
+        worker_stats_t::add(&this->n_responses[status / 100 - 1]);
+
+    worker_stats_t::add(&this->n_bytes, bytes);
+    worker_stats_t::add(&this->latency_sum, latency);
+    worker_stats_t::add(&this->latencies[bucket(latency)]);
+}
+
+inline size_t loadgen_stats_t::bucket(uint64_t cycles)
+{
+    if (cycles < SUB_BUCKETS)
+        return cycles;
+
+    size_t msb = 63 - __builtin_clzll(cycles);
+    size_t sub = (cycles >> (msb - SUB_BUCKETS_LOG2)) & (SUB_BUCKETS - 1);
+
+    return (msb - SUB_BUCKETS_LOG2 + 1) * SUB_BUCKETS + sub;
+}
+
+inline uint64_t loadgen_stats_t::bucket_end(size_t bucket)
+{
+    bucket++;
+
+    if (bucket < SUB_BUCKETS)
+        return bucket;
+
+    if (bucket >= N_BUCKETS)
+        return UINT64_MAX;
+
+    size_t msb = bucket / SUB_BUCKETS + SUB_BUCKETS_LOG2 - 1;
+    size_t sub = bucket % SUB_BUCKETS;
+
+    return (SUB_BUCKETS + sub) << (msb - SUB_BUCKETS_LOG2);
+}
+
+inline void loadgen_snapshot_t::subtract(const loadgen_snapshot_t *previous)
+{
+    this->taken             -= previous->taken;
+    this->n_connects        -= previous->n_connects;
+    this->n_connect_errors  -= previous->n_connect_errors;
+    this->n_misrouted       -= previous->n_misrouted;
+    this->n_requests        -= previous->n_requests;
+    this->n_errors          -= previous->n_errors;
+    this->n_dropped         -= previous->n_dropped;
+    this->n_bytes           -= previous->n_bytes;
+    this->latency_sum       -= previous->latency_sum;
+
+    for (size_t i = 0; i < 5; i++)
+        this->n_responses[i] -= previous->n_responses[i];
+
+    for (size_t i = 0; i < loadgen_stats_t::N_BUCKETS; i++)
+        this->latencies[i] -= previous->latencies[i];
+}
+
+inline double loadgen_snapshot_t::latency_percentile(double percentile) const
+{
+    uint64_t n_samples = 0;
+    for (uint64_t n : this->latencies)
+        n_samples += n;
+
+    if (n_samples == 0)
+        return 0.0;
+
+    // The highest sample is returned for the 100th percentile.
+    uint64_t rank = min(
+        (uint64_t) (n_samples * percentile / 100.0), n_samples - 1
+    );
+
+    size_t      bucket      = 0;
+    uint64_t    cumulated   = 0;
+
+    while (
+           bucket < loadgen_stats_t::N_BUCKETS - 1
+        && cumulated + this->latencies[bucket] <= rank
+    )
+        cumulated += this->latencies[bucket++];
+
+    return loadgen_stats_t::bucket_end(bucket) * 1000000.0 / CYCLES_PER_SECOND;
+}
+
+inline void loadgen_snapshot_t::write_text(string *text) const
+{
+    double secs = (double) this->taken / CYCLES_PER_SECOND;
+
+    uint64_t n_responses = 0;
+    for (uint64_t n : this->n_responses)
+        n_responses += n;
+
+    double mean_us =   n_responses == 0
+                     ? 0.0
+                     :   this->latency_sum * 1000000.0
+                       / (CYCLES_PER_SECOND * (double) n_responses);
+
+    _append(
+        text,
+        "%" PRIu64 " responses in %.2f s: %.1f req/s, %.2f Mb/s\n"
+        "  1xx: %" PRIu64 ", 2xx: %" PRIu64 ", 3xx: %" PRIu64 ", "
+        "4xx: %" PRIu64 ", 5xx: %" PRIu64 "\n",
+        n_responses, secs, n_responses / secs,
+        this->n_bytes * 8 / secs / 1000000.0, this->n_responses[0],
+        this->n_responses[1], this->n_responses[2], this->n_responses[3],
+        this->n_responses[4]
+    );
+
+    _append(
+        text,
+        "  requests: %" PRIu64 ", errors: %" PRIu64 ", dropped: %" PRIu64 "\n"
+        "  connects: %" PRIu64 ", connect errors: %" PRIu64 ", "
+        "misrouted: %" PRIu64 "\n",
+        this->n_requests, this->n_errors, this->n_dropped, this->n_connects,
+        this->n_connect_errors, this->n_misrouted
+    );
+
+    _append(text, "Latency (us): mean %.1f", mean_us);
+
+    for (double percentile : LOADGEN_PERCENTILES) {
+        _append(
+            text, ", p%g %.1f", percentile,
+            this->latency_percentile(percentile)
+        );
+    }
+
+    _append(text, ", max %.1f\n", this->latency_percentile(100.0));
+}
+
+inline void loadgen_snapshot_t::write_json(string *json) const
+{
+    double secs = (double) this->taken / CYCLES_PER_SECOND;
+
+    uint64_t n_responses = 0;
+    for (uint64_t n : this->n_responses)
+        n_responses += n;
+
+    double mean_us =   n_responses == 0
+                     ? 0.0
+                     :   this->latency_sum * 1000000.0
+                       / (CYCLES_PER_SECOND * (double) n_responses);
+
+    _append(
+        json,
+        "{ \"duration_s\": %.3f, \"requests\": %" PRIu64 ", "
+        "\"req_per_s\": %.1f, \"bytes\": %" PRIu64 ", "
+        "\"errors\": %" PRIu64 ", \"dropped\": %" PRIu64 ", ",
+        secs, this->n_requests, n_responses / secs, this->n_bytes,
+        this->n_errors, this->n_dropped
+    );
+
+    _append(
+        json,
+        "\"connects\": %" PRIu64 ", \"connect_errors\": %" PRIu64 ", "
+        "\"misrouted\": %" PRIu64 ", "
+        "\"responses\": { \"1xx\": %" PRIu64 ", \"2xx\": %" PRIu64 ", "
+        "\"3xx\": %" PRIu64 ", \"4xx\": %" PRIu64 ", \"5xx\": %" PRIu64 " }, ",
+        this->n_connects, this->n_connect_errors, this->n_misrouted,
+        this->n_responses[0], this->n_responses[1], this->n_responses[2],
+        this->n_responses[3], this->n_responses[4]
+    );
+
+    _append(json, "\"latency_us\": { \"mean\": %.1f", mean_us);
+
+    for (double percentile : LOADGEN_PERCENTILES) {
+        _append(
+            json, ", \"p%g\": %.1f", percentile,
+            this->latency_percentile(percentile)
+        );
+    }
+
+    _append(json, ", \"max\": %.1f } }", this->latency_percentile(100.0));
+}
+
+inline loadgen_registry_t::loadgen_registry_t(void) : n_workers(0)
+{
+    for (atomic<loadgen_stats_t *> &worker : this->workers)
+        worker = nullptr;
+}
+
+inline loadgen_stats_t *loadgen_registry_t::register_worker(void)
+{
+    size_t i = this->n_workers.fetch_add(1, memory_order_relaxed);
+
+    if (i >= MAX_WORKERS)
+        LOADGEN_STATS_DIE("Too many workers (%zu)", i + 1);
+
+    loadgen_stats_t *stats = new loadgen_stats_t();
+    this->workers[i].store(stats, memory_order_release);
+
+    return stats;
+}
+
+inline void loadgen_registry_t::snapshot(
+    loadgen_snapshot_t *snapshot, cycles_t now
+) const
+{
+    #define LOAD(COUNTER) ((COUNTER).load(memory_order_relaxed))
+
+    memset(snapshot, 0, sizeof (loadgen_snapshot_t));
+
+    snapshot->taken = now;
+
+    size_t n_workers = min(
+        this->n_workers.load(memory_order_relaxed), (size_t) MAX_WORKERS
+    );
+
+    for (size_t i = 0; i < n_workers; i++) {
+        const loadgen_stats_t *worker =
+            this->workers[i].load(memory_order_acquire);
+
+        if (worker == nullptr)
+            continue;
+
+        snapshot->n_connects        += LOAD(worker->n_connects);
+        snapshot->n_connect_errors  += LOAD(worker->n_connect_errors);
+        snapshot->n_misrouted       += LOAD(worker->n_misrouted);
+        snapshot->n_requests        += LOAD(worker->n_requests);
+        snapshot->n_errors          += LOAD(worker->n_errors);
+        snapshot->n_dropped         += LOAD(worker->n_dropped);
+        snapshot->n_bytes           += LOAD(worker->n_bytes);
+        snapshot->latency_sum       += LOAD(worker->latency_sum);
+
+        for (size_t j = 0; j < 5; j++)
+            snapshot->n_responses[j] += LOAD(worker->n_responses[j]);
+
+        for (size_t j = 0; j < loadgen_stats_t::N_BUCKETS; j++)
+            snapshot->latencies[j] += LOAD(worker->latencies[j]);
+    }
+
+    #undef LOAD
+}
+
+#undef LOADGEN_STATS_COLOR
+#undef LOADGEN_STATS_DIE
+
+} } /* namespace rusty::app */
+
+#endif /* __RUSTY_APP_LOADGEN_STATS_HPP__ */
@@ -0,0 +1,161 @@
+//
+// Workers which receive the segments of the local TCP ports of a client.
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// mPIPE distributes the received packets to the workers with a hash of their
+// flow, which can't be computed in software. A worker which opens a connection
+// only gets its SYN/ACK if the flow of the connection hashes to the worker.
+//
+// When a client connects to a single server address and port, the flow only
+// depends on the local port. The table learns the owner of each local port:
+//
+//  - a worker probes an unknown port by opening a connection with it;
+//  - if the connection gets established, the port is owned by the worker;
+//  - if the SYN/ACK is received by another worker as a stray segment (see
+//    'tcp_t::stray_syn_ack'), the port is owned by this other worker. The
+//    probing worker notices it and abandons its connection.
+//
+// Once owned, a port is only used by its owner.
+//
+
+#ifndef __RUSTY_APP_PORT_OWNERS_HPP__
+#define __RUSTY_APP_PORT_OWNERS_HPP__
+
+#include <atomic>
+#include <cstdint>
+
+using namespace std;
+
+namespace rusty {
+namespace app {
+
+struct port_owners_t {
+    //
+    // Member types
+    //
+
+    enum state_t {
+        UNKNOWN,
+        PROBING,    // A connection of 'worker' is waiting for its SYN/ACK.
+        OWNED       // The segments of the port are received by 'worker'.
+    };
+
+    //
+    // Static fields
+    //
+
+    static constexpr size_t     N_PORTS         = 65536;
+
+    // Maximum number of workers which can be stored in an entry.
+    static constexpr size_t     MAX_WORKERS     = 1 << 14;
+
+    //
+    // Fields
+    //
+
+    // Entries are 16 bits wide: the state in the two highest bits, the
+    // worker in the others.
+    atomic<uint16_t>            entries[N_PORTS];
+
+    //
+    // Methods
+    //
+
+    inline port_owners_t(void)
+    {
+        for (atomic<uint16_t> &entry : this->entries)
+            entry.store(_entry(UNKNOWN, 0), memory_order_relaxed);
+    }
+
+    // Starts probing the port with the worker.
+    //
+    // Returns 'false' if the port is not 'UNKNOWN'.
+    inline bool probe(uint16_t port, size_t worker)
+    {
+        uint16_t unknown = _entry(UNKNOWN, 0);
+
+        return this->entries[port].compare_exchange_strong(
+            unknown, _entry(PROBING, worker), memory_order_relaxed
+        );
+    }
+
+    // The connection which probed the port got established.
+    inline void own(uint16_t port, size_t worker)
+    {
+        this->entries[port].store(
+            _entry(OWNED, worker), memory_order_relaxed
+        );
+    }
+
+    // The SYN/ACK of a probing connection has been received by the worker.
+    //
+    // Returns 'false' if the port was already owned, by this worker or by
+    // another one.
+    inline bool learn(uint16_t port, size_t worker)
+    {
+        uint16_t entry = this->entries[port].load(memory_order_relaxed);
+
+        do {
+            if (_state(entry) == OWNED)
+                return false;
+        } while (
+            !this->entries[port].compare_exchange_weak(
+                entry, _entry(OWNED, worker), memory_order_relaxed
+            )
+        );
+
+        return true;
+    }
+
+    // The probe of the port failed without any worker getting its SYN/ACK.
+    //
+    // Leaves the entry untouched if the port has been learned in the meantime.
+    inline void forget(uint16_t port, size_t worker)
+    {
+        uint16_t probing = _entry(PROBING, worker);
+
+        this->entries[port].compare_exchange_strong(
+            probing, _entry(UNKNOWN, 0), memory_order_relaxed
+        );
+    }
+
+    // Returns the state of the port, and sets 'worker' to the worker of a
+    // 'PROBING' or 'OWNED' port.
+    inline state_t state(uint16_t port, size_t *worker) const
+    {
+        uint16_t entry = this->entries[port].load(memory_order_relaxed);
+
+        *worker = entry & (MAX_WORKERS - 1);
+        return _state(entry);
+    }
+
+private:
+    static inline uint16_t _entry(state_t state, size_t worker)
+    {
+        return (uint16_t) ((state << 14) | worker);
+    }
+
+    static inline state_t _state(uint16_t entry)
+    {
+        return (state_t) (entry >> 14);
+    }
+};
+
+} } /* namespace rusty::app */
+
+#endif /* __RUSTY_APP_PORT_OWNERS_HPP__ */
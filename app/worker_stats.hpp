@@ -0,0 +1,471 @@
+//
+// Counters of the workers, readable by any thread without locks.
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Each worker only writes its own counters, which stay in its cache. Counters
+// are updated with plain relaxed loads and stores, without any atomic
+// read-modify-write instruction. Readers load every counter independently, so
+// a snapshot is not consistent across counters, but is never more than a few
+// requests off.
+//
+// The hardware events of each worker (instructions, cache misses, ...) are
+// optionally counted by the kernel. Each worker reads its own counters at a low
+// fixed rate and copies them next to its other counters, so readers never
+// issue any system call on behalf of the workers.
+//
+
+#ifndef __RUSTY_APP_WORKER_STATS_HPP__
+#define __RUSTY_APP_WORKER_STATS_HPP__
+
+#include <algorithm>            // min()
+#include <atomic>
+#include <cassert>
+#include <cinttypes>            // PRIu64
+#include <cstdarg>              // va_list, va_start(), va_end()
+#include <cstdint>
+#include <cstdio>               // vsnprintf()
+#include <string>
+
+#include "driver/cpu.hpp"       // CYCLES_PER_SECOND, cycles_t
+#include "driver/perf_counters.hpp" // perf_counters_t
+#include "util/macros.hpp"      // LIKELY(), UNLIKELY(), RUSTY_*
+
+using namespace std;
+
+using namespace rusty::driver;
+using namespace rusty::driver::cpu;
+
+namespace rusty {
+namespace app {
+
+#define STATS_COLOR     COLOR_YEL
+#define STATS_DIE(MSG, ...)                                                    \
+    RUSTY_DIE("STATS", STATS_COLOR, MSG, ##__VA_ARGS__)
+
+// Counters of a single worker.
+struct worker_stats_t {
+    //
+    // Static fields
+    //
+
+    // Service times are counted in buckets which split each power of two in
+    // 'SUB_BUCKETS' intervals of the same size, so a percentile is never more
+    // than 25% above the actual value.
+    static constexpr size_t SUB_BUCKETS_LOG2    = 2;
+    static constexpr size_t SUB_BUCKETS         = 1 << SUB_BUCKETS_LOG2;
+    static constexpr size_t N_BUCKETS           =
+        (64 - SUB_BUCKETS_LOG2 + 1) * SUB_BUCKETS;
+
+    //
+    // Fields
+    //
+
+    atomic<uint64_t>    n_accepted;     // Accepted connections.
+    atomic<uint64_t>    n_closed;       // Closed or reset connections.
+
+    atomic<uint64_t>    n_requests;
+
+    // Responses by status class, from '1xx' (index 0) to '5xx' (index 4).
+    atomic<uint64_t>    n_responses[5];
+
+    // Bytes of the queued responses, headers included.
+    atomic<uint64_t>    n_bytes;
+
+    // Number of responses by service time, in cycles. See 'bucket()'.
+    atomic<uint64_t>    service_times[N_BUCKETS];
+
+    // Hardware events of the worker's thread. 'nullptr' if they are not
+    // counted. Some events can be unavailable if the kernel or the CPU doesn't
+    // allow counting them.
+    perf_counters_t     *perf;
+
+    // Last reading of 'perf', copied by the worker with 'snapshot_perf()'.
+    // Like the other counters, each field is loaded independently.
+    struct {
+        atomic<bool>        is_counted;
+        atomic<uint64_t>    value;
+        atomic<uint64_t>    time_enabled;
+        atomic<uint64_t>    time_running;
+    } perf_snapshot[perf_counters_t::N_EVENTS];
+
+    //
+    // Methods
+    //
+
+    // Starts counting the hardware events of the calling thread if
+    // 'count_perf' is set.
+    worker_stats_t(bool count_perf);
+
+    // Increments the counter. Must only be called by the worker which owns
+    // the counters.
+    static inline void add(atomic<uint64_t> *counter, uint64_t n = 1);
+
+    // Counts a queued response.
+    inline void count_response(
+        unsigned int status, uint64_t bytes, cycles_t service_cycles
+    );
+
+    // Reads the hardware events and copies them to 'perf_snapshot'. Must only
+    // be called by the worker which owns the counters, if they are counted.
+    inline void snapshot_perf(void);
+
+    // Returns the last snapshot of the hardware events. No event is counted if
+    // no snapshot has been taken.
+    inline perf_counters_t::values_t perf_values(void) const;
+
+    // Returns the bucket of a service time.
+    static inline size_t bucket(uint64_t cycles);
+
+    // Returns the smallest service time of the bucket following 'bucket',
+    // i.e. the exclusive upper bound of the bucket.
+    static inline uint64_t bucket_end(size_t bucket);
+};
+
+// Counters of all the workers.
+//
+// Workers register once. The counters can then be read by any thread, without
+// taking any lock.
+struct stats_registry_t {
+    //
+    // Static fields
+    //
+
+    static constexpr size_t MAX_WORKERS         = 256;
+
+    //
+    // Fields
+    //
+
+    // Reserved entries. An entry can still be 'nullptr' for a short time
+    // after having been reserved.
+    atomic<size_t>              n_workers;
+    atomic<worker_stats_t *>    workers[MAX_WORKERS];
+
+    // Cycle count when the registry has been created.
+    cycles_t                    started;
+
+    // Set if the workers count their hardware events.
+    bool                        count_perf;
+
+    //
+    // Methods
+    //
+
+    stats_registry_t(cycles_t _started, bool _count_perf = false);
+
+    // Allocates and returns the counters of the calling worker. Must be called
+    // once by each worker, on its own thread.
+    worker_stats_t *register_worker(void);
+
+    // Appends the JSON members of the counters of every worker, of their sum
+    // and of the percentiles of their service times to 'json' (i.e.
+    // '"workers": [ ... ], "total": { ... }, "service_time_us": { ... }'),
+    // without the braces of the enclosing object.
+    void write_json(string *json) const;
+};
+
+// Appends the members of the JSON object of the counters to 'json'.
+static void _write_counters_json(
+    string *json, uint64_t n_accepted, uint64_t n_closed, uint64_t n_requests,
+    const uint64_t *n_responses, uint64_t n_bytes
+);
+
+// Appends the '"perf"' member of the JSON object of the counters to 'json',
+// with the hardware events per request. 'null' if no event is counted.
+static void _write_perf_json(
+    string *json, const perf_counters_t::values_t *perf, uint64_t n_requests
+);
+
+// Appends 'printf()'-formatted text to the string.
+static void _append(string *str, const char *format, ...)
+    __attribute__ ((format (printf, 2, 3)));
+
+inline worker_stats_t::worker_stats_t(bool count_perf)
+    : n_accepted(0), n_closed(0), n_requests(0), n_bytes(0),
+      perf(count_perf ? new perf_counters_t() : nullptr)
+{
+    for (atomic<uint64_t> &n : this->n_responses)
+        n = 0;
+
+    for (atomic<uint64_t> &n : this->service_times)
+        n = 0;
+
+    for (auto &event : this->perf_snapshot) {
+        event.is_counted    = false;
+        event.value         = 0;
+        event.time_enabled  = 0;
+        event.time_running  = 0;
+    }
+}
+
+inline void worker_stats_t::add(atomic<uint64_t> *counter, uint64_t n)
+{
+    counter->store(
+        counter->load(memory_order_relaxed) + n, memory_order_relaxed
+    );
+}
+
+inline void worker_stats_t::count_response(
+    unsigned int status, uint64_t bytes, cycles_t service_cycles
+)
+{
+    if (LIKELY(status >= 100 && status < 600))
+        add(&this->n_responses[status / 100 - 1]);
+
+    add(&this->n_bytes, bytes);
+    add(&this->service_times[bucket(service_cycles)]);
+}
+
+inline void worker_stats_t::snapshot_perf(void)
+{
+    assert(this->perf != nullptr);
+
+    perf_counters_t::values_t values = this->perf->read();
+
+    for (size_t i = 0; i < perf_counters_t::N_EVENTS; i++) {
+        auto &event = this->perf_snapshot[i];
+
+        event.value.store(values.value[i], memory_order_relaxed);
+        event.time_enabled.store(values.time_enabled[i], memory_order_relaxed);
+        event.time_running.store(values.time_running[i], memory_order_relaxed);
+        event.is_counted.store(values.is_counted[i], memory_order_relaxed);
+    }
+}
+
+inline perf_counters_t::values_t worker_stats_t::perf_values(void) const
+{
+    perf_counters_t::values_t values;
+
+    for (size_t i = 0; i < perf_counters_t::N_EVENTS; i++) {
+        const auto &event = this->perf_snapshot[i];
+
+        values.is_counted[i]    = event.is_counted.load(memory_order_relaxed);
+        values.value[i]         = event.value.load(memory_order_relaxed);
+        values.time_enabled[i]  = event.time_enabled.load(memory_order_relaxed);
+        values.time_running[i]  = event.time_running.load(memory_order_relaxed);
+    }
+
+    return values;
+}
+
+inline size_t worker_stats_t::bucket(uint64_t cycles)
+{
+    if (cycles < SUB_BUCKETS)
+        return cycles;
+
+    // Index of the most significant bit, and the bits following it.
+    size_t msb = 63 - __builtin_clzll(cycles);
+    size_t sub = (cycles >> (msb - SUB_BUCKETS_LOG2)) & (SUB_BUCKETS - 1);
+
+    return (msb - SUB_BUCKETS_LOG2 + 1) * SUB_BUCKETS + sub;
+}
+
+inline uint64_t worker_stats_t::bucket_end(size_t bucket)
+{
+    bucket++;
+
+    if (bucket < SUB_BUCKETS)
+        return bucket;
+
+    if (bucket >= N_BUCKETS)
+        return UINT64_MAX;
+
+    size_t msb = bucket / SUB_BUCKETS + SUB_BUCKETS_LOG2 - 1;
+    size_t sub = bucket % SUB_BUCKETS;
+
+    return (SUB_BUCKETS + sub) << (msb - SUB_BUCKETS_LOG2);
+}
+
+inline stats_registry_t::stats_registry_t(cycles_t _started, bool _count_perf)
+    : n_workers(0), started(_started), count_perf(_count_perf)
+{
+    for (atomic<worker_stats_t *> &worker : this->workers)
+        worker = nullptr;
+}
+
+inline worker_stats_t *stats_registry_t::register_worker(void)
+{
+    size_t i = this->n_workers.fetch_add(1, memory_order_relaxed);
+
+    if (i >= MAX_WORKERS)
+        STATS_DIE("Too many workers (%zu)", i + 1);
+
+    worker_stats_t *stats = new worker_stats_t(this->count_perf);
+    this->workers[i].store(stats, memory_order_release);
+
+    return stats;
+}
+
+inline void stats_registry_t::write_json(string *json) const
+{
+    static constexpr double PERCENTILES[] = { 50.0, 90.0, 99.0, 99.9 };
+
+    uint64_t    n_accepted = 0, n_closed = 0, n_requests = 0, n_bytes = 0;
+    uint64_t    n_responses[5] = { 0 };
+    uint64_t    service_times[worker_stats_t::N_BUCKETS] = { 0 };
+
+    // Sum of the hardware events of the workers. Only the events counted for
+    // every worker are summed.
+    perf_counters_t::values_t perf;
+
+    size_t n_workers = min(
+        this->n_workers.load(memory_order_relaxed), (size_t) MAX_WORKERS
+    );
+
+    *json += "\"workers\": [";
+
+    bool first = true;
+    for (size_t i = 0; i < n_workers; i++) {
+        const worker_stats_t *worker =
+            this->workers[i].load(memory_order_acquire);
+
+        if (worker == nullptr)
+            continue;
+
+        // Takes a single snapshot of each counter.
+
+        uint64_t worker_responses[5];
+        for (size_t j = 0; j < 5; j++) {
+            worker_responses[j] =
+                worker->n_responses[j].load(memory_order_relaxed);
+            n_responses[j] += worker_responses[j];
+        }
+
+        uint64_t    worker_accepted =
+                        worker->n_accepted.load(memory_order_relaxed),
+                    worker_closed   =
+                        worker->n_closed.load(memory_order_relaxed),
+                    worker_requests =
+                        worker->n_requests.load(memory_order_relaxed),
+                    worker_bytes    =
+                        worker->n_bytes.load(memory_order_relaxed);
+
+        n_accepted  += worker_accepted;
+        n_closed    += worker_closed;
+        n_requests  += worker_requests;
+        n_bytes     += worker_bytes;
+
+        for (size_t j = 0; j < worker_stats_t::N_BUCKETS; j++)
+            service_times[j] +=
+                worker->service_times[j].load(memory_order_relaxed);
+
+        perf_counters_t::values_t worker_perf = worker->perf_values();
+        perf = first ? worker_perf : perf + worker_perf;
+
+        *json += first ? " {" : ", {";
+        _write_counters_json(
+            json, worker_accepted, worker_closed, worker_requests,
+            worker_responses, worker_bytes
+        );
+        _write_perf_json(json, &worker_perf, worker_requests);
+        *json += " }";
+
+        first = false;
+    }
+
+    *json += " ], \"total\": {";
+    _write_counters_json(
+        json, n_accepted, n_closed, n_requests, n_responses, n_bytes
+    );
+    _write_perf_json(json, first ? nullptr : &perf, n_requests);
+
+    // Percentiles are the upper bounds of the buckets which contain them.
+
+    uint64_t n_samples = 0;
+    for (uint64_t n : service_times)
+        n_samples += n;
+
+    *json += " }, \"service_time_us\": {";
+
+    size_t      bucket      = 0;
+    uint64_t    cumulated   = 0;
+
+    first = true;
+    for (double percentile : PERCENTILES) {
+        uint64_t rank = (uint64_t) (n_samples * percentile / 100.0);
+
+        while (
+               bucket < worker_stats_t::N_BUCKETS - 1
+            && cumulated + service_times[bucket] <= rank
+        )
+            cumulated += service_times[bucket++];
+
+        double us =   n_samples == 0
+                    ? 0.0
+                    :   worker_stats_t::bucket_end(bucket) * 1000000.0
+                      / CYCLES_PER_SECOND;
+
+        _append(
+            json, "%s \"p%g\": %.1f", first ? "" : ",", percentile, us
+        );
+
+        first = false;
+    }
+
+    *json += " }";
+}
+
+static void _write_counters_json(
+    string *json, uint64_t n_accepted, uint64_t n_closed, uint64_t n_requests,
+    const uint64_t *n_responses, uint64_t n_bytes
+)
+{
+    _append(
+        json,
+        " \"connections\": %" PRIu64 ", \"accepted\": %" PRIu64 ", "
+        "\"requests\": %" PRIu64 ", \"bytes\": %" PRIu64 ", "
+        "\"responses\": { \"1xx\": %" PRIu64 ", \"2xx\": %" PRIu64 ", "
+        "\"3xx\": %" PRIu64 ", \"4xx\": %" PRIu64 ", \"5xx\": %" PRIu64 " }",
+        n_accepted - min(n_closed, n_accepted), n_accepted, n_requests,
+        n_bytes, n_responses[0], n_responses[1], n_responses[2],
+        n_responses[3], n_responses[4]
+    );
+}
+
+static void _write_perf_json(
+    string *json, const perf_counters_t::values_t *perf, uint64_t n_requests
+)
+{
+    if (perf == nullptr || !perf->is_available()) {
+        *json += ", \"perf\": null";
+        return;
+    }
+
+    _append(json, ", \"perf\": { \"ipc\": %.2f, ", perf->ipc());
+    perf->write_json(json, "request", n_requests);
+    *json += " }";
+}
+
+static void _append(string *str, const char *format, ...)
+{
+    char buffer[512];
+
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(buffer, sizeof (buffer), format, args);
+    va_end(args);
+
+    str->append(buffer, min((size_t) len, sizeof (buffer) - 1));
+}
+
+#undef STATS_COLOR
+#undef STATS_DIE
+
+} } /* namespace rusty::app */
+
+#endif /* __RUSTY_APP_WORKER_STATS_HPP__ */
@@ -0,0 +1,539 @@
+//
+// Tests the coalescing of the TCP segments received within a burst (see
+// 'tcp_t::_coalesce_segment()').
+//
+// Two instances of the stack are connected through a queue of frames. The
+// client sends runs of segments, which the server receives as a single burst,
+// in order, out of order, with a PSH or a FIN flag, or with TCP options.
+// Checks the runs of pending segments built by the TCP layer before the end of
+// the burst, and the data eventually received by the server.
+//
+// Must be built with TCP_RECEIVE_COALESCING and MPIPE_CHAINED_BUFFERS. Exits
+// with a non-zero status on the first failure.
+//
+// Usage: ./coalesce_test
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <utility>              // pair
+#include <vector>
+
+#include <arpa/inet.h>          // inet_aton()
+#include <net/ethernet.h>       // ETH_HLEN
+
+#include "bench/mock_phys.hpp"  // mock_phys_t
+#include "net/endian.hpp"       // net_t
+#include "util/macros.hpp"      // RUSTY_*
+
+#ifndef TCP_RECEIVE_COALESCING
+    #error "coalesce_test requires TCP_RECEIVE_COALESCING"
+#endif /* TCP_RECEIVE_COALESCING */
+
+using namespace std;
+
+using namespace rusty::bench;
+using namespace rusty::driver;
+using namespace rusty::net;
+
+#define TEST_COLOR     COLOR_CYN
+#define TEST_DIE(MSG, ...)                                                     \
+    RUSTY_DIE(  "TEST", TEST_COLOR, MSG, ##__VA_ARGS__)
+
+typedef mock_phys_t::cursor_t                           cursor_t;
+
+// Small frames, so that the initial congestion window of the client (4 MSS)
+// holds every segment of a test.
+static constexpr size_t FRAME_SIZE                  = 256;
+
+// Segments sent by the client in each test.
+static constexpr size_t N_SEGS                      = 4;
+
+// Frame waiting to be received, and the instance which will receive it.
+struct frame_t {
+    mock_phys_t     *dest;
+    char            *data;
+    size_t          size;
+};
+
+static mock_phys_t client(FRAME_SIZE), server(FRAME_SIZE);
+
+static deque<frame_t> wire;
+
+static mock_phys_t::tcp_t::conn_t conn;
+
+// Data sent by the client, and received by the server.
+static size_t n_sent = 0;
+static string received;
+
+// Calls of the 'new_data' handler of the server.
+static size_t n_new_data = 0;
+
+// 'true' once the server received the FIN of the client.
+static bool is_remote_closed = false;
+
+// Opens the connection from the client to the server.
+static void _connect(void);
+
+// Receives the frames of the wire one by one, until the wire is empty.
+static void _deliver_all(void);
+
+// Sends 'N_SEGS' segments from the client, and returns them.
+//
+// If 'close' is true, closes the connection after the data.
+static vector<frame_t> _send_segments(bool close);
+
+// Receives the frames as a single burst of the server, and returns the number
+// of segments of each run of pending segments, before the end of the burst.
+static vector<size_t> _receive_burst(const vector<frame_t> &frames);
+
+// Checks that the server received every byte sent by the client.
+static void _check_received(const char *test);
+
+// Sets the PSH flag of the TCP segment of the frame, and updates its checksum
+// incrementally (RFC 1624).
+static void _set_psh(const frame_t &frame);
+
+// Inserts a timestamp option (RFC 7323) with the given value in the TCP
+// segment of the frame, which must not have any option, and updates the
+// lengths and the checksums of the headers.
+static void _add_timestamp(frame_t *frame, uint32_t value);
+
+// Returns the sum of the 16-bit words of the data added to 'sum', without
+// folding the carries.
+static uint32_t _sum(const uint8_t *data, size_t size, uint32_t sum = 0);
+
+// Folds the carries of the sum and writes its complement at 'check', in
+// network byte order.
+static void _write_check(uint8_t *check, uint32_t sum);
+
+// Returns a comma-separated list of the values.
+static string _to_string(const vector<size_t> &values);
+
+static void _test_in_order(void);
+static void _test_out_of_order(void);
+static void _test_psh(void);
+static void _test_options(void);
+static void _test_fin(void);
+
+int main(void)
+{
+    _connect();
+
+    _test_in_order();
+    _test_out_of_order();
+    _test_psh();
+    _test_options();
+    _test_fin();
+
+    printf("coalesce_test: all tests passed\n");
+
+    return EXIT_SUCCESS;
+}
+
+static void _connect(void)
+{
+    struct in_addr in_addr;
+
+    net_t<mock_phys_t::ipv4_t::addr_t> client_addr, server_addr;
+    inet_aton("10.0.0.1", &in_addr);
+    client_addr = ipv4_addr_t::from_in_addr(in_addr);
+    inet_aton("10.0.0.2", &in_addr);
+    server_addr = ipv4_addr_t::from_in_addr(in_addr);
+
+    net_t<mock_phys_t::ethernet_t::addr_t> client_ether, server_ether;
+    uint8_t client_bytes[] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+    uint8_t server_bytes[] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x02 };
+    memcpy(client_ether.net.value, client_bytes, sizeof (client_bytes));
+    memcpy(server_ether.net.value, server_bytes, sizeof (server_bytes));
+
+    client.init(
+        client_ether, { client_addr }, { { server_addr, server_ether } }
+    );
+    server.init(
+        server_ether, { server_addr }, { { client_addr, client_ether } }
+    );
+
+    client.transmit = [](char *frame, size_t size) {
+        wire.push_back({ &server, frame, size });
+    };
+
+    server.transmit = [](char *frame, size_t size) {
+        wire.push_back({ &client, frame, size });
+    };
+
+    mock_phys_t::tcp_t::conn_handlers_t server_handlers;
+    server_handlers.new_data = [](cursor_t in) {
+        n_new_data++;
+
+        size_t offset = received.size();
+        received.resize(offset + in.size());
+        in.read(&received[offset], in.size());
+    };
+    server_handlers.remote_close    = []() { is_remote_closed = true; };
+    server_handlers.close           = []() { };
+    server_handlers.reset           = []() { };
+
+    server.ethernet.ipv4.tcp.listen(
+        80, [server_handlers](mock_phys_t::tcp_t::conn_t) {
+            return server_handlers;
+        }
+    );
+
+    mock_phys_t::tcp_t::conn_handlers_t client_handlers;
+    client_handlers.new_data        = [](cursor_t) { };
+    client_handlers.remote_close    = []() { };
+    client_handlers.close           = []() { };
+    client_handlers.reset           = []() { };
+
+    client.ethernet.ipv4.tcp.connect(
+        client_addr, 1024, server_addr, 80, client_handlers, &conn
+    );
+
+    _deliver_all();
+
+    if (!conn.is_established())
+        TEST_DIE("Failed to establish the connection");
+}
+
+static void _deliver_all(void)
+{
+    while (!wire.empty()) {
+        frame_t frame = wire.front();
+        wire.pop_front();
+
+        frame.dest->receive(frame.data, frame.size);
+    }
+}
+
+static vector<frame_t> _send_segments(bool close)
+{
+    size_t mss  = client.ethernet.ipv4.tcp.tcbs.begin()->second.tx_window.mss;
+    size_t size = N_SEGS * mss;
+
+    // Each byte is its offset in the stream, modulo 251, so that a misplaced
+    // segment is detected.
+    size_t first = n_sent;
+    conn.send(
+        size,
+        mock_phys_t::tcp_t::writer_t([first](size_t offset, cursor_t cursor) {
+            string data(cursor.size(), '\0');
+            for (size_t i = 0; i < data.size(); i++)
+                data[i] = (char) ((first + offset + i) % 251);
+
+            cursor.write(data.data(), data.size());
+        }),
+        []() { }
+    );
+    n_sent += size;
+
+    if (close)
+        conn.close();
+
+    vector<frame_t> frames(wire.begin(), wire.end());
+    wire.clear();
+
+    for (const frame_t &frame : frames) {
+        if (frame.dest != &server)
+            TEST_DIE("Unexpected frame sent to the client");
+    }
+
+    return frames;
+}
+
+static vector<size_t> _receive_burst(const vector<frame_t> &frames)
+{
+    assert(frames.size() <= mock_phys_t::RX_BURST_SIZE);
+
+    cursor_t cursors[mock_phys_t::RX_BURST_SIZE];
+
+    for (size_t i = 0; i < frames.size(); i++) {
+        cursors[i] = mock_phys_t::frame_cursor(
+            frames[i].data, frames[i].size, true
+        );
+    }
+
+    server.ethernet.receive_frames(cursors, frames.size());
+
+    vector<size_t> runs;
+
+    const auto &pending_segs = server.ethernet.ipv4.tcp.pending_segs;
+    for (size_t i = 0; i < pending_segs.size(); i++) {
+        if (pending_segs[i].head == i)
+            runs.push_back(pending_segs[i].n_segs);
+    }
+
+    server.ethernet.end_receive_burst();
+
+    return runs;
+}
+
+static void _check_received(const char *test)
+{
+    _deliver_all();
+
+    if (received.size() != n_sent) {
+        TEST_DIE(
+            "%s: received %zu bytes, %zu bytes sent", test, received.size(),
+            n_sent
+        );
+    }
+
+    for (size_t i = 0; i < received.size(); i++) {
+        if (received[i] != (char) (i % 251))
+            TEST_DIE("%s: byte %zu is corrupted", test, i);
+    }
+}
+
+static void _set_psh(const frame_t &frame)
+{
+    uint8_t *ip     = (uint8_t *) frame.data + ETH_HLEN;
+    uint8_t *tcp    = ip + (ip[0] & 0xF) * 4;
+
+    // The flags are the low byte of the 7th 16-bit word of the header.
+    uint16_t old_word   = (tcp[12] << 8) | tcp[13];
+    tcp[13] |= 0x08;
+    uint16_t new_word   = (tcp[12] << 8) | tcp[13];
+
+    uint16_t check = (tcp[16] << 8) | tcp[17];
+
+    uint32_t sum = (uint16_t) ~check + (uint16_t) ~old_word + new_word;
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+
+    check = (uint16_t) ~sum;
+    tcp[16] = check >> 8;
+    tcp[17] = check & 0xFF;
+}
+
+static void _add_timestamp(frame_t *frame, uint32_t value)
+{
+    // Two NOPs, then the kind, the length, the value and the echo reply of
+    // the timestamp.
+    static constexpr size_t OPTION_SIZE = 12;
+
+    const uint8_t *ip   = (const uint8_t *) frame->data + ETH_HLEN;
+    size_t ip_hdr_size  = (ip[0] & 0xF) * 4;
+    size_t headers_size = ETH_HLEN + ip_hdr_size + 20;
+
+    if ((ip[ip_hdr_size + 12] >> 4) * 4 != 20)
+        TEST_DIE("The segment already has options");
+
+    size_t size = frame->size + OPTION_SIZE;
+    char *data  = mock_phys_t::alloc_frame(size);
+
+    uint8_t option[OPTION_SIZE] = {
+        1, 1, 8, 10,
+        (uint8_t) (value >> 24), (uint8_t) (value >> 16),
+        (uint8_t) (value >> 8), (uint8_t) value,
+        0, 0, 0, 0
+    };
+
+    memcpy(data, frame->data, headers_size);
+    memcpy(data + headers_size, option, OPTION_SIZE);
+    memcpy(
+        data + headers_size + OPTION_SIZE, frame->data + headers_size,
+        frame->size - headers_size
+    );
+
+    free(frame->data);
+    frame->data = data;
+    frame->size = size;
+
+    // IPv4 header.
+
+    uint8_t *new_ip = (uint8_t *) data + ETH_HLEN;
+    size_t ip_size  = size - ETH_HLEN;
+
+    new_ip[2]   = ip_size >> 8;
+    new_ip[3]   = ip_size & 0xFF;
+    new_ip[10]  = new_ip[11] = 0;
+    _write_check(new_ip + 10, _sum(new_ip, ip_hdr_size));
+
+    // TCP header, summed with its pseudo header (RFC 793 page 17).
+
+    uint8_t *tcp    = new_ip + ip_hdr_size;
+    size_t tcp_size = ip_size - ip_hdr_size;
+
+    tcp[12]     = (uint8_t) (((20 + OPTION_SIZE) / 4) << 4) | (tcp[12] & 0xF);
+    tcp[16]     = tcp[17] = 0;
+
+    uint8_t pseudo[12];
+    memcpy(pseudo, new_ip + 12, 8);     // Source and destination addresses.
+    pseudo[8]   = 0;
+    pseudo[9]   = new_ip[9];            // Protocol.
+    pseudo[10]  = tcp_size >> 8;
+    pseudo[11]  = tcp_size & 0xFF;
+
+    _write_check(
+        tcp + 16, _sum(tcp, tcp_size, _sum(pseudo, sizeof (pseudo)))
+    );
+}
+
+static uint32_t _sum(const uint8_t *data, size_t size, uint32_t sum)
+{
+    for (size_t i = 0; i + 1 < size; i += 2)
+        sum += (data[i] << 8) | data[i + 1];
+
+    if (size % 2 != 0)
+        sum += data[size - 1] << 8;
+
+    return sum;
+}
+
+static void _write_check(uint8_t *check, uint32_t sum)
+{
+    while (sum >> 16)
+        sum = (sum & 0xFFFF) + (sum >> 16);
+
+    uint16_t value = (uint16_t) ~sum;
+    check[0] = value >> 8;
+    check[1] = value & 0xFF;
+}
+
+static string _to_string(const vector<size_t> &values)
+{
+    string str;
+
+    for (size_t i = 0; i < values.size(); i++) {
+        if (i > 0)
+            str += ",";
+        str += to_string(values[i]);
+    }
+
+    return str;
+}
+
+// Contiguous data segments are merged in a single run, which is given to the
+// application at once.
+static void _test_in_order(void)
+{
+    vector<frame_t> frames = _send_segments(false);
+
+    if (frames.size() != N_SEGS)
+        TEST_DIE("in order: %zu segments sent", frames.size());
+
+    size_t n_new_data_before = n_new_data;
+
+    vector<size_t> runs = _receive_burst(frames);
+
+    if (runs != vector<size_t>{ N_SEGS })
+        TEST_DIE("in order: runs of %s segments", _to_string(runs).c_str());
+
+    if (n_new_data - n_new_data_before != 1) {
+        TEST_DIE(
+            "in order: data delivered in %zu calls",
+            n_new_data - n_new_data_before
+        );
+    }
+
+    _check_received("in order");
+    printf("in order: ok (runs: %s)\n", _to_string(runs).c_str());
+}
+
+// A segment which doesn't follow the previous segment of the connection
+// starts a new run.
+static void _test_out_of_order(void)
+{
+    vector<frame_t> frames = _send_segments(false);
+
+    if (frames.size() != N_SEGS)
+        TEST_DIE("out of order: %zu segments sent", frames.size());
+
+    vector<frame_t> reordered = { frames[0], frames[2], frames[1], frames[3] };
+
+    vector<size_t> runs = _receive_burst(reordered);
+
+    if (runs != vector<size_t>{ 1, 1, 1, 1 }) {
+        TEST_DIE(
+            "out of order: runs of %s segments", _to_string(runs).c_str()
+        );
+    }
+
+    _check_received("out of order");
+    printf("out of order: ok (runs: %s)\n", _to_string(runs).c_str());
+}
+
+// A PSH flag ends the run of the segment which carries it.
+static void _test_psh(void)
+{
+    vector<frame_t> frames = _send_segments(false);
+
+    if (frames.size() != N_SEGS)
+        TEST_DIE("PSH: %zu segments sent", frames.size());
+
+    _set_psh(frames[1]);
+
+    vector<size_t> runs = _receive_burst(frames);
+
+    if (runs != vector<size_t>{ 2, 2 })
+        TEST_DIE("PSH: runs of %s segments", _to_string(runs).c_str());
+
+    _check_received("PSH");
+    printf("PSH: ok (runs: %s)\n", _to_string(runs).c_str());
+}
+
+// A segment is only merged into a run whose segments have exactly the same
+// options: the same timestamp, or no option at all.
+static void _test_options(void)
+{
+    vector<frame_t> frames = _send_segments(false);
+
+    if (frames.size() != N_SEGS)
+        TEST_DIE("options: %zu segments sent", frames.size());
+
+    _add_timestamp(&frames[0], 1);
+    _add_timestamp(&frames[1], 1);
+    _add_timestamp(&frames[2], 2);
+
+    vector<size_t> runs = _receive_burst(frames);
+
+    if (runs != vector<size_t>{ 2, 1, 1 })
+        TEST_DIE("options: runs of %s segments", _to_string(runs).c_str());
+
+    _check_received("options");
+    printf("options: ok (runs: %s)\n", _to_string(runs).c_str());
+}
+
+// A segment with a FIN flag is never merged, and ends the run of the data
+// segments which precede it.
+static void _test_fin(void)
+{
+    vector<frame_t> frames = _send_segments(true);
+
+    if (frames.size() < N_SEGS)
+        TEST_DIE("FIN: %zu segments sent", frames.size());
+
+    vector<size_t> runs = _receive_burst(frames);
+
+    if (runs != vector<size_t>{ frames.size() - 1, 1 })
+        TEST_DIE("FIN: runs of %s segments", _to_string(runs).c_str());
+
+    _check_received("FIN");
+
+    if (!is_remote_closed)
+        TEST_DIE("FIN: the connection has not been closed");
+
+    printf("FIN: ok (runs: %s)\n", _to_string(runs).c_str());
+}
@@ -0,0 +1,881 @@
+//
+// Tests the HTTP/2 connections of the HTTP server (see 'http/server.hpp').
+//
+// Two instances of the stack are connected through a queue of frames. The
+// client opens an h2c connection with prior knowledge, and sends raw HTTP/2
+// frames to the server. Checks the parsing of the frames, the flow control
+// windows (changes of SETTINGS_INITIAL_WINDOW_SIZE and overflowing
+// WINDOW_UPDATE frames), the header blocks split in CONTINUATION frames and the
+// errors which close the connection.
+//
+// Exits with a non-zero status on the first failure.
+//
+// Usage: ./h2_test
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>               // make_shared(), shared_ptr
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>          // inet_aton()
+
+#include "bench/mock_phys.hpp"  // mock_phys_t
+#include "http/h2.hpp"          // h2_frame_header_t, h2_settings_t, H2_*
+#include "http/hpack.hpp"       // hpack_decoder_t, hpack_encoder_t
+#include "http/parser.hpp"      // http_request_t, str_ref_t
+#include "http/server.hpp"      // server_t
+#include "net/endian.hpp"       // net_t
+#include "util/macros.hpp"      // RUSTY_*
+
+using namespace std;
+
+using namespace rusty::bench;
+using namespace rusty::driver;
+using namespace rusty::http;
+using namespace rusty::net;
+
+#define TEST_COLOR     COLOR_CYN
+#define TEST_DIE(MSG, ...)                                                     \
+    RUSTY_DIE(  "TEST", TEST_COLOR, MSG, ##__VA_ARGS__)
+
+typedef mock_phys_t::cursor_t                           cursor_t;
+
+// The server keeps no state of its own on the connections.
+struct test_conn_t { };
+
+typedef server_t<mock_phys_t::tcp_t, test_conn_t>       http_server_t;
+typedef http_server_t::response_t                       http_response_t;
+
+// Sizes of the contents of the '/large' and '/small' paths. The large one
+// exceeds the initial flow control windows.
+static constexpr size_t LARGE_SIZE                  = 100 * 1024;
+static constexpr size_t SMALL_SIZE                  = 10;
+
+static constexpr mock_phys_t::tcp_t::port_t SERVER_PORT = 80;
+
+// Frame waiting to be received, and the instance which will receive it.
+struct frame_t {
+    mock_phys_t     *dest;
+    char            *data;
+    size_t          size;
+};
+
+// HTTP/2 frame received by the client.
+struct h2_frame_t {
+    h2_frame_header_t   hdr;
+    string              payload;
+};
+
+static mock_phys_t client, server;
+
+static net_t<mock_phys_t::ipv4_t::addr_t> client_addr, server_addr;
+
+static deque<frame_t> wire;
+
+static http_server_t http_server;
+
+// Connection of the client, opened by '_open()'. Each test opens its own
+// connection, from a new port.
+static mock_phys_t::tcp_t::conn_t conn;
+static mock_phys_t::tcp_t::port_t next_port = 1024;
+
+// Bytes received by the client which have not been parsed into frames yet.
+static string received;
+
+// 'true' once the client received the FIN of the server.
+static bool is_remote_closed;
+
+// Compression contexts of the connection.
+static hpack_encoder_t encoder;
+static hpack_decoder_t decoder;
+
+// Initializes the instances and the server.
+static void _init(void);
+
+// Returns an HTTP/1 response whose content has the given size.
+static string _response(size_t size);
+
+// Receives the frames of the wire one by one, and runs the expired timers,
+// until the wire is empty.
+static void _deliver_all(void);
+
+// Opens a connection, sends the connection preface followed by a SETTINGS
+// frame with the given payload, and checks the SETTINGS frames of the server.
+static void _open(const char *test, const string &settings = "");
+
+// Sends the bytes on the connection, and delivers them.
+static void _send(string data);
+
+// Sends a frame, and delivers it.
+static void _send_frame(
+    uint8_t type, uint8_t flags, uint32_t stream_id,
+    const string &payload = ""
+);
+
+// Returns a SETTINGS payload with a single parameter.
+static string _setting(h2_settings_t::id_t id, uint32_t value);
+
+// Returns a WINDOW_UPDATE or RST_STREAM payload.
+static string _uint32(uint32_t value);
+
+// Returns the header block of a GET request for the path.
+static string _request(const char *path);
+
+// Returns the frames received since the last call.
+static vector<h2_frame_t> _receive(void);
+
+// Checks that the frames are a HEADERS frame on the stream with a '200'
+// status, followed by its DATA frames. Returns the content of the DATA frames.
+//
+// Sets 'end_stream' if the last frame ends the stream.
+static string _check_response(
+    const char *test, const vector<h2_frame_t> &frames, uint32_t stream_id,
+    bool *end_stream
+);
+
+// Checks that the content is the beginning of the content of the responses.
+static void _check_content(const char *test, const string &content);
+
+// Checks that the frames only contain DATA frames on the stream, and returns
+// their content.
+static string _data(
+    const char *test, const vector<h2_frame_t> &frames, uint32_t stream_id,
+    bool *end_stream
+);
+
+// Checks that the last frame is a GOAWAY frame with the error, and that the
+// server closed the connection.
+static void _check_goaway(
+    const char *test, const vector<h2_frame_t> &frames, h2_error_t error
+);
+
+static void _test_frames(void);
+static void _test_frame_errors(void);
+static void _test_settings_window(void);
+static void _test_settings_overflow(void);
+static void _test_window_update_overflow(void);
+static void _test_continuation(void);
+static void _test_continuation_errors(void);
+static void _test_compression_error(void);
+
+int main(void)
+{
+    _init();
+
+    _test_frames();
+    _test_frame_errors();
+    _test_settings_window();
+    _test_settings_overflow();
+    _test_window_update_overflow();
+    _test_continuation();
+    _test_continuation_errors();
+    _test_compression_error();
+
+    printf("h2_test: all tests passed\n");
+
+    return EXIT_SUCCESS;
+}
+
+static void _init(void)
+{
+    struct in_addr in_addr;
+
+    inet_aton("10.0.0.1", &in_addr);
+    client_addr = ipv4_addr_t::from_in_addr(in_addr);
+    inet_aton("10.0.0.2", &in_addr);
+    server_addr = ipv4_addr_t::from_in_addr(in_addr);
+
+    net_t<mock_phys_t::ethernet_t::addr_t> client_ether, server_ether;
+    uint8_t client_bytes[] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+    uint8_t server_bytes[] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x02 };
+    memcpy(client_ether.net.value, client_bytes, sizeof (client_bytes));
+    memcpy(server_ether.net.value, server_bytes, sizeof (server_bytes));
+
+    client.init(
+        client_ether, { client_addr }, { { server_addr, server_ether } }
+    );
+    server.init(
+        server_ether, { server_addr }, { { client_addr, client_ether } }
+    );
+
+    client.transmit = [](char *frame, size_t size) {
+        wire.push_back({ &server, frame, size });
+    };
+
+    server.transmit = [](char *frame, size_t size) {
+        wire.push_back({ &client, frame, size });
+    };
+
+    http_server.route(
+        "/large", [](const http_request_t *, http_response_t *response) {
+            response->send(_response(LARGE_SIZE));
+        }
+    );
+
+    http_server.route(
+        "/small", [](const http_request_t *, http_response_t *response) {
+            response->send(_response(SMALL_SIZE));
+        }
+    );
+
+    server.ethernet.ipv4.tcp.listen(
+        SERVER_PORT, [](mock_phys_t::tcp_t::conn_t server_conn) {
+            return http_server.accept(server_conn);
+        }
+    );
+}
+
+static string _response(size_t size)
+{
+    string response =
+          "HTTP/1.1 200 OK\r\nContent-Length: " + to_string(size)
+        + "\r\n\r\n";
+
+    for (size_t i = 0; i < size; i++)
+        response.push_back((char) ('a' + i % 26));
+
+    return response;
+}
+
+static void _deliver_all(void)
+{
+    do {
+        while (!wire.empty()) {
+            frame_t frame = wire.front();
+            wire.pop_front();
+
+            frame.dest->receive(frame.data, frame.size);
+        }
+
+        // The server resumes the transmission of its responses from a timer
+        // once their data is acknowledged.
+        client.timers.tick();
+        server.timers.tick();
+    } while (!wire.empty());
+}
+
+static void _open(const char *test, const string &settings)
+{
+    received.clear();
+    is_remote_closed = false;
+    encoder          = hpack_encoder_t();
+    decoder          = hpack_decoder_t();
+
+    mock_phys_t::tcp_t::conn_handlers_t handlers;
+    handlers.new_data       = [](cursor_t in) {
+        size_t offset = received.size();
+        received.resize(offset + in.size());
+        in.read(&received[offset], in.size());
+    };
+    handlers.remote_close   = []() {
+        is_remote_closed = true;
+        conn.close();
+    };
+    handlers.close          = []() { };
+    handlers.reset          = []() { };
+
+    client.ethernet.ipv4.tcp.connect(
+        client_addr, next_port++, server_addr, SERVER_PORT, handlers, &conn
+    );
+
+    _deliver_all();
+
+    if (!conn.is_established())
+        TEST_DIE("%s: failed to establish the connection", test);
+
+    string preface(H2_PREFACE, H2_PREFACE_LEN);
+    h2_frame_header_t::append(
+        h2_frame_header_t::SETTINGS, 0, 0, settings.data(), settings.size(),
+        &preface
+    );
+    _send(move(preface));
+
+    // The SETTINGS frame of the server, then the acknowledgement of the
+    // settings of the client.
+    vector<h2_frame_t> frames = _receive();
+
+    if (
+           frames.size() != 2
+        || frames[0].hdr.type != h2_frame_header_t::SETTINGS
+        || frames[0].hdr.flags != 0
+        || frames[0].payload != _setting(
+               h2_settings_t::MAX_CONCURRENT_STREAMS,
+               http_server_t::H2_MAX_STREAMS
+           )
+        || frames[1].hdr.type != h2_frame_header_t::SETTINGS
+        || frames[1].hdr.flags != h2_frame_header_t::ACK
+    )
+        TEST_DIE("%s: unexpected SETTINGS frames from the server", test);
+}
+
+static void _send(string data)
+{
+    auto shared = make_shared<const string>(move(data));
+
+    conn.send(
+        shared->size(),
+        mock_phys_t::tcp_t::writer_t(
+            [shared](size_t offset, cursor_t cursor) {
+                cursor.write(shared->data() + offset, cursor.size());
+            }
+        ),
+        []() { }
+    );
+
+    _deliver_all();
+}
+
+static void _send_frame(
+    uint8_t type, uint8_t flags, uint32_t stream_id, const string &payload
+)
+{
+    string frame;
+    h2_frame_header_t::append(
+        type, flags, stream_id, payload.data(), payload.size(), &frame
+    );
+    _send(move(frame));
+}
+
+static string _setting(h2_settings_t::id_t id, uint32_t value)
+{
+    string payload;
+    h2_settings_t::append(id, value, &payload);
+    return payload;
+}
+
+static string _uint32(uint32_t value)
+{
+    uint8_t bytes[4];
+    h2_frame_header_t::write_uint32(value, bytes);
+    return string((const char *) bytes, sizeof (bytes));
+}
+
+static string _request(const char *path)
+{
+    static const char authority[] = "test";
+
+    string block;
+
+    encoder.encode(str_ref_t(":method", 7), str_ref_t("GET", 3), &block);
+    encoder.encode(str_ref_t(":scheme", 7), str_ref_t("http", 4), &block);
+    encoder.encode(
+        str_ref_t(":path", 5), str_ref_t(path, strlen(path)), &block
+    );
+    encoder.encode(
+        str_ref_t(":authority", 10),
+        str_ref_t(authority, sizeof (authority) - 1), &block
+    );
+
+    return block;
+}
+
+static vector<h2_frame_t> _receive(void)
+{
+    vector<h2_frame_t> frames;
+
+    size_t offset = 0;
+
+    while (received.size() - offset >= h2_frame_header_t::SIZE) {
+        h2_frame_header_t hdr = h2_frame_header_t::read(
+            received.data() + offset
+        );
+
+        size_t frame_size = h2_frame_header_t::SIZE + hdr.length;
+
+        if (received.size() - offset < frame_size)
+            break;
+
+        frames.push_back({
+            hdr, received.substr(offset + h2_frame_header_t::SIZE, hdr.length)
+        });
+
+        offset += frame_size;
+    }
+
+    received.erase(0, offset);
+
+    return frames;
+}
+
+static string _check_response(
+    const char *test, const vector<h2_frame_t> &frames, uint32_t stream_id,
+    bool *end_stream
+)
+{
+    if (
+           frames.empty()
+        || frames[0].hdr.type != h2_frame_header_t::HEADERS
+        || frames[0].hdr.stream_id != stream_id
+        || !(frames[0].hdr.flags & h2_frame_header_t::END_HEADERS)
+        || (frames[0].hdr.flags & h2_frame_header_t::END_STREAM)
+    )
+        TEST_DIE("%s: no HEADERS frame on the stream %u", test, stream_id);
+
+    string status;
+
+    const string &block = frames[0].payload;
+    bool decoded = decoder.decode(
+        block.data(), block.size(),
+        [&status](str_ref_t name, str_ref_t value)
+        {
+            if (name.len == 7 && memcmp(name.data, ":status", 7) == 0)
+                status.assign(value.data, value.len);
+            return true;
+        }
+    );
+
+    if (!decoded || status != "200")
+        TEST_DIE("%s: invalid response on the stream %u", test, stream_id);
+
+    return _data(
+        test, vector<h2_frame_t>(frames.begin() + 1, frames.end()), stream_id,
+        end_stream
+    );
+}
+
+static void _check_content(const char *test, const string &content)
+{
+    for (size_t i = 0; i < content.size(); i++) {
+        if (content[i] != (char) ('a' + i % 26))
+            TEST_DIE("%s: byte %zu of the content is corrupted", test, i);
+    }
+}
+
+static string _data(
+    const char *test, const vector<h2_frame_t> &frames, uint32_t stream_id,
+    bool *end_stream
+)
+{
+    string content;
+
+    *end_stream = false;
+
+    for (const h2_frame_t &frame : frames) {
+        if (
+               frame.hdr.type != h2_frame_header_t::DATA
+            || frame.hdr.stream_id != stream_id || *end_stream
+        ) {
+            TEST_DIE(
+                "%s: unexpected frame of type %u on the stream %u", test,
+                (unsigned int) frame.hdr.type, frame.hdr.stream_id
+            );
+        }
+
+        if (frame.payload.size() > h2_settings_t::MIN_FRAME_SIZE)
+            TEST_DIE("%s: DATA frame larger than the maximum size", test);
+
+        content    += frame.payload;
+        *end_stream = frame.hdr.flags & h2_frame_header_t::END_STREAM;
+    }
+
+    return content;
+}
+
+static void _check_goaway(
+    const char *test, const vector<h2_frame_t> &frames, h2_error_t error
+)
+{
+    if (
+           frames.empty()
+        || frames.back().hdr.type != h2_frame_header_t::GOAWAY
+        || frames.back().payload.size() != 8
+    )
+        TEST_DIE("%s: no GOAWAY frame", test);
+
+    uint32_t code = h2_frame_header_t::read_uint32(
+        (const uint8_t *) frames.back().payload.data() + 4
+    );
+
+    if (code != (uint32_t) error) {
+        TEST_DIE(
+            "%s: GOAWAY with the error 0x%x, 0x%x expected", test, code, error
+        );
+    }
+
+    if (!is_remote_closed)
+        TEST_DIE("%s: the server did not close the connection", test);
+}
+
+static void _test_frames(void)
+{
+    const char *test = "frames";
+
+    _open(test);
+
+    // PING frames are acknowledged with the same payload.
+    _send_frame(h2_frame_header_t::PING, 0, 0, "12345678");
+
+    vector<h2_frame_t> frames = _receive();
+    if (
+           frames.size() != 1 || frames[0].hdr.type != h2_frame_header_t::PING
+        || frames[0].hdr.flags != h2_frame_header_t::ACK
+        || frames[0].payload != "12345678"
+    )
+        TEST_DIE("%s: invalid PING acknowledgement", test);
+
+    // Unknown frames and PRIORITY frames are ignored.
+    _send_frame(0xA, 0, 0, "ignored");
+    _send_frame(h2_frame_header_t::PRIORITY, 0, 1, string(5, '\0'));
+
+    if (!_receive().empty())
+        TEST_DIE("%s: response to an ignored frame", test);
+
+    // HEADERS frame with padding and a priority.
+    string payload = string(1, (char) 4) + string(5, '\0') + _request("/small")
+                     + string(4, '\0');
+    _send_frame(
+        h2_frame_header_t::HEADERS,
+          h2_frame_header_t::END_HEADERS | h2_frame_header_t::END_STREAM
+        | h2_frame_header_t::PADDED | h2_frame_header_t::PRIORITY_FLAG,
+        1, payload
+    );
+
+    bool end_stream;
+    string content = _check_response(test, _receive(), 1, &end_stream);
+
+    if (content.size() != SMALL_SIZE || !end_stream)
+        TEST_DIE("%s: incomplete response", test);
+    _check_content(test, content);
+
+    // The large response is limited by the connection window, which the small
+    // response already used, then by the window of its stream.
+    _send_frame(
+        h2_frame_header_t::HEADERS,
+        h2_frame_header_t::END_HEADERS | h2_frame_header_t::END_STREAM,
+        3, _request("/large")
+    );
+
+    content = _check_response(test, _receive(), 3, &end_stream);
+
+    if (content.size() != h2_settings_t::DEFAULT_WINDOW_SIZE - SMALL_SIZE)
+        TEST_DIE("%s: %zu bytes sent beyond the window", test, content.size());
+
+    size_t remaining = LARGE_SIZE - content.size();
+
+    _send_frame(h2_frame_header_t::WINDOW_UPDATE, 0, 0, _uint32(remaining));
+
+    content += _data(test, _receive(), 3, &end_stream);
+
+    if (content.size() != h2_settings_t::DEFAULT_WINDOW_SIZE)
+        TEST_DIE("%s: %zu bytes sent beyond the window", test, content.size());
+
+    _send_frame(
+        h2_frame_header_t::WINDOW_UPDATE, 0, 3,
+        _uint32(LARGE_SIZE - content.size())
+    );
+
+    content += _data(test, _receive(), 3, &end_stream);
+
+    if (content.size() != LARGE_SIZE || !end_stream)
+        TEST_DIE("%s: incomplete response", test);
+    _check_content(test, content);
+}
+
+static void _test_frame_errors(void)
+{
+    const char *test = "frame errors";
+
+    // Frames larger than SETTINGS_MAX_FRAME_SIZE.
+    _open(test);
+    _send_frame(
+        h2_frame_header_t::PING, 0, 0,
+        string(h2_settings_t::MIN_FRAME_SIZE + 1, '\0')
+    );
+    _check_goaway(test, _receive(), H2_FRAME_SIZE_ERROR);
+
+    // PING frames of an invalid size.
+    _open(test);
+    _send_frame(h2_frame_header_t::PING, 0, 0, "1234");
+    _check_goaway(test, _receive(), H2_FRAME_SIZE_ERROR);
+
+    // SETTINGS frames whose size isn't a multiple of the size of a parameter.
+    _open(test);
+    _send_frame(h2_frame_header_t::SETTINGS, 0, 0, "12345");
+    _check_goaway(test, _receive(), H2_FRAME_SIZE_ERROR);
+
+    // Streams with an even identifier.
+    _open(test);
+    _send_frame(
+        h2_frame_header_t::HEADERS,
+        h2_frame_header_t::END_HEADERS | h2_frame_header_t::END_STREAM,
+        2, _request("/small")
+    );
+    _check_goaway(test, _receive(), H2_PROTOCOL_ERROR);
+
+    // Padding larger than the frame.
+    _open(test);
+    _send_frame(
+        h2_frame_header_t::HEADERS,
+          h2_frame_header_t::END_HEADERS | h2_frame_header_t::END_STREAM
+        | h2_frame_header_t::PADDED,
+        1, string(1, (char) 10) + "abc"
+    );
+    _check_goaway(test, _receive(), H2_PROTOCOL_ERROR);
+}
+
+static void _test_settings_window(void)
+{
+    const char *test = "SETTINGS initial window";
+
+    _open(test, _setting(h2_settings_t::INITIAL_WINDOW_SIZE, 1000));
+
+    _send_frame(
+        h2_frame_header_t::HEADERS,
+        h2_frame_header_t::END_HEADERS | h2_frame_header_t::END_STREAM,
+        1, _request("/large")
+    );
+
+    bool end_stream;
+    string content = _check_response(test, _receive(), 1, &end_stream);
+
+    if (content.size() != 1000)
+        TEST_DIE("%s: %zu bytes sent, 1000 expected", test, content.size());
+
+    // The window of the open stream drops to -1000, and is only opened again
+    // once the new initial size is above the sent data.
+    _send_frame(
+        h2_frame_header_t::SETTINGS, 0, 0,
+        _setting(h2_settings_t::INITIAL_WINDOW_SIZE, 0)
+    );
+
+    vector<h2_frame_t> frames = _receive();
+    if (
+           frames.size() != 1
+        || frames[0].hdr.type != h2_frame_header_t::SETTINGS
+        || frames[0].hdr.flags != h2_frame_header_t::ACK
+    )
+        TEST_DIE("%s: data sent on a closed window", test);
+
+    _send_frame(
+        h2_frame_header_t::SETTINGS, 0, 0,
+        _setting(h2_settings_t::INITIAL_WINDOW_SIZE, 3000)
+    );
+
+    frames = _receive();
+    if (
+           frames.empty() || frames[0].hdr.type != h2_frame_header_t::SETTINGS
+        || frames[0].hdr.flags != h2_frame_header_t::ACK
+    )
+        TEST_DIE("%s: the settings have not been acknowledged", test);
+
+    content += _data(
+        test, vector<h2_frame_t>(frames.begin() + 1, frames.end()), 1,
+        &end_stream
+    );
+
+    if (content.size() != 3000 || end_stream)
+        TEST_DIE("%s: %zu bytes sent, 3000 expected", test, content.size());
+    _check_content(test, content);
+
+    // Windows above 2^31 - 1.
+    _send_frame(
+        h2_frame_header_t::SETTINGS, 0, 0,
+        _setting(
+            h2_settings_t::INITIAL_WINDOW_SIZE,
+            h2_settings_t::MAX_WINDOW_SIZE + 1
+        )
+    );
+    _check_goaway(test, _receive(), H2_FLOW_CONTROL_ERROR);
+}
+
+static void _test_settings_overflow(void)
+{
+    const char *test = "SETTINGS window overflow";
+
+    _open(test);
+
+    // Exhausts the connection window.
+    _send_frame(
+        h2_frame_header_t::HEADERS,
+        h2_frame_header_t::END_HEADERS | h2_frame_header_t::END_STREAM,
+        1, _request("/large")
+    );
+
+    bool end_stream;
+    string content = _check_response(test, _receive(), 1, &end_stream);
+
+    if (content.size() != h2_settings_t::DEFAULT_WINDOW_SIZE)
+        TEST_DIE("%s: %zu bytes sent beyond the window", test, content.size());
+
+    // The window of the second stream is untouched, and is then raised above
+    // the initial size.
+    _send_frame(
+        h2_frame_header_t::HEADERS,
+        h2_frame_header_t::END_HEADERS | h2_frame_header_t::END_STREAM,
+        3, _request("/large")
+    );
+    _send_frame(h2_frame_header_t::WINDOW_UPDATE, 0, 3, _uint32(1000));
+
+    content = _check_response(test, _receive(), 3, &end_stream);
+    if (!content.empty())
+        TEST_DIE("%s: data sent beyond the connection window", test);
+
+    // The window of the second stream would exceed 2^31 - 1.
+    _send_frame(
+        h2_frame_header_t::SETTINGS, 0, 0,
+        _setting(
+            h2_settings_t::INITIAL_WINDOW_SIZE, h2_settings_t::MAX_WINDOW_SIZE
+        )
+    );
+    _check_goaway(test, _receive(), H2_FLOW_CONTROL_ERROR);
+}
+
+static void _test_window_update_overflow(void)
+{
+    const char *test = "WINDOW_UPDATE overflow";
+
+    _open(test);
+
+    // Exhausts the windows of the connection and of the stream.
+    _send_frame(
+        h2_frame_header_t::HEADERS,
+        h2_frame_header_t::END_HEADERS | h2_frame_header_t::END_STREAM,
+        1, _request("/large")
+    );
+
+    bool end_stream;
+    _check_response(test, _receive(), 1, &end_stream);
+
+    // A stream window of 2^31 - 1 is valid, one more byte resets the stream.
+    _send_frame(
+        h2_frame_header_t::WINDOW_UPDATE, 0, 1,
+        _uint32(h2_settings_t::MAX_WINDOW_SIZE)
+    );
+
+    if (!_receive().empty())
+        TEST_DIE("%s: data sent beyond the connection window", test);
+
+    _send_frame(h2_frame_header_t::WINDOW_UPDATE, 0, 1, _uint32(1));
+
+    vector<h2_frame_t> frames = _receive();
+    if (
+           frames.size() != 1
+        || frames[0].hdr.type != h2_frame_header_t::RST_STREAM
+        || frames[0].hdr.stream_id != 1
+        || frames[0].payload != _uint32(H2_FLOW_CONTROL_ERROR)
+    )
+        TEST_DIE("%s: the stream has not been reset", test);
+
+    // The reset stream doesn't send its remaining data once the connection
+    // window opens.
+    _send_frame(
+        h2_frame_header_t::WINDOW_UPDATE, 0, 0,
+        _uint32(h2_settings_t::MAX_WINDOW_SIZE)
+    );
+
+    if (!_receive().empty() || is_remote_closed)
+        TEST_DIE("%s: data sent on a reset stream", test);
+
+    // The connection window is now 2^31 - 1.
+    _send_frame(h2_frame_header_t::WINDOW_UPDATE, 0, 0, _uint32(1));
+    _check_goaway(test, _receive(), H2_FLOW_CONTROL_ERROR);
+
+    // Increments of zero.
+    _open(test);
+    _send_frame(h2_frame_header_t::WINDOW_UPDATE, 0, 0, _uint32(0));
+    _check_goaway(test, _receive(), H2_PROTOCOL_ERROR);
+}
+
+static void _test_continuation(void)
+{
+    const char *test = "CONTINUATION";
+
+    _open(test);
+
+    // The header block is split in a HEADERS frame and two CONTINUATION
+    // frames. Only the last one ends the header block.
+    string block = _request("/small");
+    size_t third = block.size() / 3;
+
+    _send_frame(
+        h2_frame_header_t::HEADERS, h2_frame_header_t::END_STREAM, 1,
+        block.substr(0, third)
+    );
+    _send_frame(
+        h2_frame_header_t::CONTINUATION, 0, 1, block.substr(third, third)
+    );
+
+    if (!_receive().empty())
+        TEST_DIE("%s: response to an incomplete header block", test);
+
+    _send_frame(
+        h2_frame_header_t::CONTINUATION, h2_frame_header_t::END_HEADERS, 1,
+        block.substr(2 * third)
+    );
+
+    bool end_stream;
+    string content = _check_response(test, _receive(), 1, &end_stream);
+
+    if (content.size() != SMALL_SIZE || !end_stream)
+        TEST_DIE("%s: incomplete response", test);
+    _check_content(test, content);
+}
+
+static void _test_continuation_errors(void)
+{
+    const char *test = "CONTINUATION errors";
+
+    // Other frames can't be interleaved with the header block.
+    _open(test);
+    _send_frame(
+        h2_frame_header_t::HEADERS, h2_frame_header_t::END_STREAM, 1,
+        _request("/small")
+    );
+    _send_frame(h2_frame_header_t::PING, 0, 0, "12345678");
+    _check_goaway(test, _receive(), H2_PROTOCOL_ERROR);
+
+    // CONTINUATION frames on another stream.
+    _open(test);
+    _send_frame(
+        h2_frame_header_t::HEADERS, h2_frame_header_t::END_STREAM, 1,
+        _request("/small")
+    );
+    _send_frame(
+        h2_frame_header_t::CONTINUATION, h2_frame_header_t::END_HEADERS, 3
+    );
+    _check_goaway(test, _receive(), H2_PROTOCOL_ERROR);
+
+    // CONTINUATION frames which don't follow a HEADERS frame.
+    _open(test);
+    _send_frame(
+        h2_frame_header_t::CONTINUATION, h2_frame_header_t::END_HEADERS, 1,
+        _request("/small")
+    );
+    _check_goaway(test, _receive(), H2_PROTOCOL_ERROR);
+}
+
+static void _test_compression_error(void)
+{
+    const char *test = "compression error";
+
+    // A dynamic table size update after the first field of the block
+    // (RFC 7541, 4.2).
+    _open(test);
+    _send_frame(
+        h2_frame_header_t::HEADERS,
+        h2_frame_header_t::END_HEADERS | h2_frame_header_t::END_STREAM,
+        1, _request("/small") + string(1, (char) 0x20)
+    );
+    _check_goaway(test, _receive(), H2_COMPRESSION_ERROR);
+}
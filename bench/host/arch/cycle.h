@@ -0,0 +1,47 @@
+//
+// Host replacement of the <arch/cycle.h> header of the TILE-Gx MDE.
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __RUSTY_BENCH_HOST_ARCH_CYCLE_H__
+#define __RUSTY_BENCH_HOST_ARCH_CYCLE_H__
+
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <x86intrin.h>  // __rdtsc()
+#else
+    #include <time.h>       // clock_gettime()
+#endif
+
+// Returns the value of the time-stamp counter on x86, which is incremented at a
+// constant rate, whatever the frequency of the core is.
+//
+// Other architectures count nanoseconds instead.
+static inline uint64_t get_cycle_count(void)
+{
+    #if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+    #else
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+    #endif
+}
+
+#endif /* __RUSTY_BENCH_HOST_ARCH_CYCLE_H__ */
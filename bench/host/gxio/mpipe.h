@@ -0,0 +1,103 @@
+//
+// Host replacement of the <gxio/mpipe.h> header of the TILE-Gx MDE.
+//
+// Only declares what the buffer cursors require. Buffers are allocated in the
+// host memory by the benchmarks (see 'mock_phys_t') and are freed when they are
+// pushed back.
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __RUSTY_BENCH_HOST_GXIO_MPIPE_H__
+#define __RUSTY_BENCH_HOST_GXIO_MPIPE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>             // free()
+
+#define MPIPE_EDMA_DESC_WORD1__C_VAL_UNCHAINED  0
+#define MPIPE_EDMA_DESC_WORD1__C_VAL_CHAINED    1
+#define MPIPE_EDMA_DESC_WORD1__C_VAL_INVALID    3
+
+typedef struct {
+    int                 instance;
+} gxio_mpipe_context_t;
+
+typedef struct {
+    uint64_t            words[8];
+} gxio_mpipe_idesc_t;
+
+// Same layout as the TILE-Gx buffer descriptor. 'va' is the address of the
+// buffer divided by 128 and '__reserved_0' the offset of the data.
+typedef union {
+    struct {
+        uint64_t        va              : 42;
+        uint64_t        __reserved_0    : 7;
+        uint64_t        stack_idx       : 5;
+        uint64_t        __reserved_1    : 3;
+        uint64_t        inst            : 1;
+        uint64_t        hwb             : 1;
+        uint64_t        size            : 3;
+        uint64_t        c               : 2;
+    };
+
+    uint64_t            word;
+} gxio_mpipe_bdesc_t;
+
+typedef enum {
+    GXIO_MPIPE_BUFFER_SIZE_128      = 0,
+    GXIO_MPIPE_BUFFER_SIZE_256      = 1,
+    GXIO_MPIPE_BUFFER_SIZE_512      = 2,
+    GXIO_MPIPE_BUFFER_SIZE_1024     = 3,
+    GXIO_MPIPE_BUFFER_SIZE_1664     = 4,
+    GXIO_MPIPE_BUFFER_SIZE_4096     = 5,
+    GXIO_MPIPE_BUFFER_SIZE_10368    = 6,
+    GXIO_MPIPE_BUFFER_SIZE_16384    = 7
+} gxio_mpipe_buffer_size_enum_t;
+
+static inline const char *gxio_strerror(int errcode)
+{
+    (void) errcode;
+    return "GXIO error";
+}
+
+static inline size_t gxio_mpipe_idesc_get_xfer_size(gxio_mpipe_idesc_t *idesc)
+{
+    return idesc->words[0] & 0x3FFF;
+}
+
+static inline size_t gxio_mpipe_buffer_size_enum_to_buffer_size(
+    gxio_mpipe_buffer_size_enum_t buffer_size_enum
+)
+{
+    static const size_t sizes[] = {
+        128, 256, 512, 1024, 1664, 4096, 10368, 16384
+    };
+
+    return sizes[buffer_size_enum];
+}
+
+// Releases a buffer allocated with 'aligned_alloc()'.
+static inline void gxio_mpipe_push_buffer_bdesc(
+    gxio_mpipe_context_t *context, gxio_mpipe_bdesc_t bdesc
+)
+{
+    (void) context;
+    free((void *) ((uintptr_t) bdesc.va << 7));
+}
+
+#endif /* __RUSTY_BENCH_HOST_GXIO_MPIPE_H__ */
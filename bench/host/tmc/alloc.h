@@ -0,0 +1,80 @@
+//
+// Host replacement of the <tmc/alloc.h> header of the TILE-Gx MDE.
+//
+// Only declares what 'tile_allocator_t' refers to. The benchmarks use the
+// standard allocator.
+//
+// Maps the memory of the content replicas (see 'app/content_replica.hpp')
+// with 'mmap()'. The host has no Tiles to home the memory on, so the home is
+// ignored, and the pages are placed on the node of the thread which touches
+// them first. A page size of at least 2 MB asks for transparent huge pages.
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __RUSTY_BENCH_HOST_TMC_ALLOC_H__
+#define __RUSTY_BENCH_HOST_TMC_ALLOC_H__
+
+#include <stddef.h>
+
+#include <sys/mman.h>           // madvise(), mmap(), munmap()
+
+typedef struct {
+    int                 home;
+    size_t              pagesize;
+} tmc_alloc_t;
+
+#define TMC_ALLOC_INIT  { 0, 0 }
+
+// Size of the huge pages of x86-64.
+#define TMC_ALLOC_HUGE_PAGESIZE     (2 * 1024 * 1024)
+
+static inline tmc_alloc_t *tmc_alloc_set_home(tmc_alloc_t *alloc, int home)
+{
+    alloc->home = home;
+    return alloc;
+}
+
+static inline tmc_alloc_t *tmc_alloc_set_pagesize(
+    tmc_alloc_t *alloc, size_t pagesize
+)
+{
+    alloc->pagesize = pagesize;
+    return alloc;
+}
+
+static inline void *tmc_alloc_map(tmc_alloc_t *alloc, size_t size)
+{
+    void *mem = mmap(
+        NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0
+    );
+
+    if (mem == MAP_FAILED)
+        return NULL;
+
+    if (alloc->pagesize >= TMC_ALLOC_HUGE_PAGESIZE)
+        madvise(mem, size, MADV_HUGEPAGE);
+
+    return mem;
+}
+
+static inline int tmc_alloc_unmap(void *addr, size_t size)
+{
+    return munmap(addr, size);
+}
+
+#endif /* __RUSTY_BENCH_HOST_TMC_ALLOC_H__ */
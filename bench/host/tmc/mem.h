@@ -0,0 +1,35 @@
+//
+// Host replacement of the <tmc/mem.h> header of the TILE-Gx MDE.
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __RUSTY_BENCH_HOST_TMC_MEM_H__
+#define __RUSTY_BENCH_HOST_TMC_MEM_H__
+
+#include <stddef.h>
+
+// Prefetches every cache line of the memory area.
+static inline void tmc_mem_prefetch(const void *addr, size_t size)
+{
+    const char *p = (const char *) addr, *end = p + size;
+
+    for (; p < end; p += 64)
+        __builtin_prefetch(p);
+}
+
+#endif /* __RUSTY_BENCH_HOST_TMC_MEM_H__ */
@@ -0,0 +1,51 @@
+//
+// Host replacement of the <tmc/mspace.h> header of the TILE-Gx MDE.
+//
+// Only declares what 'tile_allocator_t' refers to. The benchmarks use the
+// standard allocator.
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __RUSTY_BENCH_HOST_TMC_MSPACE_H__
+#define __RUSTY_BENCH_HOST_TMC_MSPACE_H__
+
+#include <stddef.h>
+
+#include <tmc/alloc.h>
+
+typedef void *tmc_mspace;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+tmc_mspace tmc_mspace_create_special(
+    size_t init_size, int flags, tmc_alloc_t *alloc
+);
+
+void tmc_mspace_destroy(tmc_mspace mspace);
+
+void *tmc_mspace_malloc(tmc_mspace mspace, size_t size);
+
+void tmc_mspace_free(void *ptr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RUSTY_BENCH_HOST_TMC_MSPACE_H__ */
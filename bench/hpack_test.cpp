@@ -0,0 +1,398 @@
+//
+// Tests the HPACK decoder and encoder (see 'http/hpack.hpp').
+//
+// Decodes the header blocks of the examples of RFC 7541, appendix C.4
+// (requests, with the Huffman code) and C.6 (responses, with the Huffman code
+// and evictions from a 256 bytes dynamic table), and checks the decoded fields
+// and the dynamic table after each block. Then checks where the dynamic table
+// size updates are accepted, and decodes the blocks of the encoder.
+//
+// Exits with a non-zero status on the first failure.
+//
+// Usage: ./hpack_test
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <utility>              // pair
+#include <vector>
+
+#include "http/hpack.hpp"       // hpack_decoder_t, hpack_encoder_t
+#include "http/parser.hpp"      // str_ref_t
+#include "util/macros.hpp"      // RUSTY_*
+
+using namespace std;
+
+using namespace rusty::http;
+
+#define TEST_COLOR     COLOR_CYN
+#define TEST_DIE(MSG, ...)                                                     \
+    RUSTY_DIE(  "TEST", TEST_COLOR, MSG, ##__VA_ARGS__)
+
+typedef pair<string, string>                            field_t;
+
+// Returns the bytes of the hexadecimal string.
+static string _from_hex(const char *hex);
+
+// Decodes the block, and returns its fields. Fails the test if the block is
+// rejected.
+static vector<field_t> _decode(
+    const char *test, hpack_decoder_t *decoder, const string &block
+);
+
+// Returns 'true' if the decoder accepts the block.
+static bool _accepts(hpack_decoder_t *decoder, const string &block);
+
+// Checks that the fields are the expected ones, in order.
+static void _check_fields(
+    const char *test, const vector<field_t> &fields,
+    const vector<field_t> &expected
+);
+
+// Checks the entries of the dynamic table, from the newest to the oldest, and
+// its size.
+static void _check_table(
+    const char *test, const hpack_table_t &table,
+    const vector<field_t> &expected, size_t size
+);
+
+static void _test_requests(void);
+static void _test_responses(void);
+static void _test_size_updates(void);
+static void _test_encoder(void);
+
+int main(void)
+{
+    _test_requests();
+    _test_responses();
+    _test_size_updates();
+    _test_encoder();
+
+    printf("hpack_test: all tests passed\n");
+
+    return EXIT_SUCCESS;
+}
+
+static string _from_hex(const char *hex)
+{
+    string bytes;
+
+    for (; hex[0] != '\0' && hex[1] != '\0'; hex += 2) {
+        char digits[3] = { hex[0], hex[1], '\0' };
+        bytes.push_back((char) strtoul(digits, nullptr, 16));
+    }
+
+    return bytes;
+}
+
+static vector<field_t> _decode(
+    const char *test, hpack_decoder_t *decoder, const string &block
+)
+{
+    vector<field_t> fields;
+
+    bool success = decoder->decode(
+        block.data(), block.size(),
+        [&fields](str_ref_t name, str_ref_t value)
+        {
+            fields.emplace_back(
+                string(name.data, name.len), string(value.data, value.len)
+            );
+            return true;
+        }
+    );
+
+    if (!success)
+        TEST_DIE("%s: the block has been rejected", test);
+
+    return fields;
+}
+
+static bool _accepts(hpack_decoder_t *decoder, const string &block)
+{
+    return decoder->decode(
+        block.data(), block.size(), [](str_ref_t, str_ref_t) { return true; }
+    );
+}
+
+static void _check_fields(
+    const char *test, const vector<field_t> &fields,
+    const vector<field_t> &expected
+)
+{
+    if (fields.size() != expected.size()) {
+        TEST_DIE(
+            "%s: %zu fields decoded, %zu expected", test, fields.size(),
+            expected.size()
+        );
+    }
+
+    for (size_t i = 0; i < fields.size(); i++) {
+        if (fields[i] != expected[i]) {
+            TEST_DIE(
+                "%s: field %zu is \"%s: %s\", \"%s: %s\" expected", test, i,
+                fields[i].first.c_str(), fields[i].second.c_str(),
+                expected[i].first.c_str(), expected[i].second.c_str()
+            );
+        }
+    }
+}
+
+static void _check_table(
+    const char *test, const hpack_table_t &table,
+    const vector<field_t> &expected, size_t size
+)
+{
+    if (table.entries.size() != expected.size()) {
+        TEST_DIE(
+            "%s: %zu entries in the dynamic table, %zu expected", test,
+            table.entries.size(), expected.size()
+        );
+    }
+
+    for (size_t i = 0; i < expected.size(); i++) {
+        const hpack_table_t::entry_t &entry = table.entries[i];
+
+        if (
+               entry.name != expected[i].first
+            || entry.value != expected[i].second
+        )
+            TEST_DIE("%s: entry %zu of the dynamic table differs", test, i + 1);
+    }
+
+    if (table.size != size) {
+        TEST_DIE(
+            "%s: the dynamic table has a size of %zu, %zu expected", test,
+            table.size, size
+        );
+    }
+}
+
+static void _test_requests(void)
+{
+    // Three requests on the same connection (RFC 7541, C.4).
+
+    hpack_decoder_t decoder;
+
+    vector<field_t> fields = _decode(
+        "C.4.1", &decoder, _from_hex("828684418cf1e3c2e5f23a6ba0ab90f4ff")
+    );
+    _check_fields(
+        "C.4.1", fields, {
+            { ":method", "GET" }, { ":scheme", "http" }, { ":path", "/" },
+            { ":authority", "www.example.com" }
+        }
+    );
+    _check_table(
+        "C.4.1", decoder.table, { { ":authority", "www.example.com" } }, 57
+    );
+
+    fields = _decode(
+        "C.4.2", &decoder, _from_hex("828684be5886a8eb10649cbf")
+    );
+    _check_fields(
+        "C.4.2", fields, {
+            { ":method", "GET" }, { ":scheme", "http" }, { ":path", "/" },
+            { ":authority", "www.example.com" },
+            { "cache-control", "no-cache" }
+        }
+    );
+    _check_table(
+        "C.4.2", decoder.table, {
+            { "cache-control", "no-cache" },
+            { ":authority", "www.example.com" }
+        }, 110
+    );
+
+    fields = _decode(
+        "C.4.3", &decoder,
+        _from_hex("828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf")
+    );
+    _check_fields(
+        "C.4.3", fields, {
+            { ":method", "GET" }, { ":scheme", "https" },
+            { ":path", "/index.html" }, { ":authority", "www.example.com" },
+            { "custom-key", "custom-value" }
+        }
+    );
+    _check_table(
+        "C.4.3", decoder.table, {
+            { "custom-key", "custom-value" }, { "cache-control", "no-cache" },
+            { ":authority", "www.example.com" }
+        }, 164
+    );
+}
+
+static void _test_responses(void)
+{
+    // Three responses on the same connection, with a 256 bytes dynamic table
+    // (RFC 7541, C.6).
+
+    static const char *cookie =
+        "foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1";
+
+    hpack_decoder_t decoder(256);
+
+    vector<field_t> fields = _decode(
+        "C.6.1", &decoder, _from_hex(
+            "488264025885aec3771a4b6196d07abe941054d444a8200595040b8166e082a6"
+            "2d1bff6e919d29ad171863c78f0b97c8e9ae82ae43d3"
+        )
+    );
+    _check_fields(
+        "C.6.1", fields, {
+            { ":status", "302" }, { "cache-control", "private" },
+            { "date", "Mon, 21 Oct 2013 20:13:21 GMT" },
+            { "location", "https://www.example.com" }
+        }
+    );
+    _check_table(
+        "C.6.1", decoder.table, {
+            { "location", "https://www.example.com" },
+            { "date", "Mon, 21 Oct 2013 20:13:21 GMT" },
+            { "cache-control", "private" }, { ":status", "302" }
+        }, 222
+    );
+
+    // Evicts ':status: 302'.
+    fields = _decode("C.6.2", &decoder, _from_hex("4883640effc1c0bf"));
+    _check_fields(
+        "C.6.2", fields, {
+            { ":status", "307" }, { "cache-control", "private" },
+            { "date", "Mon, 21 Oct 2013 20:13:21 GMT" },
+            { "location", "https://www.example.com" }
+        }
+    );
+    _check_table(
+        "C.6.2", decoder.table, {
+            { ":status", "307" }, { "location", "https://www.example.com" },
+            { "date", "Mon, 21 Oct 2013 20:13:21 GMT" },
+            { "cache-control", "private" }
+        }, 222
+    );
+
+    // Evicts every entry but the date, before adding the new date.
+    fields = _decode(
+        "C.6.3", &decoder, _from_hex(
+            "88c16196d07abe941054d444a8200595040b8166e084a62d1bffc05a839bd9ab"
+            "77ad94e7821dd7f2e6c7b335dfdfcd5b3960d5af27087f3672c1ab270fb5291f"
+            "9587316065c003ed4ee5b1063d5007"
+        )
+    );
+    _check_fields(
+        "C.6.3", fields, {
+            { ":status", "200" }, { "cache-control", "private" },
+            { "date", "Mon, 21 Oct 2013 20:13:22 GMT" },
+            { "location", "https://www.example.com" },
+            { "content-encoding", "gzip" }, { "set-cookie", cookie }
+        }
+    );
+    _check_table(
+        "C.6.3", decoder.table, {
+            { "set-cookie", cookie }, { "content-encoding", "gzip" },
+            { "date", "Mon, 21 Oct 2013 20:13:22 GMT" }
+        }, 215
+    );
+}
+
+static void _test_size_updates(void)
+{
+    // Two updates, to 0 then to 4096, followed by ':method: GET'.
+    string updates = _from_hex("203fe11f82");
+
+    hpack_decoder_t decoder;
+
+    if (!_accepts(&decoder, updates))
+        TEST_DIE("Size updates at the start of a block have been rejected");
+
+    if (decoder.table.max_size != 4096)
+        TEST_DIE("The last size update has not been applied");
+
+    // RFC 7541, 4.2: the update must precede the first field of the block.
+    if (_accepts(&decoder, _from_hex("8220")))
+        TEST_DIE("A size update after a field has been accepted");
+
+    // Above the maximum announced in the SETTINGS frame.
+    hpack_decoder_t small_decoder(256);
+    if (_accepts(&small_decoder, _from_hex("3fe11f")))
+        TEST_DIE("A size update above the maximum size has been accepted");
+
+    // An update to 0 evicts every entry.
+    hpack_decoder_t empty_decoder;
+    _decode(
+        "size updates", &empty_decoder,
+        _from_hex("418cf1e3c2e5f23a6ba0ab90f4ff")
+    );
+    _decode("size updates", &empty_decoder, _from_hex("2082"));
+    _check_table("size updates", empty_decoder.table, { }, 0);
+}
+
+static void _test_encoder(void)
+{
+    hpack_encoder_t encoder;
+    hpack_decoder_t decoder;
+
+    vector<field_t> response = {
+        { ":status", "200" }, { "content-type", "text/html" },
+        { "content-length", "5120" }, { "server", "rusty" }
+    };
+
+    // The second block references the entries added by the first one, and
+    // must be smaller.
+    size_t sizes[2];
+
+    for (size_t i = 0; i < 2; i++) {
+        string block;
+        encoder.begin_block(&block);
+        encoder.encode_status(200, &block);
+
+        for (size_t j = 1; j < response.size(); j++) {
+            const field_t &field = response[j];
+            encoder.encode(
+                str_ref_t(field.first.data(), field.first.size()),
+                str_ref_t(field.second.data(), field.second.size()), &block
+            );
+        }
+
+        _check_fields("encoder", _decode("encoder", &decoder, block), response);
+        sizes[i] = block.size();
+    }
+
+    if (sizes[1] >= sizes[0])
+        TEST_DIE("The encoder did not reuse its dynamic table");
+
+    if (decoder.table.size != encoder.table.size)
+        TEST_DIE("The dynamic tables of the encoder and decoder differ");
+
+    // A smaller table is signaled at the start of the next block.
+    encoder.set_max_table_size(0);
+
+    string block;
+    encoder.begin_block(&block);
+    encoder.encode_status(404, &block);
+
+    _check_fields(
+        "encoder resize", _decode("encoder resize", &decoder, block),
+        { { ":status", "404" } }
+    );
+
+    if (decoder.table.max_size != 0 || decoder.table.size != 0)
+        TEST_DIE("The size update of the encoder has not been applied");
+}
@@ -0,0 +1,1526 @@
+//
+// Micro-benchmarks of the data structures and of the kernels of the stack.
+//
+// Runs on the host, against frames allocated in the host memory (see
+// 'mock_phys_t'). Reports the time and the number of cycles per operation of
+// each benchmark in JSON, on the standard output, with the hardware events per
+// operation if the host allows counting them (see 'perf_counters_t').
+//
+// The 'content.*' benchmarks load the files of the directory given with '-p',
+// as httpd does, and are skipped without it.
+//
+// Usage: ./microbench [-r <runs>] [-f <filter>] [-p <pages>]
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>                // clock_gettime()
+#include <deque>
+#include <string>
+#include <utility>              // pair
+#include <vector>
+
+#include <arpa/inet.h>          // inet_aton()
+#include <fcntl.h>              // open()
+#include <net/if_arp.h>         // ARPHRD_ETHER
+#include <netinet/ip.h>         // IP_MF, IPOPT_NOP
+#include <pthread.h>            // pthread_create(), pthread_join()
+#include <strings.h>            // strncasecmp()
+#include <unistd.h>             // dup2(), getopt(), optarg, optind
+
+#include <arch/cycle.h>         // get_cycle_count()
+
+#include "app/content.hpp"      // file_t, files_t, free_files(),
+                                // preload_files(), response_t
+#include "app/content_replica.hpp" // free_replica(), replica_t,
+                                   // replicate_files()
+#include "app/file_index.hpp"  // file_index_t
+#include "bench/mock_phys.hpp"  // mock_phys_t
+#include "driver/clock.hpp"     // cpu_clock_t
+#include "driver/perf_counters.hpp" // perf_counters_t
+#include "driver/timer.hpp"     // cpu_timer_manager_t
+#include "http/parser.hpp"      // http_parser_t, http_request_t
+#include "http/router.hpp"      // router_t
+#include "http/static_response.hpp" // SEGMENT_SIZES, response_sum(),
+                                    // write_static_response()
+#include "net/checksum.hpp"     // _ones_complement_sum(), precomputed_sums_t
+#include "net/endian.hpp"       // net_t
+#include "util/macros.hpp"      // RUSTY_*
+
+using namespace std;
+
+using namespace rusty::app;
+using namespace rusty::bench;
+using namespace rusty::driver;
+using namespace rusty::http;
+using namespace rusty::net;
+
+#define BENCH_COLOR     COLOR_CYN
+#define BENCH_DIE(MSG, ...)                                                    \
+    RUSTY_DIE(  "BENCH", BENCH_COLOR, MSG, ##__VA_ARGS__)
+
+typedef mock_phys_t::cursor_t                           cursor_t;
+
+typedef mock_phys_t::ethernet_t::header_t               ether_header_t;
+typedef mock_phys_t::ipv4_t::header_t                   ipv4_header_t;
+typedef mock_phys_t::arp_ipv4_t::message_t              arp_message_t;
+
+// Frame allocated with 'mock_phys_t::alloc_frame()', and its size.
+typedef pair<char *, size_t>                            frame_t;
+
+// Default value of the '-r' CLI option.
+static constexpr size_t DEFAULT_RUNS                = 5;
+
+// Number of connections in the table of the 'tcp.tcb_lookup' benchmark.
+static constexpr size_t N_TCBS                      = 10000;
+
+// Size of the file of the 'checksum.precomputed_sum' benchmark.
+static constexpr size_t PRECOMPUTED_SIZE            = 1 << 20;
+
+// Number of files of the corpora of the 'file_index.*' benchmarks: the pages of
+// 'bench/pages' and a large static site.
+static constexpr size_t N_PAGES                     = 500;
+static constexpr size_t N_SITE_FILES                = 1000000;
+
+// Largest file served by the 'content.serve_*' benchmarks, and replicated
+// by the 'content.serve_replicas_*' ones, as 'httpd -r 64'.
+static constexpr size_t REPLICATED_SIZE             = 64 * 1024;
+
+// Frames of the receive bursts of the 'receive.burst_*' benchmarks.
+static constexpr size_t BURST_SIZE = mock_phys_t::RX_BURST_SIZE;
+
+// Number of random values drawn before a benchmark, which are then used in a
+// loop.
+static constexpr size_t N_RANDOM                    = 4096;
+
+// Parsed CLI arguments.
+struct args_t {
+    size_t                  n_runs;
+
+    // Only runs the benchmarks whose name contains this string, if not
+    // 'nullptr'.
+    const char              *filter;
+
+    // Directory of the files of the 'content.*' benchmarks, or 'nullptr'.
+    const char              *pages;
+};
+
+// A worker thread of the 'content.serve_*' benchmarks, which sends 'n_ops'
+// responses of the small files of 'files'.
+struct serve_thread_t {
+    const files_t           *files;
+
+    // Indexes of the small files in 'files->values'.
+    const vector<size_t>    *small_files;
+
+    size_t                  n_ops;
+
+    pthread_t               thread;
+};
+
+// Fastest run of a benchmark.
+struct result_t {
+    const char              *name;
+    size_t                  n_ops;
+    double                  ns_per_op;
+    double                  cycles_per_op;
+
+    // Hardware events during the run.
+    perf_counters_t::values_t perf;
+};
+
+static args_t args;
+
+// Hardware counters of the main thread, which runs the benchmarks.
+static perf_counters_t *perf_counters;
+
+static vector<result_t> results;
+
+static void _print_usage(char **argv);
+
+// Parses CLI arguments.
+//
+// Fails on a malformed command.
+static bool _parse_args(int argc, char **argv, args_t *args);
+
+// Runs 'f(n_ops)' once to warm the caches up, and then 'args.n_runs' times.
+// Records the fastest run in 'results'.
+template <typename F>
+static void _bench(const char *name, size_t n_ops, F f);
+
+static void _bench_cursor(void);
+static void _bench_checksum(void);
+static void _bench_timers(void);
+static void _bench_tcb_lookup(void);
+static void _bench_arp(void);
+static void _bench_write_headers(void);
+static void _bench_receive(void);
+static void _bench_http_parser(void);
+static void _bench_file_index(void);
+static void _bench_content(void);
+
+// Benchmarks the responses of the small files by 1, 2 and 4 threads, which
+// either share 'files' or each use their own replica of the files.
+static void _bench_content_serve(const files_t *files);
+
+// Sends the responses of a 'serve_thread_t', as TCP does, in segments of the
+// MSS written in a frame.
+static void *_serve_main(void *serve_thread);
+
+// Benchmarks lookups of existing and of missing keys in an index of the given
+// keys, separated by '\0' in 'keys'.
+static void _bench_file_index_lookups(
+    const char *name_hit, const char *name_miss, const string &keys,
+    size_t n_keys
+);
+
+static void _write_json(void);
+
+// Prevents the compiler from removing the computation of 'value'.
+template <typename T>
+static inline void _keep(const T &value)
+{
+    asm volatile ("" : : "r" (&value) : "memory");
+}
+
+// Returns the current time of the monotonic clock, in nanoseconds.
+static inline uint64_t _now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// xorshift64.
+static inline uint64_t _random(uint64_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static net_t<mock_phys_t::ipv4_t::addr_t> _ipv4_addr(const char *addr);
+
+// Request parser of httpd before 'http/parser.hpp', which scanned the header
+// with 'memchr()' and classified the fields with 'strncasecmp()'. Only used as
+// a reference by the 'http.*_legacy' benchmarks.
+//
+// Returns 'false' if the request is incomplete or invalid.
+static bool _legacy_parse_request(
+    const char *buffer, size_t size, const char **path, size_t *path_len,
+    bool *keep_alive, size_t *request_size
+);
+
+static net_t<mock_phys_t::ethernet_t::addr_t> _ether_addr(uint8_t last_byte);
+
+// Returns frames derived from the given TCP segment of the client which don't
+// take the fast paths of 'ethernet_t::receive_frames()' and
+// 'ipv4_t::receive_datagrams()': a broadcasted ARP request for the destination
+// of the segment, a fragment of the segment, the segment with IP options, and
+// the segment sent to 'non_local_addr'.
+static vector<frame_t> _slow_path_frames(
+    const char *frame, size_t size,
+    net_t<mock_phys_t::ipv4_t::addr_t> non_local_addr
+);
+
+// Sets the checksum of the IPv4 header of the frame.
+static void _set_ipv4_checksum(char *frame);
+
+// Redirects the standard error to '/dev/null', as the stack reports every
+// ignored frame, and returns the previous standard error, to be given to
+// '_restore_stderr()'.
+static int _silence_stderr(void);
+
+static void _restore_stderr(int saved_stderr);
+
+int main(int argc, char **argv)
+{
+    if (!_parse_args(argc, argv, &args))
+        return EXIT_FAILURE;
+
+    perf_counters = new perf_counters_t();
+
+    _bench_cursor();
+    _bench_checksum();
+    _bench_timers();
+    _bench_tcb_lookup();
+    _bench_arp();
+    _bench_write_headers();
+    _bench_receive();
+    _bench_http_parser();
+    _bench_file_index();
+    _bench_content();
+
+    _write_json();
+
+    return EXIT_SUCCESS;
+}
+
+static void _print_usage(char **argv)
+{
+    fprintf(
+        stderr,
+        "Usage: %s [-r <runs>] [-f <filter>] [-p <pages>]\n"
+        "\n"
+        "-r <runs>           runs each benchmark this number of times and "
+        "reports the\n"
+        "                    fastest run (default: %zu).\n"
+        "-f <filter>         only runs the benchmarks whose name contains "
+        "this string.\n"
+        "-p <pages>          directory of the files of the content.* "
+        "benchmarks, which\n"
+        "                    are skipped without it.\n",
+        argv[0], DEFAULT_RUNS
+    );
+}
+
+static bool _parse_args(int argc, char **argv, args_t *args)
+{
+    args->n_runs = DEFAULT_RUNS;
+    args->filter = nullptr;
+    args->pages  = nullptr;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "r:f:p:")) != -1) {
+        switch (opt) {
+        case 'r':
+            args->n_runs = atol(optarg);
+            break;
+        case 'f':
+            args->filter = optarg;
+            break;
+        case 'p':
+            args->pages = optarg;
+            break;
+        default:
+            _print_usage(argv);
+            return false;
+        }
+    }
+
+    if (optind != argc || args->n_runs == 0) {
+        _print_usage(argv);
+        return false;
+    }
+
+    return true;
+}
+
+template <typename F>
+static void _bench(const char *name, size_t n_ops, F f)
+{
+    if (args.filter != nullptr && strstr(name, args.filter) == nullptr)
+        return;
+
+    f(n_ops);
+
+    result_t result;
+    result.name             = name;
+    result.n_ops            = n_ops;
+
+    for (size_t i = 0; i < args.n_runs; i++) {
+        // Counters are read outside of the timed section, as reading them
+        // requires system calls.
+        perf_counters_t::values_t perf = perf_counters->read();
+
+        uint64_t    ns      = _now_ns();
+        cycles_t    cycles  = get_cycle_count();
+
+        f(n_ops);
+
+        cycles  = get_cycle_count() - cycles;
+        ns      = _now_ns() - ns;
+
+        perf = perf_counters->read() - perf;
+
+        double ns_per_op        = (double) ns / n_ops;
+        double cycles_per_op    = (double) cycles / n_ops;
+
+        if (i == 0 || ns_per_op < result.ns_per_op) {
+            result.ns_per_op        = ns_per_op;
+            result.cycles_per_op    = cycles_per_op;
+            result.perf             = perf;
+        }
+    }
+
+    results.push_back(result);
+}
+
+static void _bench_cursor(void)
+{
+    char *frame = mock_phys_t::alloc_frame(mock_phys_t::STANDARD_FRAME_SIZE);
+    memset(frame, 0, mock_phys_t::STANDARD_FRAME_SIZE);
+
+    cursor_t cursor = mock_phys_t::frame_cursor(
+        frame, mock_phys_t::STANDARD_FRAME_SIZE, true
+    );
+
+    _bench("cursor.take", 1000000, [&cursor](size_t n_ops) {
+        for (size_t i = 0; i < n_ops; i++)
+            _keep(cursor.take(mock_phys_t::ethernet_t::HEADER_SIZE));
+    });
+
+    _bench("cursor.drop", 1000000, [&cursor](size_t n_ops) {
+        for (size_t i = 0; i < n_ops; i++)
+            _keep(cursor.drop(mock_phys_t::ethernet_t::HEADER_SIZE));
+    });
+
+    _bench("cursor.read_with", 1000000, [&cursor](size_t n_ops) {
+        typedef mock_phys_t::ethernet_t::header_t header_t;
+
+        for (size_t i = 0; i < n_ops; i++) {
+            _keep(
+                cursor.read_with<header_t, uint16_t>(
+                [](const header_t *hdr, cursor_t payload) {
+                    return hdr->type.net;
+                })
+            );
+        }
+    });
+
+    _bench("cursor.write", 1000000, [&cursor](size_t n_ops) {
+        char data[64] = { 0 };
+
+        for (size_t i = 0; i < n_ops; i++)
+            _keep(cursor.write(data, sizeof (data)));
+    });
+}
+
+static void _bench_checksum(void)
+{
+    char *data = new char[PRECOMPUTED_SIZE];
+
+    uint64_t random_state = 1;
+    for (size_t i = 0; i < PRECOMPUTED_SIZE; i++)
+        data[i] = (char) _random(&random_state);
+
+    _bench("checksum.sum_64", 1000000, [data](size_t n_ops) {
+        for (size_t i = 0; i < n_ops; i++)
+            _keep(_ones_complement_sum(data + (i & 0xFF), 64));
+    });
+
+    // The payload of a standard TCP segment.
+    _bench("checksum.sum_1460", 200000, [data](size_t n_ops) {
+        for (size_t i = 0; i < n_ops; i++)
+            _keep(_ones_complement_sum(data + (i & 0xFF), 1460));
+    });
+
+    precomputed_sums_t sums(data, PRECOMPUTED_SIZE);
+
+    vector<pair<size_t, size_t>> ranges;
+    for (size_t i = 0; i < N_RANDOM; i++) {
+        size_t begin = _random(&random_state) % PRECOMPUTED_SIZE;
+        size_t end   = _random(&random_state) % PRECOMPUTED_SIZE;
+        ranges.emplace_back(min(begin, end), max(begin, end));
+    }
+
+    _bench("checksum.precomputed_sum", 1000000, [&sums, &ranges](size_t n_ops) {
+        for (size_t i = 0; i < n_ops; i++) {
+            const pair<size_t, size_t> &range = ranges[i % N_RANDOM];
+            _keep(sums.sum(range.first, range.second));
+        }
+    });
+
+    delete[] data;
+}
+
+static void _bench_timers(void)
+{
+    mock_phys_t::timer_manager_t timers;
+
+    // Timers which don't expire during the benchmark.
+    _bench("timer.schedule_remove", 1000000, [&timers](size_t n_ops) {
+        cpu_clock_t::interval_t delay(1000000);
+
+        for (size_t i = 0; i < n_ops; i++) {
+            auto timer_id = timers.schedule(delay, []() { });
+            timers.remove(timer_id);
+        }
+    });
+
+    // Expired timers, executed by bursts as in a worker loop.
+    _bench("timer.schedule_tick", 1000000, [&timers](size_t n_ops) {
+        static constexpr size_t BURST_SIZE = 64;
+
+        size_t n_executed = 0;
+
+        for (size_t i = 0; i < n_ops; i += BURST_SIZE) {
+            for (size_t j = 0; j < BURST_SIZE; j++) {
+                timers.schedule(
+                    cpu_clock_t::interval_t(), [&n_executed]() { n_executed++; }
+                );
+            }
+
+            timers.tick();
+        }
+
+        _keep(n_executed);
+    });
+}
+
+static void _bench_tcb_lookup(void)
+{
+    net_t<mock_phys_t::ipv4_t::addr_t>   addr        = _ipv4_addr("10.0.0.1"),
+                            server_addr = _ipv4_addr("10.0.0.2");
+
+    mock_phys_t phys;
+    phys.init(_ether_addr(1), { addr }, { { server_addr, _ether_addr(2) } });
+
+    mock_phys_t::tcp_t *tcp = &phys.ethernet.ipv4.tcp;
+
+    // Fills the table with connections in the SYN-SENT state. Their SYN
+    // segments are dropped.
+
+    mock_phys_t::tcp_t::conn_handlers_t handlers;
+    handlers.new_data       = [](cursor_t) { };
+    handlers.remote_close   = []() { };
+    handlers.close          = []() { };
+    handlers.reset          = []() { };
+
+    vector<mock_phys_t::tcp_t::tcb_id_t> tcb_ids;
+
+    for (size_t i = 0; i < N_TCBS; i++) {
+        mock_phys_t::tcp_t::port_t   port = 1024 + i;
+        mock_phys_t::tcp_t::conn_t   conn;
+
+        if (!tcp->connect(addr, port, server_addr, 80, handlers, &conn))
+            BENCH_DIE("Failed to open connection %zu", i);
+
+        tcb_ids.push_back(conn.tcb_id);
+    }
+
+    vector<mock_phys_t::tcp_t::tcb_id_t> lookups;
+    uint64_t random_state = 1;
+    for (size_t i = 0; i < N_RANDOM; i++)
+        lookups.push_back(tcb_ids[_random(&random_state) % N_TCBS]);
+
+    _bench("tcp.tcb_lookup", 1000000, [tcp, &lookups](size_t n_ops) {
+        for (size_t i = 0; i < n_ops; i++)
+            _keep(tcp->tcbs.find(lookups[i % N_RANDOM])->second);
+    });
+}
+
+static void _bench_arp(void)
+{
+    net_t<mock_phys_t::ipv4_t::addr_t> addr = _ipv4_addr("10.0.0.1");
+
+    // Resolves addresses among 256 static entries.
+
+    vector<mock_phys_t::arp_ipv4_t::static_entry_t> entries;
+    for (size_t i = 0; i < 256; i++) {
+        struct in_addr in_addr;
+        in_addr.s_addr = htonl((10 << 24) | (1 << 16) | i);
+
+        entries.push_back(
+            { ipv4_addr_t::from_in_addr(in_addr), _ether_addr((uint8_t) i) }
+        );
+    }
+
+    mock_phys_t phys;
+    phys.init(_ether_addr(1), { addr }, entries);
+
+    mock_phys_t::arp_ipv4_t *arp = &phys.ethernet.arp;
+
+    _bench("arp.lookup", 1000000, [arp, &entries](size_t n_ops) {
+        for (size_t i = 0; i < n_ops; i++) {
+            arp->with_data_link_addr(
+                entries[i & 0xFF].proto_addr,
+                [](const net_t<mock_phys_t::ethernet_t::addr_t> *ether_addr) {
+                    _keep(*ether_addr);
+                }
+            );
+        }
+    });
+}
+
+static void _bench_write_headers(void)
+{
+    net_t<mock_phys_t::ipv4_t::addr_t>   addr        = _ipv4_addr("10.0.0.1"),
+                            server_addr = _ipv4_addr("10.0.0.2");
+    net_t<mock_phys_t::ethernet_t::addr_t> server_ether = _ether_addr(2);
+
+    mock_phys_t phys;
+    phys.init(_ether_addr(1), { addr }, { { server_addr, server_ether } });
+
+    // Frames are written in the buffer of dropped frames.
+
+    _bench("ethernet.write_header", 1000000, [&](size_t n_ops) {
+        for (size_t i = 0; i < n_ops; i++) {
+            phys.ethernet.send_ip_payload(
+                server_ether, mock_phys_t::ipv4_t::HEADER_SIZE,
+                [](cursor_t payload) { }
+            );
+        }
+    });
+
+    // Includes the ARP resolution of the destination.
+    _bench("ipv4.write_header", 1000000, [&](size_t n_ops) {
+        for (size_t i = 0; i < n_ops; i++) {
+            phys.ethernet.ipv4.send_tcp_payload(
+                addr, server_addr, mock_phys_t::tcp_t::HEADER_SIZE,
+                [](cursor_t payload) { }
+            );
+        }
+    });
+}
+
+static void _bench_receive(void)
+{
+    net_t<mock_phys_t::ipv4_t::addr_t>   client_addr = _ipv4_addr("10.0.0.1"),
+                            server_addr = _ipv4_addr("10.0.0.2");
+    net_t<mock_phys_t::ethernet_t::addr_t>
+                            client_ether = _ether_addr(1),
+                            server_ether = _ether_addr(2);
+
+    mock_phys_t client, server;
+    client.init(
+        client_ether, { client_addr }, { { server_addr, server_ether } }
+    );
+    server.init(
+        server_ether, { server_addr }, { { client_addr, client_ether } }
+    );
+
+    // Connects the two instances with a queue of frames, and keeps a copy of
+    // the last frame sent by the client.
+
+    deque<pair<mock_phys_t *, pair<char *, size_t>>> wire;
+
+    char    *last_frame         = mock_phys_t::alloc_frame(
+                                    mock_phys_t::STANDARD_FRAME_SIZE
+                                  );
+    size_t  last_frame_size     = 0;
+
+    client.transmit = [&](char *frame, size_t size) {
+        memcpy(last_frame, frame, size);
+        last_frame_size = size;
+
+        wire.push_back({ &server, { frame, size } });
+    };
+
+    server.transmit = [&](char *frame, size_t size) {
+        wire.push_back({ &client, { frame, size } });
+    };
+
+    mock_phys_t::tcp_t::conn_handlers_t handlers;
+    handlers.new_data       = [](cursor_t) { };
+    handlers.remote_close   = []() { };
+    handlers.close          = []() { };
+    handlers.reset          = []() { };
+
+    bool is_established = false;
+
+    server.ethernet.ipv4.tcp.listen(
+        80, [&handlers, &is_established](mock_phys_t::tcp_t::conn_t conn) {
+            is_established = true;
+            return handlers;
+        }
+    );
+
+    mock_phys_t::tcp_t::conn_t conn;
+    client.ethernet.ipv4.tcp.connect(
+        client_addr, 1024, server_addr, 80, handlers, &conn
+    );
+
+    while (!wire.empty()) {
+        auto packet = wire.front();
+        wire.pop_front();
+
+        packet.first->receive(packet.second.first, packet.second.second);
+    }
+
+    if (!is_established)
+        BENCH_DIE("Failed to establish the connection");
+
+    // The last frame sent by the client is the ACK segment of the three-way
+    // handshake. The server receives it again and again as a pure ACK, which
+    // doesn't trigger any response. Measures the whole receive path: the
+    // Ethernet, IPv4 and TCP headers and their checksums, and the TCB lookup.
+
+    _bench("receive.tcp_ack", 1000000, [&](size_t n_ops) {
+        for (size_t i = 0; i < n_ops; i++) {
+            cursor_t frame = mock_phys_t::frame_cursor(
+                last_frame, last_frame_size, false
+            );
+
+            server.ethernet.receive_frames(&frame, 1);
+            server.ethernet.end_receive_burst();
+        }
+    });
+
+    // Bursts of 16 frames, as mPIPE gives them to a worker. The first burst
+    // only holds the pure ACK, and takes the fast paths of the Ethernet and
+    // IPv4 layers. The mixed burst also holds an ARP request, a fragment, a
+    // datagram with IP options and a datagram to another host, which fall back
+    // to the per-frame paths. Its frames are also received one by one, to be
+    // compared with the burst.
+
+    vector<frame_t> mixed = _slow_path_frames(
+        last_frame, last_frame_size, _ipv4_addr("10.0.0.3")
+    );
+    size_t n_slow = mixed.size();
+
+    while (mixed.size() < BURST_SIZE)
+        mixed.insert(mixed.begin(), { last_frame, last_frame_size });
+
+    vector<frame_t> acks(BURST_SIZE, frame_t(last_frame, last_frame_size));
+
+    auto receive_bursts = [&server](
+        const vector<frame_t> &frames, size_t burst_size, size_t n_ops
+    ) {
+        cursor_t cursors[BURST_SIZE];
+
+        for (size_t i = 0; i < n_ops; i += burst_size) {
+            for (size_t j = 0; j < burst_size; j++) {
+                const frame_t &frame = frames[(i + j) % frames.size()];
+                cursors[j] = mock_phys_t::frame_cursor(
+                    frame.first, frame.second, false
+                );
+            }
+
+            server.ethernet.receive_frames(cursors, burst_size);
+            server.ethernet.end_receive_burst();
+        }
+    };
+
+    int saved_stderr = _silence_stderr();
+
+    // Only the ARP request is answered.
+    size_t n_replies = 0;
+    server.transmit = [&n_replies](char *frame, size_t) {
+        n_replies++;
+        free(frame);
+    };
+
+    receive_bursts(mixed, BURST_SIZE, BURST_SIZE);
+    receive_bursts(acks, BURST_SIZE, BURST_SIZE);
+
+    if (n_replies != 1) {
+        _restore_stderr(saved_stderr);
+        BENCH_DIE("%zu responses to the receive bursts", n_replies);
+    }
+
+    server.transmit = nullptr;
+
+    _bench(
+        "receive.burst_tcp_ack", BURST_SIZE * 62500,
+        [&receive_bursts, &acks](size_t n_ops) {
+            receive_bursts(acks, BURST_SIZE, n_ops);
+        }
+    );
+
+    _bench(
+        "receive.burst_mixed", BURST_SIZE * 62500,
+        [&receive_bursts, &mixed](size_t n_ops) {
+            receive_bursts(mixed, BURST_SIZE, n_ops);
+        }
+    );
+
+    _bench(
+        "receive.mixed_one_by_one", BURST_SIZE * 62500,
+        [&receive_bursts, &mixed](size_t n_ops) {
+            receive_bursts(mixed, 1, n_ops);
+        }
+    );
+
+    _restore_stderr(saved_stderr);
+
+    for (size_t i = BURST_SIZE - n_slow; i < BURST_SIZE; i++)
+        free(mixed[i].first);
+
+    free(last_frame);
+}
+
+static void _bench_http_parser(void)
+{
+    // Requests as sent by a command line client, by a browser, by an HTTP/1.0
+    // client, and conditional and range requests.
+    static const char *REQUESTS[] = {
+        "GET /pages/96.htm HTTP/1.1\r\n"
+        "Host: 10.0.2.2\r\n"
+        "User-Agent: curl/7.38.0\r\n"
+        "Accept: */*\r\n"
+        "\r\n",
+
+        "GET /pages/436.htm HTTP/1.1\r\n"
+        "Host: 10.0.2.2\r\n"
+        "Connection: keep-alive\r\n"
+        "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,"
+        "image/webp,*/*;q=0.8\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 "
+        "(KHTML, like Gecko) Chrome/45.0.2454.85 Safari/537.36\r\n"
+        "Accept-Encoding: gzip, deflate, sdch\r\n"
+        "Accept-Language: en-US,en;q=0.8,fr;q=0.6\r\n"
+        "\r\n",
+
+        "GET /pages/12.htm HTTP/1.0\r\n"
+        "Connection: Keep-Alive\r\n"
+        "\r\n",
+
+        "GET /pages/301.htm HTTP/1.1\r\n"
+        "Host: 10.0.2.2\r\n"
+        "Accept-Encoding: br, gzip\r\n"
+        "If-None-Match: \"1f3a-54c3b2e1\"\r\n"
+        "If-Modified-Since: Sat, 24 Jan 2015 16:42:09 GMT\r\n"
+        "\r\n",
+
+        "GET /pages/7.htm?lang=en HTTP/1.1\r\n"
+        "Host: 10.0.2.2\r\n"
+        "Range: bytes=1024-\r\n"
+        "If-Range: \"1f3a-54c3b2e1\"\r\n"
+        "Connection: close\r\n"
+        "\r\n"
+    };
+
+    static constexpr size_t N_REQUESTS = sizeof (REQUESTS) / sizeof (char *);
+
+    size_t request_lens[N_REQUESTS];
+    for (size_t i = 0; i < N_REQUESTS; i++)
+        request_lens[i] = strlen(REQUESTS[i]);
+
+    // Both parsers must accept every request.
+    for (size_t i = 0; i < N_REQUESTS; i++) {
+        http_parser_t   parser;
+        http_request_t  request;
+        size_t          request_size;
+
+        const char      *path;
+        size_t          path_len;
+        bool            keep_alive;
+
+        if (
+               parser.parse(
+                   REQUESTS[i], request_lens[i], &request, &request_size
+               ) != http_parser_t::COMPLETE
+            || !_legacy_parse_request(
+                   REQUESTS[i], request_lens[i], &path, &path_len, &keep_alive,
+                   &request_size
+               )
+        )
+            BENCH_DIE("Failed to parse request %zu", i);
+    }
+
+    // Finds the end of each line of the browser request.
+
+    const char *lines       = REQUESTS[1];
+    const char *lines_end   = lines + request_lens[1];
+
+    _bench("http.find_char", 1000000, [lines, lines_end](size_t n_ops) {
+        for (size_t i = 0; i < n_ops; i++) {
+            const char *p = lines;
+            while ((p = http_parser_t::find_char(p, lines_end, '\n')))
+                p++;
+            _keep(p);
+        }
+    });
+
+    _bench("http.find_char_memchr", 1000000, [lines, lines_end](size_t n_ops) {
+        for (size_t i = 0; i < n_ops; i++) {
+            const char *p = lines;
+            while ((p = (const char *) memchr(p, '\n', lines_end - p)))
+                p++;
+            _keep(p);
+        }
+    });
+
+    // Parses the requests in turn.
+
+    _bench("http.parse", 1000000, [&request_lens](size_t n_ops) {
+        http_parser_t   parser;
+        http_request_t  request;
+        size_t          request_size;
+
+        for (size_t i = 0; i < n_ops; i++) {
+            size_t j = i % N_REQUESTS;
+            _keep(
+                parser.parse(
+                    REQUESTS[j], request_lens[j], &request, &request_size
+                )
+            );
+        }
+    });
+
+    _bench("http.parse_legacy", 1000000, [&request_lens](size_t n_ops) {
+        const char      *path;
+        size_t          path_len;
+        bool            keep_alive;
+        size_t          request_size;
+
+        for (size_t i = 0; i < n_ops; i++) {
+            size_t j = i % N_REQUESTS;
+            _keep(
+                _legacy_parse_request(
+                    REQUESTS[j], request_lens[j], &path, &path_len,
+                    &keep_alive, &request_size
+                )
+            );
+        }
+    });
+
+    // Receives the browser request in three segments. The parser is called
+    // after each segment, with all the bytes received so far.
+
+    size_t split_sizes[] = {
+        request_lens[1] / 3, request_lens[1] * 2 / 3, request_lens[1]
+    };
+
+    _bench("http.parse_split", 1000000, [lines, &split_sizes](size_t n_ops) {
+        http_parser_t   parser;
+        http_request_t  request;
+        size_t          request_size;
+
+        for (size_t i = 0; i < n_ops; i++) {
+            for (size_t size : split_sizes)
+                _keep(parser.parse(lines, size, &request, &request_size));
+        }
+    });
+
+    _bench(
+        "http.parse_split_legacy", 1000000, [lines, &split_sizes](size_t n_ops)
+        {
+            const char      *path;
+            size_t          path_len;
+            bool            keep_alive;
+            size_t          request_size;
+
+            for (size_t i = 0; i < n_ops; i++) {
+                for (size_t size : split_sizes) {
+                    _keep(
+                        _legacy_parse_request(
+                            lines, size, &path, &path_len, &keep_alive,
+                            &request_size
+                        )
+                    );
+                }
+            }
+        }
+    );
+}
+
+static void _bench_file_index(void)
+{
+    char key[64];
+
+    // 'bench/pages' names its files '<n>.htm'.
+    string pages;
+    for (size_t i = 0; i < N_PAGES; i++) {
+        pages.append(key, snprintf(key, sizeof (key), "%zu.htm", i));
+        pages.push_back('\0');
+    }
+
+    _bench_file_index_lookups(
+        "file_index.500.hit", "file_index.500.miss", pages, N_PAGES
+    );
+
+    // Files spread in 1,000 directories, as the assets of a large site.
+    string site;
+    site.reserve(N_SITE_FILES * 32);
+    for (size_t i = 0; i < N_SITE_FILES; i++) {
+        site.append(
+            key,
+            snprintf(
+                key, sizeof (key), "assets/%03zu/img-%07zu.png",
+                i % 1000, i
+            )
+        );
+        site.push_back('\0');
+    }
+
+    _bench_file_index_lookups(
+        "file_index.1m.hit", "file_index.1m.miss", site, N_SITE_FILES
+    );
+}
+
+static void _bench_file_index_lookups(
+    const char *name_hit, const char *name_miss, const string &keys,
+    size_t n_keys
+)
+{
+    typedef pair<const char *, size_t> key_ref_t;
+
+    vector<key_ref_t> all_keys;
+    all_keys.reserve(n_keys);
+
+    file_index_t<size_t> index;
+
+    for (const char *key = keys.data(); all_keys.size() < n_keys; ) {
+        size_t key_len = strlen(key);
+
+        if (!index.insert(key, key_len, all_keys.size()))
+            BENCH_DIE("Duplicated key \"%s\"", key);
+
+        all_keys.emplace_back(key, key_len);
+        key += key_len + 1;
+    }
+
+    uint64_t random_state = 1;
+
+    vector<key_ref_t> hits;
+    for (size_t i = 0; i < N_RANDOM; i++)
+        hits.push_back(all_keys[_random(&random_state) % n_keys]);
+
+    // Missing keys only differ from existing keys by their last character.
+    vector<string> miss_strings;
+    for (size_t i = 0; i < N_RANDOM; i++) {
+        const key_ref_t &key = all_keys[_random(&random_state) % n_keys];
+
+        string miss(key.first, key.second);
+        miss[miss.size() - 1] = '_';
+        miss_strings.push_back(miss);
+    }
+
+    vector<key_ref_t> misses;
+    for (const string &miss : miss_strings)
+        misses.emplace_back(miss.data(), miss.size());
+
+    for (const key_ref_t &key : hits) {
+        if (index.find(key.first, key.second) == nullptr)
+            BENCH_DIE("Indexed key not found");
+    }
+
+    for (const key_ref_t &key : misses) {
+        if (index.find(key.first, key.second) != nullptr)
+            BENCH_DIE("Missing key found");
+    }
+
+    _bench(name_hit, 1000000, [&index, &hits](size_t n_ops) {
+        for (size_t i = 0; i < n_ops; i++) {
+            const key_ref_t &key = hits[i % N_RANDOM];
+            _keep(index.find(key.first, key.second));
+        }
+    });
+
+    _bench(name_miss, 1000000, [&index, &misses](size_t n_ops) {
+        for (size_t i = 0; i < n_ops; i++) {
+            const key_ref_t &key = misses[i % N_RANDOM];
+            _keep(index.find(key.first, key.second));
+        }
+    });
+}
+
+static void _bench_content(void)
+{
+    if (args.pages == nullptr)
+        return;
+
+    files_t files;
+
+    // 'preload_files()' reports its progress on the standard error.
+    int saved_stderr = _silence_stderr();
+    preload_files(&files, args.pages, 1);
+    _restore_stderr(saved_stderr);
+
+    if (files.size() == 0)
+        BENCH_DIE("No file in %s", args.pages);
+
+    // Responses are cut in segments of the MSS of Ethernet frames, which are
+    // written in a frame, as TCP does. An operation is a whole response.
+    size_t mss = SEGMENT_SIZES[0];
+    char *frame = mock_phys_t::alloc_frame(mss);
+
+    // Partial sums of the segments taken from the tables of the response.
+    _bench(
+        "content.response_precomputed", files.size(),
+        [&files, mss, frame](size_t n_ops) {
+            for (size_t i = 0; i < n_ops; i++) {
+                const file_t        *file       = &files.values[
+                                                    i % files.size()
+                                                  ];
+                const response_t    *response   = &file->responses[1];
+
+                for (size_t begin = 0; begin < response->len; begin += mss) {
+                    size_t end = min(begin + mss, response->len);
+
+                    _keep(response_sum(file, response, begin, end));
+
+                    write_static_response(
+                        file, response, begin,
+                        mock_phys_t::frame_cursor(frame, end - begin, false)
+                    );
+                }
+            }
+        }
+    );
+
+    // Partial sums computed on the written segments, as without
+    // USE_PRECOMPUTED_CHECKSUMS.
+    _bench(
+        "content.response_computed", files.size(),
+        [&files, mss, frame](size_t n_ops) {
+            for (size_t i = 0; i < n_ops; i++) {
+                const file_t        *file       = &files.values[
+                                                    i % files.size()
+                                                  ];
+                const response_t    *response   = &file->responses[1];
+
+                for (size_t begin = 0; begin < response->len; begin += mss) {
+                    size_t end = min(begin + mss, response->len);
+
+                    write_static_response(
+                        file, response, begin,
+                        mock_phys_t::frame_cursor(frame, end - begin, false)
+                    );
+
+                    _keep(partial_sum_t(frame, end - begin));
+                }
+            }
+        }
+    );
+
+    free(frame);
+
+    // Loads the whole directory with an increasing number of threads. An
+    // operation is a file.
+    static const pair<const char *, size_t> PRELOADS[] = {
+        { "content.preload_1_thread",   1 },
+        { "content.preload_2_threads",  2 },
+        { "content.preload_4_threads",  4 },
+    };
+
+    for (const pair<const char *, size_t> &preload : PRELOADS) {
+        size_t n_threads = preload.second;
+
+        _bench(preload.first, files.size(), [n_threads](size_t n_ops) {
+            files_t loaded;
+
+            int saved_stderr = _silence_stderr();
+            preload_files(&loaded, args.pages, n_threads);
+            _restore_stderr(saved_stderr);
+
+            free_files(&loaded);
+        });
+    }
+
+    // Finds the file of each request, as httpd did before 'http/server.hpp',
+    // and as 'server_t' does, whose router only holds the status route of
+    // httpd and falls back to the files. An operation is a request.
+    vector<str_ref_t> paths;
+    for (const files_t::slot_t &slot : files.slots) {
+        if (slot.key != nullptr)
+            paths.emplace_back(slot.key, slot.key_len);
+    }
+
+    _bench("content.dispatch_direct", 1000000, [&files, &paths](size_t n_ops) {
+        for (size_t i = 0; i < n_ops; i++) {
+            const str_ref_t &path = paths[i % paths.size()];
+            _keep(files.find(path.data, path.len));
+        }
+    });
+
+    router_t<size_t> router;
+    router.add("/__status", 0);
+
+    _bench(
+        "content.dispatch_router", 1000000,
+        [&files, &paths, &router](size_t n_ops) {
+            for (size_t i = 0; i < n_ops; i++) {
+                const str_ref_t &path = paths[i % paths.size()];
+
+                const size_t *route = router.find(path.data, path.len);
+                if (route == nullptr)
+                    _keep(files.find(path.data, path.len));
+                else
+                    _keep(route);
+            }
+        }
+    );
+
+    _bench_content_serve(&files);
+
+    free_files(&files);
+}
+
+static void _bench_content_serve(const files_t *files)
+{
+    vector<size_t> small_files;
+    for (size_t i = 0; i < files->size(); i++) {
+        const file_t *file = &files->values[i];
+
+        if (!file->streamed && file->content_len <= REPLICATED_SIZE)
+            small_files.push_back(i);
+    }
+
+    if (small_files.empty())
+        return;
+
+    // An operation is a response, whatever the thread sending it. Each run
+    // sends the small files 64 times, so that starting the threads is
+    // negligible.
+    static const pair<const char *, size_t> SERVES[] = {
+        { "content.serve_shared_1_thread",      1 },
+        { "content.serve_shared_2_threads",     2 },
+        { "content.serve_shared_4_threads",     4 },
+        { "content.serve_replicas_1_thread",    1 },
+        { "content.serve_replicas_2_threads",   2 },
+        { "content.serve_replicas_4_threads",   4 },
+    };
+
+    for (const pair<const char *, size_t> &serve : SERVES) {
+        size_t  n_threads   = serve.second;
+        bool    replicated  = strstr(serve.first, "replicas") != nullptr;
+
+        // Replicas are made before the timed runs, as httpd does when it
+        // loads the files.
+        vector<replica_t *> replicas(n_threads, nullptr);
+        if (replicated) {
+            for (size_t i = 0; i < n_threads; i++) {
+                replicas[i] = replicate_files(files, REPLICATED_SIZE, i);
+
+                if (replicas[i] == nullptr)
+                    BENCH_DIE("Unable to replicate the files");
+            }
+        }
+
+        _bench(
+            serve.first, small_files.size() * 64,
+            [files, &small_files, &replicas, n_threads](size_t n_ops) {
+                vector<serve_thread_t> threads(n_threads);
+
+                for (size_t i = 0; i < n_threads; i++) {
+                    serve_thread_t *thread = &threads[i];
+
+                    thread->files       =   replicas[i] != nullptr
+                                          ? &replicas[i]->files : files;
+                    thread->small_files = &small_files;
+                    thread->n_ops       = n_ops / n_threads;
+
+                    if (
+                        pthread_create(
+                            &thread->thread, nullptr, _serve_main, thread
+                        ) != 0
+                    )
+                        BENCH_DIE("Unable to start a serving thread");
+                }
+
+                for (serve_thread_t &thread : threads)
+                    pthread_join(thread.thread, nullptr);
+            }
+        );
+
+        for (replica_t *replica : replicas) {
+            if (replica != nullptr)
+                free_replica(replica);
+        }
+    }
+}
+
+static void *_serve_main(void *serve_thread)
+{
+    const serve_thread_t *thread = (const serve_thread_t *) serve_thread;
+
+    const files_t           *files          = thread->files;
+    const vector<size_t>    &small_files    = *thread->small_files;
+
+    size_t mss = SEGMENT_SIZES[0];
+    char *frame = mock_phys_t::alloc_frame(mss);
+
+    for (size_t i = 0; i < thread->n_ops; i++) {
+        const file_t        *file       = &files->values[
+                                            small_files[i % small_files.size()]
+                                          ];
+        const response_t    *response   = &file->responses[1];
+
+        for (size_t begin = 0; begin < response->len; begin += mss) {
+            size_t end = min(begin + mss, response->len);
+
+            _keep(response_sum(file, response, begin, end));
+
+            write_static_response(
+                file, response, begin,
+                mock_phys_t::frame_cursor(frame, end - begin, false)
+            );
+        }
+    }
+
+    free(frame);
+
+    return nullptr;
+}
+
+static void _write_json(void)
+{
+    printf("{\n  \"benchmarks\": [\n");
+
+    for (size_t i = 0; i < results.size(); i++) {
+        const result_t &result = results[i];
+
+        string perf;
+        if (result.perf.is_available()) {
+            char ipc[32];
+            snprintf(ipc, sizeof (ipc), "{ \"ipc\": %.2f, ", result.perf.ipc());
+
+            perf = ipc;
+            result.perf.write_json(&perf, "op", result.n_ops);
+            perf += " }";
+        } else
+            perf = "null";
+
+        printf(
+            "    { \"name\": \"%s\", \"ops\": %zu, \"ns_per_op\": %.2f, "
+            "\"cycles_per_op\": %.2f, \"perf\": %s }%s\n",
+            result.name, result.n_ops, result.ns_per_op, result.cycles_per_op,
+            perf.c_str(), i + 1 < results.size() ? "," : ""
+        );
+    }
+
+    printf("  ]\n}\n");
+}
+
+static net_t<mock_phys_t::ipv4_t::addr_t> _ipv4_addr(const char *addr)
+{
+    struct in_addr in_addr;
+    int ret = inet_aton(addr, &in_addr);
+    assert(ret == 1);
+    (void) ret;
+
+    return ipv4_addr_t::from_in_addr(in_addr);
+}
+
+static net_t<mock_phys_t::ethernet_t::addr_t> _ether_addr(uint8_t last_byte)
+{
+    net_t<mock_phys_t::ethernet_t::addr_t> addr;
+    uint8_t bytes[] = { 0x02, 0x00, 0x00, 0x00, 0x00, last_byte };
+    memcpy(addr.net.value, bytes, sizeof (bytes));
+    return addr;
+}
+
+static vector<frame_t> _slow_path_frames(
+    const char *frame, size_t size,
+    net_t<mock_phys_t::ipv4_t::addr_t> non_local_addr
+)
+{
+    static constexpr size_t ETHER_SIZE  = sizeof (ether_header_t),
+                            IPV4_SIZE   = sizeof (ipv4_header_t);
+
+    // IP options are four 'No Operation' options.
+    static constexpr size_t OPTIONS_SIZE = 4;
+
+    const ether_header_t *ether = (const ether_header_t *) frame;
+    const ipv4_header_t  *ip    = (const ipv4_header_t *) (frame + ETHER_SIZE);
+
+    vector<frame_t> frames;
+
+    // ARP request.
+
+    size_t arp_size = ETHER_SIZE + sizeof (arp_message_t);
+    char *arp = mock_phys_t::alloc_frame(arp_size);
+
+    ether_header_t *arp_ether   = (ether_header_t *) arp;
+    arp_ether->dhost            = mock_phys_t::ethernet_t::BROADCAST_ADDR;
+    arp_ether->shost            = ether->shost;
+    arp_ether->type             = ETHERTYPE_ARP_NET;
+
+    arp_message_t *msg  = (arp_message_t *) (arp + ETHER_SIZE);
+    msg->hdr.hrd        = net_t<uint16_t>(ARPHRD_ETHER);
+    msg->hdr.pro        = net_t<uint16_t>(ETHERTYPE_IP);
+    msg->hdr.hln        = (uint8_t) mock_phys_t::ethernet_t::ADDR_LEN;
+    msg->hdr.pln        = (uint8_t) mock_phys_t::ipv4_t::ADDR_LEN;
+    msg->hdr.op         = ARPOP_REQUEST_NET;
+    msg->sha            = ether->shost;
+    msg->spa            = ip->saddr;
+    memset(msg->tha.net.value, 0, sizeof (msg->tha.net.value));
+    msg->tpa            = ip->daddr;
+
+    frames.push_back({ arp, arp_size });
+
+    // First fragment of the datagram.
+
+    char *fragment = mock_phys_t::alloc_frame(size);
+    memcpy(fragment, frame, size);
+
+    ipv4_header_t *fragment_ip = (ipv4_header_t *) (fragment + ETHER_SIZE);
+    fragment_ip->frag_off = net_t<uint16_t>(IP_MF);
+    _set_ipv4_checksum(fragment);
+
+    frames.push_back({ fragment, size });
+
+    // Datagram with IP options, inserted after the header.
+
+    size_t options_size = size + OPTIONS_SIZE;
+    char *options = mock_phys_t::alloc_frame(options_size);
+    memcpy(options, frame, ETHER_SIZE + IPV4_SIZE);
+    memset(options + ETHER_SIZE + IPV4_SIZE, IPOPT_NOP, OPTIONS_SIZE);
+    memcpy(
+        options + ETHER_SIZE + IPV4_SIZE + OPTIONS_SIZE,
+        frame + ETHER_SIZE + IPV4_SIZE, size - ETHER_SIZE - IPV4_SIZE
+    );
+
+    ipv4_header_t *options_ip = (ipv4_header_t *) (options + ETHER_SIZE);
+    options_ip->ihl     = (IPV4_SIZE + OPTIONS_SIZE) / sizeof (uint32_t);
+    options_ip->tot_len = net_t<uint16_t>(ip->tot_len.host() + OPTIONS_SIZE);
+    _set_ipv4_checksum(options);
+
+    frames.push_back({ options, options_size });
+
+    // Datagram to another host.
+
+    char *non_local = mock_phys_t::alloc_frame(size);
+    memcpy(non_local, frame, size);
+
+    ipv4_header_t *non_local_ip = (ipv4_header_t *) (non_local + ETHER_SIZE);
+    non_local_ip->daddr = non_local_addr;
+    _set_ipv4_checksum(non_local);
+
+    frames.push_back({ non_local, size });
+
+    return frames;
+}
+
+static void _set_ipv4_checksum(char *frame)
+{
+    ipv4_header_t *ip = (ipv4_header_t *) (frame + sizeof (ether_header_t));
+    size_t header_size = ip->ihl * sizeof (uint32_t);
+
+    ip->check = checksum_t::ZERO;
+    ip->check = checksum_t(ip, header_size);
+}
+
+static int _silence_stderr(void)
+{
+    fflush(stderr);
+
+    int saved_stderr    = dup(STDERR_FILENO);
+    int null            = open("/dev/null", O_WRONLY);
+
+    if (saved_stderr < 0 || null < 0)
+        BENCH_DIE("Failed to redirect the standard error");
+
+    dup2(null, STDERR_FILENO);
+    close(null);
+
+    return saved_stderr;
+}
+
+static void _restore_stderr(int saved_stderr)
+{
+    fflush(stderr);
+
+    dup2(saved_stderr, STDERR_FILENO);
+    close(saved_stderr);
+}
+
+#undef BENCH_COLOR
+#undef BENCH_DIE
+
+static bool _legacy_parse_request(
+    const char *buffer, size_t size, const char **path, size_t *path_len,
+    bool *keep_alive, size_t *request_size
+)
+{
+    const char *end = buffer + size;
+
+    // Finds the end of the request header (an empty line).
+
+    const char *header_end = nullptr;
+
+    for (
+        const char *p = (const char *) memchr(buffer, '\n', size);
+        p != nullptr;
+        p = (const char *) memchr(p + 1, '\n', end - p - 1)
+    ) {
+        size_t left = end - p - 1;
+
+        if (left >= 1 && p[1] == '\n') {
+            header_end = p + 2;
+            break;
+        } else if (left >= 2 && p[1] == '\r' && p[2] == '\n') {
+            header_end = p + 3;
+            break;
+        }
+    }
+
+    if (header_end == nullptr)
+        return false;
+
+    // Parses the request line.
+
+    size_t get_len = sizeof ("GET /") - sizeof ('\0');
+
+    if (strncmp(buffer, "GET /", get_len) != 0)
+        return false;
+
+    const char  *path_begin     = buffer + get_len;
+    const char  *path_end       = (const char *) memchr(
+                                        path_begin, ' ', header_end - path_begin
+                                  );
+
+    if (path_end == nullptr)
+        return false;
+
+    const char  *version_begin  = path_end + 1;
+    size_t      version_len     = sizeof ("HTTP/1.X") - sizeof ('\0');
+    const char  *version_end    = version_begin + version_len;
+
+    if (version_end >= header_end)
+        return false;
+
+    if (strncmp(version_begin, "HTTP/1.", version_len - 1) != 0)
+        return false;
+
+    char minor_version = version_end[-1];
+
+    if (minor_version != '0' && minor_version != '1')
+        return false;
+
+    *path       = path_begin;
+    *path_len   = path_end - path_begin;
+    *keep_alive = minor_version == '1';
+
+    // Looks for a 'Connection' header.
+
+    constexpr char  conn_header[]   = "Connection:";
+    size_t          conn_header_len = sizeof (conn_header) - sizeof ('\0');
+
+    const char *line = (const char *) memchr(
+        version_end, '\n', header_end - version_end
+    ) + 1;
+
+    while (line < header_end) {
+        const char *line_end = (const char *) memchr(
+            line, '\n', header_end - line
+        );
+
+        if (
+               (size_t) (line_end - line) > conn_header_len
+            && strncasecmp(line, conn_header, conn_header_len) == 0
+        ) {
+            const char *value = line + conn_header_len;
+            while (value < line_end && (*value == ' ' || *value == '\t'))
+                value++;
+
+            size_t value_len = line_end - value;
+
+            if (value_len >= 5 && strncasecmp(value, "close", 5) == 0)
+                *keep_alive = false;
+            else if (
+                value_len >= 10 && strncasecmp(value, "keep-alive", 10) == 0
+            )
+                *keep_alive = true;
+        }
+
+        line = line_end + 1;
+    }
+
+    *request_size = header_end - buffer;
+
+    return true;
+}
@@ -0,0 +1,287 @@
+//
+// Physical layer which runs the network stack on the host, without mPIPE.
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __RUSTY_BENCH_MOCK_PHYS_HPP__
+#define __RUSTY_BENCH_MOCK_PHYS_HPP__
+
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>              // aligned_alloc(), free()
+#include <functional>
+#include <memory>               // allocator
+#include <vector>
+
+#include <net/ethernet.h>       // ETH_FRAME_LEN, ETH_HLEN
+
+#include <gxio/mpipe.h>         // gxio_mpipe_bdesc_t
+
+#include "driver/buffer.hpp"    // cursor_t
+#include "driver/clock.hpp"     // cpu_clock_t
+#include "driver/cpu.hpp"       // CYCLES_PER_SECOND, cycles_t
+#include "driver/timer.hpp"     // cpu_timer_manager_t
+#include "net/endian.hpp"       // net_t
+#include "net/ethernet.hpp"     // ethernet_t
+
+using namespace std;
+
+using namespace rusty::driver;
+using namespace rusty::driver::cpu;
+
+namespace rusty {
+namespace bench {
+
+// Replaces 'mpipe_t::instance_t' below the Ethernet layer.
+//
+// Frames are stored in host buffers which have the alignment of mPIPE buffers,
+// so cursors are created from buffer descriptors exactly as with mPIPE.
+// Transmitted frames are given to the 'transmit' handler, or dropped.
+//
+// Like an mPIPE link, the instance sends frames of up to 'frame_size' bytes,
+// which is the size of standard Ethernet frames unless jumbo frames are
+// enabled, and receives frames by bursts of at most 'RX_BURST_SIZE' frames.
+//
+// Timers and TCP sequence numbers use the 'clock_var_t' clock, which is
+// 'cpu_clock_t' except in simulations (see 'virtual_clock_t').
+template <typename clock_var_t>
+struct basic_mock_phys_t {
+    //
+    // Member types
+    //
+
+    typedef basic_mock_phys_t<clock_var_t>              this_t;
+
+    typedef allocator<char *>                           alloc_t;
+
+    typedef clock_var_t                                 clock_t;
+    typedef driver::buffer::cursor_t                    cursor_t;
+    typedef cpu_timer_manager_t<alloc_t, clock_t>       timer_manager_t;
+
+    typedef net::ethernet_t<this_t, alloc_t>            ethernet_t;
+    typedef typename ethernet_t::ipv4_ethernet_t        ipv4_t;
+    typedef typename ethernet_t::arp_ethernet_ipv4_t    arp_ipv4_t;
+    typedef typename ipv4_t::tcp_ipv4_t                 tcp_t;
+
+    // Receives the ownership of a transmitted frame, allocated with
+    // 'alloc_frame()'.
+    typedef function<void(char *frame, size_t size)>    transmit_t;
+
+    //
+    // Static fields
+    //
+
+    // Same sizes as 'driver/mpipe.hpp'.
+    static constexpr size_t     STANDARD_FRAME_SIZE = ETH_FRAME_LEN;
+    static constexpr size_t     JUMBO_FRAME_SIZE    = 9000 + ETH_HLEN;
+
+    // Same burst size as 'driver/mpipe.hpp'.
+    static constexpr size_t     RX_BURST_SIZE       = 16;
+
+    // mPIPE buffers are aligned on 128 bytes, as their buffer descriptors don't
+    // store the 7 lower bits of their address.
+    static constexpr size_t     BUFFER_ALIGN        = 128;
+
+    //
+    // Fields
+    //
+
+    ethernet_t                              ethernet;
+
+    timer_manager_t                         timers;
+
+    // Called on each transmitted frame. Frames are dropped if 'nullptr'.
+    transmit_t                              transmit;
+
+    // Maximum size of the frames. Must be set before 'init()', as the MSS of
+    // TCP depends on it.
+    size_t                                  frame_size;
+
+    // Buffer in which dropped frames are written. Large enough for jumbo
+    // frames.
+    char                                    *drop_buffer;
+
+    //
+    // Methods
+    //
+
+    basic_mock_phys_t(size_t _frame_size = STANDARD_FRAME_SIZE)
+        : frame_size(_frame_size), drop_buffer(alloc_frame(JUMBO_FRAME_SIZE))
+    {
+        assert(_frame_size <= JUMBO_FRAME_SIZE);
+    }
+
+    basic_mock_phys_t(const basic_mock_phys_t &) = delete;
+
+    ~basic_mock_phys_t(void)
+    {
+        free(this->drop_buffer);
+    }
+
+    // Initializes the Ethernet layer, and the layers above, with the given
+    // addresses.
+    void init(
+        net_t<typename ethernet_t::addr_t> ether_addr,
+        vector<net_t<typename ipv4_t::addr_t>> ipv4_addrs,
+        vector<typename arp_ipv4_t::static_entry_t> static_arp_entries
+            = vector<typename arp_ipv4_t::static_entry_t>()
+    )
+    {
+        this->ethernet.init(
+            this, &this->timers, ether_addr, ipv4_addrs, static_arp_entries
+        );
+    }
+
+    // Processes a received frame as a burst of a single frame. Takes the
+    // ownership of the frame, which must have been allocated with
+    // 'alloc_frame()'.
+    void receive(char *frame, size_t size)
+    {
+        this->receive_burst(&frame, &size, 1);
+    }
+
+    // Processes the received frames as a single burst, as the mPIPE driver
+    // does with the frames of its ingress queue. Takes the ownership of the
+    // frames, which must have been allocated with 'alloc_frame()'.
+    void receive_burst(char **frames, const size_t *sizes, size_t n_frames)
+    {
+        static_assert(
+            RX_BURST_SIZE <= ethernet_t::MAX_BURST_SIZE,
+            "RX_BURST_SIZE is larger than the maximum burst of ethernet_t"
+        );
+
+        assert(n_frames <= RX_BURST_SIZE);
+
+        cursor_t cursors[RX_BURST_SIZE];
+
+        for (size_t i = 0; i < n_frames; i++)
+            cursors[i] = frame_cursor(frames[i], sizes[i], true);
+
+        this->ethernet.receive_frames(cursors, n_frames);
+        this->ethernet.end_receive_burst();
+    }
+
+    void send_packet(size_t packet_size, function<void(cursor_t)> packet_writer)
+    {
+        assert(packet_size <= this->frame_size);
+
+        if (this->transmit == nullptr) {
+            packet_writer(frame_cursor(this->drop_buffer, packet_size, false));
+            return;
+        }
+
+        char *frame = alloc_frame(packet_size);
+        packet_writer(frame_cursor(frame, packet_size, false));
+        this->transmit(frame, packet_size);
+    }
+
+    void send_packets(
+        size_t n_packets, size_t packet_size, size_t last_packet_size,
+        function<void(size_t, cursor_t)> packet_writer
+    )
+    {
+        for (size_t i = 0; i < n_packets; i++) {
+            size_t size = i + 1 == n_packets ? last_packet_size : packet_size;
+
+            this->send_packet(size, [i, &packet_writer](cursor_t cursor) {
+                packet_writer(i, cursor);
+            });
+        }
+    }
+
+    inline size_t max_packet_size(void)
+    {
+        return this->frame_size;
+    }
+
+    //
+    // Static methods
+    //
+
+    // Same sequence numbers as 'mpipe_t::instance_t', from the cycles of
+    // 'clock_t'.
+    static inline typename tcp_t::seq_t get_current_tcp_seq(void)
+    {
+        static const cycles_t DELAY = CYCLES_PER_SECOND * 4 / 1000000;
+
+        cycles_t cycles = clock_t::time_t::now().cycles;
+        return typename tcp_t::seq_t((uint32_t) cycles / DELAY);
+    }
+
+    // Allocates a buffer able to hold a frame of the given size.
+    static inline char *alloc_frame(size_t size)
+    {
+        size_t rounded = (size + BUFFER_ALIGN - 1) & ~(BUFFER_ALIGN - 1);
+
+        char *frame = (char *) aligned_alloc(BUFFER_ALIGN, rounded);
+        assert(frame != nullptr);
+
+        return frame;
+    }
+
+    // Creates a cursor on a buffer allocated with 'alloc_frame()'.
+    //
+    // If 'managed' is true, the buffer is freed with the last cursor which
+    // refers to it.
+    static inline cursor_t frame_cursor(char *frame, size_t size, bool managed)
+    {
+        gxio_mpipe_bdesc_t bdesc;
+        bdesc.word          = 0;
+        bdesc.va            = (uintptr_t) frame >> 7;
+        bdesc.size          = _buffer_size_enum(size);
+        bdesc.c             = MPIPE_EDMA_DESC_WORD1__C_VAL_UNCHAINED;
+
+        return cursor_t(nullptr, &bdesc, size, managed);
+    }
+
+private:
+    // Returns the smallest mPIPE buffer size able to hold the given frame, as
+    // chained cursors check the size of unchained buffers.
+    static inline gxio_mpipe_buffer_size_enum_t _buffer_size_enum(size_t size)
+    {
+        int size_enum = GXIO_MPIPE_BUFFER_SIZE_128;
+
+        while (
+               size_enum < GXIO_MPIPE_BUFFER_SIZE_16384
+            && gxio_mpipe_buffer_size_enum_to_buffer_size(
+                   (gxio_mpipe_buffer_size_enum_t) size_enum
+               ) < size
+        )
+            size_enum++;
+
+        return (gxio_mpipe_buffer_size_enum_t) size_enum;
+    }
+};
+
+template <typename clock_t>
+constexpr size_t basic_mock_phys_t<clock_t>::STANDARD_FRAME_SIZE;
+
+template <typename clock_t>
+constexpr size_t basic_mock_phys_t<clock_t>::JUMBO_FRAME_SIZE;
+
+template <typename clock_t>
+constexpr size_t basic_mock_phys_t<clock_t>::RX_BURST_SIZE;
+
+template <typename clock_t>
+constexpr size_t basic_mock_phys_t<clock_t>::BUFFER_ALIGN;
+
+typedef basic_mock_phys_t<cpu_clock_t> mock_phys_t;
+
+} } /* namespace rusty::bench */
+
+#endif /* __RUSTY_BENCH_MOCK_PHYS_HPP__ */
@@ -0,0 +1,567 @@
+#!/usr/bin/env python3
+#
+# Performance regression gate of the stack.
+#
+# Runs the micro-benchmarks and a fixed set of simulated scenarios (see
+# 'SCENARIOS'), writes their metrics and a description of the environment in
+# JSON, and compares them against a baseline. Exits with a non-zero status if a
+# metric regressed by more than its threshold.
+#
+# Usage: bench/perf_check.py --build <dir> --pages <dir> --baseline <file>
+#                            [--output <file>] [--repeat <n>] [--update]
+#
+# Normally called by the 'perf-check' and 'perf-baseline' targets of
+# 'bench/CMakeLists.txt'.
+#
+# Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+# University of Liege.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+import argparse
+import datetime
+import gzip
+import json
+import os
+import platform
+import statistics
+import subprocess
+import sys
+
+# Simulated scenarios, as '(name, simulator, arguments of the simulator)'.
+#
+# 'sim_no_super' sends TCP segments one by one, without TCP_SUPER_SEGMENTS.
+# 'sim_coalesce' merges the segments of receive bursts, with
+# TCP_RECEIVE_COALESCING.
+#
+# '{gzip_pages}' in the arguments is replaced by a copy of the pages with a
+# precompressed gzip variant of each file (see '_gzip_pages()'), and
+# '{large_pages}' by a directory with a single multi-GB file (see
+# '_large_pages()').
+SCENARIOS = [
+    ('bulk',            'sim',          ['bulk']),
+    ('bulk_no_super',   'sim_no_super', ['bulk']),
+    ('bulk_jumbo',      'sim',          ['bulk_jumbo']),
+    ('bulk_bursts',     'sim',          ['bulk_bursts']),
+    ('bulk_coalesce',   'sim_coalesce', ['bulk_bursts']),
+    ('rr',              'sim',          ['rr']),
+    ('short',           'sim',          ['short']),
+    ('incast',          'sim',          ['incast']),
+    ('http',            'sim',          ['http']),
+
+    # The same 1,600 requests of 'http', on 16 connections at a time, with 1
+    # and 10 requests per connection instead of 100.
+    ('http_1',          'sim',          ['-n', '1600', '-k', '1', '-c', '16',
+                                         'http']),
+    ('http_10',         'sim',          ['-n', '160', '-k', '10', '-c', '16',
+                                         'http']),
+
+    # 'http' while another thread reloads the pages every 500 ms.
+    ('http_reload',     'sim',          ['-R', '500', 'http']),
+
+    # 'http' with clients accepting the gzip variants of the pages.
+    ('http_gzip',       'sim',          ['-p', '{gzip_pages}', '-e', 'gzip',
+                                         'http']),
+
+    # 'http' with 90% of the requests revalidating a cached copy of the file,
+    # answered with '304 Not Modified'.
+    ('http_revalidate', 'sim',          ['-r', '90', 'http']),
+
+    # 'http' over HTTP/2 without TLS (h2c), to be compared with the HTTP/1.1
+    # persistent connections of 'http'.
+    ('http_h2c',        'sim',          ['-2', 'http']),
+
+    # One request of a file streamed from the page cache, on a 10 Gbps link.
+    ('http_large',      'sim',          ['-p', '{large_pages}', '-n', '1',
+                                         '-k', '1', '-c', '1', '-b',
+                                         '10000', 'http']),
+
+    ('rr_lossy',        'sim',          ['-l', '0.5', 'rr']),
+    ('short_lossy',     'sim',          ['-l', '0.5', 'short']),
+]
+
+# Seed of the simulations.
+SEED = '1'
+
+# Size of the file of '_large_pages()', larger than the 2 GB the sequence
+# numbers of TCP can tell apart.
+LARGE_FILE_SIZE = 3 * 1024 ** 3
+
+# Runs of each benchmark and scenario.
+DEFAULT_REPEAT  = 5
+
+# Metrics measured on the host CPU vary between runs, and a whole run of a
+# benchmark can be disturbed by the other processes of the host. The median
+# runs of the check and of the baseline are compared, and a change is
+# significant when it is larger than this fraction, and than 'NOISE_FACTOR'
+# times the spread of the runs of either (see '_spread()').
+HOST_THRESHOLD  = 0.25
+NOISE_FACTOR    = 2.0
+
+# Metrics of the virtual time are reproducible. Any change larger than the
+# rounding of the reports is significant.
+VIRTUAL_THRESHOLD = 0.005
+
+# Hardware events (see 'driver/perf_counters.hpp') explain a regression but
+# don't fail the check. They are only reported if the host allows counting
+# them.
+PERF_EVENTS = [
+    'instructions', 'cycles', 'l1d_misses', 'llc_misses', 'branch_misses',
+    'dtlb_misses',
+]
+
+# Metrics of the simulator reports, as '(name, path in the report, unit,
+# whether higher is better, whether measured on the host CPU)'.
+SIM_METRICS = [
+    ('goodput',             ('goodput_mbps',),                      'Mbps',
+     True,  False),
+    ('requests_per_s',      ('transactions_per_s',),                'req/s',
+     True,  False),
+    ('p99',                 ('completion_time_us', 'p99'),          'us',
+     False, False),
+    ('retransmissions',     ('retransmissions',),                   'segments',
+     False, False),
+    ('bytes_per_request',   ('bytes_per_transaction',),             'bytes',
+     False, False),
+    ('cycles_per_packet',   ('host', 'cycles_per_frame'),           'cycles',
+     False, True),
+    ('cycles_per_byte',     ('host', 'cycles_per_byte'),            'cycles',
+     False, True),
+    ('cycles_per_request',  ('host', 'cycles_per_transaction'),     'cycles',
+     False, True),
+]
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Compares the performances of the stack to a baseline.'
+    )
+    parser.add_argument(
+        '--build', required=True,
+        help='build directory of the benchmarks, with microbench and the '
+        'simulators'
+    )
+    parser.add_argument(
+        '--pages', required=True,
+        help='directory of the files served by the http scenarios and '
+        'of the content micro-benchmarks'
+    )
+    parser.add_argument(
+        '--baseline', required=True, help='JSON file of the baseline'
+    )
+    parser.add_argument(
+        '--output', help='JSON file of the results (default: '
+        '<build>/perf_results.json)'
+    )
+    parser.add_argument(
+        '--repeat', type=int, default=DEFAULT_REPEAT,
+        help='runs of each benchmark and scenario (default: %d)' %
+        DEFAULT_REPEAT
+    )
+    parser.add_argument(
+        '--update', action='store_true',
+        help='replaces the baseline with the results instead of comparing'
+    )
+    args = parser.parse_args()
+
+    if args.repeat < 1:
+        parser.error('--repeat must be at least 1')
+
+    output = args.output or os.path.join(args.build, 'perf_results.json')
+
+    results = {
+        'environment':  _environment(args.build, args.repeat),
+        'metrics':      _run_micro(args) + _run_sim(args),
+    }
+
+    _write_json(output, results)
+    print('Results written to %s' % output)
+
+    if args.update:
+        _write_json(args.baseline, results)
+        print('Baseline written to %s' % args.baseline)
+        return 0
+
+    if not os.path.exists(args.baseline):
+        print(
+            'No baseline (%s). Run the perf-baseline target first.' %
+            args.baseline, file=sys.stderr
+        )
+        return 2
+
+    with open(args.baseline) as f:
+        baseline = json.load(f)
+
+    return 1 if _compare(baseline, results) else 0
+
+
+# Describes the machine and the build on which the metrics are measured.
+def _environment(build_dir, repeat):
+    return {
+        'date':         datetime.datetime.utcnow().strftime(
+                            '%Y-%m-%dT%H:%M:%SZ'
+                        ),
+        'host':         platform.node(),
+        'system':       platform.platform(),
+        'machine':      platform.machine(),
+        'cpu':          _cpu_model(),
+        'n_cpus':       os.cpu_count(),
+        'compiler':     _compiler(build_dir),
+        'commit':       _git('rev-parse', 'HEAD'),
+        'dirty':        _git('status', '--porcelain', '--untracked-files=no')
+                        not in ('', None),
+        'repeat':       repeat,
+    }
+
+
+def _cpu_model():
+    try:
+        with open('/proc/cpuinfo') as f:
+            for line in f:
+                if line.startswith('model name'):
+                    return line.split(':', 1)[1].strip()
+    except OSError:
+        pass
+
+    return platform.processor() or None
+
+
+# Returns the first line of the version of the compiler of the build.
+def _compiler(build_dir):
+    compiler = None
+
+    try:
+        with open(os.path.join(build_dir, 'CMakeCache.txt')) as f:
+            for line in f:
+                if line.startswith('CMAKE_CXX_COMPILER:'):
+                    compiler = line.split('=', 1)[1].strip()
+    except OSError:
+        return None
+
+    if compiler is None:
+        return None
+
+    try:
+        version = subprocess.run(
+            [compiler, '--version'], stdout=subprocess.PIPE,
+            stderr=subprocess.DEVNULL, universal_newlines=True
+        ).stdout
+    except OSError:
+        return compiler
+
+    return version.splitlines()[0] if version else compiler
+
+
+def _git(*args):
+    try:
+        out = subprocess.run(
+            ['git', '-C', os.path.dirname(os.path.abspath(__file__))] +
+            list(args), stdout=subprocess.PIPE, stderr=subprocess.DEVNULL,
+            universal_newlines=True
+        )
+    except OSError:
+        return None
+
+    return out.stdout.strip() if out.returncode == 0 else None
+
+
+# Runs the micro-benchmarks 'args.repeat' times. The benchmarks already report
+# their fastest run.
+def _run_micro(args):
+    samples = {}
+
+    for i in range(args.repeat):
+        report = _run_json(
+            [os.path.join(args.build, 'microbench'), '-p', args.pages]
+        )
+
+        for bench in report['benchmarks']:
+            samples.setdefault(bench['name'], []).append(bench)
+
+    metrics = []
+
+    for name, benches in sorted(samples.items()):
+        metrics.append(_metric(
+            'micro.%s.cycles_per_op' % name, 'cycles', False, True,
+            [bench['cycles_per_op'] for bench in benches]
+        ))
+
+        metrics += _perf_metrics(
+            'micro.%s' % name, [bench.get('perf') for bench in benches],
+            [('op', 'op')]
+        )
+
+    return metrics
+
+
+# Runs every scenario 'args.repeat' times.
+def _run_sim(args):
+    metrics = []
+
+    paths = {
+        'gzip_pages':   _gzip_pages(args.build, args.pages),
+        'large_pages':  _large_pages(args.build),
+    }
+
+    for name, sim, sim_args in SCENARIOS:
+        sim_args = [arg.format(**paths) for arg in sim_args]
+
+        reports = [
+            _run_json(
+                [os.path.join(args.build, sim), '-s', SEED, '-p', args.pages]
+                + sim_args
+            )
+            for i in range(args.repeat)
+        ]
+
+        for report in reports:
+            if report['status'] != 'completed' or report['failed'] > 0:
+                sys.exit('Scenario %s did not complete' % name)
+
+        for metric, path, unit, higher_is_better, is_host in SIM_METRICS:
+            values = [_get(report, path) for report in reports]
+
+            if not is_host and len(set(values)) > 1:
+                sys.exit(
+                    'Scenario %s is not reproducible: %s varies (%s)' %
+                    (name, metric, values)
+                )
+
+            metrics.append(_metric(
+                'sim.%s.%s' % (name, metric), unit, higher_is_better, is_host,
+                values
+            ))
+
+        metrics += _perf_metrics(
+            'sim.%s' % name, [report['host'].get('perf') for report in reports],
+            [('frame', 'packet'), ('transaction', 'request')]
+        )
+
+    return metrics
+
+
+# Returns the metrics of the hardware events of the runs, given as the 'perf'
+# objects of the reports, per each of 'units' ('(unit in the report, unit of
+# the metric)').
+#
+# Returns no metric if the events have not been counted.
+def _perf_metrics(prefix, perfs, units):
+    if any(perf is None for perf in perfs):
+        return []
+
+    metrics = [
+        _metric(
+            '%s.perf.ipc' % prefix, 'instructions', True, True,
+            [perf['ipc'] for perf in perfs], gating=False
+        )
+    ]
+
+    for report_unit, unit in units:
+        for event in PERF_EVENTS:
+            values = [perf['per_' + report_unit][event] for perf in perfs]
+
+            if any(value is None for value in values):
+                continue
+
+            metrics.append(_metric(
+                '%s.perf.%s_per_%s' % (prefix, event, unit), 'events', False,
+                True, values, gating=False
+            ))
+
+    return metrics
+
+
+# Runs the command and parses its standard output as JSON. Its standard error
+# is discarded.
+# Returns '<build>/pages_gzip', which links to the files of 'pages' and holds
+# their gzip variants ('<file>.gz'). The variants are compressed once, without
+# timestamp, so that their sizes are reproducible.
+def _gzip_pages(build_dir, pages):
+    path = os.path.join(build_dir, 'pages_gzip')
+    os.makedirs(path, exist_ok=True)
+
+    for name in sorted(os.listdir(pages)):
+        source = os.path.abspath(os.path.join(pages, name))
+        if not os.path.isfile(source) or name.endswith('.gz'):
+            continue
+
+        link = os.path.join(path, name)
+        if not os.path.lexists(link):
+            os.symlink(source, link)
+
+        variant = link + '.gz'
+        if not os.path.exists(variant):
+            with open(source, 'rb') as f:
+                data = gzip.compress(f.read(), 9, mtime=0)
+            with open(variant, 'wb') as f:
+                f.write(data)
+
+    return path
+
+
+# Returns '<build>/pages_large', which holds a sparse file of
+# 'LARGE_FILE_SIZE' bytes. Its pages are read as zeros, without disk I/O.
+def _large_pages(build_dir):
+    path = os.path.join(build_dir, 'pages_large')
+    os.makedirs(path, exist_ok=True)
+
+    with open(os.path.join(path, 'large.bin'), 'ab') as f:
+        f.truncate(LARGE_FILE_SIZE)
+
+    return path
+
+
+def _run_json(command):
+    out = subprocess.run(
+        command, stdout=subprocess.PIPE, stderr=subprocess.DEVNULL,
+        universal_newlines=True
+    )
+
+    if out.returncode != 0:
+        sys.exit('%s failed (%d)' % (' '.join(command), out.returncode))
+
+    return json.loads(out.stdout)
+
+
+def _get(report, path):
+    for key in path:
+        report = report[key]
+    return report
+
+
+# Summarizes the runs of a metric by their median.
+#
+# A metric which is not 'gating' is reported but doesn't fail the check.
+def _metric(name, unit, higher_is_better, is_host, values, gating=True):
+    return {
+        'name':             name,
+        'unit':             unit,
+        'higher_is_better': higher_is_better,
+        'host':             is_host,
+        'gating':           gating,
+        'value':            statistics.median(values),
+        'runs':             values,
+    }
+
+
+# Returns the interquartile range of the runs of the metric, as a fraction of
+# their median. Unlike their range, a single disturbed run barely changes it.
+def _spread(metric):
+    runs, median = metric.get('runs', []), metric['value']
+
+    if len(runs) < 2 or median == 0:
+        return 0.0
+
+    quartiles = statistics.quantiles(runs, n=4)
+    return (quartiles[2] - quartiles[0]) / abs(median)
+
+
+# Prints the changes of each metric. Returns 'True' if a metric regressed.
+#
+# Metrics measured on the host CPU are not compared if the baseline has been
+# measured on another CPU, or with another compiler.
+def _compare(baseline, results):
+    base_env, env = baseline['environment'], results['environment']
+
+    same_host = (
+            base_env.get('cpu') == env.get('cpu')
+        and base_env.get('compiler') == env.get('compiler')
+    )
+
+    if not same_host:
+        print(
+            'The baseline has been measured on another CPU or with another '
+            'compiler (%s, %s). Only compares the metrics of the virtual '
+            'time.' % (base_env.get('cpu'), base_env.get('compiler'))
+        )
+
+    base_metrics = {m['name']: m for m in baseline['metrics']}
+
+    regressions = []
+
+    print('%-56s %14s %14s %8s %8s' % (
+        'metric', 'baseline', 'current', 'change', 'limit'
+    ))
+
+    for metric in results['metrics']:
+        name = metric['name']
+        base = base_metrics.get(name)
+
+        if base is None:
+            print('%-56s %14s %14.2f %8s %8s' % (
+                name, '-', metric['value'], 'new', ''
+            ))
+            continue
+
+        if metric['host'] and not same_host:
+            continue
+
+        reference = base['value']
+
+        if metric['host']:
+            threshold = max(
+                HOST_THRESHOLD,
+                NOISE_FACTOR * max(_spread(base), _spread(metric))
+            )
+        else:
+            threshold = VIRTUAL_THRESHOLD
+
+        # Positive if the metric got worse.
+        if reference == 0:
+            change = 0.0 if metric['value'] == 0 else float('inf')
+            if metric['higher_is_better']:
+                change = -change
+        else:
+            change = (metric['value'] - reference) / reference
+            if metric['higher_is_better']:
+                change = -change
+
+        status = ''
+        if change > threshold:
+            if metric['gating']:
+                status = 'REGRESSION'
+                regressions.append(name)
+            else:
+                status = 'worse'
+        elif change < -threshold:
+            status = 'improved'
+
+        print('%-56s %14.2f %14.2f %+7.1f%% %7.1f%% %s' % (
+            name, reference, metric['value'], change * 100,
+            threshold * 100, status
+        ))
+
+    for name in sorted(set(base_metrics) - {m['name'] for m in
+                                                 results['metrics']}):
+        print('%-56s missing from the results' % name)
+
+    if regressions:
+        print('%d regression(s): %s' % (
+            len(regressions), ', '.join(regressions)
+        ))
+    else:
+        print('No regression.')
+
+    return len(regressions) > 0
+
+
+def _write_json(path, data):
+    with open(path, 'w') as f:
+        json.dump(data, f, indent=2, sort_keys=True)
+        f.write('\n')
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,487 @@
+//
+// Tests the recovery of TCP from lost segments (see 'tcp_t::_retransmit()').
+//
+// Two instances of the stack are connected through a queue of frames, on which
+// the test drops chosen data segments of the client. Time only advances when
+// the test moves the virtual clock, so that the retransmissions triggered by
+// the ACKs of the server are told apart from those of the retransmission
+// timer. Checks the fast retransmit after three duplicate ACKs, the
+// retransmission of the next lost segment on a partial ACK, and the recovery
+// of several lost segments after a retransmission timeout.
+//
+// Exits with a non-zero status on the first failure.
+//
+// Usage: ./recovery_test
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <cinttypes>            // PRIu32
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>          // inet_aton()
+#include <net/ethernet.h>       // ETH_HLEN
+
+#include "bench/mock_phys.hpp"  // basic_mock_phys_t
+#include "bench/virtual_clock.hpp" // advance_virtual_clock(), virtual_clock_t
+#include "net/endian.hpp"       // net_t
+#include "util/macros.hpp"      // RUSTY_*
+
+using namespace std;
+
+using namespace rusty::bench;
+using namespace rusty::driver;
+using namespace rusty::net;
+
+#define TEST_COLOR     COLOR_CYN
+#define TEST_DIE(MSG, ...)                                                     \
+    RUSTY_DIE(  "TEST", TEST_COLOR, MSG, ##__VA_ARGS__)
+
+typedef basic_mock_phys_t<virtual_clock_t>              phys_t;
+typedef phys_t::cursor_t                                cursor_t;
+typedef phys_t::tcp_t::tcb_t                            tcb_t;
+
+// Small frames, so that a few segments fill the congestion window.
+static constexpr size_t FRAME_SIZE                  = 256;
+
+// Segments sent by the client in each test.
+static constexpr size_t N_SEGS                      = 6;
+
+// Frame waiting to be received, and the instance which will receive it.
+struct frame_t {
+    phys_t          *dest;
+    char            *data;
+    size_t          size;
+};
+
+// Fields of the TCP segment of a frame.
+struct segment_t {
+    uint32_t        seq;
+    uint32_t        ack;
+    size_t          payload_size;
+};
+
+static phys_t client(FRAME_SIZE), server(FRAME_SIZE);
+
+static deque<frame_t> wire;
+
+static phys_t::tcp_t::conn_t conn;
+
+// Data sent by the client, and received by the server.
+static size_t n_sent = 0;
+static string received;
+
+// Opens the connection from the client to the server.
+static void _connect(void);
+
+// Returns the TCB of the connection on the client.
+static tcb_t *_client_tcb(void);
+
+// Receives the frames of the wire one by one, until the wire is empty.
+static void _deliver_all(void);
+
+// Receives the frames of the wire which are sent to the client, and returns
+// the frames which the client sends in response, without delivering them.
+static vector<frame_t> _deliver_to_client(void);
+
+// Sends 'size' bytes from the client, and returns the sent frames.
+static vector<frame_t> _send(size_t size);
+
+// Sends 'N_SEGS' segments from the client, after having grown its congestion
+// window until it can send them at once, and returns them.
+static vector<frame_t> _send_segments(const char *test);
+
+// Receives the frame on the server.
+static void _receive(const frame_t &frame);
+
+// Frees a frame which is not delivered, and returns its TCP segment.
+static segment_t _drop(const frame_t &frame);
+
+// Parses the TCP header of the frame.
+static segment_t _parse(const frame_t &frame);
+
+// Checks that the frames only hold the given data segment of the client.
+static void _check_retransmission(
+    const char *test, const vector<frame_t> &frames, const segment_t &lost
+);
+
+// Checks that the server received every byte sent by the client, and that the
+// client left the recovery.
+static void _check_received(const char *test);
+
+// Moves the virtual clock by the given number of microseconds, and executes
+// the expired timers.
+static void _advance(uint64_t microsec);
+
+static void _test_dupacks(void);
+static void _test_partial_ack(void);
+static void _test_rto(void);
+
+int main(void)
+{
+    _connect();
+
+    _test_dupacks();
+    _test_partial_ack();
+    _test_rto();
+
+    printf("recovery_test: all tests passed\n");
+
+    return EXIT_SUCCESS;
+}
+
+static void _connect(void)
+{
+    struct in_addr in_addr;
+
+    net_t<phys_t::ipv4_t::addr_t> client_addr, server_addr;
+    inet_aton("10.0.0.1", &in_addr);
+    client_addr = ipv4_addr_t::from_in_addr(in_addr);
+    inet_aton("10.0.0.2", &in_addr);
+    server_addr = ipv4_addr_t::from_in_addr(in_addr);
+
+    net_t<phys_t::ethernet_t::addr_t> client_ether, server_ether;
+    uint8_t client_bytes[] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+    uint8_t server_bytes[] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x02 };
+    memcpy(client_ether.net.value, client_bytes, sizeof (client_bytes));
+    memcpy(server_ether.net.value, server_bytes, sizeof (server_bytes));
+
+    client.init(
+        client_ether, { client_addr }, { { server_addr, server_ether } }
+    );
+    server.init(
+        server_ether, { server_addr }, { { client_addr, client_ether } }
+    );
+
+    client.transmit = [](char *frame, size_t size) {
+        wire.push_back({ &server, frame, size });
+    };
+
+    server.transmit = [](char *frame, size_t size) {
+        wire.push_back({ &client, frame, size });
+    };
+
+    phys_t::tcp_t::conn_handlers_t server_handlers;
+    server_handlers.new_data = [](cursor_t in) {
+        size_t offset = received.size();
+        received.resize(offset + in.size());
+        in.read(&received[offset], in.size());
+    };
+    server_handlers.remote_close    = []() { };
+    server_handlers.close           = []() { };
+    server_handlers.reset           = []() { };
+
+    server.ethernet.ipv4.tcp.listen(
+        80, [server_handlers](phys_t::tcp_t::conn_t) {
+            return server_handlers;
+        }
+    );
+
+    phys_t::tcp_t::conn_handlers_t client_handlers;
+    client_handlers.new_data        = [](cursor_t) { };
+    client_handlers.remote_close    = []() { };
+    client_handlers.close           = []() { };
+    client_handlers.reset           = []() { };
+
+    client.ethernet.ipv4.tcp.connect(
+        client_addr, 1024, server_addr, 80, client_handlers, &conn
+    );
+
+    _deliver_all();
+
+    if (!conn.is_established())
+        TEST_DIE("Failed to establish the connection");
+}
+
+static tcb_t *_client_tcb(void)
+{
+    return &client.ethernet.ipv4.tcp.tcbs.begin()->second;
+}
+
+static void _deliver_all(void)
+{
+    while (!wire.empty()) {
+        frame_t frame = wire.front();
+        wire.pop_front();
+
+        frame.dest->receive(frame.data, frame.size);
+    }
+}
+
+static vector<frame_t> _deliver_to_client(void)
+{
+    vector<frame_t> to_server;
+
+    while (!wire.empty()) {
+        frame_t frame = wire.front();
+        wire.pop_front();
+
+        if (frame.dest == &client)
+            client.receive(frame.data, frame.size);
+        else
+            to_server.push_back(frame);
+    }
+
+    return to_server;
+}
+
+static vector<frame_t> _send(size_t size)
+{
+    // Each byte is its offset in the stream, modulo 251, so that a misplaced
+    // segment is detected.
+    size_t first = n_sent;
+    conn.send(
+        size,
+        phys_t::tcp_t::writer_t([first](size_t offset, cursor_t cursor) {
+            string data(cursor.size(), '\0');
+            for (size_t i = 0; i < data.size(); i++)
+                data[i] = (char) ((first + offset + i) % 251);
+
+            cursor.write(data.data(), data.size());
+        }),
+        []() { }
+    );
+    n_sent += size;
+
+    vector<frame_t> frames(wire.begin(), wire.end());
+    wire.clear();
+
+    for (const frame_t &frame : frames) {
+        if (frame.dest != &server)
+            TEST_DIE("Unexpected frame sent to the client");
+    }
+
+    return frames;
+}
+
+static vector<frame_t> _send_segments(const char *test)
+{
+    tcb_t *tcb = _client_tcb();
+    size_t mss = tcb->tx_window.mss;
+
+    // Each round trip of full segments grows the congestion window.
+    while (tcb->tx_window.size < N_SEGS * mss) {
+        for (const frame_t &frame : _send(tcb->tx_window.size / mss * mss))
+            _receive(frame);
+
+        _deliver_all();
+    }
+
+    vector<frame_t> frames = _send(N_SEGS * mss);
+
+    if (frames.size() != N_SEGS) {
+        TEST_DIE(
+            "%s: %zu segments sent, %zu expected", test, frames.size(), N_SEGS
+        );
+    }
+
+    return frames;
+}
+
+static void _receive(const frame_t &frame)
+{
+    frame.dest->receive(frame.data, frame.size);
+}
+
+static segment_t _drop(const frame_t &frame)
+{
+    segment_t segment = _parse(frame);
+    free(frame.data);
+    return segment;
+}
+
+static segment_t _parse(const frame_t &frame)
+{
+    const uint8_t *ip   = (const uint8_t *) frame.data + ETH_HLEN;
+    size_t ip_hdr_size  = (ip[0] & 0xF) * 4;
+    const uint8_t *tcp  = ip + ip_hdr_size;
+
+    segment_t segment;
+    segment.seq             = (tcp[4] << 24) | (tcp[5] << 16)
+                            | (tcp[6] << 8)  | tcp[7];
+    segment.ack             = (tcp[8] << 24) | (tcp[9] << 16)
+                            | (tcp[10] << 8) | tcp[11];
+    segment.payload_size    =   ((ip[2] << 8) | ip[3]) - ip_hdr_size
+                              - (tcp[12] >> 4) * 4;
+
+    return segment;
+}
+
+static void _check_retransmission(
+    const char *test, const vector<frame_t> &frames, const segment_t &lost
+)
+{
+    if (frames.size() != 1) {
+        TEST_DIE(
+            "%s: %zu segments sent by the client, 1 retransmission expected",
+            test, frames.size()
+        );
+    }
+
+    segment_t segment = _parse(frames[0]);
+
+    if (
+           segment.seq != lost.seq
+        || segment.payload_size != lost.payload_size
+    ) {
+        TEST_DIE(
+            "%s: segment %" PRIu32 " (%zu bytes) retransmitted, %" PRIu32
+            " (%zu bytes) expected", test, segment.seq, segment.payload_size,
+            lost.seq, lost.payload_size
+        );
+    }
+}
+
+static void _check_received(const char *test)
+{
+    _deliver_all();
+
+    if (received.size() != n_sent) {
+        TEST_DIE(
+            "%s: received %zu bytes, %zu bytes sent", test, received.size(),
+            n_sent
+        );
+    }
+
+    for (size_t i = 0; i < received.size(); i++) {
+        if (received[i] != (char) (i % 251))
+            TEST_DIE("%s: byte %zu is corrupted", test, i);
+    }
+
+    if (_client_tcb()->tx_window.in_recovery)
+        TEST_DIE("%s: the client is still recovering", test);
+}
+
+static void _advance(uint64_t microsec)
+{
+    virtual_clock_t::time_t now = virtual_clock_t::time_t::now();
+    advance_virtual_clock(now + virtual_clock_t::interval_t(microsec));
+
+    client.timers.tick();
+    server.timers.tick();
+}
+
+static void _test_dupacks(void)
+{
+    // The first segment is lost. The server acknowledges each of the following
+    // ones with a duplicate ACK, and the third one makes the client retransmit
+    // the lost segment, before its retransmission timer expires.
+
+    vector<frame_t> frames = _send_segments("dupacks");
+
+    segment_t lost = _drop(frames[0]);
+    for (size_t i = 1; i < frames.size(); i++)
+        _receive(frames[i]);
+
+    size_t n_dupacks = 0;
+    for (const frame_t &frame : wire) {
+        if (_parse(frame).ack == lost.seq)
+            n_dupacks++;
+    }
+
+    if (n_dupacks != N_SEGS - 1) {
+        TEST_DIE(
+            "dupacks: %zu duplicate ACKs sent, %zu expected", n_dupacks,
+            N_SEGS - 1
+        );
+    }
+
+    vector<frame_t> retransmitted = _deliver_to_client();
+    _check_retransmission("dupacks", retransmitted, lost);
+
+    _receive(retransmitted[0]);
+
+    _check_received("dupacks");
+}
+
+static void _test_partial_ack(void)
+{
+    // The first two segments are lost. The ACK of the fast retransmission of
+    // the first one only acknowledges it, and makes the client retransmit the
+    // second one, and only it, while restarting the retransmission timer.
+
+    vector<frame_t> frames = _send_segments("partial ACK");
+
+    segment_t lost[2] = { _drop(frames[0]), _drop(frames[1]) };
+    for (size_t i = 2; i < frames.size(); i++)
+        _receive(frames[i]);
+
+    vector<frame_t> retransmitted = _deliver_to_client();
+    _check_retransmission("partial ACK", retransmitted, lost[0]);
+
+    // Half of the retransmission timeout elapses before the partial ACK.
+    tcb_t *tcb = _client_tcb();
+    uint64_t rto = tcb->rtt.rto.microsec();
+    _advance(rto / 2);
+
+    _receive(retransmitted[0]);
+
+    virtual_clock_t::time_t now = virtual_clock_t::time_t::now();
+    retransmitted = _deliver_to_client();
+    _check_retransmission("partial ACK", retransmitted, lost[1]);
+
+    if (
+           !tcb->has_timer
+        || (tcb->timer - now).microsec() < tcb->rtt.rto.microsec()
+    )
+        TEST_DIE("partial ACK: the retransmission timer was not restarted");
+
+    _receive(retransmitted[0]);
+
+    _check_received("partial ACK");
+}
+
+static void _test_rto(void)
+{
+    // The first four segments are lost, and the two following ones only make
+    // two duplicate ACKs. The retransmission timer resends the first one, and
+    // the partial ACKs the next ones, without waiting for the timer again.
+
+    vector<frame_t> frames = _send_segments("RTO");
+
+    segment_t lost[4];
+    for (size_t i = 0; i < 4; i++)
+        lost[i] = _drop(frames[i]);
+    for (size_t i = 4; i < frames.size(); i++)
+        _receive(frames[i]);
+
+    if (!_deliver_to_client().empty())
+        TEST_DIE("RTO: retransmission before the timeout");
+
+    _advance(_client_tcb()->rtt.rto.microsec());
+
+    vector<frame_t> retransmitted(wire.begin(), wire.end());
+    wire.clear();
+
+    for (size_t i = 0; i < 4; i++) {
+        _check_retransmission("RTO", retransmitted, lost[i]);
+
+        _receive(retransmitted[0]);
+        retransmitted = _deliver_to_client();
+    }
+
+    if (!retransmitted.empty())
+        TEST_DIE("RTO: unexpected segment after the last retransmission");
+
+    _check_received("RTO");
+}
@@ -0,0 +1,1779 @@
+//
+// Deterministic simulation of two instances of the stack connected by a
+// simulated link.
+//
+// The client instance opens flows of request/response transactions to the
+// server instance. Both instances run on a virtual clock which jumps from an
+// event to the next one (a frame arrival or an expired timer), so that a
+// simulation runs faster than real time and always gives the same results for
+// the same seed.
+//
+// The 'bulk_jumbo' scenario is the 'bulk' scenario with jumbo frames, to be
+// compared with the latter.
+//
+// Frames which arrive at the same time are received as a burst, as mPIPE
+// gives them to a worker. In the 'bulk_bursts' scenario, the instances only
+// poll their link every 100 µs, so that the frames which arrived in between
+// form bursts, in which TCP can coalesce segments if built with
+// TCP_RECEIVE_COALESCING (see 'sim_coalesce' in 'bench/CMakeLists.txt').
+//
+// The 'http' scenario serves the files of a directory with the HTTP server of
+// 'http/server.hpp', as httpd does, and requests each file in turn. With '-e',
+// the requests accept the given content codings, and are answered with the
+// precompressed variants of the files, if any. Files larger than '-S' are
+// streamed from the page cache, as in httpd. With '-r', a share of the
+// requests carry the 'ETag' of the file and are answered with '304 Not
+// Modified'. With '-R', a thread reloads the files periodically while they
+// are served, and the server moves its connections to the new versions as
+// httpd does (see 'app/content_versions.hpp'). With '-2', the client speaks
+// HTTP/2 without TLS and with prior knowledge (h2c), one stream at a time on
+// each connection, to be compared with the HTTP/1.1 persistent connections.
+//
+// Reports the goodput, the number of retransmitted TCP segments and the
+// percentiles of the completion times of the transactions in JSON, on the
+// standard output, with the CPU cycles the host spent per frame, per byte of
+// response and per transaction, and the hardware events counted meanwhile if
+// the host allows counting them (see 'perf_counters_t').
+//
+// Usage: ./sim [options] bulk|bulk_jumbo|bulk_bursts|rr|short|incast|http
+//        (see '_print_usage()')
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <algorithm>            // max(), min(), sort()
+#include <cinttypes>            // PRIu64
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>                // clock_gettime()
+#include <atomic>
+#include <memory>               // make_shared(), shared_ptr
+#include <queue>                // priority_queue
+#include <string>
+#include <unordered_map>
+#include <utility>              // pair
+#include <vector>
+
+#include <arpa/inet.h>          // htonl(), ntohs(), ntohl()
+#include <pthread.h>
+#include <unistd.h>             // getopt(), optarg, optind, usleep()
+
+#include <arch/cycle.h>         // get_cycle_count()
+
+#include "app/content.hpp"      // file_t, files_t, is_not_modified(),
+                                // select_variant()
+#include "app/content_versions.hpp" // content_t, content_versions_t,
+                                    // load_content()
+#include "bench/mock_phys.hpp"  // basic_mock_phys_t
+#include "bench/sim_link.hpp"   // link_params_t, sim_link_t
+#include "bench/virtual_clock.hpp" // advance_virtual_clock(), virtual_clock_t
+#include "driver/cpu.hpp"       // CYCLES_PER_SECOND, cycles_t
+#include "driver/perf_counters.hpp" // perf_counters_t
+#include "http/h2.hpp"          // h2_frame_header_t, h2_settings_t,
+                                // H2_PREFACE
+#include "http/hpack.hpp"       // hpack_decoder_t, hpack_encoder_t
+#include "http/response_parser.hpp" // http_response_parser_t
+#include "http/server.hpp"      // server_t
+#include "net/endian.hpp"       // net_t
+#include "util/macros.hpp"      // RUSTY_*
+
+using namespace std;
+
+using namespace rusty::app;
+using namespace rusty::bench;
+using namespace rusty::driver;
+using namespace rusty::http;
+using namespace rusty::net;
+
+#define SIM_COLOR     COLOR_CYN
+#define SIM_DIE(MSG, ...)                                                      \
+    RUSTY_DIE(  "SIM", SIM_COLOR, MSG, ##__VA_ARGS__)
+
+typedef basic_mock_phys_t<virtual_clock_t>              sim_phys_t;
+
+typedef sim_phys_t::cursor_t                            cursor_t;
+
+// State of the HTTP server on each connection.
+struct sim_http_conn_t {
+    // Version of the content the requests are served from. 'nullptr' until the
+    // first request, and once the connection has been released.
+    content_versions_t::worker_version_t *version;
+};
+
+typedef server_t<sim_phys_t::tcp_t, sim_http_conn_t>    http_server_t;
+typedef http_server_t::connection_t                     http_conn_t;
+typedef http_server_t::response_t                       http_response_t;
+
+// Size of the requests sent by the client.
+static constexpr size_t REQUEST_SIZE                = 100;
+
+// Flow control windows of the HTTP/2 client, for the connection and for each
+// stream. The credit is given back once half of a window has been used.
+static constexpr uint32_t H2_WINDOW_SIZE            = 16 * 1024 * 1024;
+
+static constexpr sim_phys_t::tcp_t::port_t SERVER_PORT = 80;
+static constexpr sim_phys_t::tcp_t::port_t FIRST_CLIENT_PORT = 1024;
+
+// Default values of the CLI options.
+static constexpr uint64_t   DEFAULT_SEED            = 1;
+static constexpr double     DEFAULT_BANDWIDTH       = 1000.0;   // Mbps
+static constexpr double     DEFAULT_DELAY           = 50.0;     // µs
+static constexpr double     DEFAULT_QUEUE_SIZE      = 128.0;    // KB
+static constexpr double     DEFAULT_MAX_TIME        = 600.0;    // seconds
+static constexpr char       DEFAULT_PAGES[]         = "bench/pages";
+static constexpr size_t     DEFAULT_STREAM_THRESHOLD = 4;       // MB
+
+// Flows and transactions of a scenario.
+struct scenario_t {
+    const char      *name;
+
+    size_t          n_flows;
+
+    // Number of transactions of each flow. A flow executes its transactions
+    // one after the other, on the same connection.
+    size_t          n_transactions;
+
+    // Maximum number of flows which are open at the same time. Zero to open
+    // every flow at once.
+    size_t          concurrency;
+
+    // Ignored by the HTTP scenario, whose responses are files.
+    size_t          response_size;
+
+    // If 'true', each flow connects to its own server address, and the
+    // transactions of all flows start together, once every flow completed its
+    // previous transaction.
+    bool            is_synchronized;
+
+    // If 'true', the client requests the files served by the HTTP server.
+    bool            is_http;
+
+    // Largest Ethernet frame sent by both instances.
+    size_t          frame_size;
+
+    // Interval between two polls of the link by the instances, in µs. Zero to
+    // receive frames as soon as they arrive.
+    double          poll_interval;
+};
+
+static constexpr size_t STANDARD_FRAME_SIZE = sim_phys_t::STANDARD_FRAME_SIZE;
+static constexpr size_t JUMBO_FRAME_SIZE    = sim_phys_t::JUMBO_FRAME_SIZE;
+
+static const scenario_t SCENARIOS[] = {
+    // A single long transfer.
+    { "bulk",           1,      1,      0,  10 * 1024 * 1024,   false,  false,
+      STANDARD_FRAME_SIZE,  0.0 },
+
+    // The same transfer, with jumbo frames.
+    { "bulk_jumbo",     1,      1,      0,  10 * 1024 * 1024,   false,  false,
+      JUMBO_FRAME_SIZE,     0.0 },
+
+    // The same transfer, with frames received by bursts.
+    { "bulk_bursts",    1,      1,      0,  10 * 1024 * 1024,   false,  false,
+      STANDARD_FRAME_SIZE,  100.0 },
+
+    // Short transactions on a persistent connection.
+    { "rr",             1,      1000,   0,  1024,               false,  false,
+      STANDARD_FRAME_SIZE,  0.0 },
+
+    // One transaction per connection, a few connections at a time.
+    { "short",          1000,   1,      16, 10 * 1024,          false,  false,
+      STANDARD_FRAME_SIZE,  0.0 },
+
+    // Many servers answering the same client at once, through the same link.
+    { "incast",         32,     20,     0,  32 * 1024,          true,   false,
+      STANDARD_FRAME_SIZE,  0.0 },
+
+    // Persistent HTTP connections, as the clients of httpd.
+    { "http",           16,     100,    0,  0,                  false,  true,
+      STANDARD_FRAME_SIZE,  0.0 },
+};
+
+// 'true' if TCP sends runs of segments with a single call to the lower layers
+// (see 'sim_no_super' in 'bench/CMakeLists.txt').
+#ifdef TCP_SUPER_SEGMENTS
+    static constexpr bool   SUPER_SEGMENTS      = true;
+#else
+    static constexpr bool   SUPER_SEGMENTS      = false;
+#endif /* TCP_SUPER_SEGMENTS */
+
+// 'true' if TCP merges the contiguous segments of a receive burst (see
+// 'sim_coalesce' in 'bench/CMakeLists.txt').
+#ifdef TCP_RECEIVE_COALESCING
+    static constexpr bool   RECEIVE_COALESCING  = true;
+#else
+    static constexpr bool   RECEIVE_COALESCING  = false;
+#endif /* TCP_RECEIVE_COALESCING */
+
+// Smallest frame size accepted by '-m', which leaves room for the headers and
+// the options of TCP segments.
+static constexpr size_t     MIN_FRAME_SIZE      = 256;
+
+// Parsed CLI arguments.
+struct args_t {
+    scenario_t              scenario;
+
+    uint64_t                seed;
+
+    // Same parameters for both directions of the link.
+    link_params_t           link;
+
+    // Virtual time after which the simulation is stopped.
+    cycles_t                max_time;
+
+    // 'scenario_t::poll_interval' in cycles.
+    cycles_t                poll_interval;
+
+    // Directory of the files served by the HTTP scenario.
+    const char              *pages;
+
+    // Files larger than this are streamed (see 'load_content()'), in bytes.
+    size_t                  stream_threshold;
+
+    // Value of the 'Accept-Encoding' header of the HTTP requests, or
+    // 'nullptr' to send none.
+    const char              *accept_encoding;
+
+    // Percentage of the HTTP requests with an 'If-None-Match' header matching
+    // the file.
+    long                    revalidations;
+
+    // Interval between two reloads of the files, in ms. Zero to never reload
+    // them.
+    long                    reload_interval;
+
+    // If 'true', the HTTP requests are sent over HTTP/2 (h2c).
+    bool                    h2;
+};
+
+// State of a flow of the client.
+struct flow_t {
+    size_t                              id;
+
+    sim_phys_t::tcp_t::conn_t           conn;
+
+    // Transactions not yet started.
+    size_t                              n_transactions_left;
+
+    // Response bytes of the current transaction not yet received.
+    size_t                              n_expected;
+
+    // Parses the responses of the HTTP scenario.
+    http_response_parser_t              parser;
+
+    // State of the HTTP/2 connection, with '-2'.
+
+    // Received bytes which don't form a complete frame yet.
+    string                              h2_buffer;
+
+    hpack_decoder_t                     h2_decoder;
+
+    // Stream of the current transaction, zero before the first one.
+    uint32_t                            h2_stream_id;
+
+    // Header block of the response being received in CONTINUATION frames,
+    // and whether its HEADERS frame ended the stream.
+    string                              h2_header_block;
+    bool                                h2_end_stream;
+
+    // Bytes of DATA frames received since the last WINDOW_UPDATE frames of
+    // the connection and of the stream.
+    size_t                              h2_conn_consumed;
+    size_t                              h2_stream_consumed;
+
+    // 'true' while a transaction has been started but has not completed yet.
+    bool                                in_transaction;
+
+    // Start of the current transaction.
+    cycles_t                            started;
+
+    // 'false' once the connection has been reset.
+    bool                                is_alive;
+};
+
+// Frame which will be received by an instance of the stack.
+struct event_t {
+    cycles_t                time;
+
+    // Orders the events which occur at the same time by their creation.
+    uint64_t                seq;
+
+    sim_phys_t              *dest;
+
+    char                    *frame;
+    size_t                  size;
+};
+
+struct event_later_t {
+    inline bool operator()(const event_t &a, const event_t &b) const
+    {
+        return a.time > b.time || (a.time == b.time && a.seq > b.seq);
+    }
+};
+
+// Results of the simulation.
+struct report_t {
+    enum status_t {
+        COMPLETED,  // Every transaction completed or failed.
+        TIMEOUT,    // Stopped after 'args_t::max_time'.
+        STALLED     // No frame nor timer was pending anymore.
+    } status;
+
+    size_t                  n_completed;
+    size_t                  n_failed;
+
+    // Response bytes received by the client.
+    uint64_t                n_bytes;
+
+    // TCP segments carrying data, a SYN or a FIN, and the ones among them
+    // which have already been sent.
+    uint64_t                n_segments;
+    uint64_t                n_retransmissions;
+
+    // Time at which the last transaction completed, or at which the simulation
+    // has been stopped.
+    cycles_t                end;
+
+    // Host CPU cycles spent by the simulation, and frames put on the links.
+    cycles_t                host_cycles;
+    uint64_t                n_frames;
+
+    // Bursts of frames received by the instances.
+    uint64_t                n_bursts;
+
+    // Hardware events during the simulation.
+    perf_counters_t::values_t perf;
+
+    // Versions of the files published by the reloading thread.
+    size_t                  n_reloads;
+
+    vector<cycles_t>        completion_times;
+};
+
+static args_t args;
+
+static sim_phys_t client, server;
+
+static net_t<sim_phys_t::ipv4_t::addr_t> client_addr;
+static vector<net_t<sim_phys_t::ipv4_t::addr_t>> server_addrs;
+
+// 'links[0]' transmits the frames of the client, 'links[1]' the ones of the
+// server.
+static vector<sim_link_t> links;
+
+static priority_queue<event_t, vector<event_t>, event_later_t> events;
+static uint64_t next_event_seq = 0;
+
+// Highest sequence number sent on each flow of TCP segments, by
+// '(source address, source port, destination port)'.
+static unordered_map<uint64_t, uint32_t> highest_seqs;
+
+static vector<flow_t> flows;
+
+// Next flow to open, and number of open flows which have not completed all
+// their transactions.
+static size_t next_flow = 0;
+static size_t n_active_flows = 0;
+
+// Transactions of the current round which have not completed yet, if the
+// scenario is synchronized.
+static size_t n_round_pending = 0;
+
+static report_t report;
+
+// Versions of the files served by the HTTP scenario, and the requests of the
+// client, one for each file, in the order of their paths. The requests of
+// 'http_revalidations' are conditional on the 'ETag' of the file.
+static content_versions_t *content_versions;
+static vector<string> http_requests;
+static vector<string> http_revalidations;
+static size_t next_http_request = 0;
+
+// With '-2', the header blocks of the same requests, and the bytes which start
+// the connections: the connection preface, the SETTINGS frame and the
+// WINDOW_UPDATE frame of the connection.
+static vector<string> h2_requests;
+static vector<string> h2_revalidations;
+static string h2_preface;
+
+// The server is the only worker of the versions.
+static content_versions_t::worker_t *http_worker;
+
+static http_server_t http_server;
+
+// Reloads the files every 'args.reload_interval' ms until 'stop_reloading' is
+// set.
+static pthread_t reloader;
+static atomic<bool> stop_reloading(false);
+
+static void _print_usage(char **argv);
+
+// Parses CLI arguments.
+//
+// Fails on a malformed command.
+static bool _parse_args(int argc, char **argv, args_t *args);
+
+// Initializes the client and the server, and connects them with the links.
+static void _init_instances(void);
+
+// Starts listening for the connections of the client.
+static void _init_server(void);
+
+// Loads the files served by the HTTP scenario and starts the HTTP server.
+//
+// Starts the reloading thread if required.
+static void _init_http_server(void);
+
+// Publishes a new version of the files every 'args.reload_interval' ms, and
+// frees the versions which are not used anymore.
+static void *_reloader_main(void *unused);
+
+// Runs the simulation until all transactions completed, until nothing
+// remains to be done, or until 'args.max_time'.
+static void _run(void);
+
+// Returns the virtual time of the simulation.
+static inline cycles_t _now(void);
+
+// Returns when an instance polls a frame which arrives at the given time.
+static inline cycles_t _next_poll(cycles_t arrival);
+
+// Puts a frame transmitted by an instance of the stack on its link.
+static void _transmit(size_t link, sim_phys_t *dest, char *frame, size_t size);
+
+// Counts the TCP segments of the frame which are retransmissions.
+static void _trace(const char *frame, size_t size);
+
+// Opens flows until 'scenario_t::concurrency' flows are open.
+static void _open_flows(void);
+
+static void _open_flow(flow_t *flow);
+
+static void _start_transaction(flow_t *flow);
+
+static void _complete_transaction(flow_t *flow);
+
+// Records the transactions that a reset flow will never complete.
+static void _fail_flow(flow_t *flow);
+
+// Starts the next transaction of every flow, if the scenario is synchronized.
+static void _start_round(void);
+
+// Called when a flow has no transaction left. Closes the connection and
+// replaces the flow by a new one.
+static void _end_flow(flow_t *flow);
+
+// Writes the data of requests and responses.
+static void _write_data(size_t offset, cursor_t cursor);
+
+// Parses the received data of an HTTP response.
+static void _receive_http(flow_t *flow, cursor_t in);
+
+// Sends the bytes on the connection of the flow.
+static void _send_h2(flow_t *flow, string data);
+
+// Receives data of an HTTP/2 connection, and handles its complete frames.
+static void _receive_h2(flow_t *flow, cursor_t in);
+
+static void _on_h2_frame(
+    flow_t *flow, const h2_frame_header_t &hdr, const char *payload
+);
+
+// Returns the header block of a request, without using the dynamic table, so
+// that the blocks can be sent on any connection.
+static string _h2_request_block(
+    const string &path, const char *accept_encoding, const string *etag
+);
+
+// Returns the version of the files the next response of the connection must
+// be served from, as httpd does.
+static inline content_versions_t::worker_version_t *_version(
+    http_conn_t *http_conn
+);
+
+// Releases the version of the files used by the connection, if any.
+static void _release_version(http_conn_t *http_conn);
+
+// Serves the requested file, as httpd does.
+static void _serve_file(
+    const http_request_t *request, http_response_t *response
+);
+
+// Returns the given percentile of the sorted values, in microseconds.
+static double _percentile_us(const vector<cycles_t> &sorted, double p);
+
+static void _write_json(double wall_time);
+
+int main(int argc, char **argv)
+{
+    if (!_parse_args(argc, argv, &args))
+        return EXIT_FAILURE;
+
+    struct timespec wall_start, wall_end;
+    clock_gettime(CLOCK_MONOTONIC, &wall_start);
+
+    _init_instances();
+
+    if (args.scenario.is_http)
+        _init_http_server();
+    else
+        _init_server();
+
+    const scenario_t &scenario = args.scenario;
+
+    for (size_t i = 0; i < scenario.n_flows; i++) {
+        flow_t flow;
+        flow.id                     = i;
+        flow.n_transactions_left    = scenario.n_transactions;
+        flow.n_expected             = 0;
+        flow.in_transaction         = false;
+        flow.started                = 0;
+        flow.is_alive               = true;
+        flow.h2_stream_id           = 0;
+        flow.h2_end_stream          = false;
+        flow.h2_conn_consumed       = 0;
+        flow.h2_stream_consumed     = 0;
+        flows.push_back(flow);
+    }
+
+    perf_counters_t perf_counters;
+
+    perf_counters_t::values_t perf = perf_counters.read();
+    cycles_t host_cycles = get_cycle_count();
+
+    _open_flows();
+
+    _run();
+
+    report.host_cycles = get_cycle_count() - host_cycles;
+    report.perf = perf_counters.read() - perf;
+
+    clock_gettime(CLOCK_MONOTONIC, &wall_end);
+
+    if (args.reload_interval > 0) {
+        stop_reloading = true;
+        pthread_join(reloader, nullptr);
+    }
+
+    double wall_time =   (wall_end.tv_sec - wall_start.tv_sec)
+                       + (wall_end.tv_nsec - wall_start.tv_nsec) / 1E9;
+
+    _write_json(wall_time);
+
+    size_t n_transactions = scenario.n_flows * scenario.n_transactions;
+    return report.n_completed == n_transactions ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static void _print_usage(char **argv)
+{
+    fprintf(
+        stderr,
+        "Usage: %s [-s <seed>] [-b <bandwidth>] [-d <delay>] [-j <jitter>]\n"
+        "          [-l <loss>] [-o <reorder>] [-u <duplicate>] "
+        "[-q <queue size>]\n"
+        "          [-n <flows>] [-k <transactions>] [-c <concurrency>]\n"
+        "          [-z <response size>] [-m <frame size>] "
+        "[-i <poll interval>]\n"
+        "          [-t <max time>] [-p <pages>] [-S <threshold>] "
+        "[-e <codings>]\n"
+        "          [-r <revalidations>] [-R <interval>] [-2]\n"
+        "          bulk|bulk_jumbo|bulk_bursts|rr|short|incast|http\n"
+        "\n"
+        "Link (both directions):\n"
+        "-s <seed>           seed of the random events (default: %" PRIu64
+        ").\n"
+        "-b <bandwidth>      in Mbps, 0 for an infinite bandwidth "
+        "(default: %.0f).\n"
+        "-d <delay>          one-way delay in µs (default: %.0f).\n"
+        "-j <jitter>         maximum random delay added to each frame, in µs "
+        "(default: 0).\n"
+        "-l <loss>           percentage of lost frames (default: 0).\n"
+        "-o <reorder>        percentage of frames delayed by an additional "
+        "one-way delay\n"
+        "                    (default: 0).\n"
+        "-u <duplicate>      percentage of duplicated frames (default: 0).\n"
+        "-q <queue size>     in KB, 0 for an unlimited queue "
+        "(default: %.0f).\n"
+        "\n"
+        "Scenario (defaults depend on the scenario):\n"
+        "-n <flows>          number of connections.\n"
+        "-k <transactions>   number of request/response transactions per "
+        "connection.\n"
+        "-c <concurrency>    maximum number of simultaneous connections, "
+        "0 for all.\n"
+        "-z <response size>  in bytes.\n"
+        "-m <frame size>     largest Ethernet frame sent by both instances, "
+        "in bytes,\n"
+        "                    from %zu to %zu.\n"
+        "-i <poll interval>  interval between two polls of the link by the "
+        "instances,\n"
+        "                    in µs, 0 to receive frames as soon as they "
+        "arrive.\n"
+        "-t <max time>       virtual seconds after which the simulation "
+        "is stopped\n"
+        "                    (default: %.0f).\n"
+        "-p <pages>          directory of the files served by the http "
+        "scenario\n"
+        "                    (default: %s).\n"
+        "-S <threshold>      in MB, files of the http scenario larger than "
+        "this are\n"
+        "                    streamed (default: %zu).\n"
+        "-e <codings>        'Accept-Encoding' header of the requests of the "
+        "http scenario\n"
+        "                    (default: none).\n"
+        "-r <revalidations>  percentage of the requests of the http scenario "
+        "which\n"
+        "                    revalidate the file with 'If-None-Match' "
+        "(default: 0).\n"
+        "-R <interval>       reloads the files of the http scenario every "
+        "<interval> ms,\n"
+        "                    from another thread (default: 0, never).\n"
+        "-2                  sends the requests of the http scenario over "
+        "HTTP/2 without\n"
+        "                    TLS, with prior knowledge (h2c).\n"
+        "\n"
+        "bulk                one long transfer.\n"
+        "bulk_jumbo          one long transfer, with jumbo frames.\n"
+        "bulk_bursts         one long transfer, with frames received by "
+        "bursts.\n"
+        "rr                  request/response transactions on a persistent "
+        "connection.\n"
+        "short               one transaction per connection.\n"
+        "incast              many servers answer together through the same "
+        "link.\n"
+        "http                persistent connections to the HTTP server, "
+        "which serves\n"
+        "                    the pages.\n",
+        argv[0], DEFAULT_SEED, DEFAULT_BANDWIDTH, DEFAULT_DELAY,
+        DEFAULT_QUEUE_SIZE, MIN_FRAME_SIZE, JUMBO_FRAME_SIZE, DEFAULT_MAX_TIME,
+        DEFAULT_PAGES, DEFAULT_STREAM_THRESHOLD
+    );
+}
+
+static bool _parse_args(int argc, char **argv, args_t *args)
+{
+    // Microseconds to cycles.
+    static const double US = CYCLES_PER_SECOND / 1E6;
+
+    double      bandwidth   = DEFAULT_BANDWIDTH,
+                delay       = DEFAULT_DELAY,
+                jitter      = 0.0,
+                loss        = 0.0,
+                reorder     = 0.0,
+                duplicate   = 0.0,
+                queue_size  = DEFAULT_QUEUE_SIZE,
+                max_time    = DEFAULT_MAX_TIME;
+
+    // -1 when not given.
+    long        n_flows         = -1,
+                n_transactions  = -1,
+                concurrency     = -1,
+                response_size   = -1,
+                frame_size      = -1;
+    double      poll_interval   = -1.0;
+
+    args->seed              = DEFAULT_SEED;
+    args->pages             = DEFAULT_PAGES;
+    args->stream_threshold  = DEFAULT_STREAM_THRESHOLD * 1024 * 1024;
+    args->accept_encoding   = nullptr;
+    args->revalidations     = 0;
+    args->reload_interval   = 0;
+    args->h2                = false;
+
+    const char *options = "s:b:d:j:l:o:u:q:n:k:c:z:m:i:t:p:S:e:r:R:2";
+
+    int opt;
+    while ((opt = getopt(argc, argv, options)) != -1) {
+        switch (opt) {
+        case 's':
+            args->seed = strtoull(optarg, nullptr, 10);
+            break;
+        case 'b':
+            bandwidth = atof(optarg);
+            break;
+        case 'd':
+            delay = atof(optarg);
+            break;
+        case 'j':
+            jitter = atof(optarg);
+            break;
+        case 'l':
+            loss = atof(optarg);
+            break;
+        case 'o':
+            reorder = atof(optarg);
+            break;
+        case 'u':
+            duplicate = atof(optarg);
+            break;
+        case 'q':
+            queue_size = atof(optarg);
+            break;
+        case 'n':
+            n_flows = atol(optarg);
+            break;
+        case 'k':
+            n_transactions = atol(optarg);
+            break;
+        case 'c':
+            concurrency = atol(optarg);
+            break;
+        case 'z':
+            response_size = atol(optarg);
+            break;
+        case 'm':
+            frame_size = atol(optarg);
+            break;
+        case 'i':
+            poll_interval = atof(optarg);
+            break;
+        case 't':
+            max_time = atof(optarg);
+            break;
+        case 'p':
+            args->pages = optarg;
+            break;
+        case 'S':
+            args->stream_threshold = atol(optarg) * 1024 * 1024;
+            break;
+        case 'e':
+            args->accept_encoding = optarg;
+            break;
+        case 'r':
+            args->revalidations = atol(optarg);
+            break;
+        case 'R':
+            args->reload_interval = atol(optarg);
+            break;
+        case '2':
+            args->h2 = true;
+            break;
+        default:
+            _print_usage(argv);
+            return false;
+        }
+    }
+
+    if (optind + 1 != argc) {
+        _print_usage(argv);
+        return false;
+    }
+
+    const scenario_t *scenario = nullptr;
+    for (const scenario_t &candidate : SCENARIOS) {
+        if (strcmp(candidate.name, argv[optind]) == 0)
+            scenario = &candidate;
+    }
+
+    if (scenario == nullptr) {
+        _print_usage(argv);
+        return false;
+    }
+
+    args->scenario = *scenario;
+
+    if (n_flows >= 0)
+        args->scenario.n_flows          = n_flows;
+    if (n_transactions >= 0)
+        args->scenario.n_transactions   = n_transactions;
+    if (concurrency >= 0)
+        args->scenario.concurrency      = concurrency;
+    if (response_size >= 0)
+        args->scenario.response_size    = response_size;
+    if (frame_size >= 0)
+        args->scenario.frame_size       = frame_size;
+    if (poll_interval >= 0.0)
+        args->scenario.poll_interval    = poll_interval;
+
+    if (
+           args->scenario.n_flows == 0 || args->scenario.n_transactions == 0
+        || (args->scenario.response_size == 0 && !args->scenario.is_http)
+        || args->scenario.n_flows > 65536 - FIRST_CLIENT_PORT
+        || args->scenario.frame_size < MIN_FRAME_SIZE
+        || args->scenario.frame_size > JUMBO_FRAME_SIZE
+        || bandwidth < 0.0 || delay < 0.0 || jitter < 0.0 || queue_size < 0.0
+        || loss < 0.0 || loss > 100.0 || reorder < 0.0 || reorder > 100.0
+        || duplicate < 0.0 || duplicate > 100.0 || max_time <= 0.0
+        || args->revalidations < 0 || args->revalidations > 100
+        || args->reload_interval < 0
+    ) {
+        _print_usage(argv);
+        return false;
+    }
+
+    args->link.bandwidth    = (uint64_t) (bandwidth * 1E6);
+    args->link.delay        = (cycles_t) (delay * US);
+    args->link.jitter       = (cycles_t) (jitter * US);
+    args->link.loss         = loss / 100.0;
+    args->link.reorder      = reorder / 100.0;
+    args->link.duplicate    = duplicate / 100.0;
+    args->link.queue_size   = (size_t) (queue_size * 1024);
+
+    args->max_time          = (cycles_t) (max_time * CYCLES_PER_SECOND);
+    args->poll_interval     = (cycles_t) (args->scenario.poll_interval * US);
+
+    return true;
+}
+
+static void _init_instances(void)
+{
+    struct in_addr in_addr;
+
+    in_addr.s_addr = htonl((10 << 24) | 1);
+    client_addr = ipv4_addr_t::from_in_addr(in_addr);
+
+    // Synchronized flows each have their own server address.
+    size_t n_server_addrs = args.scenario.is_synchronized
+                          ? args.scenario.n_flows : 1;
+
+    for (size_t i = 0; i < n_server_addrs; i++) {
+        in_addr.s_addr = htonl((10 << 24) | (1 << 16) | (i + 1));
+        server_addrs.push_back(ipv4_addr_t::from_in_addr(in_addr));
+    }
+
+    net_t<sim_phys_t::ethernet_t::addr_t> client_ether, server_ether;
+    uint8_t client_bytes[] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+    uint8_t server_bytes[] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x02 };
+    memcpy(client_ether.net.value, client_bytes, sizeof (client_bytes));
+    memcpy(server_ether.net.value, server_bytes, sizeof (server_bytes));
+
+    // Static ARP entries, so that no ARP traffic is simulated.
+
+    vector<sim_phys_t::arp_ipv4_t::static_entry_t> client_entries;
+    for (net_t<sim_phys_t::ipv4_t::addr_t> addr : server_addrs)
+        client_entries.push_back({ addr, server_ether });
+
+    // The MSS of TCP is derived from the frame size when initializing.
+    client.frame_size = args.scenario.frame_size;
+    server.frame_size = args.scenario.frame_size;
+
+    client.init(client_ether, { client_addr }, client_entries);
+    server.init(server_ether, server_addrs, { { client_addr, client_ether } });
+
+    links.emplace_back(args.link, args.seed * 2);
+    links.emplace_back(args.link, args.seed * 2 + 1);
+
+    client.transmit = [](char *frame, size_t size) {
+        _transmit(0, &server, frame, size);
+    };
+
+    server.transmit = [](char *frame, size_t size) {
+        _transmit(1, &client, frame, size);
+    };
+}
+
+static void _init_server(void)
+{
+    server.ethernet.ipv4.tcp.listen(
+        SERVER_PORT, [](sim_phys_t::tcp_t::conn_t conn) {
+            // Request bytes received since the last response.
+            shared_ptr<size_t> n_received = make_shared<size_t>(0);
+
+            sim_phys_t::tcp_t::conn_handlers_t handlers;
+
+            handlers.new_data = [conn, n_received](cursor_t in) mutable {
+                *n_received += in.size();
+
+                while (*n_received >= REQUEST_SIZE) {
+                    *n_received -= REQUEST_SIZE;
+
+                    conn.send(
+                        args.scenario.response_size,
+                        sim_phys_t::tcp_t::writer_t(_write_data), []() { }
+                    );
+                }
+            };
+
+            handlers.remote_close = [conn]() mutable { conn.close(); };
+            handlers.close        = []() { };
+            handlers.reset        = []() { };
+
+            return handlers;
+        }
+    );
+}
+
+static void _init_http_server(void)
+{
+    content_t *content = load_content(args.pages, 1, args.stream_threshold);
+
+    if (content == nullptr)
+        SIM_DIE("Unable to get info on %s", args.pages);
+
+    string      headers = "Host: sim\r\n";
+    str_ref_t   accept_encoding;
+    if (args.accept_encoding != nullptr) {
+        headers += string("Accept-Encoding: ") + args.accept_encoding + "\r\n";
+        accept_encoding = str_ref_t(
+            args.accept_encoding, strlen(args.accept_encoding)
+        );
+    }
+
+    // Paths and 'ETag' of the served files. The slots are ordered by the
+    // hashes of the paths.
+    vector<pair<string, string>> files;
+
+    for (const files_t::slot_t &slot : content->files.slots) {
+        if (slot.key == nullptr)
+            continue;
+
+        const file_t *file = select_variant(
+            &content->files.values[slot.value], accept_encoding
+        );
+
+        files.emplace_back(
+            string(slot.key, slot.key_len),
+            string(file->etag.data, file->etag.len)
+        );
+    }
+
+    if (files.empty())
+        SIM_DIE("No file to serve in %s", args.pages);
+
+    sort(files.begin(), files.end());
+
+    for (const pair<string, string> &file : files) {
+        string request_line = "GET /" + file.first + " HTTP/1.1\r\n";
+
+        http_requests.push_back(request_line + headers + "\r\n");
+        http_revalidations.push_back(
+              request_line + headers
+            + "If-None-Match: " + file.second + "\r\n\r\n"
+        );
+
+        if (args.h2) {
+            string path = "/" + file.first;
+
+            h2_requests.push_back(
+                _h2_request_block(path, args.accept_encoding, nullptr)
+            );
+            h2_revalidations.push_back(
+                _h2_request_block(path, args.accept_encoding, &file.second)
+            );
+        }
+    }
+
+    if (args.h2) {
+        // Opens the windows of the responses, which the HTTP/1 connections
+        // only limit by the receive window of TCP.
+        string settings;
+        h2_settings_t::append(
+            h2_settings_t::INITIAL_WINDOW_SIZE, H2_WINDOW_SIZE, &settings
+        );
+
+        uint8_t increment[4];
+        h2_frame_header_t::write_uint32(
+            H2_WINDOW_SIZE - h2_settings_t::DEFAULT_WINDOW_SIZE, increment
+        );
+
+        h2_preface.assign(H2_PREFACE, H2_PREFACE_LEN);
+        h2_frame_header_t::append(
+            h2_frame_header_t::SETTINGS, 0, 0, settings.data(),
+            settings.size(), &h2_preface
+        );
+        h2_frame_header_t::append(
+            h2_frame_header_t::WINDOW_UPDATE, 0, 0, (const char *) increment,
+            sizeof (increment), &h2_preface
+        );
+    }
+
+    content_versions = new content_versions_t(content, { 0 });
+    http_worker      = content_versions->register_worker(0);
+
+    http_server.fallback        = _serve_file;
+    http_server.hooks.released  = _release_version;
+
+    if (
+           args.reload_interval > 0
+        && pthread_create(&reloader, nullptr, _reloader_main, nullptr) != 0
+    )
+        SIM_DIE("Unable to start the reloading thread");
+
+    server.ethernet.ipv4.tcp.listen(
+        SERVER_PORT, [](sim_phys_t::tcp_t::conn_t conn) {
+            return http_server.accept(conn);
+        }
+    );
+}
+
+static void *_reloader_main(void *unused)
+{
+    (void) unused;
+
+    while (!stop_reloading) {
+        usleep(args.reload_interval * 1000);
+
+        content_t *content = load_content(args.pages, 1, args.stream_threshold);
+
+        if (content == nullptr)
+            SIM_DIE("Unable to get info on %s", args.pages);
+
+        content_versions->publish(content);
+        report.n_reloads++;
+
+        content_versions->collect();
+    }
+
+    return nullptr;
+}
+
+static void _run(void)
+{
+    const scenario_t &scenario = args.scenario;
+    size_t n_transactions = scenario.n_flows * scenario.n_transactions;
+
+    while (report.n_completed + report.n_failed < n_transactions) {
+        // Jumps to the next frame arrival or timer.
+
+        cycles_t next = UINT64_MAX;
+
+        if (!events.empty())
+            next = events.top().time;
+
+        for (sim_phys_t *phys : { &client, &server }) {
+            if (!phys->timers.timers.empty())
+                next = min(next, phys->timers.timers.begin()->first.cycles);
+        }
+
+        if (next == UINT64_MAX || next > args.max_time) {
+            report.status =   next == UINT64_MAX
+                            ? report_t::STALLED : report_t::TIMEOUT;
+            report.end    = _now();
+            return;
+        }
+
+        advance_virtual_clock((virtual_clock_t::time_t) { max(next, _now()) });
+
+        // Frames which arrive together at an instance are received as a
+        // burst.
+        while (!events.empty() && events.top().time <= _now()) {
+            sim_phys_t *dest = events.top().dest;
+
+            char    *frames[sim_phys_t::RX_BURST_SIZE];
+            size_t  sizes[sim_phys_t::RX_BURST_SIZE];
+            size_t  n_frames = 0;
+
+            do {
+                event_t event = events.top();
+                events.pop();
+
+                frames[n_frames]    = event.frame;
+                sizes[n_frames]     = event.size;
+                n_frames++;
+            } while (
+                   n_frames < sim_phys_t::RX_BURST_SIZE && !events.empty()
+                && events.top().time <= _now() && events.top().dest == dest
+            );
+
+            dest->receive_burst(frames, sizes, n_frames);
+            report.n_bursts++;
+        }
+
+        client.timers.tick();
+        server.timers.tick();
+    }
+
+    report.status = report_t::COMPLETED;
+}
+
+static inline cycles_t _now(void)
+{
+    return virtual_clock_t::time_t::now().cycles;
+}
+
+static inline cycles_t _next_poll(cycles_t arrival)
+{
+    cycles_t interval = args.poll_interval;
+
+    if (interval == 0)
+        return arrival;
+
+    return (arrival + interval - 1) / interval * interval;
+}
+
+static void _transmit(size_t link, sim_phys_t *dest, char *frame, size_t size)
+{
+    _trace(frame, size);
+
+    sim_link_t::delivery_t delivery = links[link].transmit(_now(), size);
+    report.n_frames++;
+
+    if (delivery.n_copies == 0) {
+        free(frame);
+        return;
+    }
+
+    events.push({
+        _next_poll(delivery.arrivals[0]), next_event_seq++, dest, frame, size
+    });
+
+    if (delivery.n_copies == 2) {
+        char *copy = sim_phys_t::alloc_frame(size);
+        memcpy(copy, frame, size);
+
+        events.push({
+            _next_poll(delivery.arrivals[1]), next_event_seq++, dest, copy, size
+        });
+    }
+}
+
+static void _trace(const char *frame, size_t size)
+{
+    // Ethernet and IPv4 headers without options, and the fixed part of the
+    // TCP header.
+    static constexpr size_t IPV4_OFFSET = 14, MIN_SIZE = 14 + 20 + 20;
+
+    if (size < MIN_SIZE)
+        return;
+
+    uint16_t ether_type;
+    memcpy(&ether_type, frame + 12, sizeof (ether_type));
+
+    const char *ip = frame + IPV4_OFFSET;
+
+    if (ntohs(ether_type) != 0x0800 || ip[9] != IPPROTO_TCP)
+        return;
+
+    size_t ip_header_size = (ip[0] & 0xF) * 4;
+
+    uint16_t ip_size;
+    memcpy(&ip_size, ip + 2, sizeof (ip_size));
+
+    const char *tcp = ip + ip_header_size;
+
+    uint32_t    saddr, seq;
+    uint16_t    sport, dport;
+    memcpy(&saddr, ip + 12, sizeof (saddr));
+    memcpy(&sport, tcp, sizeof (sport));
+    memcpy(&dport, tcp + 2, sizeof (dport));
+    memcpy(&seq, tcp + 4, sizeof (seq));
+    seq = ntohl(seq);
+
+    size_t  tcp_header_size = ((uint8_t) tcp[12] >> 4) * 4;
+    uint8_t flags           = tcp[13];
+
+    // SYN and FIN flags each take a sequence number.
+    uint32_t length =   ntohs(ip_size) - ip_header_size - tcp_header_size
+                      + ((flags & 0x02) != 0) + ((flags & 0x01) != 0);
+
+    if (length == 0)
+        return;
+
+    report.n_segments++;
+
+    uint64_t flow_id =   ((uint64_t) saddr << 32) | ((uint32_t) sport << 16)
+                       | dport;
+    uint32_t end     = seq + length;
+
+    auto it = highest_seqs.find(flow_id);
+
+    if (it == highest_seqs.end()) {
+        highest_seqs.emplace(flow_id, end);
+        return;
+    }
+
+    // Sequence numbers wrap around.
+    if ((int32_t) (seq - it->second) < 0)
+        report.n_retransmissions++;
+
+    if ((int32_t) (end - it->second) > 0)
+        it->second = end;
+}
+
+static void _open_flows(void)
+{
+    // Synchronized flows are all open at once.
+    size_t concurrency = args.scenario.is_synchronized
+                       ? 0 : args.scenario.concurrency;
+
+    while (
+           next_flow < flows.size()
+        && (concurrency == 0 || n_active_flows < concurrency)
+    ) {
+        _open_flow(&flows[next_flow++]);
+    }
+}
+
+static void _open_flow(flow_t *flow)
+{
+    sim_phys_t::tcp_t::conn_handlers_t handlers;
+
+    handlers.new_data = [flow](cursor_t in) {
+        if (args.scenario.is_http) {
+            if (args.h2)
+                _receive_h2(flow, in);
+            else
+                _receive_http(flow, in);
+            return;
+        }
+
+        size_t size = min(in.size(), flow->n_expected);
+
+        report.n_bytes      += size;
+        flow->n_expected    -= size;
+
+        if (flow->in_transaction && flow->n_expected == 0)
+            _complete_transaction(flow);
+    };
+
+    handlers.remote_close   = []() { };
+    handlers.close          = []() { };
+    handlers.reset          = [flow]() { _fail_flow(flow); };
+
+    const net_t<sim_phys_t::ipv4_t::addr_t> &server_addr =
+        server_addrs[flow->id % server_addrs.size()];
+
+    n_active_flows++;
+
+    bool connected = client.ethernet.ipv4.tcp.connect(
+        client_addr, FIRST_CLIENT_PORT + flow->id, server_addr, SERVER_PORT,
+        handlers, &flow->conn
+    );
+
+    if (!connected)
+        SIM_DIE("Failed to open flow %zu", flow->id);
+
+    // The request is queued until the connection is established.
+    if (args.scenario.is_synchronized)
+        n_round_pending++;
+
+    if (args.scenario.is_http && args.h2)
+        _send_h2(flow, h2_preface);
+
+    _start_transaction(flow);
+}
+
+static void _start_transaction(flow_t *flow)
+{
+    flow->n_transactions_left--;
+    flow->n_expected        = args.scenario.response_size;
+    flow->in_transaction    = true;
+    flow->started           = _now();
+
+    if (!args.scenario.is_http) {
+        flow->conn.send(
+            REQUEST_SIZE, sim_phys_t::tcp_t::writer_t(_write_data), []() { }
+        );
+        return;
+    }
+
+    // Spreads the revalidations evenly over the requests.
+    size_t  n           = next_http_request++;
+    bool    revalidate  =   (n + 1) * args.revalidations / 100
+                          > n * args.revalidations / 100;
+
+    if (args.h2) {
+        const string &block = revalidate
+            ? h2_revalidations[n % h2_revalidations.size()]
+            : h2_requests[n % h2_requests.size()];
+
+        // Streams are opened with increasing odd identifiers, from 1.
+        flow->h2_stream_id       = flow->h2_stream_id == 0
+                                 ? 1 : flow->h2_stream_id + 2;
+        flow->h2_stream_consumed = 0;
+
+        string frame;
+        h2_frame_header_t::append(
+            h2_frame_header_t::HEADERS,
+            h2_frame_header_t::END_HEADERS | h2_frame_header_t::END_STREAM,
+            flow->h2_stream_id, block.data(), block.size(), &frame
+        );
+        _send_h2(flow, move(frame));
+        return;
+    }
+
+    const string *request = revalidate
+        ? &http_revalidations[n % http_revalidations.size()]
+        : &http_requests[n % http_requests.size()];
+
+    flow->conn.send(
+        request->size(),
+        sim_phys_t::tcp_t::writer_t(
+            [request](size_t offset, cursor_t cursor) {
+                cursor.write(request->data() + offset, cursor.size());
+            }
+        ),
+        []() { }
+    );
+}
+
+static void _complete_transaction(flow_t *flow)
+{
+    flow->in_transaction = false;
+
+    report.n_completed++;
+    report.completion_times.push_back(_now() - flow->started);
+    report.end = _now();
+
+    if (args.scenario.is_synchronized) {
+        if (--n_round_pending == 0)
+            _start_round();
+    } else if (flow->n_transactions_left > 0)
+        _start_transaction(flow);
+    else
+        _end_flow(flow);
+}
+
+static void _fail_flow(flow_t *flow)
+{
+    if (!flow->is_alive)
+        return;
+
+    flow->is_alive = false;
+
+    report.n_failed += flow->n_transactions_left;
+    flow->n_transactions_left = 0;
+
+    bool was_pending = flow->in_transaction;
+
+    if (was_pending) {
+        report.n_failed++;
+        flow->in_transaction = false;
+    }
+
+    n_active_flows--;
+
+    if (!args.scenario.is_synchronized)
+        _open_flows();
+    else if (was_pending && --n_round_pending == 0)
+        _start_round();
+}
+
+static void _start_round(void)
+{
+    for (flow_t &flow : flows) {
+        if (!flow.is_alive)
+            continue;
+
+        if (flow.n_transactions_left > 0) {
+            n_round_pending++;
+            _start_transaction(&flow);
+        } else
+            _end_flow(&flow);
+    }
+}
+
+static void _end_flow(flow_t *flow)
+{
+    flow->is_alive = false;
+    flow->conn.close();
+
+    n_active_flows--;
+    _open_flows();
+}
+
+static void _write_data(size_t offset, cursor_t cursor)
+{
+    static const char DATA[1024] = { 0 };
+
+    while (!cursor.empty()) {
+        size_t size = min(cursor.size(), sizeof (DATA));
+        cursor = cursor.write(DATA, size);
+    }
+}
+
+static void _receive_http(flow_t *flow, cursor_t in)
+{
+    in.for_each([flow](const char *data, size_t size) {
+        if (!flow->in_transaction)
+            SIM_DIE("Unexpected data on flow %zu", flow->id);
+
+        switch (flow->parser.feed(data, size)) {
+        case http_response_parser_t::COMPLETE:
+            if (flow->parser.status != 200 && flow->parser.status != 304) {
+                SIM_DIE(
+                    "Unexpected HTTP status on flow %zu (%u)", flow->id,
+                    flow->parser.status
+                );
+            }
+
+            report.n_bytes += flow->parser.size;
+            flow->parser.reset();
+
+            _complete_transaction(flow);
+            break;
+        case http_response_parser_t::INCOMPLETE:
+            break;
+        case http_response_parser_t::INVALID:
+            SIM_DIE("Invalid HTTP response on flow %zu", flow->id);
+        }
+    });
+}
+
+static void _send_h2(flow_t *flow, string data)
+{
+    auto shared = make_shared<const string>(move(data));
+
+    flow->conn.send(
+        shared->size(),
+        sim_phys_t::tcp_t::writer_t(
+            [shared](size_t offset, cursor_t cursor) {
+                cursor.write(shared->data() + offset, cursor.size());
+            }
+        ),
+        []() { }
+    );
+}
+
+static void _receive_h2(flow_t *flow, cursor_t in)
+{
+    string &buffer = flow->h2_buffer;
+
+    in.for_each([&buffer](const char *data, size_t size) {
+        buffer.append(data, size);
+    });
+
+    size_t offset = 0;
+
+    while (buffer.size() - offset >= h2_frame_header_t::SIZE) {
+        h2_frame_header_t hdr = h2_frame_header_t::read(buffer.data() + offset);
+
+        size_t frame_size = h2_frame_header_t::SIZE + hdr.length;
+
+        if (buffer.size() - offset < frame_size)
+            break;
+
+        _on_h2_frame(
+            flow, hdr, buffer.data() + offset + h2_frame_header_t::SIZE
+        );
+
+        offset += frame_size;
+    }
+
+    buffer.erase(0, offset);
+}
+
+static void _on_h2_frame(
+    flow_t *flow, const h2_frame_header_t &hdr, const char *payload
+)
+{
+    switch (hdr.type) {
+    case h2_frame_header_t::HEADERS:
+    case h2_frame_header_t::CONTINUATION:
+    case h2_frame_header_t::DATA:
+        if (!flow->in_transaction || hdr.stream_id != flow->h2_stream_id) {
+            SIM_DIE(
+                "Unexpected HTTP/2 frame on flow %zu (stream %u)", flow->id,
+                hdr.stream_id
+            );
+        }
+
+        // The frame headers are counted, as the HTTP/1 headers.
+        report.n_bytes += h2_frame_header_t::SIZE + hdr.length;
+        break;
+
+    case h2_frame_header_t::SETTINGS:
+        if (!(hdr.flags & h2_frame_header_t::ACK)) {
+            string ack;
+            h2_frame_header_t::append(
+                h2_frame_header_t::SETTINGS, h2_frame_header_t::ACK, 0,
+                nullptr, 0, &ack
+            );
+            _send_h2(flow, move(ack));
+        }
+        return;
+
+    case h2_frame_header_t::RST_STREAM:
+    case h2_frame_header_t::GOAWAY:
+        SIM_DIE("HTTP/2 stream or connection reset on flow %zu", flow->id);
+
+    default:
+        // The server never sends PING frames, and the windows of the client
+        // are never filled.
+        return;
+    }
+
+    if (hdr.type == h2_frame_header_t::DATA) {
+        flow->h2_conn_consumed      += hdr.length;
+        flow->h2_stream_consumed    += hdr.length;
+
+        bool end_stream = hdr.flags & h2_frame_header_t::END_STREAM;
+
+        // Gives the credit back once half of a window has been used.
+        string frames;
+        uint8_t increment[4];
+
+        if (flow->h2_conn_consumed >= H2_WINDOW_SIZE / 2) {
+            h2_frame_header_t::write_uint32(flow->h2_conn_consumed, increment);
+            h2_frame_header_t::append(
+                h2_frame_header_t::WINDOW_UPDATE, 0, 0,
+                (const char *) increment, sizeof (increment), &frames
+            );
+            flow->h2_conn_consumed = 0;
+        }
+
+        if (!end_stream && flow->h2_stream_consumed >= H2_WINDOW_SIZE / 2) {
+            h2_frame_header_t::write_uint32(
+                flow->h2_stream_consumed, increment
+            );
+            h2_frame_header_t::append(
+                h2_frame_header_t::WINDOW_UPDATE, 0, hdr.stream_id,
+                (const char *) increment, sizeof (increment), &frames
+            );
+            flow->h2_stream_consumed = 0;
+        }
+
+        if (!frames.empty())
+            _send_h2(flow, move(frames));
+
+        if (end_stream)
+            _complete_transaction(flow);
+        return;
+    }
+
+    // HEADERS and CONTINUATION frames. The server sends neither padding nor
+    // priorities.
+    if (hdr.type == h2_frame_header_t::HEADERS) {
+        flow->h2_header_block.assign(payload, hdr.length);
+        flow->h2_end_stream = hdr.flags & h2_frame_header_t::END_STREAM;
+    } else
+        flow->h2_header_block.append(payload, hdr.length);
+
+    if (!(hdr.flags & h2_frame_header_t::END_HEADERS))
+        return;
+
+    unsigned int status = 0;
+
+    const string &block = flow->h2_header_block;
+    bool decoded = flow->h2_decoder.decode(
+        block.data(), block.size(),
+        [&status](str_ref_t name, str_ref_t value)
+        {
+            if (
+                   name.len == sizeof (":status") - 1
+                && memcmp(name.data, ":status", name.len) == 0
+                && value.len == 3
+            ) {
+                status = (value.data[0] - '0') * 100
+                       + (value.data[1] - '0') * 10 + (value.data[2] - '0');
+            }
+            return true;
+        }
+    );
+
+    if (!decoded)
+        SIM_DIE("Invalid HTTP/2 header block on flow %zu", flow->id);
+
+    if (status != 200 && status != 304) {
+        SIM_DIE(
+            "Unexpected HTTP status on flow %zu (%u)", flow->id, status
+        );
+    }
+
+    if (flow->h2_end_stream)
+        _complete_transaction(flow);
+}
+
+static string _h2_request_block(
+    const string &path, const char *accept_encoding, const string *etag
+)
+{
+    // The dynamic table of the server is emptied at the start of each block,
+    // so that the fields are never referenced by the next blocks.
+    hpack_encoder_t encoder;
+    encoder.set_max_table_size(0);
+
+    string block;
+    encoder.begin_block(&block);
+
+    auto encode = [&encoder, &block](const char *name, const string &value) {
+        encoder.encode(
+            str_ref_t(name, strlen(name)),
+            str_ref_t(value.data(), value.size()), &block
+        );
+    };
+
+    encode(":method", "GET");
+    encode(":scheme", "http");
+    encode(":path", path);
+    encode(":authority", "sim");
+
+    if (accept_encoding != nullptr)
+        encode("accept-encoding", accept_encoding);
+
+    if (etag != nullptr)
+        encode("if-none-match", *etag);
+
+    return block;
+}
+
+static inline content_versions_t::worker_version_t *_version(
+    http_conn_t *http_conn
+)
+{
+    // The unacknowledged data of a new connection can be the 101 response or
+    // the SETTINGS frame of HTTP/2, which reference no content.
+    if (http_conn->n_unacked == 0 || http_conn->data.version == nullptr) {
+        http_conn->data.version = content_versions->move_conn(
+            http_worker, http_conn->data.version
+        );
+    }
+
+    return http_conn->data.version;
+}
+
+static void _release_version(http_conn_t *http_conn)
+{
+    if (http_conn->data.version != nullptr) {
+        content_versions->release_conn(http_worker, http_conn->data.version);
+        http_conn->data.version = nullptr;
+    }
+}
+
+static void _serve_file(
+    const http_request_t *request, http_response_t *response
+)
+{
+    const file_t *file = _version(response->connection.get())->files->find(
+        request->path.data, request->path.len
+    );
+
+    if (file == nullptr) {
+        response->send_not_found();
+        return;
+    }
+
+    file = select_variant(file, request->accept_encoding);
+
+    if (is_not_modified(file, request))
+        response->send_static(file, &file->not_modified[response->keep_alive]);
+    else
+        response->send_static(file, &file->responses[response->keep_alive]);
+}
+
+static double _percentile_us(const vector<cycles_t> &sorted, double p)
+{
+    if (sorted.empty())
+        return 0.0;
+
+    size_t index = min((size_t) (p * sorted.size()), sorted.size() - 1);
+    return sorted[index] * 1E6 / CYCLES_PER_SECOND;
+}
+
+static void _write_json(double wall_time)
+{
+    const scenario_t    &scenario   = args.scenario;
+    const link_params_t &link       = args.link;
+
+    vector<cycles_t> sorted = report.completion_times;
+    sort(sorted.begin(), sorted.end());
+
+    double virtual_time = (double) report.end / CYCLES_PER_SECOND;
+    double goodput      = virtual_time > 0.0
+                        ? report.n_bytes * 8 / virtual_time / 1E6 : 0.0;
+    double rate         = virtual_time > 0.0
+                        ? report.n_completed / virtual_time : 0.0;
+    double size         = report.n_completed > 0
+                        ? (double) report.n_bytes / report.n_completed : 0.0;
+
+    double cycles_per_frame         = report.n_frames > 0
+                                    ? (double) report.host_cycles
+                                      / report.n_frames
+                                    : 0.0;
+    double cycles_per_byte          = report.n_bytes > 0
+                                    ? (double) report.host_cycles
+                                      / report.n_bytes
+                                    : 0.0;
+    double cycles_per_transaction   = report.n_completed > 0
+                                    ? (double) report.host_cycles
+                                      / report.n_completed
+                                    : 0.0;
+
+    uint64_t    n_lost = 0, n_queue_drops = 0, n_reordered = 0,
+                n_duplicated = 0;
+
+    for (const sim_link_t &l : links) {
+        n_lost          += l.n_lost;
+        n_queue_drops   += l.n_queue_drops;
+        n_reordered     += l.n_reordered;
+        n_duplicated    += l.n_duplicated;
+    }
+
+    static const char *STATUSES[] = { "completed", "timeout", "stalled" };
+
+    printf("{\n");
+    printf(
+        "  \"scenario\": \"%s\", \"seed\": %" PRIu64 ", "
+        "\"status\": \"%s\",\n"
+        "  \"flows\": %zu, \"transactions\": %zu, \"concurrency\": %zu, "
+        "\"response_size\": %zu, \"frame_size\": %zu,\n"
+        "  \"poll_interval_us\": %.1f, \"super_segments\": %s, "
+        "\"receive_coalescing\": %s, \"h2c\": %s,\n",
+        scenario.name, args.seed, STATUSES[report.status], scenario.n_flows,
+        scenario.n_transactions, scenario.concurrency, scenario.response_size,
+        scenario.frame_size, scenario.poll_interval,
+        SUPER_SEGMENTS ? "true" : "false",
+        RECEIVE_COALESCING ? "true" : "false", args.h2 ? "true" : "false"
+    );
+    printf(
+        "  \"link\": { \"bandwidth_mbps\": %.1f, \"delay_us\": %.1f, "
+        "\"jitter_us\": %.1f, \"loss\": %.4f, \"reorder\": %.4f, "
+        "\"duplicate\": %.4f, \"queue_kb\": %.1f },\n",
+        link.bandwidth / 1E6, link.delay * 1E6 / CYCLES_PER_SECOND,
+        link.jitter * 1E6 / CYCLES_PER_SECOND, link.loss, link.reorder,
+        link.duplicate, link.queue_size / 1024.0
+    );
+    printf(
+        "  \"completed\": %zu, \"failed\": %zu,\n"
+        "  \"virtual_time_s\": %.6f, \"wall_time_s\": %.3f,\n"
+        "  \"goodput_mbps\": %.2f, \"transactions_per_s\": %.1f, "
+        "\"bytes_per_transaction\": %.1f,\n"
+        "  \"segments\": %" PRIu64 ", \"retransmissions\": %" PRIu64 ",\n"
+        "  \"frames\": { \"lost\": %" PRIu64 ", \"queue_drops\": %" PRIu64
+        ", \"reordered\": %" PRIu64 ", \"duplicated\": %" PRIu64 " },\n"
+        "  \"bursts\": %" PRIu64 ", \"reloads\": %zu,\n",
+        report.n_completed, report.n_failed, virtual_time, wall_time, goodput,
+        rate, size, report.n_segments, report.n_retransmissions, n_lost,
+        n_queue_drops, n_reordered, n_duplicated, report.n_bursts,
+        report.n_reloads
+    );
+    printf(
+        "  \"completion_time_us\": { \"p50\": %.1f, \"p90\": %.1f, "
+        "\"p99\": %.1f, \"max\": %.1f },\n",
+        _percentile_us(sorted, 0.50), _percentile_us(sorted, 0.90),
+        _percentile_us(sorted, 0.99), _percentile_us(sorted, 1.0)
+    );
+
+    // Cost of the simulation on the host, the instances of the stack and the
+    // links included.
+    string perf;
+    if (report.perf.is_available()) {
+        char ipc[32];
+        snprintf(ipc, sizeof (ipc), "{ \"ipc\": %.2f, ", report.perf.ipc());
+
+        perf = ipc;
+        report.perf.write_json(&perf, "frame", report.n_frames);
+        perf += ", ";
+        report.perf.write_json(&perf, "transaction", report.n_completed);
+        perf += " }";
+    } else
+        perf = "null";
+
+    printf(
+        "  \"host\": { \"frames\": %" PRIu64 ", \"cycles_per_frame\": %.1f, "
+        "\"cycles_per_byte\": %.2f,\n"
+        "            \"cycles_per_transaction\": %.1f, \"perf\": %s }\n",
+        report.n_frames, cycles_per_frame, cycles_per_byte,
+        cycles_per_transaction, perf.c_str()
+    );
+    printf("}\n");
+}
+
+#undef SIM_COLOR
+#undef SIM_DIE
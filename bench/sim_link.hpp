@@ -0,0 +1,204 @@
+//
+// Simulated link between two instances of the stack.
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __RUSTY_BENCH_SIM_LINK_HPP__
+#define __RUSTY_BENCH_SIM_LINK_HPP__
+
+#include <algorithm>            // max()
+#include <cstdint>
+
+#include "driver/cpu.hpp"       // CYCLES_PER_SECOND, cycles_t
+
+using namespace std;
+
+using namespace rusty::driver::cpu;
+
+namespace rusty {
+namespace bench {
+
+// Parameters of one direction of a simulated link.
+struct link_params_t {
+    // Bits per second. Zero for an infinite bandwidth.
+    uint64_t    bandwidth;
+
+    // One-way propagation delay, and maximum random delay added to it.
+    cycles_t    delay;
+    cycles_t    jitter;
+
+    // Probabilities, between 0 and 1, that a frame is lost, that it is
+    // reordered (i.e. delayed by an additional propagation delay) and that it
+    // is duplicated.
+    double      loss;
+    double      reorder;
+    double      duplicate;
+
+    // Maximum number of bytes waiting for the link. Frames which don't fit
+    // are dropped (drop-tail). Zero for an unlimited queue.
+    size_t      queue_size;
+};
+
+// One direction of a simulated link: a drop-tail queue which feeds a link of
+// a fixed bandwidth and delay, which can lose, reorder and duplicate frames.
+//
+// Draws its random events from its own seeded generator, so a simulation is
+// reproducible from its seed.
+struct sim_link_t {
+    //
+    // Member types
+    //
+
+    // Fate of a frame given to 'transmit()'.
+    struct delivery_t {
+        // 0 if the frame has been dropped, 2 if it has been duplicated.
+        size_t      n_copies;
+
+        // Arrival times of the frame and of its duplicate.
+        cycles_t    arrivals[2];
+    };
+
+    //
+    // Fields
+    //
+
+    link_params_t   params;
+
+    // Time at which the last queued frame will have been serialized.
+    cycles_t        busy_until;
+
+    // Arrival time of the last frame which has not been reordered. Jitter does
+    // not reorder frames.
+    cycles_t        last_arrival;
+
+    uint64_t        random_state;
+
+    // Counters.
+    uint64_t        n_frames;
+    uint64_t        n_bytes;
+    uint64_t        n_lost;
+    uint64_t        n_queue_drops;
+    uint64_t        n_reordered;
+    uint64_t        n_duplicated;
+
+    //
+    // Methods
+    //
+
+    sim_link_t(link_params_t _params, uint64_t seed)
+        : params(_params), busy_until(0), last_arrival(0),
+          random_state(seed * 0x9E3779B97F4A7C15ULL | 1), n_frames(0),
+          n_bytes(0), n_lost(0), n_queue_drops(0), n_reordered(0),
+          n_duplicated(0)
+    {
+    }
+
+    // Queues a frame of 'size' bytes at time 'now' and returns when its copies
+    // will be received.
+    delivery_t transmit(cycles_t now, size_t size)
+    {
+        delivery_t delivery = { 0, { 0, 0 } };
+
+        this->n_frames++;
+        this->n_bytes += size;
+
+        cycles_t start = max(now, this->busy_until);
+
+        if (
+               this->params.queue_size > 0
+            && this->_bytes_in(start - now) + size > this->params.queue_size
+        ) {
+            this->n_queue_drops++;
+            return delivery;
+        }
+
+        cycles_t serialization = this->_serialization(size);
+        this->busy_until = start + serialization;
+
+        // A lost frame still occupies the link.
+        if (this->_draw(this->params.loss)) {
+            this->n_lost++;
+            return delivery;
+        }
+
+        cycles_t arrival = this->busy_until + this->params.delay;
+
+        if (this->params.jitter > 0)
+            arrival += this->_random() % (this->params.jitter + 1);
+
+        if (this->_draw(this->params.reorder)) {
+            this->n_reordered++;
+            arrival += this->params.delay;
+        } else {
+            arrival = max(arrival, this->last_arrival);
+            this->last_arrival = arrival;
+        }
+
+        delivery.arrivals[delivery.n_copies++] = arrival;
+
+        if (this->_draw(this->params.duplicate)) {
+            this->n_duplicated++;
+            delivery.arrivals[delivery.n_copies++] = arrival + serialization;
+        }
+
+        return delivery;
+    }
+
+private:
+    // Time required to put 'size' bytes on the link.
+    inline cycles_t _serialization(size_t size) const
+    {
+        if (this->params.bandwidth == 0)
+            return 0;
+
+        return size * 8 * CYCLES_PER_SECOND / this->params.bandwidth;
+    }
+
+    // Number of bytes the link serializes in the given time.
+    inline size_t _bytes_in(cycles_t time) const
+    {
+        if (this->params.bandwidth == 0)
+            return 0;
+
+        return (double) time * this->params.bandwidth / 8 / CYCLES_PER_SECOND;
+    }
+
+    // Returns 'true' with the given probability.
+    inline bool _draw(double probability)
+    {
+        if (probability <= 0.0)
+            return false;
+
+        // 53 random bits in [0, 1).
+        double value = (this->_random() >> 11) * (1.0 / (1ULL << 53));
+        return value < probability;
+    }
+
+    // xorshift64.
+    inline uint64_t _random(void)
+    {
+        this->random_state ^= this->random_state << 13;
+        this->random_state ^= this->random_state >> 7;
+        this->random_state ^= this->random_state << 17;
+        return this->random_state;
+    }
+};
+
+} } /* namespace rusty::bench */
+
+#endif /* __RUSTY_BENCH_SIM_LINK_HPP__ */
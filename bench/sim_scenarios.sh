@@ -0,0 +1,66 @@
+#!/bin/sh
+#
+# Runs the scenarios of the simulator on a clean, a lossy and a chaotic link,
+# and prints their reports as a JSON array.
+#
+# Usage: bench/sim_scenarios.sh <sim executable> [<seed>]
+#
+# Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+# University of Liege.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+if [ $# -lt 1 ] || [ $# -gt 2 ]; then
+    echo "Usage: $0 <sim executable> [<seed>]" >&2
+    exit 1
+fi
+
+SIM=$1
+SEED=${2:-1}
+
+# Link options of each profile.
+CLEAN=""
+LOSSY="-l 0.5"
+CHAOTIC="-l 1 -j 20 -o 1 -u 1"
+
+STATUS=0
+FIRST=1
+
+echo "["
+
+for PROFILE in CLEAN LOSSY CHAOTIC; do
+    eval "LINK=\$$PROFILE"
+
+    for SCENARIO in bulk bulk_jumbo bulk_bursts rr short incast; do
+        # The reports of the simulator don't end with a comma.
+        if [ $FIRST -eq 0 ]; then
+            echo ","
+        fi
+        FIRST=0
+
+        echo "{ \"profile\": \"$PROFILE\", \"report\":"
+
+        # shellcheck disable=SC2086
+        if ! "$SIM" -s "$SEED" $LINK $SCENARIO; then
+            STATUS=1
+        fi
+
+        echo "}"
+    done
+done
+
+echo "]"
+
+exit $STATUS
@@ -0,0 +1,66 @@
+//
+// Clock of the simulations, which only moves when it is told to.
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __RUSTY_BENCH_VIRTUAL_CLOCK_HPP__
+#define __RUSTY_BENCH_VIRTUAL_CLOCK_HPP__
+
+#include <cassert>
+
+#include "driver/clock.hpp"     // cycle_clock_t
+#include "driver/cpu.hpp"       // cycles_t
+
+using namespace std;
+
+using namespace rusty::driver;
+using namespace rusty::driver::cpu;
+
+namespace rusty {
+namespace bench {
+
+// Returns a reference to the virtual cycle counter.
+//
+// The counter is shared by every instance of the stack of the process, as the
+// CPU's cycle counter is.
+static inline cycles_t &_virtual_cycles(void)
+{
+    static cycles_t cycles = 0;
+    return cycles;
+}
+
+static inline cycles_t get_virtual_cycle_count(void)
+{
+    return _virtual_cycles();
+}
+
+// Clock with the same resolution as 'cpu_clock_t', but which counts virtual
+// cycles.
+typedef cycle_clock_t<get_virtual_cycle_count> virtual_clock_t;
+
+// Moves the virtual clock forward to the given time. The clock never goes
+// back.
+static inline void advance_virtual_clock(virtual_clock_t::time_t time)
+{
+    assert(time.cycles >= _virtual_cycles());
+    _virtual_cycles() = time.cycles;
+}
+
+} } /* namespace rusty::bench */
+
+#endif /* __RUSTY_BENCH_VIRTUAL_CLOCK_HPP__ */
@@ -23,12 +23,15 @@
 
 #include <algorithm>        // min()
 #include <cassert>
+#include <cstdio>           // fprintf(), used by DRIVER_DIE()
+#include <cstdlib>          // exit(), used by DRIVER_DIE()
 #include <cstring>
 #include <functional>
 #include <memory>           // shared_ptr
 
 #include <gxio/mpipe.h>     // gxio_mpipe_*
 
+#include "driver/driver.hpp" // DRIVER_DIE()
 #include "util/macros.hpp"
 
 using namespace std;
@@ -76,6 +79,17 @@ struct cursor_t {
 
     #endif /* MPIPE_CHAINED_BUFFERS */
 
+    // Creates an empty cursor (same state as 'EMPTY').
+    #ifdef MPIPE_CHAINED_BUFFERS
+        inline cursor_t(void)
+            : current(nullptr), current_size(0), next(nullptr), next_size(0)
+    #else
+        inline cursor_t(void)
+            : current(nullptr), current_size(0)
+    #endif /* MPIPE_CHAINED_BUFFERS */
+    {
+    }
+
     // Creates a buffer's cursor from an ingress packet descriptor.
     //
     // If 'managed' is true, buffer descriptors will be freed automatically by
@@ -148,7 +162,8 @@ struct cursor_t {
     // If 'n' is larger than the size of the cursor (given 'size()'), the
     // original cursor is returned.
     //
-    // Complexity: O(1).
+    // Complexity: O(1) with unchained buffers, O(n) with chained buffers where
+    // 'n' is the number of buffer descriptors in the returned chain.
     inline cursor_t take(size_t n) const
     {
         #ifdef MPIPE_CHAINED_BUFFERS
@@ -157,8 +172,10 @@ struct cursor_t {
             else if (n >= size())
                 return *this;
             else {
+                size_t next_n = n - current_size;
                 return cursor_t(
-                    desc, current, current_size, next, next_size - n
+                    desc, current, current_size,
+                    make_shared<cursor_t>(next->take(next_n)), next_n
                 );
             }
         #else
@@ -242,7 +259,8 @@ struct cursor_t {
 
             while (n > cursor.current_size) {
                 memcpy(data, cursor.current, cursor.current_size);
-                n -= cursor.current_size;
+                data += cursor.current_size;
+                n    -= cursor.current_size;
                 cursor = *(cursor.next);
             }
 
@@ -281,7 +299,8 @@ struct cursor_t {
 
             while (n > cursor.current_size) {
                 memcpy(cursor.current, data, cursor.current_size);
-                n -= cursor.current_size;
+                data += cursor.current_size;
+                n    -= cursor.current_size;
                 cursor = *(cursor.next);
             }
 
@@ -340,7 +359,7 @@ struct cursor_t {
         *data = current;
 
         #ifdef MPIPE_CHAINED_BUFFERS
-            if (n == current_size)
+            if (n == current_size && next != nullptr)
                 return *next;
             else
                 return _drop_in_buffer(n);
@@ -363,7 +382,7 @@ struct cursor_t {
         *data = current;
 
         #ifdef MPIPE_CHAINED_BUFFERS
-            if (n == current_size)
+            if (n == current_size && next != nullptr)
                 return *next;
             else
                 return _drop_in_buffer(n);
@@ -522,6 +541,38 @@ struct cursor_t {
         #endif /* MPIPE_CHAINED_BUFFERS */
     }
 
+    #ifdef MPIPE_CHAINED_BUFFERS
+
+    // Returns a new cursor which references the bytes of the cursor followed by
+    // the bytes of the given cursor.
+    //
+    // Neither the cursor nor the given cursor are modified.
+    //
+    // The allocator is used to allocate the 'shared_ptr's of the new chain.
+    //
+    // Complexity: O(n) where 'n' is the number of buffer descriptors in the
+    // chain of the cursor (but not of the given cursor).
+    template <typename alloc_t = allocator<char *>>
+    inline cursor_t append(cursor_t other, alloc_t alloc = alloc_t()) const
+    {
+        if (empty())
+            return other;
+        else if (other.empty())
+            return *this;
+
+        shared_ptr<cursor_t> _next;
+        if (next_size == 0)
+            _next = allocate_shared<cursor_t>(alloc, other);
+        else
+            _next = allocate_shared<cursor_t>(alloc, next->append(other, alloc));
+
+        return cursor_t(
+            desc, current, current_size, _next, next_size + other.size()
+        );
+    }
+
+    #endif /* MPIPE_CHAINED_BUFFERS */
+
     // Executes the given function on each buffer, in order.
     //
     // Complexity: O(n).
@@ -532,7 +583,11 @@ struct cursor_t {
 
             while (!cursor.empty()) {
                 f(cursor.current, cursor.current_size);
-                cursor = *cursor._next;
+
+                if (cursor.next == nullptr)
+                    break;
+
+                cursor = *cursor.next;
             }
         #else
             if (!empty())
@@ -545,7 +600,7 @@ private:
         cursor_t(
             shared_ptr<_buffer_desc_t> _desc, char *_current,
             size_t _current_size,
-            shared_ptr<cur> _next, size_t _next_size
+            shared_ptr<cursor_t> _next, size_t _next_size
         ) : desc(_desc), current(_current), current_size(_current_size),
             next(_next), next_size(_next_size)
     #else
@@ -40,7 +40,12 @@ using namespace rusty::driver::cpu;
 namespace rusty {
 namespace driver {
 
-struct cpu_clock_t {
+// Clock which reads the time from the 'counter_f' cycle counter.
+//
+// 'cpu_clock_t' reads the CPU's cycle counter. Simulations can provide a
+// virtual counter instead, so timers don't wait for the real time.
+template <cycles_t (*counter_f)(void)>
+struct cycle_clock_t {
     // Interval between two dates.
     struct interval_t {
         cycles_t    cycles;
@@ -55,6 +60,16 @@ struct cpu_clock_t {
         {
         }
 
+        // Creates a time interval from a number of cycles.
+        //
+        // '(interval_t) { cycles }' would call the microseconds constructor.
+        static inline interval_t from_cycles(cycles_t cycles)
+        {
+            interval_t interval;
+            interval.cycles = cycles;
+            return interval;
+        }
+
         // Returns the number of microseconds (10^-6) in the time interval.
         inline uint64_t microsec(void)
         {
@@ -63,18 +78,18 @@ struct cpu_clock_t {
 
         inline interval_t operator+(interval_t other) const
         {
-            return (interval_t) { this->cycles + other.cycles };
+            return from_cycles(this->cycles + other.cycles);
         }
 
         // If 'this' is < than 'other', is the same as 'other - this'.
         inline interval_t operator-(interval_t other) const
         {
-            return (interval_t) { this->cycles - other.cycles };
+            return from_cycles(this->cycles - other.cycles);
         }
 
         inline interval_t operator*(double factor) const
         {
-            return (interval_t) { (cycles_t) round(this->cycles * factor) };
+            return from_cycles((cycles_t) round(this->cycles * factor));
         }
 
         inline interval_t operator*=(double factor)
@@ -106,7 +121,7 @@ struct cpu_clock_t {
         inline interval_t operator-(time_t other) const
         {
             assert(this->cycles >= other.cycles);
-            return (interval_t) { this->cycles - other.cycles };
+            return interval_t::from_cycles(this->cycles - other.cycles);
         }
 
         inline time_t operator+(interval_t interval) const
@@ -114,31 +129,22 @@ struct cpu_clock_t {
             return (time_t) { this->cycles + interval.cycles };
         }
 
+        // Required for 'time_t' to be used in ordered containers.
+        inline bool operator<(time_t other) const
+        {
+            return this->cycles < other.cycles;
+        }
+
         // Returns a 'time_t' object representing the current time.
         inline static time_t now(void)
         {
-            return (time_t) { get_cycle_count() };
+            return (time_t) { counter_f() };
         }
     };
 };
 
-} } /* namespace rusty::driver */
-
-namespace std {
-
-// 'std::less<>' instance required for 'time_t' to be used in ordered
-// containers.
-
-using namespace rusty::driver;
+typedef cycle_clock_t<get_cycle_count> cpu_clock_t;
 
-template <>
-struct less<cpu_clock_t::time_t> {
-    inline bool operator()(cpu_clock_t::time_t a, cpu_clock_t::time_t b) const
-    {
-        return a.cycles < b.cycles;
-    }
-};
-
-}
+} } /* namespace rusty::driver */
 
 #endif /* __RUSTY_DRIVER_CLOCK_HPP__ */
@@ -58,6 +58,11 @@ namespace driver {
 // environment (in network byte order).
 static net_t<mpipe_t::ethernet_t::addr_t> _ether_addr(gxio_mpipe_link_t *link);
 
+static_assert(
+    RX_BURST_SIZE <= mpipe_t::ethernet_t::MAX_BURST_SIZE,
+    "RX_BURST_SIZE is larger than the Ethernet layer's maximum burst size"
+);
+
 mpipe_t::instance_t::instance_t(alloc_t _alloc)
     : alloc(_alloc), ethernet(_alloc), timers(_alloc)
 {
@@ -81,34 +86,56 @@ void mpipe_t::instance_t::run(void)
 
     // Polling loop over the packet queue. Tries to executes timers between
     // polling attempts.
+    //
+    // Packets are processed by bursts of at most 'RX_BURST_SIZE' packets. The
+    // upper layers are notified at the end of each burst.
 
     while (LIKELY(this->parent->is_running)) {
         this->timers.tick();
 
-        gxio_mpipe_idesc_t idesc;
+        gxio_mpipe_idesc_t *idescs;
 
-        result = gxio_mpipe_iqueue_try_get(&this->iqueue, &idesc);
+        int n_idescs = gxio_mpipe_iqueue_try_peek(&this->iqueue, &idescs);
 
-        if (UNLIKELY(result == GXIO_MPIPE_ERR_IQUEUE_EMPTY)) // Queue is empty. Retries.
+        if (UNLIKELY(n_idescs <= 0)) // Queue is empty. Retries.
             continue;
+        else if (n_idescs > (int) RX_BURST_SIZE)
+            n_idescs = RX_BURST_SIZE;
 
-        if (gxio_mpipe_iqueue_drop_if_bad(&this->iqueue, &idesc)) {
-            DRIVER_DEBUG("Invalid packet dropped");
-            continue;
-        }
+        tmc_mem_prefetch(idescs, n_idescs * sizeof (gxio_mpipe_idesc_t));
 
-        // Initializes a buffer cursor which starts at the Ethernet header and
-        // stops at the end of the packet.
-        //
-        // The buffer will be freed when the cursor will be destructed.
-        cursor_t cursor(&this->parent->context, &idesc, true, this->alloc);
-        cursor = cursor.drop(gxio_mpipe_idesc_get_l2_offset(&idesc));
+        cursor_t frames[RX_BURST_SIZE];
+        size_t n_frames = 0;
+
+        for (int i = 0; i < n_idescs; i++) {
+            gxio_mpipe_idesc_t *idesc = &idescs[i];
+
+            if (gxio_mpipe_iqueue_drop_if_bad(&this->iqueue, idesc)) {
+                DRIVER_DEBUG("Invalid packet dropped");
+                gxio_mpipe_iqueue_consume(&this->iqueue, idesc);
+                continue;
+            }
+
+            // Initializes a buffer cursor which starts at the Ethernet header
+            // and stops at the end of the packet.
+            //
+            // The buffer will be freed when the cursor will be destructed.
+            cursor_t cursor(&this->parent->context, idesc, true, this->alloc);
+            cursor = cursor.drop(gxio_mpipe_idesc_get_l2_offset(idesc));
+
+            // Releases the descriptor. The cursor keeps a copy of the buffer
+            // descriptor.
+            gxio_mpipe_iqueue_consume(&this->iqueue, idesc);
 
-        tmc_mem_prefetch(cursor.current, cursor.current_size);
+            tmc_mem_prefetch(cursor.current, cursor.current_size);
 
-        DRIVER_DEBUG("Receives a %zu bytes packet", cursor.size());
+            DRIVER_DEBUG("Receives a %zu bytes packet", cursor.size());
 
-        this->ethernet.receive_frame(cursor);
+            frames[n_frames++] = cursor;
+        }
+
+        this->ethernet.receive_frames(frames, n_frames);
+        this->ethernet.end_receive_burst();
     }
 }
 
@@ -145,16 +172,73 @@ void mpipe_t::instance_t::send_packet(
     gxio_mpipe_equeue_put(&this->parent->equeue, edesc);
 }
 
+void mpipe_t::instance_t::send_packets(
+    size_t n_packets, size_t packet_size, size_t last_packet_size,
+    function<void(size_t, cursor_t)> packet_writer
+)
+{
+    assert(n_packets > 0);
+    assert(packet_size <= this->parent->max_packet_size);
+    assert(last_packet_size <= packet_size);
+
+    DRIVER_DEBUG(
+        "Sends a burst of %zu packets (%zu bytes, last packet %zu bytes)",
+        n_packets, packet_size, last_packet_size
+    );
+
+    gxio_mpipe_edesc_t edescs[TX_BURST_SIZE];
+
+    for (size_t first = 0; first < n_packets; first += TX_BURST_SIZE) {
+        size_t n_edescs = min(n_packets - first, TX_BURST_SIZE);
+
+        // Writes every packet of the burst before reserving the eDMA slots, so
+        // other workers' packets will not wait behind slots that are not yet
+        // filled.
+        for (size_t i = 0; i < n_edescs; i++) {
+            size_t index = first + i;
+            size_t size  = index + 1 == n_packets ? last_packet_size
+                                                  : packet_size;
+
+            gxio_mpipe_bdesc_t bdesc = this->parent->_alloc_buffer(size);
+
+            cursor_t cursor(
+                &this->parent->context, &bdesc, size, false, this->alloc
+            );
+            packet_writer(index, cursor);
+
+            gxio_mpipe_edesc_t *edesc = &edescs[i];
+            *edesc = { 0 };
+            edesc->bound     = 1;
+            edesc->hwb       = 1;
+            edesc->xfer_size = size;
+            gxio_mpipe_edesc_set_bdesc(edesc, bdesc);
+        }
+
+        // Reserves all the slots with a single memory barrier.
+        int64_t slot = gxio_mpipe_equeue_reserve_fast(
+            &this->parent->equeue, n_edescs
+        );
+        VERIFY_GXIO(slot, "gxio_mpipe_equeue_reserve_fast()");
+
+        for (size_t i = 0; i < n_edescs; i++) {
+            gxio_mpipe_equeue_put_at(
+                &this->parent->equeue, edescs[i], slot + i
+            );
+        }
+    }
+}
+
 // We use multiple NotigRings linked to the same NotifGroup to enable some
 // kind of load balancing: with multiple NotifRings, each related to a distinct
 // worker thread, the hardware load-balancer will classify packets by their flow
 // (IP addresses, ports, ...) by worker.
 mpipe_t::mpipe_t(
-    const char *link_name, net_t<ipv4_t::addr_t> ipv4_addr, int n_workers,
-    int first_dataplane_cpu,
+    const char *link_name, vector<net_t<ipv4_t::addr_t>> ipv4_addrs,
+    int n_workers, int first_dataplane_cpu,
     vector<arp_ipv4_t::static_entry_t> static_arp4_entries
 ) : instances(n_workers)
 {
+    assert(!ipv4_addrs.empty());
     assert(n_workers > 0);
     assert((unsigned int) n_workers <= N_BUCKETS);
 
@@ -180,11 +264,6 @@ mpipe_t::mpipe_t(
 
         result = gxio_mpipe_link_open(link, context, link_name, 0);
         VERIFY_GXIO(result, "gxio_mpipe_link_open()");
-
-        #ifdef MPIPE_JUMBO_FRAMES
-            // Enable JUMBO ethernet packets
-            gxio_mpipe_link_set_attr(link, GXIO_MPIPE_LINK_RECEIVE_JUMBO, 1);
-        #endif
     }
 
     //
@@ -519,16 +598,45 @@ mpipe_t::mpipe_t(
             }
         );
 
-        max_packet_size = this->buffer_stacks.back().buffer_size;
+        //
+        // Maximum packet size.
+        //
+        // Packets are limited by the largest buffer size and by the frame size
+        // supported by the link.
+        //
+        // Smaller buffers are still used for smaller packets (see
+        // '_alloc_buffer()'), so connections with a standard MSS don't consume
+        // jumbo buffers.
+        //
+
+        size_t max_frame_size = STANDARD_FRAME_SIZE;
+
+        #ifdef MPIPE_JUMBO_FRAMES
+            // Enables the reception of jumbo frames, if supported by the link.
+            result = gxio_mpipe_link_set_attr(
+                &this->link, GXIO_MPIPE_LINK_RECEIVE_JUMBO, 1
+            );
 
-        #ifndef MPIPE_JUMBO_FRAMES
-            gxio_mpipe_link_set_attr(&link, GXIO_MPIPE_LINK_RECEIVE_JUMBO, 1);
+            if (result >= 0) {
+                max_frame_size = JUMBO_FRAME_SIZE;
 
-            gxio_mpipe_equeue_set_snf_size(&this->equeue, max_packet_size);
-        #else 
-            max_packet_size = min((size_t) 1500, max_packet_size);
+                // The eDMA engine must be able to buffer entire jumbo frames.
+                result = gxio_mpipe_equeue_set_snf_size(
+                    &this->equeue, max_frame_size
+                );
+                VERIFY_GXIO(result, "gxio_mpipe_equeue_set_snf_size()");
+            } else {
+                DRIVER_DEBUG(
+                    "The link doesn't support jumbo frames (%s). Uses standard "
+                    "frames", gxio_strerror(result)
+                );
+            }
         #endif /* MPIPE_JUMBO_FRAMES */
 
+        max_packet_size = min(
+            this->buffer_stacks.back().buffer_size, max_frame_size
+        );
+
         DRIVER_DEBUG("Maximum packet size: %zu bytes", max_packet_size);
     }
 
@@ -564,7 +672,7 @@ mpipe_t::mpipe_t(
         for (instance_t *instance : this->instances) {
             instance->parent = this;
             instance->ethernet.init(
-                instance, &instance->timers, this->ether_addr, ipv4_addr,
+                instance, &instance->timers, this->ether_addr, ipv4_addrs,
                 static_arp4_entries
             );
         }
@@ -652,6 +760,24 @@ void mpipe_t::tcp_listen(
         instance->ethernet.ipv4.tcp.listen(port, new_conn_callback);
 }
 
+// Replicates the call to every worker TCP stack.
+//
+// FIXME: Is not thread-safe, could not be called while the instances are
+// running.
+void mpipe_t::tcp_listen(
+    net_t<ipv4_t::addr_t> ipv4_addr, tcp_t::port_t port,
+    tcp_t::new_conn_callback_t new_conn_callback
+)
+{
+    assert(!this->is_running); // FIXME: not thread-safe.
+
+    for (instance_t *instance : this->instances) {
+        instance->ethernet.ipv4.tcp.listen(
+            ipv4_addr, port, new_conn_callback
+        );
+    }
+}
+
 
 gxio_mpipe_bdesc_t mpipe_t::_alloc_buffer(size_t size)
 {
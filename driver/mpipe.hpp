@@ -28,6 +28,8 @@
 #include <vector>
 #include <memory>               // allocator
 
+#include <net/ethernet.h>       // ETH_FRAME_LEN, ETH_HLEN
+
 #include <arch/cycle.h>         // get_cycle_count()
 #include <gxio/mpipe.h>         // gxio_mpipe_*, GXIO_MPIPE_*
 
@@ -42,6 +44,11 @@ using namespace std;
 
 using namespace rusty::net;
 
+#if defined(TCP_RECEIVE_COALESCING) && !defined(MPIPE_CHAINED_BUFFERS)
+    // Coalesced segments are delivered as a chain of the received buffers.
+    #error "TCP_RECEIVE_COALESCING requires MPIPE_CHAINED_BUFFERS"
+#endif
+
 namespace rusty {
 namespace driver {
 
@@ -62,11 +69,33 @@ static const unsigned int N_BUCKETS         = 1024;
 // Could be 128, 512, 2K or 64K.
 static const unsigned int IQUEUE_ENTRIES    = GXIO_MPIPE_IQUEUE_ENTRY_512;
 
+// Maximum number of packet descriptors processed by a worker between two
+// calls to 'end_receive_burst()' on the upper layers.
+//
+// Segments of a same TCP connection can only be coalesced when received
+// within the same burst.
+static const unsigned int RX_BURST_SIZE     = 16;
+
 // Number of packet descriptors in the egress queue.
 //
 // Could be 512, 2K, 8K or 64K.
 static const unsigned int EQUEUE_ENTRIES    = GXIO_MPIPE_EQUEUE_ENTRY_2K;
 
+// Maximum number of egress descriptors pushed with a single reservation of
+// eDMA slots by 'send_packets()'.
+//
+// Must be smaller than the number of packet descriptors in the egress queue.
+static const size_t TX_BURST_SIZE           = 64;
+
+// Maximum size of Ethernet frames (without the FCS) for the standard 1500 bytes
+// MTU and for the 9000 bytes jumbo MTU.
+//
+// The largest size is only used if jumbo frames are enabled and supported by
+// the link. TCP connections negotiate their own MSS, and thus their frame size,
+// below this value.
+static const size_t STANDARD_FRAME_SIZE = ETH_FRAME_LEN;
+static const size_t JUMBO_FRAME_SIZE    = 9000 + ETH_HLEN;
+
 // mPIPE buffer stacks.
 //
 // Gives the number of buffers and the buffer sizes for each buffer stack.
@@ -187,6 +216,20 @@ struct mpipe_t {
             size_t packet_size, function<void(cursor_t)> packet_writer
         );
 
+        // Sends 'n_packets' packets on the interface as a single burst.
+        //
+        // Every packet is 'packet_size' bytes long, except the last one which
+        // is 'last_packet_size' bytes long. 'packet_writer' is called with the
+        // index of the packet in the burst and a cursor corresponding to the
+        // packet's buffer memory.
+        //
+        // eDMA slots are reserved for up to 'TX_BURST_SIZE' packets at once,
+        // which saves a memory barrier per packet compared to 'send_packet()'.
+        void send_packets(
+            size_t n_packets, size_t packet_size, size_t last_packet_size,
+            function<void(size_t, cursor_t)> packet_writer
+        );
+
         // Maximum packet size. Doesn't change after initialization.
         inline size_t max_packet_size(void);
 
@@ -272,6 +315,9 @@ struct mpipe_t {
     net_t<ethernet_t::addr_t>   ether_addr;
 
     // Maximum packet size. Doesn't change after initialization.
+    //
+    // Is the minimum of the largest buffer size and of the maximum frame size
+    // supported by the link.
     size_t                      max_packet_size;
 
     // -------------------------------------------------------------------------
@@ -289,12 +335,28 @@ struct mpipe_t {
     // 'first_dataplane_cpu' specifies the number of the first dataplane Tile
     // that can be used. Useful when multiple 'mpipe_t' instances are created
     // and that you don't want them to share the same dataplane Tiles.
+    //
+    // The instances answer to every address in 'ipv4_addrs'. The first address
+    // is the primary address of the interface.
+    mpipe_t(
+        const char *link_name, vector<net_t<ipv4_t::addr_t>> ipv4_addrs,
+        int n_workers, int first_dataplane_cpu = 0,
+        vector<arp_ipv4_t::static_entry_t> static_arp_entries
+            = vector<arp_ipv4_t::static_entry_t>()
+    );
+
+    // Same as the previous constructor, with a single IPv4 address.
     mpipe_t(
         const char *link_name, net_t<ipv4_t::addr_t> ipv4_addr, int n_workers,
         int first_dataplane_cpu = 0,
         vector<arp_ipv4_t::static_entry_t> static_arp_entries
             = vector<arp_ipv4_t::static_entry_t>()
-    );
+    ) : mpipe_t(
+            link_name, vector<net_t<ipv4_t::addr_t>>({ ipv4_addr }), n_workers,
+            first_dataplane_cpu, static_arp_entries
+        )
+    {
+    }
 
     // Releases mPIPE resources referenced by current mPIPE environment.
     ~mpipe_t(void);
@@ -317,7 +379,8 @@ struct mpipe_t {
     // TCP server sockets.
     //
 
-    // Starts listening for TCP connections on the given port.
+    // Starts listening for TCP connections on the given port, on every IPv4
+    // address of the interface.
     //
     // If the port was already in the listen state, replaces the previous
     // callback function.
@@ -328,6 +391,16 @@ struct mpipe_t {
         tcp_t::port_t tcp, tcp_t::new_conn_callback_t new_conn_callback
     );
 
+    // Starts listening for TCP connections on the given port, only for the
+    // given IPv4 address of the interface.
+    //
+    // FIXME: the function is not thread safe. DON'T call it when workers are
+    // concurrently running.
+    void tcp_listen(
+        net_t<ipv4_t::addr_t> ipv4_addr, tcp_t::port_t tcp,
+        tcp_t::new_conn_callback_t new_conn_callback
+    );
+
     //
     // TCP client/connected sockets.
     //
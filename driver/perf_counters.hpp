@@ -0,0 +1,353 @@
+//
+// Hardware performance counters of a thread, read with 'perf_event_open()'.
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Each event is counted by its own counter, so an event which is not supported
+// by the CPU (or by the hypervisor) doesn't prevent the others from being
+// counted. When there are more events than hardware counters, the kernel
+// multiplexes them and the values are scaled to the time they have been
+// counted.
+//
+// Only user-space events are counted, which is where the stack runs. This is
+// also what unprivileged processes are allowed to count with the default
+// 'perf_event_paranoid' level.
+//
+
+#ifndef __RUSTY_DRIVER_PERF_COUNTERS_HPP__
+#define __RUSTY_DRIVER_PERF_COUNTERS_HPP__
+
+#include <algorithm>            // min()
+#include <cstdint>
+#include <cstdio>               // snprintf()
+#include <cstring>              // memset()
+#include <string>
+
+#include <linux/perf_event.h>   // perf_event_attr, PERF_*
+#include <sys/syscall.h>        // SYS_perf_event_open
+#include <unistd.h>             // close(), read(), syscall()
+
+using namespace std;
+
+namespace rusty {
+namespace driver {
+
+struct perf_counters_t {
+    //
+    // Member types
+    //
+
+    enum event_t {
+        INSTRUCTIONS    = 0,
+        CYCLES,
+        L1D_MISSES,             // Loads which missed the L1 data cache.
+        LLC_MISSES,             // Loads which missed the last level cache.
+        BRANCH_MISSES,          // Mispredicted branches.
+        DTLB_MISSES,            // Loads which missed the data TLB.
+
+        N_EVENTS
+    };
+
+    // Values of the counters, as read with 'PERF_FORMAT_TOTAL_TIME_ENABLED'
+    // and 'PERF_FORMAT_TOTAL_TIME_RUNNING'.
+    //
+    // The difference of two readings gives the events which happened in
+    // between.
+    struct values_t {
+        //
+        // Fields
+        //
+
+        bool        is_counted[N_EVENTS];
+
+        uint64_t    value[N_EVENTS];
+        uint64_t    time_enabled[N_EVENTS];
+        uint64_t    time_running[N_EVENTS];
+
+        //
+        // Methods
+        //
+
+        // Returns 'true' if at least one event is counted.
+        inline bool is_available(void) const;
+
+        // Returns the number of events, scaled to the time the event has been
+        // enabled if the counter has been multiplexed.
+        //
+        // Returns 0 if the event is not counted.
+        inline double get(event_t event) const;
+
+        // Returns the instructions per cycle, or 0 if either is not counted.
+        inline double ipc(void) const;
+
+        inline values_t operator-(const values_t &other) const;
+
+        inline values_t operator+(const values_t &other) const;
+
+        // Appends a JSON member with the number of each event per 'unit'
+        // (i.e. '"per_<unit>": { "instructions": 1234.5, ... }') to 'json'.
+        //
+        // Events which are not counted are 'null'.
+        inline void write_json(
+            string *json, const char *unit, uint64_t n_units
+        ) const;
+    };
+
+    //
+    // Fields
+    //
+
+    // File descriptor of each event, or -1 if the event is not counted.
+    int     fds[N_EVENTS];
+
+    //
+    // Methods
+    //
+
+    // Starts counting the events of the calling thread.
+    //
+    // Events which can't be counted (unsupported by the CPU, or not allowed)
+    // are ignored.
+    inline perf_counters_t(void);
+
+    inline ~perf_counters_t(void);
+
+    // Returns the name of the event, as reported in JSON.
+    static inline const char *name(event_t event);
+
+    perf_counters_t(const perf_counters_t &) = delete;
+    perf_counters_t &operator=(const perf_counters_t &) = delete;
+
+    // Returns 'true' if at least one event is counted.
+    inline bool is_available(void) const;
+
+    // Returns the events counted since the creation of the counters.
+    //
+    // Can be called from any thread of the process, while the counted thread
+    // is still running.
+    inline values_t read(void) const;
+};
+
+// Sets the 'type' and 'config' fields of the attributes of the event.
+static inline void _perf_event_config(
+    perf_counters_t::event_t event, struct perf_event_attr *attr
+);
+
+inline bool perf_counters_t::values_t::is_available(void) const
+{
+    for (bool is_counted : this->is_counted) {
+        if (is_counted)
+            return true;
+    }
+
+    return false;
+}
+
+inline double perf_counters_t::values_t::get(event_t event) const
+{
+    if (!this->is_counted[event] || this->time_running[event] == 0)
+        return 0.0;
+
+    return   (double) this->value[event] * this->time_enabled[event]
+           / this->time_running[event];
+}
+
+inline double perf_counters_t::values_t::ipc(void) const
+{
+    double cycles = this->get(CYCLES);
+
+    if (cycles == 0.0)
+        return 0.0;
+
+    return this->get(INSTRUCTIONS) / cycles;
+}
+
+inline perf_counters_t::values_t perf_counters_t::values_t::operator-(
+    const values_t &other
+) const
+{
+    values_t diff;
+
+    for (size_t i = 0; i < N_EVENTS; i++) {
+        diff.is_counted[i]      = this->is_counted[i] && other.is_counted[i];
+        diff.value[i]           = this->value[i] - other.value[i];
+        diff.time_enabled[i]    = this->time_enabled[i] - other.time_enabled[i];
+        diff.time_running[i]    = this->time_running[i] - other.time_running[i];
+    }
+
+    return diff;
+}
+
+inline perf_counters_t::values_t perf_counters_t::values_t::operator+(
+    const values_t &other
+) const
+{
+    values_t sum;
+
+    for (size_t i = 0; i < N_EVENTS; i++) {
+        sum.is_counted[i]       = this->is_counted[i] && other.is_counted[i];
+        sum.value[i]            = this->value[i] + other.value[i];
+        sum.time_enabled[i]     = this->time_enabled[i] + other.time_enabled[i];
+        sum.time_running[i]     = this->time_running[i] + other.time_running[i];
+    }
+
+    return sum;
+}
+
+inline void perf_counters_t::values_t::write_json(
+    string *json, const char *unit, uint64_t n_units
+) const
+{
+    char buffer[64];
+    int len;
+
+    len = snprintf(buffer, sizeof (buffer), "\"per_%s\": {", unit);
+    json->append(buffer, min((size_t) len, sizeof (buffer) - 1));
+
+    for (size_t i = 0; i < N_EVENTS; i++) {
+        if (this->is_counted[i] && n_units > 0) {
+            len = snprintf(
+                buffer, sizeof (buffer), "%s \"%s\": %.2f", i > 0 ? "," : "",
+                name((event_t) i), this->get((event_t) i) / n_units
+            );
+        } else {
+            len = snprintf(
+                buffer, sizeof (buffer), "%s \"%s\": null", i > 0 ? "," : "",
+                name((event_t) i)
+            );
+        }
+
+        json->append(buffer, min((size_t) len, sizeof (buffer) - 1));
+    }
+
+    *json += " }";
+}
+
+inline const char *perf_counters_t::name(event_t event)
+{
+    static const char *names[N_EVENTS] = {
+        "instructions", "cycles", "l1d_misses", "llc_misses", "branch_misses",
+        "dtlb_misses"
+    };
+
+    return names[event];
+}
+
+inline perf_counters_t::perf_counters_t(void)
+{
+    for (size_t i = 0; i < N_EVENTS; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof (attr));
+
+        attr.size           = sizeof (attr);
+        attr.read_format    =   PERF_FORMAT_TOTAL_TIME_ENABLED
+                              | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv     = 1;
+
+        _perf_event_config((event_t) i, &attr);
+
+        // Counts the calling thread, on any CPU.
+        this->fds[i] = (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+}
+
+inline perf_counters_t::~perf_counters_t(void)
+{
+    for (int fd : this->fds) {
+        if (fd >= 0)
+            close(fd);
+    }
+}
+
+inline bool perf_counters_t::is_available(void) const
+{
+    for (int fd : this->fds) {
+        if (fd >= 0)
+            return true;
+    }
+
+    return false;
+}
+
+inline perf_counters_t::values_t perf_counters_t::read(void) const
+{
+    values_t values;
+
+    for (size_t i = 0; i < N_EVENTS; i++) {
+        uint64_t buffer[3];
+
+        values.is_counted[i] =
+               this->fds[i] >= 0
+            && ::read(this->fds[i], buffer, sizeof (buffer))
+               == (ssize_t) sizeof (buffer);
+
+        if (values.is_counted[i]) {
+            values.value[i]         = buffer[0];
+            values.time_enabled[i]  = buffer[1];
+            values.time_running[i]  = buffer[2];
+        } else {
+            values.value[i]         = 0;
+            values.time_enabled[i]  = 0;
+            values.time_running[i]  = 0;
+        }
+    }
+
+    return values;
+}
+
+static inline void _perf_event_config(
+    perf_counters_t::event_t event, struct perf_event_attr *attr
+)
+{
+    // Cache events are '<cache> | <operation> << 8 | <result> << 16'.
+    #define CACHE_READ_MISS(CACHE)                                             \
+        (   (CACHE) | (PERF_COUNT_HW_CACHE_OP_READ << 8)                       \
+          | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+    switch (event) {
+    case perf_counters_t::INSTRUCTIONS:
+        attr->type     = PERF_TYPE_HARDWARE;
+        attr->config   = PERF_COUNT_HW_INSTRUCTIONS;
+        break;
+    case perf_counters_t::CYCLES:
+        attr->type     = PERF_TYPE_HARDWARE;
+        attr->config   = PERF_COUNT_HW_CPU_CYCLES;
+        break;
+    case perf_counters_t::L1D_MISSES:
+        attr->type     = PERF_TYPE_HW_CACHE;
+        attr->config   = CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1D);
+        break;
+    case perf_counters_t::LLC_MISSES:
+        attr->type     = PERF_TYPE_HW_CACHE;
+        attr->config   = CACHE_READ_MISS(PERF_COUNT_HW_CACHE_LL);
+        break;
+    case perf_counters_t::BRANCH_MISSES:
+        attr->type     = PERF_TYPE_HARDWARE;
+        attr->config   = PERF_COUNT_HW_BRANCH_MISSES;
+        break;
+    default: // DTLB_MISSES
+        attr->type     = PERF_TYPE_HW_CACHE;
+        attr->config   = CACHE_READ_MISS(PERF_COUNT_HW_CACHE_DTLB);
+    }
+
+    #undef CACHE_READ_MISS
+}
+
+} } /* namespace rusty::driver */
+
+#endif /* __RUSTY_DRIVER_PERF_COUNTERS_HPP__ */
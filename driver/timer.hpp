@@ -31,25 +31,33 @@
 #include <unordered_map>
 
 #include "driver/clock.hpp" // cpu_clock_t
+#include "driver/driver.hpp" // DRIVER_DEBUG
 
 using namespace std;
 
 namespace rusty {
 namespace driver {
 
-// Manages timers using uses the CPU's cycle counter.
+// Manages timers using uses the CPU's cycle counter, or the cycle counter of
+// another 'cycle_clock_t' clock.
 //
 // The 'tick()' method should be called periodically to execute expired timers.
 //
 // The manager is *not* thread-safe. Users must avoid concurrent calls to
 // 'tick()', 'schedule()' and 'remove()'. Calling 'schedule()' or 'remove()'
 // within a timer should be safe.
-template <typename alloc_t = allocator<char *>>
+template <
+    typename alloc_t = allocator<char *>, typename clock_var_t = cpu_clock_t
+>
 struct cpu_timer_manager_t {
     //
     // Member types
     //
 
+    // Redefines 'clock_var_t' as 'clock_t' so it can be accessible as a member
+    // type.
+    typedef clock_var_t         clock_t;
+
     // Timers are stored by the time they will expire.
     //
     // Only one function/timer can be mapped to an expiration date. In
@@ -64,13 +72,14 @@ struct cpu_timer_manager_t {
     // simplifies the implementation and makes it more efficient than a vector
     // of timers which requires numerous dynamic memory allocations.
     typedef map<
-                cpu_clock_t::time_t, function<void()>,
-                less<cpu_clock_t::time_t>, alloc_t
+                typename clock_t::time_t, function<void()>,
+                less<typename clock_t::time_t>, alloc_t
             >                   timers_t;
 
     // The 'destroy()' method uses the timer expiration date to retrieve and
     // remove a timer.
-    typedef cpu_clock_t::time_t timer_id_t;
+    typedef typename clock_t::time_t
+                                timer_id_t;
 
     //
     // Fields
@@ -88,11 +97,13 @@ struct cpu_timer_manager_t {
     void tick(void);
 
     // Registers a timer. The timer will only be executed once.
-    timer_id_t schedule(cpu_clock_t::interval_t delay, function<void()> f);
+    timer_id_t schedule(
+        typename clock_t::interval_t delay, function<void()> f
+    );
 
     // Reschedules the given timer with a new delay. Returns the new 'timer_id'.
     timer_id_t reschedule(
-        timer_id_t timer_id, cpu_clock_t::interval_t new_delay
+        timer_id_t timer_id, typename clock_t::interval_t new_delay
     );
 
     // Unschedules a timer by the identifier that has been returned by the
@@ -104,17 +115,19 @@ struct cpu_timer_manager_t {
 
 private:
     // Sames as 'schedule' but doesn't produce a log message.
-    timer_id_t _insert(cpu_clock_t::interval_t delay, function<void()> f);
+    timer_id_t _insert(
+        typename clock_t::interval_t delay, function<void()> f
+    );
 };
 
-template <typename alloc_t>
-cpu_timer_manager_t<alloc_t>::cpu_timer_manager_t(alloc_t _alloc)
-    : timers(less<cpu_clock_t::time_t>(), _alloc)
+template <typename alloc_t, typename clock_t>
+cpu_timer_manager_t<alloc_t, clock_t>::cpu_timer_manager_t(alloc_t _alloc)
+    : timers(less<typename clock_t::time_t>(), _alloc)
 {
 }
 
-template <typename alloc_t>
-void cpu_timer_manager_t<alloc_t>::tick(void)
+template <typename alloc_t, typename clock_t>
+void cpu_timer_manager_t<alloc_t, clock_t>::tick(void)
 {
     typename timers_t::const_iterator it;
 
@@ -125,8 +138,8 @@ void cpu_timer_manager_t<alloc_t>::tick(void)
         // Similarly, the loop call 'timers.begin()' at each iteration as the
         // iterator could be invalidated.
 
-        cpu_clock_t::time_t now = cpu_clock_t::time_t::now();
-        if (less<cpu_clock_t::time_t>()(now, it->first))
+        typename clock_t::time_t now = clock_t::time_t::now();
+        if (less<typename clock_t::time_t>()(now, it->first))
             break;
 
         DRIVER_DEBUG("Executes timer %" PRIu64, it->first.cycles);
@@ -138,10 +151,10 @@ void cpu_timer_manager_t<alloc_t>::tick(void)
     }
 }
 
-template <typename alloc_t>
-typename cpu_timer_manager_t<alloc_t>::timer_id_t
-cpu_timer_manager_t<alloc_t>::schedule(
-    cpu_clock_t::interval_t delay, function<void()> f
+template <typename alloc_t, typename clock_t>
+typename cpu_timer_manager_t<alloc_t, clock_t>::timer_id_t
+cpu_timer_manager_t<alloc_t, clock_t>::schedule(
+    typename clock_t::interval_t delay, function<void()> f
 )
 {
     timer_id_t timer_id = this->_insert(delay, f);
@@ -154,10 +167,10 @@ cpu_timer_manager_t<alloc_t>::schedule(
     return timer_id;
 }
 
-template <typename alloc_t>
-typename cpu_timer_manager_t<alloc_t>::timer_id_t
-cpu_timer_manager_t<alloc_t>::reschedule(
-    timer_id_t timer_id, cpu_clock_t::interval_t new_delay
+template <typename alloc_t, typename clock_t>
+typename cpu_timer_manager_t<alloc_t, clock_t>::timer_id_t
+cpu_timer_manager_t<alloc_t, clock_t>::reschedule(
+    timer_id_t timer_id, typename clock_t::interval_t new_delay
 )
 {
     auto it = timers.find(timer_id);
@@ -175,21 +188,21 @@ cpu_timer_manager_t<alloc_t>::reschedule(
     return new_timer_id;
 }
 
-template <typename alloc_t>
-bool cpu_timer_manager_t<alloc_t>::remove(timer_id_t timer_id)
+template <typename alloc_t, typename clock_t>
+bool cpu_timer_manager_t<alloc_t, clock_t>::remove(timer_id_t timer_id)
 {
     DRIVER_DEBUG("Unschedules timer %" PRIu64, timer_id.cycles);
 
     return timers.erase(timer_id);
 }
 
-template <typename alloc_t>
-typename cpu_timer_manager_t<alloc_t>::timer_id_t
-cpu_timer_manager_t<alloc_t>::_insert(
-    cpu_clock_t::interval_t delay, function<void()> f
+template <typename alloc_t, typename clock_t>
+typename cpu_timer_manager_t<alloc_t, clock_t>::timer_id_t
+cpu_timer_manager_t<alloc_t, clock_t>::_insert(
+    typename clock_t::interval_t delay, function<void()> f
 )
 {
-    cpu_clock_t::time_t expire = cpu_clock_t::time_t::now() + delay;
+    typename clock_t::time_t expire = clock_t::time_t::now() + delay;
 
     // Uses the next time slot if the current one already exist.
     while (!timers.emplace(expire, f).second)
@@ -0,0 +1,313 @@
+//
+// Frames and settings of HTTP/2 (RFC 7540).
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __RUSTY_HTTP_H2_HPP__
+#define __RUSTY_HTTP_H2_HPP__
+
+#include <cstdint>
+#include <string>
+
+#include "http/parser.hpp"      // str_ref_t
+#include "util/macros.hpp"      // UNLIKELY()
+
+using namespace std;
+
+namespace rusty {
+namespace http {
+
+// Connection preface sent by the clients.
+static constexpr char   H2_PREFACE[]    = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+static constexpr size_t H2_PREFACE_LEN  = sizeof (H2_PREFACE) - 1;
+
+// Error codes of the RST_STREAM and GOAWAY frames.
+enum h2_error_t {
+    H2_NO_ERROR             = 0x0,
+    H2_PROTOCOL_ERROR       = 0x1,
+    H2_INTERNAL_ERROR       = 0x2,
+    H2_FLOW_CONTROL_ERROR   = 0x3,
+    H2_STREAM_CLOSED        = 0x5,
+    H2_FRAME_SIZE_ERROR     = 0x6,
+    H2_REFUSED_STREAM       = 0x7,
+    H2_CANCEL               = 0x8,
+    H2_COMPRESSION_ERROR    = 0x9
+};
+
+// Header of a frame.
+struct h2_frame_header_t {
+    //
+    // Member types
+    //
+
+    enum type_t {
+        DATA            = 0x0,
+        HEADERS         = 0x1,
+        PRIORITY        = 0x2,
+        RST_STREAM      = 0x3,
+        SETTINGS        = 0x4,
+        PUSH_PROMISE    = 0x5,
+        PING            = 0x6,
+        GOAWAY          = 0x7,
+        WINDOW_UPDATE   = 0x8,
+        CONTINUATION    = 0x9
+    };
+
+    enum flag_t {
+        END_STREAM      = 0x01,     // DATA and HEADERS.
+        ACK             = 0x01,     // SETTINGS and PING.
+        END_HEADERS     = 0x04,     // HEADERS and CONTINUATION.
+        PADDED          = 0x08,     // DATA and HEADERS.
+        PRIORITY_FLAG   = 0x20      // HEADERS.
+    };
+
+    //
+    // Static fields
+    //
+
+    static constexpr size_t SIZE    = 9;
+
+    //
+    // Fields
+    //
+
+    uint32_t    length;     // 24 bits.
+    uint8_t     type;
+    uint8_t     flags;
+    uint32_t    stream_id;  // 31 bits.
+
+    //
+    // Methods
+    //
+
+    // Reads the 'SIZE' bytes of a frame header.
+    static inline h2_frame_header_t read(const char *data)
+    {
+        const uint8_t *p = (const uint8_t *) data;
+
+        h2_frame_header_t hdr;
+        hdr.length      = (p[0] << 16) | (p[1] << 8) | p[2];
+        hdr.type        = p[3];
+        hdr.flags       = p[4];
+        hdr.stream_id   = read_uint32(p + 5) & 0x7FFFFFFF;
+
+        return hdr;
+    }
+
+    // Writes the 'SIZE' bytes of the frame header.
+    inline void write(char *data) const
+    {
+        uint8_t *p = (uint8_t *) data;
+
+        p[0] = this->length >> 16;
+        p[1] = this->length >> 8;
+        p[2] = this->length;
+        p[3] = this->type;
+        p[4] = this->flags;
+        write_uint32(this->stream_id, p + 5);
+    }
+
+    // Appends a frame with the given header fields and payload.
+    static inline void append(
+        uint8_t type, uint8_t flags, uint32_t stream_id, const char *payload,
+        size_t length, string *out
+    )
+    {
+        h2_frame_header_t hdr = { (uint32_t) length, type, flags, stream_id };
+
+        char header[SIZE];
+        hdr.write(header);
+
+        out->append(header, SIZE);
+        out->append(payload, length);
+    }
+
+    // Reads and writes 32 bits integers in network byte order.
+
+    static inline uint32_t read_uint32(const uint8_t *p)
+    {
+        return   ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16)
+               | ((uint32_t) p[2] << 8)  |  (uint32_t) p[3];
+    }
+
+    static inline void write_uint32(uint32_t value, uint8_t *p)
+    {
+        p[0] = value >> 24;
+        p[1] = value >> 16;
+        p[2] = value >> 8;
+        p[3] = value;
+    }
+};
+
+// Settings of one of the endpoints of a connection.
+struct h2_settings_t {
+    //
+    // Member types
+    //
+
+    enum id_t {
+        HEADER_TABLE_SIZE       = 0x1,
+        ENABLE_PUSH             = 0x2,
+        MAX_CONCURRENT_STREAMS  = 0x3,
+        INITIAL_WINDOW_SIZE     = 0x4,
+        MAX_FRAME_SIZE          = 0x5,
+        MAX_HEADER_LIST_SIZE    = 0x6
+    };
+
+    //
+    // Static fields
+    //
+
+    // Size of a parameter in a SETTINGS payload.
+    static constexpr size_t     ENTRY_SIZE              = 6;
+
+    static constexpr uint32_t   DEFAULT_WINDOW_SIZE     = 65535;
+    static constexpr uint32_t   MAX_WINDOW_SIZE         = 0x7FFFFFFF;
+
+    // Bounds of the SETTINGS_MAX_FRAME_SIZE parameter.
+    static constexpr uint32_t   MIN_FRAME_SIZE          = 16384;
+    static constexpr uint32_t   MAX_FRAME_SIZE_LIMIT    = 0xFFFFFF;
+
+    //
+    // Fields
+    //
+
+    uint32_t    header_table_size;
+    uint32_t    max_concurrent_streams;
+    uint32_t    initial_window_size;
+    uint32_t    max_frame_size;
+
+    //
+    // Methods
+    //
+
+    // Initializes the settings to their initial values.
+    inline h2_settings_t(void)
+        : header_table_size(4096), max_concurrent_streams(UINT32_MAX),
+          initial_window_size(DEFAULT_WINDOW_SIZE),
+          max_frame_size(MIN_FRAME_SIZE)
+    {
+    }
+
+    // Applies the parameters of a SETTINGS payload. Unknown parameters are
+    // ignored.
+    //
+    // Returns the error of the connection if the payload is invalid, or
+    // 'H2_NO_ERROR'.
+    h2_error_t apply(const char *payload, size_t length);
+
+    // Appends a parameter to a SETTINGS payload.
+    static inline void append(id_t id, uint32_t value, string *out)
+    {
+        uint8_t entry[ENTRY_SIZE];
+        entry[0] = id >> 8;
+        entry[1] = id;
+        h2_frame_header_t::write_uint32(value, entry + 2);
+
+        out->append((const char *) entry, ENTRY_SIZE);
+    }
+
+    // Decodes the base64url value of an 'HTTP2-Settings' header into the
+    // SETTINGS payload it encodes.
+    //
+    // Returns 'false' if the value is malformed.
+    static bool decode_header(str_ref_t value, string *payload);
+};
+
+inline h2_error_t h2_settings_t::apply(const char *payload, size_t length)
+{
+    if (UNLIKELY(length % ENTRY_SIZE != 0))
+        return H2_FRAME_SIZE_ERROR;
+
+    const uint8_t *p = (const uint8_t *) payload;
+
+    for (size_t i = 0; i < length; i += ENTRY_SIZE) {
+        uint16_t id     = (p[i] << 8) | p[i + 1];
+        uint32_t value  = h2_frame_header_t::read_uint32(p + i + 2);
+
+        switch (id) {
+        case HEADER_TABLE_SIZE:
+            this->header_table_size = value;
+            break;
+        case ENABLE_PUSH:
+            if (UNLIKELY(value > 1))
+                return H2_PROTOCOL_ERROR;
+            break;
+        case MAX_CONCURRENT_STREAMS:
+            this->max_concurrent_streams = value;
+            break;
+        case INITIAL_WINDOW_SIZE:
+            if (UNLIKELY(value > MAX_WINDOW_SIZE))
+                return H2_FLOW_CONTROL_ERROR;
+            this->initial_window_size = value;
+            break;
+        case MAX_FRAME_SIZE:
+            if (UNLIKELY(
+                   value < MIN_FRAME_SIZE || value > MAX_FRAME_SIZE_LIMIT
+            ))
+                return H2_PROTOCOL_ERROR;
+            this->max_frame_size = value;
+            break;
+        }
+    }
+
+    return H2_NO_ERROR;
+}
+
+inline bool h2_settings_t::decode_header(str_ref_t value, string *payload)
+{
+    // Accumulates 6 bits per character.
+    uint32_t    bits    = 0;
+    int         n_bits  = 0;
+
+    payload->clear();
+
+    for (size_t i = 0; i < value.len; i++) {
+        char        c = value.data[i];
+        uint32_t    sextet;
+
+        if (c >= 'A' && c <= 'Z')
+            sextet = c - 'A';
+        else if (c >= 'a' && c <= 'z')
+            sextet = c - 'a' + 26;
+        else if (c >= '0' && c <= '9')
+            sextet = c - '0' + 52;
+        else if (c == '-')
+            sextet = 62;
+        else if (c == '_')
+            sextet = 63;
+        else if (c == '=')      // Padding, which should be omitted.
+            break;
+        else
+            return false;
+
+        bits    = (bits << 6) | sextet;
+        n_bits  += 6;
+
+        if (n_bits >= 8) {
+            n_bits -= 8;
+            payload->push_back((char) (bits >> n_bits));
+        }
+    }
+
+    return payload->size() % ENTRY_SIZE == 0;
+}
+
+} } /* namespace rusty::http */
+
+#endif /* __RUSTY_HTTP_H2_HPP__ */
@@ -0,0 +1,811 @@
+//
+// HPACK header compression for HTTP/2 (RFC 7541).
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Header blocks are decoded in place. Only the Huffman-encoded strings are
+// copied, into buffers of the decoder. The other strings reference the header
+// block or the tables.
+//
+// The encoder never uses the Huffman code. Response headers are mostly short
+// tokens, and the fields which repeat across the responses of a connection
+// are only sent once, and then referenced from the dynamic table.
+//
+
+#ifndef __RUSTY_HTTP_HPACK_HPP__
+#define __RUSTY_HTTP_HPACK_HPP__
+
+#include <algorithm>            // min()
+#include <cstdint>
+#include <cstring>              // memcmp()
+#include <deque>
+#include <string>
+
+#include "http/parser.hpp"      // str_ref_t
+#include "util/macros.hpp"      // LIKELY(), UNLIKELY()
+
+using namespace std;
+
+namespace rusty {
+namespace http {
+
+// Entry of the static table.
+struct hpack_static_entry_t {
+    const char  *name;
+    size_t      name_len;
+    const char  *value;
+    size_t      value_len;
+};
+
+#define HPACK_ENTRY(NAME, VALUE)                                               \
+    { NAME, sizeof (NAME) - 1, VALUE, sizeof (VALUE) - 1 }
+
+// Static table of RFC 7541, Appendix A. The entry at index 'i' of the table
+// has the index 'i + 1' in the header blocks.
+static constexpr hpack_static_entry_t HPACK_STATIC_TABLE[] = {
+    HPACK_ENTRY(":authority",                  ""),
+    HPACK_ENTRY(":method",                     "GET"),
+    HPACK_ENTRY(":method",                     "POST"),
+    HPACK_ENTRY(":path",                       "/"),
+    HPACK_ENTRY(":path",                       "/index.html"),
+    HPACK_ENTRY(":scheme",                     "http"),
+    HPACK_ENTRY(":scheme",                     "https"),
+    HPACK_ENTRY(":status",                     "200"),
+    HPACK_ENTRY(":status",                     "204"),
+    HPACK_ENTRY(":status",                     "206"),
+    HPACK_ENTRY(":status",                     "304"),
+    HPACK_ENTRY(":status",                     "400"),
+    HPACK_ENTRY(":status",                     "404"),
+    HPACK_ENTRY(":status",                     "500"),
+    HPACK_ENTRY("accept-charset",              ""),
+    HPACK_ENTRY("accept-encoding",             "gzip, deflate"),
+    HPACK_ENTRY("accept-language",             ""),
+    HPACK_ENTRY("accept-ranges",               ""),
+    HPACK_ENTRY("accept",                      ""),
+    HPACK_ENTRY("access-control-allow-origin", ""),
+    HPACK_ENTRY("age",                         ""),
+    HPACK_ENTRY("allow",                       ""),
+    HPACK_ENTRY("authorization",               ""),
+    HPACK_ENTRY("cache-control",               ""),
+    HPACK_ENTRY("content-disposition",         ""),
+    HPACK_ENTRY("content-encoding",            ""),
+    HPACK_ENTRY("content-language",            ""),
+    HPACK_ENTRY("content-length",              ""),
+    HPACK_ENTRY("content-location",            ""),
+    HPACK_ENTRY("content-range",               ""),
+    HPACK_ENTRY("content-type",                ""),
+    HPACK_ENTRY("cookie",                      ""),
+    HPACK_ENTRY("date",                        ""),
+    HPACK_ENTRY("etag",                        ""),
+    HPACK_ENTRY("expect",                      ""),
+    HPACK_ENTRY("expires",                     ""),
+    HPACK_ENTRY("from",                        ""),
+    HPACK_ENTRY("host",                        ""),
+    HPACK_ENTRY("if-match",                    ""),
+    HPACK_ENTRY("if-modified-since",           ""),
+    HPACK_ENTRY("if-none-match",               ""),
+    HPACK_ENTRY("if-range",                    ""),
+    HPACK_ENTRY("if-unmodified-since",         ""),
+    HPACK_ENTRY("last-modified",               ""),
+    HPACK_ENTRY("link",                        ""),
+    HPACK_ENTRY("location",                    ""),
+    HPACK_ENTRY("max-forwards",                ""),
+    HPACK_ENTRY("proxy-authenticate",          ""),
+    HPACK_ENTRY("proxy-authorization",         ""),
+    HPACK_ENTRY("range",                       ""),
+    HPACK_ENTRY("referer",                     ""),
+    HPACK_ENTRY("refresh",                     ""),
+    HPACK_ENTRY("retry-after",                 ""),
+    HPACK_ENTRY("server",                      ""),
+    HPACK_ENTRY("set-cookie",                  ""),
+    HPACK_ENTRY("strict-transport-security",   ""),
+    HPACK_ENTRY("transfer-encoding",           ""),
+    HPACK_ENTRY("user-agent",                  ""),
+    HPACK_ENTRY("vary",                        ""),
+    HPACK_ENTRY("via",                         ""),
+    HPACK_ENTRY("www-authenticate",            "")
+};
+
+#undef HPACK_ENTRY
+
+static constexpr size_t HPACK_STATIC_TABLE_LEN  =
+    sizeof (HPACK_STATIC_TABLE) / sizeof (HPACK_STATIC_TABLE[0]);
+
+// The codes of the Huffman code of RFC 7541, Appendix B, are canonical: the
+// codes of a given length are consecutive, and follow the shorter codes in
+// the order of their symbols. The code is thus entirely described by the
+// symbols sorted by the length of their code, and by the first code of each
+// length.
+struct hpack_huffman_length_t {
+    uint8_t     len;    // Length of the codes, in bits.
+    uint32_t    first;  // First code of this length.
+    uint16_t    count;  // Number of codes of this length.
+
+    // Index in 'HPACK_HUFFMAN_SYMBOLS' of the symbol of 'first'.
+    uint16_t    offset;
+};
+
+static constexpr hpack_huffman_length_t HPACK_HUFFMAN_LENGTHS[] = {
+    {  5, 0x00000000,  10,   0 },
+    {  6, 0x00000014,  26,  10 },
+    {  7, 0x0000005c,  32,  36 },
+    {  8, 0x000000f8,   6,  68 },
+    { 10, 0x000003f8,   5,  74 },
+    { 11, 0x000007fa,   3,  79 },
+    { 12, 0x00000ffa,   2,  82 },
+    { 13, 0x00001ff8,   6,  84 },
+    { 14, 0x00003ffc,   2,  90 },
+    { 15, 0x00007ffc,   3,  92 },
+    { 19, 0x0007fff0,   3,  95 },
+    { 20, 0x000fffe6,   8,  98 },
+    { 21, 0x001fffdc,  13, 106 },
+    { 22, 0x003fffd2,  26, 119 },
+    { 23, 0x007fffd8,  29, 145 },
+    { 24, 0x00ffffea,  12, 174 },
+    { 25, 0x01ffffec,   4, 186 },
+    { 26, 0x03ffffe0,  15, 190 },
+    { 27, 0x07ffffde,  19, 205 },
+    { 28, 0x0fffffe2,  29, 224 },
+    { 30, 0x3ffffffc,   4, 253 },
+};
+
+static constexpr uint16_t HPACK_HUFFMAN_SYMBOLS[] = {
+    48, 49, 50, 97, 99, 101, 105, 111, 115, 116, 32, 37, 45, 46, 47, 51, 52, 53,
+    54, 55, 56, 57, 61, 65, 95, 98, 100, 102, 103, 104, 108, 109, 110, 112, 114,
+    117, 58, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76, 77, 78, 79, 80, 81, 82,
+    83, 84, 85, 86, 87, 89, 106, 107, 113, 118, 119, 120, 121, 122, 38, 42, 44,
+    59, 88, 90, 33, 34, 40, 41, 63, 39, 43, 124, 35, 62, 0, 36, 64, 91, 93, 126,
+    94, 125, 60, 96, 123, 92, 195, 208, 128, 130, 131, 162, 184, 194, 224, 226,
+    153, 161, 167, 172, 176, 177, 179, 209, 216, 217, 227, 229, 230, 129, 132,
+    133, 134, 136, 146, 154, 156, 160, 163, 164, 169, 170, 173, 178, 181, 185,
+    186, 187, 189, 190, 196, 198, 228, 232, 233, 1, 135, 137, 138, 139, 140,
+    141, 143, 147, 149, 150, 151, 152, 155, 157, 158, 165, 166, 168, 174, 175,
+    180, 182, 183, 188, 191, 197, 231, 239, 9, 142, 144, 145, 148, 159, 171,
+    206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193, 200, 201, 202, 205,
+    210, 213, 218, 219, 238, 240, 242, 243, 255, 203, 204, 211, 212, 214, 221,
+    222, 223, 241, 244, 245, 246, 247, 248, 250, 251, 252, 253, 254, 2, 3, 4, 5,
+    6, 7, 8, 11, 12, 14, 15, 16, 17, 18, 19, 20, 21, 23, 24, 25, 26, 27, 28, 29,
+    30, 31, 127, 220, 249, 10, 13, 22, 256
+};
+
+// Symbol which ends the Huffman code. Can't be decoded.
+static constexpr uint16_t HPACK_HUFFMAN_EOS     = 256;
+
+// Dynamic table of a decoder or of an encoder.
+struct hpack_table_t {
+    //
+    // Member types
+    //
+
+    struct entry_t {
+        string  name;
+        string  value;
+    };
+
+    //
+    // Static fields
+    //
+
+    // Size counted for each entry, in addition to its name and to its value.
+    static constexpr size_t ENTRY_OVERHEAD  = 32;
+
+    // Initial maximum size of the tables (SETTINGS_HEADER_TABLE_SIZE).
+    static constexpr size_t DEFAULT_SIZE    = 4096;
+
+    //
+    // Fields
+    //
+
+    // Entries, from the newest to the oldest. The first entry has the index
+    // 'HPACK_STATIC_TABLE_LEN + 1'.
+    deque<entry_t>  entries;
+
+    // Sum of the sizes of the entries.
+    size_t          size;
+
+    size_t          max_size;
+
+    //
+    // Methods
+    //
+
+    inline hpack_table_t(size_t _max_size = DEFAULT_SIZE)
+        : size(0), max_size(_max_size)
+    {
+    }
+
+    // Adds the field to the table, and evicts the oldest entries to make room
+    // for it.
+    //
+    // Returns 'false' if the field is larger than the table. The table is
+    // then emptied, and the field is not added.
+    bool add(str_ref_t name, str_ref_t value);
+
+    // Changes the maximum size of the table, and evicts the oldest entries
+    // which don't fit anymore.
+    void resize(size_t _max_size);
+
+    // Sets the name and the value of the field at the given index of the
+    // static table followed by the dynamic table, starting at 1.
+    //
+    // Returns 'false' if there is no such field.
+    inline bool get(size_t index, str_ref_t *name, str_ref_t *value) const;
+
+private:
+
+    // Evicts the oldest entries until the table can store 'needed' more
+    // bytes.
+    void _evict(size_t needed);
+};
+
+// Decodes the header blocks of a connection.
+struct hpack_decoder_t {
+    //
+    // Fields
+    //
+
+    hpack_table_t   table;
+
+    // Maximum size of the dynamic table, as announced in the
+    // SETTINGS_HEADER_TABLE_SIZE parameter. The encoder can resize the table
+    // up to this size.
+    size_t          max_table_size;
+
+    // Strings decoded from the Huffman code.
+    string          name_buffer;
+    string          value_buffer;
+
+    //
+    // Methods
+    //
+
+    inline hpack_decoder_t(
+        size_t _max_table_size = hpack_table_t::DEFAULT_SIZE
+    ) : table(_max_table_size), max_table_size(_max_table_size)
+    {
+    }
+
+    // Decodes a complete header block, and calls 'on_field(name, value)' for
+    // each of its fields, in order.
+    //
+    // The strings given to 'on_field()' are only valid during the call.
+    // 'on_field()' can return 'false' to stop decoding.
+    //
+    // Returns 'false' if the block is malformed or if 'on_field()' returned
+    // 'false'. The state of the decoder is then undefined and the connection
+    // must be closed.
+    //
+    // Dynamic table size updates must precede the first field of the block
+    // (RFC 7541, 4.2).
+    template <typename on_field_t>
+    bool decode(const char *block, size_t size, on_field_t on_field);
+
+    // Decodes an integer with an 'n_prefix' bits prefix at '*p', and moves
+    // '*p' after it.
+    //
+    // Fails on integers larger than 2^35, which are never legitimate.
+    static inline bool decode_int(
+        const uint8_t **p, const uint8_t *end, int n_prefix, size_t *value
+    );
+
+    // Decodes a Huffman-encoded string, and appends it to 'out'.
+    static bool huffman_decode(const char *data, size_t size, string *out);
+
+private:
+
+    // Decodes a string literal at '*p', and moves '*p' after it.
+    //
+    // Huffman-encoded strings are decoded in 'buffer'.
+    static inline bool _decode_string(
+        const uint8_t **p, const uint8_t *end, string *buffer, str_ref_t *str
+    );
+};
+
+// Encodes the header blocks of a connection.
+struct hpack_encoder_t {
+    //
+    // Fields
+    //
+
+    hpack_table_t   table;
+
+    // Smallest size of the table since the last header block, if the size
+    // changed. The decoder must be told of the changes at the beginning of
+    // the next block.
+    bool            resized;
+    size_t          min_size;
+
+    //
+    // Methods
+    //
+
+    inline hpack_encoder_t(void) : resized(false)
+    {
+    }
+
+    // Limits the dynamic table to the maximum size announced by the decoder
+    // (SETTINGS_HEADER_TABLE_SIZE). The table never exceeds its default size.
+    void set_max_table_size(size_t max_size);
+
+    // Appends the instructions which must start the next header block.
+    void begin_block(string *out);
+
+    // Appends the ':status' pseudo-header field.
+    void encode_status(unsigned int status, string *out);
+
+    // Appends a header field. The name must be in lowercase.
+    //
+    // The fields which usually differ between responses are never added to
+    // the dynamic table.
+    void encode(str_ref_t name, str_ref_t value, string *out);
+
+    // Appends an integer with an 'n_prefix' bits prefix. 'first' gives the
+    // bits of the first byte which are above the prefix.
+    static void encode_int(
+        size_t value, int n_prefix, uint8_t first, string *out
+    );
+
+    // Appends a string literal, without the Huffman code.
+    static inline void encode_string(str_ref_t str, string *out);
+
+private:
+
+    // Returns 'true' if the fields with this name usually differ between
+    // responses.
+    static inline bool _is_volatile(str_ref_t name);
+
+    static inline bool _equals(
+        const char *a, size_t a_len, const char *b, size_t b_len
+    );
+};
+
+inline bool hpack_table_t::add(str_ref_t name, str_ref_t value)
+{
+    size_t entry_size = name.len + value.len + ENTRY_OVERHEAD;
+
+    if (UNLIKELY(entry_size > this->max_size)) {
+        this->entries.clear();
+        this->size = 0;
+        return false;
+    }
+
+    // The name can reference an entry which is about to be evicted. Copies it
+    // first.
+    entry_t entry = {
+        string(name.data, name.len), string(value.data, value.len)
+    };
+
+    this->_evict(entry_size);
+
+    this->entries.push_front(move(entry));
+    this->size += entry_size;
+
+    return true;
+}
+
+inline void hpack_table_t::resize(size_t _max_size)
+{
+    this->max_size = _max_size;
+    this->_evict(0);
+}
+
+inline bool hpack_table_t::get(
+    size_t index, str_ref_t *name, str_ref_t *value
+) const
+{
+    if (index >= 1 && index <= HPACK_STATIC_TABLE_LEN) {
+        const hpack_static_entry_t &entry = HPACK_STATIC_TABLE[index - 1];
+
+        *name  = str_ref_t(entry.name, entry.name_len);
+        *value = str_ref_t(entry.value, entry.value_len);
+
+        return true;
+    }
+
+    size_t dyn_index = index - HPACK_STATIC_TABLE_LEN - 1;
+
+    if (UNLIKELY(index == 0 || dyn_index >= this->entries.size()))
+        return false;
+
+    const entry_t &entry = this->entries[dyn_index];
+
+    *name  = str_ref_t(entry.name.data(), entry.name.size());
+    *value = str_ref_t(entry.value.data(), entry.value.size());
+
+    return true;
+}
+
+inline void hpack_table_t::_evict(size_t needed)
+{
+    while (!this->entries.empty() && this->size + needed > this->max_size) {
+        const entry_t &entry = this->entries.back();
+
+        this->size -= entry.name.size() + entry.value.size() + ENTRY_OVERHEAD;
+        this->entries.pop_back();
+    }
+}
+
+template <typename on_field_t>
+bool hpack_decoder_t::decode(
+    const char *block, size_t size, on_field_t on_field
+)
+{
+    const uint8_t   *p      = (const uint8_t *) block,
+                    *end    = p + size;
+
+    // Set once the first field has been decoded.
+    bool has_fields = false;
+
+    while (p < end) {
+        str_ref_t   name, value;
+        size_t      index;
+
+        if (*p & 0x80) {
+            // Indexed header field.
+
+            if (UNLIKELY(
+                   !decode_int(&p, end, 7, &index)
+                || !this->table.get(index, &name, &value)
+            ))
+                return false;
+        } else if ((*p & 0xE0) == 0x20) {
+            // Dynamic table size update.
+
+            if (UNLIKELY(
+                   has_fields || !decode_int(&p, end, 5, &index)
+                || index > this->max_table_size
+            ))
+                return false;
+
+            this->table.resize(index);
+            continue;
+        } else {
+            // Literal header field, with incremental indexing (01xxxxxx),
+            // without indexing (0000xxxx) or never indexed (0001xxxx).
+
+            bool indexing = (*p & 0xC0) == 0x40;
+
+            if (UNLIKELY(!decode_int(&p, end, indexing ? 6 : 4, &index)))
+                return false;
+
+            if (index == 0) {
+                this->name_buffer.clear();
+                if (UNLIKELY(!_decode_string(
+                    &p, end, &this->name_buffer, &name
+                )))
+                    return false;
+            } else {
+                str_ref_t ignored;
+                if (UNLIKELY(!this->table.get(index, &name, &ignored)))
+                    return false;
+
+                // The entry of the name could be evicted by the new entry.
+                if (indexing && index > HPACK_STATIC_TABLE_LEN) {
+                    this->name_buffer.assign(name.data, name.len);
+                    name = str_ref_t(
+                        this->name_buffer.data(), this->name_buffer.size()
+                    );
+                }
+            }
+
+            this->value_buffer.clear();
+            if (UNLIKELY(!_decode_string(&p, end, &this->value_buffer, &value)))
+                return false;
+
+            if (indexing && this->table.add(name, value)) {
+                const hpack_table_t::entry_t &entry = this->table.entries[0];
+
+                name  = str_ref_t(entry.name.data(), entry.name.size());
+                value = str_ref_t(entry.value.data(), entry.value.size());
+            }
+        }
+
+        if (UNLIKELY(!on_field(name, value)))
+            return false;
+
+        has_fields = true;
+    }
+
+    return true;
+}
+
+inline bool hpack_decoder_t::decode_int(
+    const uint8_t **p, const uint8_t *end, int n_prefix, size_t *value
+)
+{
+    if (UNLIKELY(*p >= end))
+        return false;
+
+    size_t max = (1 << n_prefix) - 1;
+    size_t v   = *(*p)++ & max;
+
+    if (v == max) {
+        for (int shift = 0; ; shift += 7) {
+            if (UNLIKELY(*p >= end || shift > 28))
+                return false;
+
+            uint8_t byte = *(*p)++;
+            v += (size_t) (byte & 0x7F) << shift;
+
+            if (!(byte & 0x80))
+                break;
+        }
+    }
+
+    *value = v;
+    return true;
+}
+
+inline bool hpack_decoder_t::huffman_decode(
+    const char *data, size_t size, string *out
+)
+{
+    const uint8_t   *p      = (const uint8_t *) data,
+                    *end    = p + size;
+
+    // Bits which have not been decoded yet, in the lowest 'n_bits' bits.
+    uint64_t    bits    = 0;
+    size_t      n_bits  = 0;
+
+    for (;;) {
+        // Codes have at most 30 bits.
+        while (n_bits <= 48 && p < end) {
+            bits    = (bits << 8) | *p++;
+            n_bits  += 8;
+        }
+
+        const hpack_huffman_length_t *length = nullptr;
+        uint32_t code = 0;
+
+        for (const hpack_huffman_length_t &candidate : HPACK_HUFFMAN_LENGTHS) {
+            if (candidate.len > n_bits)
+                break;
+
+            code = bits >> (n_bits - candidate.len);
+
+            // Codes longer than 'candidate.len' have prefixes after the codes
+            // of this length.
+            if (code < candidate.first + candidate.count) {
+                length = &candidate;
+                break;
+            }
+        }
+
+        // The remaining bits are not a complete code.
+        if (length == nullptr)
+            break;
+
+        uint16_t symbol = HPACK_HUFFMAN_SYMBOLS[
+            length->offset + code - length->first
+        ];
+
+        if (UNLIKELY(symbol == HPACK_HUFFMAN_EOS))
+            return false;
+
+        out->push_back((char) symbol);
+
+        n_bits  -= length->len;
+        bits    &= ((uint64_t) 1 << n_bits) - 1;
+    }
+
+    // The string must be padded with at most 7 bits of the EOS code, which
+    // are all ones.
+    return n_bits <= 7 && bits == ((uint64_t) 1 << n_bits) - 1;
+}
+
+inline bool hpack_decoder_t::_decode_string(
+    const uint8_t **p, const uint8_t *end, string *buffer, str_ref_t *str
+)
+{
+    if (UNLIKELY(*p >= end))
+        return false;
+
+    bool    huffman = **p & 0x80;
+    size_t  len;
+
+    if (UNLIKELY(!decode_int(p, end, 7, &len) || len > (size_t) (end - *p)))
+        return false;
+
+    const char *data = (const char *) *p;
+    *p += len;
+
+    if (huffman) {
+        if (UNLIKELY(!huffman_decode(data, len, buffer)))
+            return false;
+
+        *str = str_ref_t(buffer->data(), buffer->size());
+    } else
+        *str = str_ref_t(data, len);
+
+    return true;
+}
+
+inline void hpack_encoder_t::set_max_table_size(size_t max_size)
+{
+    max_size = min(max_size, (size_t) hpack_table_t::DEFAULT_SIZE);
+
+    if (max_size == this->table.max_size)
+        return;
+
+    this->min_size = this->resized ? min(this->min_size, max_size) : max_size;
+    this->resized  = true;
+
+    this->table.resize(max_size);
+}
+
+inline void hpack_encoder_t::begin_block(string *out)
+{
+    if (LIKELY(!this->resized))
+        return;
+
+    // Only signals the smallest size and the final size, as the decoder will
+    // have evicted the same entries.
+    if (this->min_size < this->table.max_size)
+        encode_int(this->min_size, 5, 0x20, out);
+    encode_int(this->table.max_size, 5, 0x20, out);
+
+    this->resized = false;
+}
+
+inline void hpack_encoder_t::encode_status(unsigned int status, string *out)
+{
+    // Index of the ':status' field of the static table with this value, if
+    // any.
+    size_t index;
+
+    switch (status) {
+    case 200: index = 8;  break;
+    case 204: index = 9;  break;
+    case 206: index = 10; break;
+    case 304: index = 11; break;
+    case 400: index = 12; break;
+    case 404: index = 13; break;
+    case 500: index = 14; break;
+    default:  index = 0;
+    }
+
+    if (LIKELY(index != 0)) {
+        encode_int(index, 7, 0x80, out);
+        return;
+    }
+
+    char value[3] = {
+        (char) ('0' + status / 100 % 10), (char) ('0' + status / 10 % 10),
+        (char) ('0' + status % 10)
+    };
+
+    // Literal without indexing, with the name of the ':status' entries.
+    encode_int(8, 4, 0x00, out);
+    encode_string(str_ref_t(value, sizeof (value)), out);
+}
+
+inline void hpack_encoder_t::encode(
+    str_ref_t name, str_ref_t value, string *out
+)
+{
+    // Index of an entry with the same name, or zero.
+    size_t name_index = 0;
+
+    for (size_t i = 0; i < HPACK_STATIC_TABLE_LEN; i++) {
+        const hpack_static_entry_t &entry = HPACK_STATIC_TABLE[i];
+
+        if (!_equals(entry.name, entry.name_len, name.data, name.len))
+            continue;
+
+        if (_equals(entry.value, entry.value_len, value.data, value.len)) {
+            encode_int(i + 1, 7, 0x80, out);
+            return;
+        }
+
+        if (name_index == 0)
+            name_index = i + 1;
+    }
+
+    bool indexing = !_is_volatile(name);
+
+    if (indexing) {
+        for (size_t i = 0; i < this->table.entries.size(); i++) {
+            const hpack_table_t::entry_t &entry = this->table.entries[i];
+
+            if (!_equals(
+                entry.name.data(), entry.name.size(), name.data, name.len
+            ))
+                continue;
+
+            if (_equals(
+                entry.value.data(), entry.value.size(), value.data, value.len
+            )) {
+                encode_int(HPACK_STATIC_TABLE_LEN + 1 + i, 7, 0x80, out);
+                return;
+            }
+
+            if (name_index == 0)
+                name_index = HPACK_STATIC_TABLE_LEN + 1 + i;
+        }
+    }
+
+    if (indexing)
+        encode_int(name_index, 6, 0x40, out);
+    else
+        encode_int(name_index, 4, 0x00, out);
+
+    if (name_index == 0)
+        encode_string(name, out);
+
+    encode_string(value, out);
+
+    if (indexing)
+        this->table.add(name, value);
+}
+
+inline void hpack_encoder_t::encode_int(
+    size_t value, int n_prefix, uint8_t first, string *out
+)
+{
+    size_t max = (1 << n_prefix) - 1;
+
+    if (value < max) {
+        out->push_back((char) (first | value));
+        return;
+    }
+
+    out->push_back((char) (first | max));
+    value -= max;
+
+    while (value >= 0x80) {
+        out->push_back((char) (0x80 | (value & 0x7F)));
+        value >>= 7;
+    }
+
+    out->push_back((char) value);
+}
+
+inline void hpack_encoder_t::encode_string(str_ref_t str, string *out)
+{
+    encode_int(str.len, 7, 0x00, out);
+    out->append(str.data, str.len);
+}
+
+inline bool hpack_encoder_t::_is_volatile(str_ref_t name)
+{
+    static const str_ref_t volatile_names[] = {
+        str_ref_t("content-length",  sizeof ("content-length") - 1),
+        str_ref_t("content-range",   sizeof ("content-range") - 1),
+        str_ref_t("date",            sizeof ("date") - 1),
+        str_ref_t("etag",            sizeof ("etag") - 1),
+        str_ref_t("last-modified",   sizeof ("last-modified") - 1),
+        str_ref_t("set-cookie",      sizeof ("set-cookie") - 1)
+    };
+
+    for (const str_ref_t &volatile_name : volatile_names) {
+        if (_equals(volatile_name.data, volatile_name.len, name.data, name.len))
+            return true;
+    }
+
+    return false;
+}
+
+inline bool hpack_encoder_t::_equals(
+    const char *a, size_t a_len, const char *b, size_t b_len
+)
+{
+    return a_len == b_len && memcmp(a, b, a_len) == 0;
+}
+
+} } /* namespace rusty::http */
+
+#endif /* __RUSTY_HTTP_HPACK_HPP__ */
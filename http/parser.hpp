@@ -0,0 +1,650 @@
+//
+// Incremental parser for HTTP/1.x request headers.
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __RUSTY_HTTP_PARSER_HPP__
+#define __RUSTY_HTTP_PARSER_HPP__
+
+#include <cstddef>              // ptrdiff_t
+#include <cstdint>
+#include <cstring>              // memcpy(), memcmp(), strlen()
+
+#include <endian.h>             // __BIG_ENDIAN, __BYTE_ORDER, __LITTLE_ENDIAN
+#include <strings.h>            // strncasecmp()
+
+#include "util/macros.hpp"      // LIKELY(), UNLIKELY()
+
+namespace rusty {
+namespace http {
+
+// Reference to a sequence of characters of a receive buffer.
+//
+// The referenced characters are *not* null-terminated.
+struct str_ref_t {
+    const char  *data;
+    size_t      len;
+
+    inline str_ref_t(void) : data(nullptr), len(0)
+    {
+    }
+
+    inline str_ref_t(const char *_data, size_t _len) : data(_data), len(_len)
+    {
+    }
+
+    inline bool empty(void) const
+    {
+        return this->len == 0;
+    }
+
+    // Case-insensitive comparison with the given null-terminated string.
+    inline bool equals_nocase(const char *str) const
+    {
+        size_t str_len = strlen(str);
+        return this->len == str_len
+            && strncasecmp(this->data, str, str_len) == 0;
+    }
+};
+
+// Parsed HTTP request header.
+//
+// Strings reference the buffer given to 'http_parser_t::parse()'. Headers
+// which were not present in the request are empty.
+struct http_request_t {
+    // Requested path, without the query string.
+    str_ref_t   path;
+
+    // Query string, without the '?'.
+    str_ref_t   query;
+
+    // '1' and '0' for HTTP/1.0, '1' and '1' for HTTP/1.1, '2' and '0' for
+    // HTTP/2.
+    char        major_version;
+    char        minor_version;
+
+    // Whether the client wants to keep the connection open after the
+    // response, according to the HTTP version and to the 'Connection' header.
+    bool        keep_alive;
+
+    str_ref_t   host;
+    str_ref_t   connection;
+    str_ref_t   accept_encoding;
+    str_ref_t   if_none_match;
+    str_ref_t   if_modified_since;
+    str_ref_t   range;
+    str_ref_t   if_range;
+
+    // Upgrade to HTTP/2 ("h2c"), with the base64url encoded settings of the
+    // client.
+    str_ref_t   upgrade;
+    str_ref_t   http2_settings;
+};
+
+// Parses HTTP requests from a byte stream.
+//
+// A request can be split across several received segments. The parser
+// remembers how far it searched for the end of the request header, so a
+// request received in 'n' parts is not scanned 'n' times.
+//
+// The parser only accepts 'GET' requests.
+struct http_parser_t {
+    //
+    // Member types
+    //
+
+    enum status_t {
+        COMPLETE,       // The buffer starts with a complete request header.
+        INCOMPLETE,     // The request header has not been entirely received.
+        INVALID,        // The request is malformed or not supported.
+        TOO_LARGE       // The request exceeds one of the size limits.
+    };
+
+    enum range_status_t {
+        RANGE_NONE,         // No range, or a range which must be ignored.
+        RANGE_SATISFIABLE,  // A single range which overlaps the content.
+        RANGE_UNSATISFIABLE // A single range which is after the content.
+    };
+
+    //
+    // Static fields
+    //
+
+    // Maximum size of a request header, request line included.
+    static constexpr size_t MAX_HEADER_SIZE = 8192;
+
+    // Maximum length of the requested path and query string.
+    static constexpr size_t MAX_URI_LEN     = 2048;
+
+    // Maximum number of header fields in a request.
+    static constexpr size_t MAX_FIELDS      = 64;
+
+    //
+    // Fields
+    //
+
+    // Number of bytes at the beginning of the current request which have
+    // already been searched for the end of the header.
+    size_t      scanned;
+
+    //
+    // Methods
+    //
+
+    inline http_parser_t(void) : scanned(0)
+    {
+    }
+
+    // Parses the request at the beginning of the buffer.
+    //
+    // The buffer must always start at the beginning of the current request.
+    // On 'INCOMPLETE', the function must be called again with the same bytes
+    // followed by the newly received data.
+    //
+    // On 'COMPLETE', sets 'request' and 'request_size' to the size of the
+    // request header, and resets the parser for the next request.
+    status_t parse(
+        const char *buffer, size_t size, http_request_t *request,
+        size_t *request_size
+    );
+
+    // Returns the first occurrence of 'c' in [begin, end[, or 'nullptr'.
+    //
+    // Compares eight bytes at a time.
+    static inline const char *find_char(
+        const char *begin, const char *end, char c
+    );
+
+    // Returns 'true' if the value of an 'Accept-Encoding' header accepts the
+    // given content coding, either explicitly or through '*', with a non-zero
+    // quality value.
+    static bool accepts_coding(str_ref_t accept_encoding, const char *coding);
+
+    // Returns 'true' if the value of an 'If-None-Match' header matches the
+    // given entity tag (including its quotes), using the weak comparison.
+    static bool matches_etag(str_ref_t if_none_match, str_ref_t etag);
+
+    // Parses the value of a 'Range' header for a content of 'size' bytes.
+    //
+    // Only single byte ranges are supported ("bytes=0-99", "bytes=100-" or
+    // "bytes=-100"). Malformed ranges and multiple ranges are ignored, as
+    // allowed by RFC 7233, and the entire content should be sent.
+    //
+    // On 'RANGE_SATISFIABLE', sets the bytes [begin, end[ of the content to
+    // send.
+    static range_status_t parse_range(
+        str_ref_t range, size_t size, size_t *begin, size_t *end
+    );
+
+private:
+
+    // Returns a pointer after the empty line which ends the request header, or
+    // 'nullptr' if the header is not complete.
+    static const char *_find_header_end(const char *begin, const char *end);
+
+    // Parses a header line of the given length, without its line ending.
+    //
+    // Returns 'false' if the line is malformed.
+    static bool _parse_field(
+        const char *line, size_t len, http_request_t *request
+    );
+
+    // Removes the spaces and tabulations at both ends of the string.
+    static inline str_ref_t _trim(const char *begin, const char *end);
+
+    // Parses the decimal number at the beginning of [*p, end[ and moves '*p'
+    // after it.
+    //
+    // Returns 'false' if there is no digit or if the number overflows.
+    static inline bool _parse_size(const char **p, const char *end, size_t *n);
+};
+
+inline http_parser_t::status_t http_parser_t::parse(
+    const char *buffer, size_t size, http_request_t *request,
+    size_t *request_size
+)
+{
+    const char *end = buffer + size;
+
+    //
+    // Finds the end of the request header.
+    //
+    // Restarts the search a few bytes before the previous end, as the
+    // delimiter could be split between two segments.
+    //
+
+    size_t      resume      = this->scanned > 3 ? this->scanned - 3 : 0;
+    const char  *header_end = _find_header_end(buffer + resume, end);
+
+    if (header_end == nullptr) {
+        this->scanned = size;
+
+        if (UNLIKELY(size > MAX_HEADER_SIZE))
+            return TOO_LARGE;
+        else
+            return INCOMPLETE;
+    }
+
+    this->scanned = 0;
+
+    if (UNLIKELY((size_t) (header_end - buffer) > MAX_HEADER_SIZE))
+        return TOO_LARGE;
+
+    //
+    // Parses the request line ("GET <uri> HTTP/1.X").
+    //
+
+    constexpr size_t get_len = sizeof ("GET /") - sizeof ('\0');
+
+    if (UNLIKELY(
+           (size_t) (header_end - buffer) < get_len
+        || memcmp(buffer, "GET /", get_len) != 0
+    ))
+        return INVALID;
+
+    const char *line_end = find_char(buffer, header_end, '\n');
+
+    const char *uri_begin = buffer + get_len - 1;
+    const char *uri_end   = find_char(uri_begin, line_end, ' ');
+
+    if (UNLIKELY(uri_end == nullptr))
+        return INVALID;
+
+    if (UNLIKELY((size_t) (uri_end - uri_begin) > MAX_URI_LEN))
+        return TOO_LARGE;
+
+    const char *query_begin = find_char(uri_begin, uri_end, '?');
+
+    // The path is given without its leading '/'.
+    if (query_begin == nullptr) {
+        request->path  = str_ref_t(uri_begin + 1, uri_end - uri_begin - 1);
+        request->query = str_ref_t();
+    } else {
+        request->path  = str_ref_t(uri_begin + 1, query_begin - uri_begin - 1);
+        request->query = str_ref_t(query_begin + 1, uri_end - query_begin - 1);
+    }
+
+    const char  *version_begin  = uri_end + 1;
+    size_t      version_len     = sizeof ("HTTP/1.X") - sizeof ('\0');
+    const char  *version_end    = version_begin + version_len;
+
+    if (UNLIKELY(version_end > line_end))
+        return INVALID;
+
+    if (UNLIKELY(memcmp(version_begin, "HTTP/1.", version_len - 1) != 0))
+        return INVALID;
+
+    request->major_version = '1';
+    request->minor_version = version_end[-1];
+
+    if (UNLIKELY(
+           request->minor_version != '0' && request->minor_version != '1'
+    ))
+        return INVALID;
+
+    if (UNLIKELY(
+           version_end != line_end
+        && (version_end + 1 != line_end || version_end[0] != '\r')
+    ))
+        return INVALID;
+
+    //
+    // Parses the header fields.
+    //
+
+    request->host               = str_ref_t();
+    request->connection         = str_ref_t();
+    request->accept_encoding    = str_ref_t();
+    request->if_none_match      = str_ref_t();
+    request->if_modified_since  = str_ref_t();
+    request->range              = str_ref_t();
+    request->if_range           = str_ref_t();
+    request->upgrade            = str_ref_t();
+    request->http2_settings     = str_ref_t();
+
+    size_t n_fields = 0;
+
+    for (
+        const char *line = line_end + 1;
+        (line_end = find_char(line, header_end, '\n')) != nullptr;
+        line = line_end + 1
+    ) {
+        size_t len = line_end - line;
+        if (len > 0 && line[len - 1] == '\r')
+            len--;
+
+        // Empty line ending the header.
+        if (len == 0)
+            break;
+
+        if (UNLIKELY(++n_fields > MAX_FIELDS))
+            return TOO_LARGE;
+
+        if (UNLIKELY(!_parse_field(line, len, request)))
+            return INVALID;
+    }
+
+    // HTTP/1.1 connections are persistent by default, HTTP/1.0 connections
+    // are not.
+    if (request->connection.equals_nocase("close"))
+        request->keep_alive = false;
+    else if (request->connection.equals_nocase("keep-alive"))
+        request->keep_alive = true;
+    else
+        request->keep_alive = request->minor_version == '1';
+
+    *request_size = header_end - buffer;
+
+    return COMPLETE;
+}
+
+inline const char *http_parser_t::find_char(
+    const char *begin, const char *end, char c
+)
+{
+    // Uses the classic "has zero byte" bit trick on the XOR of the word with
+    // the searched byte repeated eight times. A word has a flagged byte if
+    // and only if it contains a match, and the least significant flagged byte
+    // is always an actual match. More significant bytes can be flagged
+    // because of the borrow of the subtraction.
+
+    constexpr uint64_t ones     = 0x0101010101010101ULL;
+    constexpr uint64_t highs    = 0x8080808080808080ULL;
+
+    const uint64_t pattern = ones * (uint8_t) c;
+
+    const char *p = begin;
+
+    while (end - p >= (ptrdiff_t) sizeof (uint64_t)) {
+        uint64_t word;
+        memcpy(&word, p, sizeof (uint64_t));
+
+        uint64_t diff  = word ^ pattern;
+        uint64_t found = (diff - ones) & ~diff & highs;
+
+        if (found != 0) {
+            #if __BYTE_ORDER == __LITTLE_ENDIAN
+                return p + (__builtin_ctzll(found) / 8);
+            #elif __BYTE_ORDER == __BIG_ENDIAN
+                // The least significant byte is the last one, and the first
+                // flagged byte might be a false match. Scans the word instead.
+                while (*p != c)
+                    p++;
+                return p;
+            #else
+                #error "Please set __BYTE_ORDER in <bits/endian.h>"
+            #endif
+        }
+
+        p += sizeof (uint64_t);
+    }
+
+    for (; p < end; p++) {
+        if (*p == c)
+            return p;
+    }
+
+    return nullptr;
+}
+
+inline bool http_parser_t::accepts_coding(
+    str_ref_t accept_encoding, const char *coding
+)
+{
+    const char *p   = accept_encoding.data,
+               *end = accept_encoding.data + accept_encoding.len;
+
+    // Set if '*' has been listed with a non-zero quality value.
+    bool any = false;
+
+    while (p < end) {
+        const char *item_end = find_char(p, end, ',');
+        if (item_end == nullptr)
+            item_end = end;
+
+        const char *params = find_char(p, item_end, ';');
+        str_ref_t name = _trim(p, params != nullptr ? params : item_end);
+
+        // The coding is refused when its quality value is zero ("q=0",
+        // "q=0.0", ...).
+        bool refused = false;
+        if (params != nullptr) {
+            str_ref_t param = _trim(params + 1, item_end);
+
+            if (
+                   param.len >= 3 && (param.data[0] | 0x20) == 'q'
+                && param.data[1] == '='
+            ) {
+                refused = true;
+                for (size_t i = 2; i < param.len; i++) {
+                    if (param.data[i] != '0' && param.data[i] != '.')
+                        refused = false;
+                }
+            }
+        }
+
+        if (name.equals_nocase(coding))
+            return !refused;
+        else if (name.len == 1 && name.data[0] == '*')
+            any = !refused;
+
+        p = item_end + 1;
+    }
+
+    return any;
+}
+
+inline bool http_parser_t::matches_etag(str_ref_t if_none_match, str_ref_t etag)
+{
+    const char *p   = if_none_match.data,
+               *end = if_none_match.data + if_none_match.len;
+
+    while (p < end) {
+        const char *item_end = find_char(p, end, ',');
+        if (item_end == nullptr)
+            item_end = end;
+
+        str_ref_t tag = _trim(p, item_end);
+
+        if (tag.len == 1 && tag.data[0] == '*')
+            return true;
+
+        // The weak comparison ignores the weakness indicator.
+        if (tag.len >= 2 && tag.data[0] == 'W' && tag.data[1] == '/') {
+            tag.data += 2;
+            tag.len  -= 2;
+        }
+
+        if (tag.len == etag.len && memcmp(tag.data, etag.data, etag.len) == 0)
+            return true;
+
+        p = item_end + 1;
+    }
+
+    return false;
+}
+
+inline http_parser_t::range_status_t http_parser_t::parse_range(
+    str_ref_t range, size_t size, size_t *begin, size_t *end
+)
+{
+    constexpr size_t unit_len = sizeof ("bytes=") - sizeof ('\0');
+
+    if (
+           range.len <= unit_len
+        || strncasecmp(range.data, "bytes=", unit_len) != 0
+    )
+        return RANGE_NONE;
+
+    const char  *p          = range.data + unit_len,
+                *range_end  = range.data + range.len;
+
+    if (find_char(p, range_end, ',') != nullptr)
+        return RANGE_NONE;
+
+    if (*p == '-') {
+        // Suffix range: the last 'n' bytes.
+        p++;
+
+        size_t n;
+        if (!_parse_size(&p, range_end, &n) || p != range_end)
+            return RANGE_NONE;
+
+        if (n == 0 || size == 0)
+            return RANGE_UNSATISFIABLE;
+
+        *begin = size > n ? size - n : 0;
+        *end   = size;
+
+        return RANGE_SATISFIABLE;
+    }
+
+    size_t first;
+    if (!_parse_size(&p, range_end, &first) || p == range_end || *p != '-')
+        return RANGE_NONE;
+
+    p++;
+
+    size_t last = SIZE_MAX;
+    if (p != range_end) {
+        if (!_parse_size(&p, range_end, &last) || p != range_end)
+            return RANGE_NONE;
+
+        if (last < first)
+            return RANGE_NONE;
+    }
+
+    if (first >= size)
+        return RANGE_UNSATISFIABLE;
+
+    *begin = first;
+    *end   = last < size ? last + 1 : size;
+
+    return RANGE_SATISFIABLE;
+}
+
+inline const char *http_parser_t::_find_header_end(
+    const char *begin, const char *end
+)
+{
+    for (
+        const char *p = find_char(begin, end, '\n');
+        p != nullptr;
+        p = find_char(p + 1, end, '\n')
+    ) {
+        size_t left = end - p - 1;
+
+        if (left >= 1 && p[1] == '\n')
+            return p + 2;
+        else if (left >= 2 && p[1] == '\r' && p[2] == '\n')
+            return p + 3;
+    }
+
+    return nullptr;
+}
+
+inline bool http_parser_t::_parse_field(
+    const char *line, size_t len, http_request_t *request
+)
+{
+    const char *line_end = line + len;
+    const char *colon    = find_char(line, line_end, ':');
+
+    if (UNLIKELY(colon == nullptr || colon == line))
+        return false;
+
+    size_t name_len = colon - line;
+
+    #define MATCH_FIELD(NAME, FIELD)                                           \
+        do {                                                                   \
+            if (strncasecmp(line, NAME, name_len) == 0) {                      \
+                request->FIELD = _trim(colon + 1, line_end);                   \
+                return true;                                                   \
+            }                                                                  \
+        } while (0)
+
+    // Only compares the names of the fields which have the same length.
+    switch (name_len) {
+    case sizeof ("Host") - 1:
+        MATCH_FIELD("Host", host);
+        break;
+    case sizeof ("Upgrade") - 1:
+        MATCH_FIELD("Upgrade", upgrade);
+        break;
+    case sizeof ("Range") - 1:
+        MATCH_FIELD("Range", range);
+        break;
+    case sizeof ("If-Range") - 1:
+        MATCH_FIELD("If-Range", if_range);
+        break;
+    case sizeof ("Connection") - 1:
+        MATCH_FIELD("Connection", connection);
+        break;
+    case sizeof ("If-None-Match") - 1:
+        MATCH_FIELD("If-None-Match", if_none_match);
+        break;
+    case sizeof ("HTTP2-Settings") - 1:
+        MATCH_FIELD("HTTP2-Settings", http2_settings);
+        break;
+    case sizeof ("Accept-Encoding") - 1:
+        MATCH_FIELD("Accept-Encoding", accept_encoding);
+        break;
+    case sizeof ("If-Modified-Since") - 1:
+        MATCH_FIELD("If-Modified-Since", if_modified_since);
+        break;
+    }
+
+    #undef MATCH_FIELD
+
+    return true;
+}
+
+inline str_ref_t http_parser_t::_trim(const char *begin, const char *end)
+{
+    while (begin < end && (*begin == ' ' || *begin == '\t'))
+        begin++;
+
+    while (end > begin && (end[-1] == ' ' || end[-1] == '\t'))
+        end--;
+
+    return str_ref_t(begin, end - begin);
+}
+
+inline bool http_parser_t::_parse_size(
+    const char **p, const char *end, size_t *n
+)
+{
+    const char *begin = *p;
+
+    *n = 0;
+
+    for (; *p < end && **p >= '0' && **p <= '9'; (*p)++) {
+        size_t digit = **p - '0';
+
+        if (*n > (SIZE_MAX - digit) / 10)
+            return false;
+
+        *n = *n * 10 + digit;
+    }
+
+    return *p != begin;
+}
+
+} } /* namespace rusty::http */
+
+#endif /* __RUSTY_HTTP_PARSER_HPP__ */
@@ -0,0 +1,443 @@
+//
+// Incremental parser for HTTP/1.x responses.
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __RUSTY_HTTP_RESPONSE_PARSER_HPP__
+#define __RUSTY_HTTP_RESPONSE_PARSER_HPP__
+
+#include <algorithm>            // min()
+#include <cassert>
+#include <cstdint>              // SIZE_MAX
+#include <cstring>              // memcmp()
+#include <string>
+
+#include "http/parser.hpp"      // http_parser_t, str_ref_t
+#include "util/macros.hpp"      // LIKELY(), UNLIKELY()
+
+using namespace std;
+
+namespace rusty {
+namespace http {
+
+// Parses the responses of a server from a byte stream, as the client of a
+// connection.
+//
+// Unlike 'http_parser_t', the parser consumes the bytes it is given: the
+// response can be fed in as many parts as it has been received, and only the
+// lines of the header and of the chunked encoding are copied.
+//
+// The body is skipped. It is delimited by the 'Content-Length' header, by the
+// chunked transfer coding, or by the end of the connection.
+struct http_response_parser_t {
+    //
+    // Member types
+    //
+
+    enum status_t {
+        COMPLETE,       // The response has been entirely received.
+        INCOMPLETE,     // More data is required to complete the response.
+        INVALID         // The response is malformed or is followed by data.
+    };
+
+    //
+    // Static fields
+    //
+
+    // Maximum size of a response header, and of a line of the chunked
+    // encoding.
+    static constexpr size_t MAX_HEADER_SIZE = 8192;
+
+    //
+    // Fields
+    //
+
+    // Status code of the response, once its status line has been parsed.
+    unsigned int    status;
+
+    // Whether the server keeps the connection open after the response,
+    // according to the HTTP version and to the 'Connection' header. Known once
+    // the header has been parsed.
+    bool            keep_alive;
+
+    // Number of bytes of the response received so far, header included.
+    size_t          size;
+
+    //
+    // Methods
+    //
+
+    inline http_response_parser_t(void)
+    {
+        this->reset();
+    }
+
+    // Prepares the parser for the next response of the connection.
+    inline void reset(void);
+
+    // Parses the next bytes of the response.
+    //
+    // Returns 'INVALID' if bytes follow the end of the response, as requests
+    // are not pipelined. Once 'INVALID' has been returned, the parser must be
+    // reset.
+    status_t feed(const char *data, size_t size);
+
+    // To be called when the server closed the connection. Completes the
+    // responses delimited by the end of the connection.
+    inline status_t end_of_stream(void);
+
+    // Returns 'true' if a part of a response has been received.
+    inline bool is_started(void) const
+    {
+        return this->size > 0;
+    }
+
+private:
+    enum state_t {
+        STATUS_LINE,
+        FIELDS,
+        BODY,               // 'remaining' bytes of body left.
+        BODY_UNTIL_CLOSE,
+        CHUNK_SIZE,
+        CHUNK_DATA,         // 'remaining' bytes of the chunk left.
+        CHUNK_END,          // Line ending after the data of a chunk.
+        TRAILER,
+        DONE,
+        ERROR
+    };
+
+    state_t         state;
+
+    // Bytes of the current line received so far.
+    string          line;
+
+    // Bytes of the header received so far.
+    size_t          header_size;
+
+    bool            has_content_length;
+    bool            is_chunked;
+    size_t          remaining;
+
+    // Appends the bytes of [*p, end[ up to the end of the current line to
+    // 'line' and moves '*p' after them.
+    //
+    // Returns 'COMPLETE' once the line has been entirely received. Its line
+    // ending is then removed from 'line'.
+    inline status_t _read_line(const char **p, const char *end);
+
+    // Parses the status line in 'line'.
+    inline bool _parse_status_line(void);
+
+    // Parses the header field in 'line'.
+    inline bool _parse_field(void);
+
+    // Chooses how the body is delimited, once the header has been parsed.
+    inline void _end_of_header(void);
+
+    // Parses the size of a chunk in 'line'. Chunk extensions are ignored.
+    inline bool _parse_chunk_size(size_t *chunk_size);
+};
+
+inline void http_response_parser_t::reset(void)
+{
+    this->status                = 0;
+    this->keep_alive            = false;
+    this->size                  = 0;
+
+    this->state                 = STATUS_LINE;
+    this->line.clear();
+    this->header_size           = 0;
+    this->has_content_length    = false;
+    this->is_chunked            = false;
+    this->remaining             = 0;
+}
+
+inline http_response_parser_t::status_t http_response_parser_t::feed(
+    const char *data, size_t size
+)
+{
+    const char *p   = data;
+    const char *end = data + size;
+
+    this->size += size;
+
+    while (p < end) {
+        if (this->state == BODY || this->state == CHUNK_DATA) {
+            size_t n = min(this->remaining, (size_t) (end - p));
+            p               += n;
+            this->remaining -= n;
+
+            if (this->remaining == 0)
+                this->state = this->state == BODY ? DONE : CHUNK_END;
+
+            continue;
+        } else if (this->state == BODY_UNTIL_CLOSE)
+            return INCOMPLETE;
+        else if (UNLIKELY(this->state == DONE || this->state == ERROR)) {
+            this->state = ERROR;
+            return INVALID;
+        }
+
+        // The remaining states are parsed line by line.
+
+        status_t line_status = this->_read_line(&p, end);
+
+        if (line_status == INCOMPLETE)
+            return INCOMPLETE;
+        else if (UNLIKELY(line_status == INVALID)) {
+            this->state = ERROR;
+            return INVALID;
+        }
+
+        bool is_valid = true;
+
+        switch (this->state) {
+        case STATUS_LINE:
+            is_valid = this->_parse_status_line();
+            this->state = FIELDS;
+            break;
+
+        case FIELDS:
+            if (this->line.empty())
+                this->_end_of_header();
+            else
+                is_valid = this->_parse_field();
+            break;
+
+        case CHUNK_SIZE:
+            is_valid = this->_parse_chunk_size(&this->remaining);
+            this->state = this->remaining > 0 ? CHUNK_DATA : TRAILER;
+            break;
+
+        case CHUNK_END:
+            is_valid = this->line.empty();
+            this->state = CHUNK_SIZE;
+            break;
+
+        case TRAILER:
+            if (this->line.empty())
+                this->state = DONE;
+            break;
+
+        default:
+            assert(false);
+        }
+
+        this->line.clear();
+
+        if (UNLIKELY(!is_valid)) {
+            this->state = ERROR;
+            return INVALID;
+        }
+    }
+
+    return this->state == DONE ? COMPLETE : INCOMPLETE;
+}
+
+inline http_response_parser_t::status_t
+http_response_parser_t::end_of_stream(void)
+{
+    if (this->state == BODY_UNTIL_CLOSE || this->state == DONE) {
+        this->state = DONE;
+        return COMPLETE;
+    } else {
+        this->state = ERROR;
+        return INVALID;
+    }
+}
+
+inline http_response_parser_t::status_t http_response_parser_t::_read_line(
+    const char **p, const char *end
+)
+{
+    const char *line_end = http_parser_t::find_char(*p, end, '\n');
+    const char *copy_end = line_end != nullptr ? line_end : end;
+
+    size_t n = copy_end - *p;
+
+    if (this->state == STATUS_LINE || this->state == FIELDS) {
+        this->header_size += n + (line_end != nullptr);
+
+        if (UNLIKELY(this->header_size > MAX_HEADER_SIZE))
+            return INVALID;
+    } else if (UNLIKELY(this->line.size() + n > MAX_HEADER_SIZE))
+        return INVALID;
+
+    this->line.append(*p, n);
+
+    if (line_end == nullptr) {
+        *p = end;
+        return INCOMPLETE;
+    }
+
+    *p = line_end + 1;
+
+    if (!this->line.empty() && this->line.back() == '\r')
+        this->line.pop_back();
+
+    return COMPLETE;
+}
+
+inline bool http_response_parser_t::_parse_status_line(void)
+{
+    // "HTTP/1.X SSS <reason>".
+
+    constexpr size_t version_len = sizeof ("HTTP/1.X") - sizeof ('\0');
+
+    const char *line = this->line.data();
+
+    if (UNLIKELY(
+           this->line.size() < version_len + 4
+        || memcmp(line, "HTTP/1.", version_len - 1) != 0
+        || line[version_len] != ' '
+    ))
+        return false;
+
+    char minor_version = line[version_len - 1];
+
+    // HTTP/1.1 connections are persistent by default, HTTP/1.0 connections
+    // are not.
+    this->keep_alive = minor_version == '1';
+
+    this->status = 0;
+    for (size_t i = version_len + 1; i < version_len + 4; i++) {
+        if (UNLIKELY(line[i] < '0' || line[i] > '9'))
+            return false;
+
+        this->status = this->status * 10 + (line[i] - '0');
+    }
+
+    return this->line.size() == version_len + 4
+        || line[version_len + 4] == ' ';
+}
+
+inline bool http_response_parser_t::_parse_field(void)
+{
+    const char *line        = this->line.data();
+    const char *line_end    = line + this->line.size();
+    const char *colon       = http_parser_t::find_char(line, line_end, ':');
+
+    if (UNLIKELY(colon == nullptr || colon == line))
+        return false;
+
+    str_ref_t name(line, colon - line);
+
+    // Removes the spaces and tabulations at both ends of the value.
+
+    const char *value_begin = colon + 1;
+    const char *value_end   = line_end;
+
+    while (
+           value_begin < value_end
+        && (*value_begin == ' ' || *value_begin == '\t')
+    )
+        value_begin++;
+
+    while (
+           value_end > value_begin
+        && (value_end[-1] == ' ' || value_end[-1] == '\t')
+    )
+        value_end--;
+
+    str_ref_t value(value_begin, value_end - value_begin);
+
+    if (name.equals_nocase("Content-Length")) {
+        size_t length = 0;
+
+        if (UNLIKELY(value.empty()))
+            return false;
+
+        for (size_t i = 0; i < value.len; i++) {
+            if (UNLIKELY(value.data[i] < '0' || value.data[i] > '9'))
+                return false;
+
+            size_t digit = value.data[i] - '0';
+
+            if (UNLIKELY(length > (SIZE_MAX - digit) / 10))
+                return false;
+
+            length = length * 10 + digit;
+        }
+
+        this->has_content_length    = true;
+        this->remaining             = length;
+    } else if (name.equals_nocase("Transfer-Encoding"))
+        this->is_chunked = value.equals_nocase("chunked");
+    else if (name.equals_nocase("Connection")) {
+        if (value.equals_nocase("close"))
+            this->keep_alive = false;
+        else if (value.equals_nocase("keep-alive"))
+            this->keep_alive = true;
+    }
+
+    return true;
+}
+
+inline void http_response_parser_t::_end_of_header(void)
+{
+    // 1xx, 204 and 304 responses never have a body (RFC 7230, 3.3.3).
+    // Responses to 'HEAD' requests are not supported.
+    bool has_body =
+           this->status >= 200 && this->status != 204 && this->status != 304;
+
+    if (!has_body)
+        this->state = DONE;
+    else if (this->is_chunked)
+        this->state = CHUNK_SIZE;
+    else if (this->has_content_length)
+        this->state = this->remaining > 0 ? BODY : DONE;
+    else {
+        // The body ends with the connection.
+        this->keep_alive    = false;
+        this->state         = BODY_UNTIL_CLOSE;
+    }
+}
+
+inline bool http_response_parser_t::_parse_chunk_size(size_t *chunk_size)
+{
+    size_t i = 0;
+
+    *chunk_size = 0;
+
+    for (; i < this->line.size(); i++) {
+        char        c = this->line[i];
+        size_t      digit;
+
+        if (c >= '0' && c <= '9')
+            digit = c - '0';
+        else if (c >= 'a' && c <= 'f')
+            digit = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F')
+            digit = c - 'A' + 10;
+        else
+            break;
+
+        if (UNLIKELY(*chunk_size > (SIZE_MAX >> 4)))
+            return false;
+
+        *chunk_size = (*chunk_size << 4) | digit;
+    }
+
+    return i > 0
+        && (i == this->line.size() || this->line[i] == ';'
+            || this->line[i] == ' ' || this->line[i] == '\t');
+}
+
+} } /* namespace rusty::http */
+
+#endif /* __RUSTY_HTTP_RESPONSE_PARSER_HPP__ */
@@ -0,0 +1,238 @@
+//
+// Maps the paths of HTTP requests to the values of their routes.
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Routes are stored in a radix tree, where each edge is labelled with the
+// bytes shared by all the routes below it. A lookup compares each byte of the
+// path at most once, and only compares the first byte of the labels of the
+// other edges of the nodes it goes through.
+//
+
+#ifndef __RUSTY_HTTP_ROUTER_HPP__
+#define __RUSTY_HTTP_ROUTER_HPP__
+
+#include <cstdint>              // SIZE_MAX
+#include <cstring>              // memcmp(), strlen()
+#include <string>
+#include <utility>              // move()
+#include <vector>
+
+using namespace std;
+
+namespace rusty {
+namespace http {
+
+// Maps paths to 'value_t' values.
+//
+// An exact route only matches its own path. A prefix route matches every path
+// starting with its prefix. An exact route has priority over prefix routes,
+// and the longest prefix has priority over the shorter ones.
+//
+// Paths are given without their leading '/', as they are parsed by
+// 'http_parser_t'. A leading '/' is removed from the paths of the routes.
+//
+// Routes are added once when the server starts, and are then only read.
+template <typename value_var_t>
+struct router_t {
+    //
+    // Member types
+    //
+
+    typedef value_var_t                 value_t;
+
+    struct node_t {
+        // Bytes of the path matched by the edge which leads to this node.
+        string          label;
+
+        // Children, in the order they have been added. Their labels start with
+        // different bytes.
+        vector<node_t>  children;
+
+        // Index in 'values' of the exact and of the prefix routes which end at
+        // this node, or 'NO_ROUTE'.
+        size_t          exact;
+        size_t          prefix;
+    };
+
+    //
+    // Static fields
+    //
+
+    static constexpr size_t NO_ROUTE    = SIZE_MAX;
+
+    //
+    // Fields
+    //
+
+    node_t              root;
+
+    vector<value_t>     values;
+
+    //
+    // Methods
+    //
+
+    inline router_t(void)
+    {
+        this->root.exact  = NO_ROUTE;
+        this->root.prefix = NO_ROUTE;
+    }
+
+    // Returns 'true' if no route has been added.
+    inline bool empty(void) const
+    {
+        return this->values.empty();
+    }
+
+    // Adds a route which only matches the given path.
+    //
+    // Returns 'false' and leaves the router unchanged if the path already has
+    // an exact route.
+    inline bool add(const char *path, value_t value)
+    {
+        return this->_add(path, false, move(value));
+    }
+
+    // Adds a route which matches every path starting with the given prefix.
+    //
+    // Returns 'false' and leaves the router unchanged if the prefix already has
+    // a prefix route.
+    inline bool add_prefix(const char *prefix, value_t value)
+    {
+        return this->_add(prefix, true, move(value));
+    }
+
+    // Returns the value of the route of the path, or 'nullptr'.
+    inline const value_t *find(const char *path, size_t len) const;
+
+private:
+
+    bool _add(const char *path, bool is_prefix, value_t value);
+
+    // Returns the child whose label starts with 'c', or 'nullptr'.
+    static inline const node_t *_child(const node_t *node, char c);
+};
+
+template <typename value_t>
+inline const value_t *router_t<value_t>::find(
+    const char *path, size_t len
+) const
+{
+    const node_t    *node   = &this->root;
+    size_t          best    = node->prefix;
+    size_t          offset  = 0;
+
+    for (;;) {
+        if (offset == len) {
+            if (node->exact != NO_ROUTE)
+                return &this->values[node->exact];
+            break;
+        }
+
+        const node_t *child = _child(node, path[offset]);
+
+        if (
+               child == nullptr
+            || child->label.size() > len - offset
+            || memcmp(
+                   child->label.data(), path + offset, child->label.size()
+               ) != 0
+        )
+            break;
+
+        node    =  child;
+        offset  += child->label.size();
+
+        if (node->prefix != NO_ROUTE)
+            best = node->prefix;
+    }
+
+    return best != NO_ROUTE ? &this->values[best] : nullptr;
+}
+
+template <typename value_t>
+bool router_t<value_t>::_add(const char *path, bool is_prefix, value_t value)
+{
+    if (path[0] == '/')
+        path++;
+
+    size_t  len     = strlen(path);
+    node_t  *node   = &this->root;
+
+    while (len > 0) {
+        node_t *child = (node_t *) _child(node, path[0]);
+
+        if (child == nullptr) {
+            node->children.push_back(
+                (node_t) { string(path, len), { }, NO_ROUTE, NO_ROUTE }
+            );
+            node = &node->children.back();
+            break;
+        }
+
+        // Length of the prefix shared by the label and the path.
+        size_t common = 0;
+        while (
+               common < child->label.size() && common < len
+            && child->label[common] == path[common]
+        )
+            common++;
+
+        // Splits the edge when the path diverges in the middle of the label.
+        if (common < child->label.size()) {
+            node_t tail = move(*child);
+            tail.label.erase(0, common);
+
+            *child = (node_t) {
+                string(path, common), { }, NO_ROUTE, NO_ROUTE
+            };
+            child->children.push_back(move(tail));
+        }
+
+        node    =  child;
+        path    += common;
+        len     -= common;
+    }
+
+    size_t *route = is_prefix ? &node->prefix : &node->exact;
+
+    if (*route != NO_ROUTE)
+        return false;
+
+    *route = this->values.size();
+    this->values.push_back(move(value));
+
+    return true;
+}
+
+template <typename value_t>
+inline const typename router_t<value_t>::node_t *router_t<value_t>::_child(
+    const node_t *node, char c
+)
+{
+    for (const node_t &child : node->children) {
+        if (child.label[0] == c)
+            return &child;
+    }
+
+    return nullptr;
+}
+
+} } /* namespace rusty::http */
+
+#endif /* __RUSTY_HTTP_ROUTER_HPP__ */
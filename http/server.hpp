@@ -0,0 +1,2522 @@
+//
+// HTTP/1.1 server on top of the TCP connections of the stack.
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// The server parses the requests received on a connection, routes them to the
+// handlers of the application and queues their responses in order. It
+// supports persistent connections, pipelined requests, idle timeouts and
+// chunked responses.
+//
+// Clients can also use HTTP/2 without TLS ("h2c"), either by starting the
+// connection with the HTTP/2 preface ("prior knowledge"), or by upgrading an
+// HTTP/1.1 request. The requests of all the streams of a connection are routed
+// to the same handlers, which don't depend on the protocol. The responses of
+// concurrent streams are multiplexed within the flow control windows of the
+// client.
+//
+// Requests are parsed in place, from the received segments. The strings of a
+// request reference the received data, which is only copied when a request is
+// split across several segments. A request is thus only valid while its
+// handler runs.
+//
+// Every event of a connection is processed by the worker which owns the
+// connection. A server can be shared by the workers of several instances once
+// its routes and hooks have been set.
+//
+
+#ifndef __RUSTY_HTTP_SERVER_HPP__
+#define __RUSTY_HTTP_SERVER_HPP__
+
+#include <algorithm>            // max(), min()
+#include <cassert>
+#include <cinttypes>            // PRIu16
+#include <cstdio>               // snprintf()
+#include <cstring>              // memchr(), memcmp(), strlen()
+#include <deque>
+#include <functional>
+#include <memory>               // make_shared(), shared_ptr, unique_ptr
+#include <string>
+#include <unordered_map>
+#include <utility>              // move()
+#include <vector>
+
+#include <arch/cycle.h>         // get_cycle_count()
+
+#include "driver/cpu.hpp"       // cycles_t
+#include "http/h2.hpp"          // h2_error_t, h2_frame_header_t,
+                                // h2_settings_t, H2_PREFACE
+#include "http/hpack.hpp"       // hpack_decoder_t, hpack_encoder_t
+#include "http/parser.hpp"      // http_parser_t, http_request_t
+#include "http/router.hpp"      // router_t
+#include "http/static_response.hpp" // content_sum(), init_static_response(),
+                                    // response_sum(), static_body_t,
+                                    // static_response_t, write_content(),
+                                    // write_static_response()
+#include "net/checksum.hpp"     // partial_sum_t
+#include "util/macros.hpp"      // LIKELY(), UNLIKELY(), RUSTY_*
+
+using namespace std;
+
+using namespace rusty::driver::cpu;
+using namespace rusty::net;
+
+namespace rusty {
+namespace http {
+
+#define HTTP_COLOR     COLOR_GRN
+#define HTTP_DEBUG(MSG, ...)                                                   \
+    RUSTY_DEBUG("HTTP", HTTP_COLOR, MSG, ##__VA_ARGS__)
+#define HTTP_ERROR(MSG, ...)                                                   \
+    RUSTY_ERROR("HTTP", HTTP_COLOR, MSG, ##__VA_ARGS__)
+#define HTTP_DIE(MSG, ...)                                                     \
+    RUSTY_DIE(  "HTTP", HTTP_COLOR, MSG, ##__VA_ARGS__)
+
+// HTTP server on the connections of the 'tcp_t' layer.
+//
+// Each connection holds a 'conn_data_t' value, value-initialized, which the
+// application can use to store its own state.
+template <typename tcp_var_t, typename conn_data_var_t>
+struct server_t {
+    //
+    // Member types
+    //
+
+    typedef tcp_var_t                           tcp_t;
+    typedef conn_data_var_t                     conn_data_t;
+
+    typedef server_t<tcp_t, conn_data_t>        this_t;
+
+    typedef typename tcp_t::conn_t              tcp_conn_t;
+    typedef typename tcp_t::conn_handlers_t     conn_handlers_t;
+    typedef typename tcp_t::cursor_t            cursor_t;
+    typedef typename tcp_t::timer_id_t          timer_id_t;
+
+    // Writes the bytes [offset, offset + out.size()[ of some data.
+    #ifdef USE_PRECOMPUTED_CHECKSUMS
+        typedef typename tcp_t::writer_sum_t    data_writer_t;
+    #else
+        typedef typename tcp_t::writer_t        data_writer_t;
+    #endif /* USE_PRECOMPUTED_CHECKSUMS */
+
+    // Data of an HTTP/2 response, sent in DATA frames as the flow control
+    // windows open.
+    struct h2_data_t {
+        size_t                          len;
+
+        // Number of bytes which have already been sent.
+        size_t                          sent;
+
+        data_writer_t                   writer;
+
+        // Set on the last data of the response.
+        bool                            end_stream;
+    };
+
+    // HTTP/2 stream which has not been entirely responded to.
+    struct h2_stream_t {
+        // Flow control window of the client for the stream. Can be negative
+        // when the client reduces its SETTINGS_INITIAL_WINDOW_SIZE.
+        int64_t                         window;
+
+        deque<h2_data_t>                queued;
+
+        // Set while the stream is in the 'ready' queue of the session.
+        bool                            ready;
+    };
+
+    // State of an HTTP/2 connection.
+    struct h2_session_t {
+        hpack_decoder_t                 decoder;
+        hpack_encoder_t                 encoder;
+
+        // Settings of the client.
+        h2_settings_t                   settings;
+
+        // Set once the connection preface of the client has been received.
+        bool                            preface;
+
+        // Connection flow control window of the client.
+        int64_t                         window;
+
+        unordered_map<uint32_t, h2_stream_t> streams;
+
+        // Streams which have data that can be sent, in the order they will
+        // be served. Streams are served in turn, 'H2_QUANTUM' bytes at a
+        // time. Can contain streams which have been reset since.
+        deque<uint32_t>                 ready;
+
+        // Highest identifier of the streams opened by the client.
+        uint32_t                        last_stream_id;
+
+        // Set while the header block of a stream is being received in
+        // CONTINUATION frames.
+        bool                            continued;
+        uint32_t                        continued_id;
+        string                          header_block;
+
+        // Copies of the fields of the request being decoded, referenced by
+        // the request given to the handler.
+        string                          fields;
+
+        // Lowercased name of the header field being encoded.
+        string                          name_buffer;
+
+        // Number of bytes of DATA frames given to the TCP connection which
+        // have not been acknowledged. No more data is given once it reaches
+        // 'H2_MAX_QUEUED', so that the responses of new streams are not
+        // queued behind large responses.
+        size_t                          queued;
+
+        // Identifier of the timer which resumes the transmission of the
+        // data, if 'has_flush_timer' is true.
+        bool                            has_flush_timer;
+        timer_id_t                      flush_timer;
+
+        // Set once a GOAWAY frame has been sent or received. The connection is
+        // closed once its streams have been responded to.
+        bool                            goaway;
+
+        // Stream whose handler is running, or zero.
+        uint32_t                        dispatching;
+    };
+
+    // State of an HTTP connection.
+    //
+    // Shared by the event handlers of the connection, by its idle timer and by
+    // its responses which have not been acknowledged.
+    struct connection_t {
+        this_t                          *server;
+
+        tcp_conn_t                      conn;
+
+        conn_data_t                     data;
+
+        // Beginning of the requests which have not been served yet.
+        //
+        // Empty when the last received segment ended on a request boundary,
+        // which is the common case.
+        vector<char>                    pending;
+
+        // Parser state of the request at the beginning of 'pending'.
+        http_parser_t                   parser;
+
+        // Number of requests received on this connection.
+        size_t                          n_requests;
+
+        // Number of queued messages which have not been entirely
+        // acknowledged. The data of these messages could still be
+        // retransmitted.
+        size_t                          n_unacked;
+
+        // Cycle count when the last data was received. Only updated when the
+        // server has a 'responded' hook.
+        cycles_t                        received;
+
+        // Set while the connection serves the received requests.
+        bool                            dispatching;
+
+        // Set while a chunked response is being sent. The next pipelined
+        // requests are only served once it ends.
+        bool                            streaming;
+
+        // Set once 'conn.close()' has been called. Further received requests
+        // are ignored.
+        bool                            closing;
+
+        // Set once the close or the reset event has been received. Responses
+        // could still be retransmitted if some are not acknowledged.
+        bool                            closed;
+
+        // Identifier of the idle timer, if 'has_timer' is true.
+        bool                            has_timer;
+        timer_id_t                      idle_timer;
+
+        // State of the connection once it switched to HTTP/2, 'nullptr'
+        // before.
+        unique_ptr<h2_session_t>        h2;
+    };
+
+    // Response to a request, given to the handler of the request.
+    //
+    // A handler must respond to its request with a single call to one of the
+    // 'send*()' methods, or with a chunked response. Chunks can be sent after
+    // the handler returned, with a copy of the response.
+    struct response_t {
+        shared_ptr<connection_t>        connection;
+
+        // Request being responded to. Only valid while its handler runs.
+        const http_request_t            *request;
+
+        // Whether the connection stays open after the response. The response
+        // must have the matching 'Connection' header.
+        bool                            keep_alive;
+
+        // Set if the chunks of a chunked response are framed, i.e. if the
+        // client supports chunked responses.
+        bool                            chunked;
+
+        // Status and size of a chunked response, counted once it ends.
+        unsigned int                    status;
+        size_t                          len;
+
+        // Stream of the request on HTTP/2 connections, zero on HTTP/1
+        // connections.
+        uint32_t                        stream_id;
+
+        // Sends a precomputed response.
+        //
+        // 'body' must have the fields of 'static_body_t', and can be 'nullptr'
+        // for a header-only response. The body and the response must remain
+        // valid until the response has been acknowledged.
+        template <typename body_t>
+        void send_static(const body_t *body, const static_response_t *response);
+
+        // Sends a response made of the given header followed by the bytes
+        // [content_begin, content_begin + content_len[ of the content of the
+        // body.
+        //
+        // 'body' must have the fields of 'static_body_t', and can be 'nullptr'
+        // if 'content_len' is zero. The body must remain valid until the
+        // response has been acknowledged.
+        template <typename body_t>
+        void send(
+            string header, const body_t *body, size_t content_begin,
+            size_t content_len
+        );
+
+        // Sends a response which is entirely given, header and content.
+        void send(string message);
+
+        // Sends a content-less '404 Not Found' response.
+        void send_not_found(void);
+
+        // Starts a chunked response with the given status (e.g. "200 OK") and
+        // header lines (e.g. "Content-Type: text/plain\r\n").
+        //
+        // Clients which don't support chunked responses (HTTP/1.0) receive
+        // the chunks without framing, and the connection is closed at the end
+        // of the response.
+        void begin_chunked(const char *status, const char *headers = "");
+
+        // Sends a chunk of a chunked response. Empty chunks are ignored.
+        //
+        // Does nothing once the connection has been closed.
+        void send_chunk(string data);
+
+        // Ends a chunked response, and serves the next pipelined requests.
+        void end_chunked(void);
+
+    private:
+
+        // Sends an HTTP/2 response made of the given HTTP/1 header, translated
+        // to a header block, followed by 'content_len' bytes written by the
+        // writer.
+        void _h2_send(
+            const char *header, size_t header_len, size_t content_len,
+            data_writer_t writer
+        );
+    };
+
+    // Function called for each request routed to it.
+    typedef function<void(const http_request_t *, response_t *)>
+                                                handler_t;
+
+    // Functions called by the server on the events of the connections. Each
+    // hook can be left empty.
+    struct hooks_t {
+        // Called when a new connection has been accepted.
+        function<void(connection_t *)>          open;
+
+        // Called when the connection has been closed or reset.
+        function<void(connection_t *)>          close;
+
+        // Called once the connection has been closed and none of its responses
+        // can be retransmitted anymore. Their data can then be released.
+        function<void(connection_t *)>          released;
+
+        // Called when a response has been queued, with its request
+        // ('nullptr' for invalid requests and chunked responses which ended
+        // after their handler returned), its status and its size.
+        function<void(
+            connection_t *, const http_request_t *, unsigned int, size_t
+        )>                                      responded;
+    };
+
+    //
+    // Static fields
+    //
+
+    // Maximum size of the header of a chunked response.
+    static constexpr size_t MAX_CHUNKED_HEADER_LEN  = 1024;
+
+    // Maximum number of concurrent streams of an HTTP/2 client
+    // (SETTINGS_MAX_CONCURRENT_STREAMS).
+    static constexpr uint32_t H2_MAX_STREAMS        = 128;
+
+    // Maximum number of bytes sent on a stream before serving the other ready
+    // streams.
+    static constexpr size_t H2_QUANTUM              = 64 * 1024;
+
+    // Maximum number of bytes of DATA frames which have been given to the TCP
+    // connection and not acknowledged.
+    static constexpr size_t H2_MAX_QUEUED           = 512 * 1024;
+
+    // Maximum size of a received header block, and of the copies of its
+    // fields.
+    static constexpr size_t H2_MAX_HEADER_BLOCK     =
+        http_parser_t::MAX_HEADER_SIZE;
+
+    //
+    // Fields
+    //
+
+    router_t<handler_t>     router;
+
+    // Handler of the requests which don't match any route. Responds with
+    // '404 Not Found' by default.
+    handler_t               fallback;
+
+    hooks_t                 hooks;
+
+    // Maximum number of requests served on a single connection before closing
+    // it. Zero means no limit.
+    size_t                  max_requests;
+
+    // Number of seconds a connection can stay without receiving any data
+    // before being closed. Zero disables the timeout.
+    size_t                  idle_timeout;
+
+    // Accepts HTTP/2 connections without TLS, with prior knowledge or by
+    // upgrading an HTTP/1.1 request. Enabled by default.
+    bool                    h2c;
+
+    // Content-less '400 Bad Request' response, and '404 Not Found' responses
+    // with a 'Connection: close' header (index 0) and with a
+    // 'Connection: keep-alive' header (index 1).
+    static_response_t       bad_request;
+    static_response_t       not_found[2];
+
+    //
+    // Methods
+    //
+
+    server_t(size_t _max_requests = 0, size_t _idle_timeout = 0);
+
+    ~server_t(void);
+
+    // Routes the requests of the given path to the handler.
+    //
+    // Fails if the path already has a route.
+    void route(const char *path, handler_t handler);
+
+    // Routes the requests of the paths starting with the given prefix to the
+    // handler.
+    //
+    // Fails if the prefix already has a route.
+    void route_prefix(const char *prefix, handler_t handler);
+
+    // Serves the requests of a new connection. Must be called by the callback
+    // given to 'tcp_listen()', with its connection.
+    conn_handlers_t accept(tcp_conn_t conn);
+
+private:
+
+    // Appends the received data to the connection's stream and serves every
+    // request which has been entirely received, in order.
+    void _on_received_data(
+        shared_ptr<connection_t> connection, cursor_t in
+    );
+
+    // Serves the requests which have been received while a chunked response
+    // was being sent.
+    void _serve_pending(shared_ptr<connection_t> connection);
+
+    // Serves the requests, or processes the HTTP/2 frames, at the beginning
+    // of the buffer.
+    //
+    // Returns the number of bytes consumed from the buffer.
+    size_t _receive(
+        shared_ptr<connection_t> connection, const char *buffer, size_t size
+    );
+
+    // Serves the complete requests at the beginning of the buffer.
+    //
+    // Returns the number of bytes consumed from the buffer. The remaining bytes
+    // are the beginning of a request which has not been entirely received
+    // yet, or requests which must wait for the end of a chunked response.
+    size_t _serve_requests(
+        shared_ptr<connection_t> connection, const char *buffer, size_t size
+    );
+
+    // Schedules or postpones the idle timer of the connection.
+    void _reset_idle_timer(shared_ptr<connection_t> connection);
+
+    // Releases the idle timer and the HTTP/2 flush timer of the connection,
+    // if any.
+    static void _release_timer(connection_t *connection);
+
+    // Queues a message of 'len' bytes on the connection, written by the
+    // writer. 'acked' is called once the message has been acknowledged.
+    template <typename writer_t>
+    static void _send(
+        shared_ptr<connection_t> connection, size_t len, writer_t writer,
+        function<void()> acked = nullptr
+    );
+
+    // Queues the message on the connection.
+    static void _send_string(
+        shared_ptr<connection_t> connection, string message
+    );
+
+    // Calls the 'responded' hook, if any.
+    static inline void _on_responded(
+        connection_t *connection, const http_request_t *request,
+        unsigned int status, size_t len
+    );
+
+    // Returns the status of the response which starts with the given header.
+    static inline unsigned int _status(const char *header);
+
+    // Closes the connection once the queued responses have been sent.
+    static void _close(connection_t *connection);
+
+    // Writer of the 'len' bytes of a string, starting at 'begin'.
+    static data_writer_t _string_writer(
+        shared_ptr<const string> str, size_t begin
+    );
+
+    // Writer of the bytes of the content of a body, starting at 'begin'.
+    template <typename body_t>
+    static data_writer_t _content_writer(const body_t *body, size_t begin);
+
+    //
+    // HTTP/2
+    //
+
+    // Switches the connection to HTTP/2, and sends the settings of the server.
+    static void _h2_start(shared_ptr<connection_t> connection);
+
+    // Switches the connection to HTTP/2 if the request asks for it, and
+    // responds to the request on the stream 1.
+    //
+    // Returns 'false' if the request doesn't ask for a valid upgrade.
+    bool _h2_upgrade(
+        shared_ptr<connection_t> connection, const http_request_t *request
+    );
+
+    // Processes the complete frames at the beginning of the buffer.
+    //
+    // Returns the number of bytes consumed from the buffer.
+    size_t _h2_receive(
+        shared_ptr<connection_t> connection, const char *buffer, size_t size
+    );
+
+    void _h2_on_frame(
+        shared_ptr<connection_t> connection, const h2_frame_header_t &hdr,
+        const char *payload
+    );
+
+    void _h2_on_headers(
+        shared_ptr<connection_t> connection, const h2_frame_header_t &hdr,
+        const char *payload
+    );
+
+    // Decodes the complete header block of a stream, and dispatches its
+    // request if the stream is new.
+    void _h2_on_header_block(
+        shared_ptr<connection_t> connection, uint32_t stream_id,
+        const char *block, size_t size
+    );
+
+    // Routes the request of an open stream to its handler. Responds with
+    // '400 Bad Request' if the request is not valid.
+    void _h2_dispatch(
+        shared_ptr<connection_t> connection, uint32_t stream_id,
+        const http_request_t *request, bool valid
+    );
+
+    static void _h2_on_data(
+        shared_ptr<connection_t> connection, const h2_frame_header_t &hdr
+    );
+
+    static void _h2_on_settings(
+        shared_ptr<connection_t> connection, const h2_frame_header_t &hdr,
+        const char *payload
+    );
+
+    static void _h2_on_window_update(
+        shared_ptr<connection_t> connection, const h2_frame_header_t &hdr,
+        const char *payload
+    );
+
+    // Returns the field of the request which receives the value of the given
+    // header field, or 'nullptr' if the field is ignored.
+    static inline str_ref_t *_h2_field(
+        str_ref_t name, http_request_t *request, str_ref_t *method,
+        str_ref_t *path
+    );
+
+    // Returns 'true' for the HTTP/1 fields which are specific to the
+    // connection, and which can't be sent in HTTP/2 responses.
+    static inline bool _h2_is_connection_field(const string &name);
+
+    // Translates an HTTP/1 response header into a header block, and sends it
+    // in HEADERS and CONTINUATION frames.
+    //
+    // Returns the number of bytes sent, zero if the stream has been reset.
+    static size_t _h2_send_headers(
+        shared_ptr<connection_t> connection, uint32_t stream_id,
+        const char *header, size_t header_len, bool end_stream
+    );
+
+    // Queues data on the stream, and sends what the flow control windows
+    // allow.
+    static void _h2_queue_data(
+        shared_ptr<connection_t> connection, uint32_t stream_id, size_t len,
+        data_writer_t writer, bool end_stream
+    );
+
+    // Adds the stream to the queue of the streams which have data to send, if
+    // it is not already in it.
+    static inline void _h2_ready(
+        h2_session_t *h2, uint32_t stream_id, h2_stream_t *stream
+    );
+
+    // Sends the queued data of the ready streams, in turn, until the flow
+    // control windows or 'H2_MAX_QUEUED' are exhausted.
+    static void _h2_flush(shared_ptr<connection_t> connection);
+
+    // Flushes the connection from a timer, on the next tick.
+    static void _h2_schedule_flush(shared_ptr<connection_t> connection);
+
+    // Sends the next 'len' bytes of the data, in DATA frames.
+    static void _h2_send_data(
+        shared_ptr<connection_t> connection, uint32_t stream_id,
+        h2_data_t *data, size_t len
+    );
+
+    // Forgets a stream which has been entirely responded to or reset. Closes
+    // the connection after a GOAWAY frame once no stream is left.
+    static void _h2_end_stream(connection_t *connection, uint32_t stream_id);
+
+    static void _h2_reset_stream(
+        shared_ptr<connection_t> connection, uint32_t stream_id,
+        h2_error_t error
+    );
+
+    // Sends a GOAWAY frame. The streams which have already been opened are
+    // still responded to.
+    static void _h2_goaway(
+        shared_ptr<connection_t> connection, h2_error_t error
+    );
+
+    // Closes the connection on a connection error.
+    static void _h2_fail(
+        shared_ptr<connection_t> connection, h2_error_t error
+    );
+};
+
+template <typename tcp_t, typename conn_data_t>
+server_t<tcp_t, conn_data_t>::server_t(
+    size_t _max_requests, size_t _idle_timeout
+) : max_requests(_max_requests), idle_timeout(_idle_timeout), h2c(true)
+{
+    static const char bad_request_header[] =
+        "HTTP/1.1 400 Bad Request\r\n"
+        "Content-Length: 0\r\n"
+        "Connection: close\r\n"
+        "\r\n";
+
+    static const char *not_found_headers[2] = {
+        "HTTP/1.1 404 Not Found\r\n"
+        "Content-Length: 0\r\n"
+        "Connection: close\r\n"
+        "\r\n",
+
+        "HTTP/1.1 404 Not Found\r\n"
+        "Content-Length: 0\r\n"
+        "Connection: keep-alive\r\n"
+        "\r\n"
+    };
+
+    init_static_response(
+        (const static_body_t *) nullptr, bad_request_header,
+        sizeof (bad_request_header) - 1, true, &this->bad_request
+    );
+
+    for (int keep_alive = 0; keep_alive < 2; keep_alive++) {
+        const char *header = not_found_headers[keep_alive];
+
+        init_static_response(
+            (const static_body_t *) nullptr, header, strlen(header), true,
+            &this->not_found[keep_alive]
+        );
+    }
+
+    this->fallback =
+        [](const http_request_t *request, response_t *response)
+        {
+            HTTP_ERROR(
+                "404 Not Found - \"%.*s\"", (int) request->path.len,
+                request->path.data
+            );
+            response->send_not_found();
+        };
+}
+
+template <typename tcp_t, typename conn_data_t>
+server_t<tcp_t, conn_data_t>::~server_t(void)
+{
+    free_static_response(&this->bad_request);
+
+    for (const static_response_t &response : this->not_found)
+        free_static_response(&response);
+}
+
+template <typename tcp_t, typename conn_data_t>
+void server_t<tcp_t, conn_data_t>::route(const char *path, handler_t handler)
+{
+    if (!this->router.add(path, move(handler)))
+        HTTP_DIE("Path already routed (%s)", path);
+}
+
+template <typename tcp_t, typename conn_data_t>
+void server_t<tcp_t, conn_data_t>::route_prefix(
+    const char *prefix, handler_t handler
+)
+{
+    if (!this->router.add_prefix(prefix, move(handler)))
+        HTTP_DIE("Prefix already routed (%s)", prefix);
+}
+
+template <typename tcp_t, typename conn_data_t>
+typename server_t<tcp_t, conn_data_t>::conn_handlers_t
+server_t<tcp_t, conn_data_t>::accept(tcp_conn_t conn)
+{
+    HTTP_DEBUG(
+        "New connection from %s:%" PRIu16 " on port %" PRIu16,
+        tcp_t::addr_t::to_alpha(conn.tcb_id.raddr),
+        conn.tcb_id.rport.host(), conn.tcb_id.lport.host()
+    );
+
+    auto connection = make_shared<connection_t>();
+    connection->server          = this;
+    connection->conn            = conn;
+    connection->data            = conn_data_t();
+    connection->n_requests      = 0;
+    connection->n_unacked       = 0;
+    connection->dispatching     = false;
+    connection->streaming       = false;
+    connection->closing         = false;
+    connection->closed          = false;
+    connection->has_timer       = false;
+
+    if (this->hooks.open)
+        this->hooks.open(connection.get());
+
+    this->_reset_idle_timer(connection);
+
+    conn_handlers_t handlers;
+
+    handlers.new_data =
+        [connection](cursor_t in)
+        {
+            if (!connection->closing && connection->conn.can_send())
+                connection->server->_on_received_data(connection, in);
+        };
+
+    handlers.remote_close =
+        [connection]()
+        {
+            // Closes when the remote closes the connection.
+            if (!connection->closing)
+                _close(connection.get());
+        };
+
+    handlers.close =
+        [connection]()
+        {
+            const hooks_t &hooks = connection->server->hooks;
+
+            _release_timer(connection.get());
+
+            if (connection->h2 != nullptr)
+                connection->h2->streams.clear();
+
+            if (hooks.close)
+                hooks.close(connection.get());
+
+            // A connection reset after this event is not reported, and would
+            // keep the data of its responses if some were not acknowledged.
+            connection->closed = true;
+            if (connection->n_unacked == 0 && hooks.released)
+                hooks.released(connection.get());
+        };
+
+    handlers.reset =
+        [connection]()
+        {
+            const hooks_t &hooks = connection->server->hooks;
+
+            _release_timer(connection.get());
+
+            if (connection->h2 != nullptr)
+                connection->h2->streams.clear();
+
+            connection->closing = true;
+            connection->closed  = true;
+
+            if (hooks.close)
+                hooks.close(connection.get());
+
+            if (hooks.released)
+                hooks.released(connection.get());
+        };
+
+    return handlers;
+}
+
+template <typename tcp_t, typename conn_data_t>
+void server_t<tcp_t, conn_data_t>::_on_received_data(
+    shared_ptr<connection_t> connection, cursor_t in
+)
+{
+    this->_reset_idle_timer(connection);
+
+    if (this->hooks.responded)
+        connection->received = get_cycle_count();
+
+    size_t size = in.size();
+
+    vector<char> &pending = connection->pending;
+
+    if (LIKELY(pending.empty() && !connection->streaming)) {
+        // Serves the requests directly from the received segment, and only
+        // copies the trailing partial request, if any.
+        in.read_with(
+            [this, connection, size](const char *buffer)
+            {
+                size_t consumed = this->_receive(connection, buffer, size);
+
+                if (consumed < size && !connection->closing) {
+                    connection->pending.assign(
+                        buffer + consumed, buffer + size
+                    );
+                }
+            }, size
+        );
+    } else {
+        size_t pending_size = pending.size();
+        pending.resize(pending_size + size);
+        in.read(pending.data() + pending_size, size);
+
+        this->_serve_pending(connection);
+    }
+}
+
+template <typename tcp_t, typename conn_data_t>
+void server_t<tcp_t, conn_data_t>::_serve_pending(
+    shared_ptr<connection_t> connection
+)
+{
+    vector<char> &pending = connection->pending;
+
+    size_t consumed = this->_receive(
+        connection, pending.data(), pending.size()
+    );
+
+    if (connection->closing)
+        pending.clear();
+    else
+        pending.erase(pending.begin(), pending.begin() + consumed);
+
+    // Releases the memory of large partial requests.
+    if (
+           pending.empty()
+        && pending.capacity() > http_parser_t::MAX_HEADER_SIZE
+    )
+        vector<char>().swap(pending);
+}
+
+template <typename tcp_t, typename conn_data_t>
+size_t server_t<tcp_t, conn_data_t>::_receive(
+    shared_ptr<connection_t> connection, const char *buffer, size_t size
+)
+{
+    size_t consumed = 0;
+
+    if (LIKELY(connection->h2 == nullptr))
+        consumed = this->_serve_requests(connection, buffer, size);
+
+    // The connection can switch to HTTP/2 while serving its HTTP/1 requests.
+    if (UNLIKELY(connection->h2 != nullptr) && !connection->closing) {
+        consumed += this->_h2_receive(
+            connection, buffer + consumed, size - consumed
+        );
+    }
+
+    return consumed;
+}
+
+template <typename tcp_t, typename conn_data_t>
+size_t server_t<tcp_t, conn_data_t>::_serve_requests(
+    shared_ptr<connection_t> connection, const char *buffer, size_t size
+)
+{
+    size_t offset = 0;
+
+    connection->dispatching = true;
+
+    // Pipelined requests are served in the order they have been received.
+    // Responses are queued on the connection in the same order.
+    while (
+           offset < size
+        && !connection->closing && !connection->streaming
+    ) {
+        // Clients with prior knowledge of HTTP/2 start with its preface.
+        if (
+               UNLIKELY(connection->n_requests == 0 && offset == 0)
+            && this->h2c
+        ) {
+            size_t n = min(size, H2_PREFACE_LEN);
+
+            if (memcmp(buffer, H2_PREFACE, n) == 0) {
+                if (n == H2_PREFACE_LEN)
+                    _h2_start(connection);
+                break;
+            }
+        }
+
+        http_request_t  request;
+        size_t          request_size;
+
+        http_parser_t::status_t status = connection->parser.parse(
+            buffer + offset, size - offset, &request, &request_size
+        );
+
+        if (status == http_parser_t::INCOMPLETE)
+            break;
+
+        if (UNLIKELY(status != http_parser_t::COMPLETE)) {
+            if (status == http_parser_t::TOO_LARGE)
+                HTTP_ERROR("400 Bad Request (request too large)");
+            else
+                HTTP_ERROR("400 Bad Request (invalid request)");
+
+            // The end of the invalid request can't be found in the stream, the
+            // connection is always closed.
+            response_t response = {
+                connection, nullptr, false, false, 0, 0, 0
+            };
+            response.send_static(
+                (const static_body_t *) nullptr, &this->bad_request
+            );
+
+            _close(connection.get());
+            break;
+        }
+
+        offset += request_size;
+
+        connection->n_requests++;
+
+        // The next requests are received as HTTP/2 frames.
+        if (
+               UNLIKELY(!request.upgrade.empty()) && this->h2c
+            && this->_h2_upgrade(connection, &request)
+        )
+            break;
+
+        bool keep_alive =    request.keep_alive
+                          && (    this->max_requests == 0
+                               || connection->n_requests < this->max_requests);
+
+        response_t response = {
+            connection, &request, keep_alive, false, 0, 0, 0
+        };
+
+        const handler_t *handler = this->router.find(
+            request.path.data, request.path.len
+        );
+
+        if (handler == nullptr)
+            handler = &this->fallback;
+
+        (*handler)(&request, &response);
+
+        // The connection is closed, or the next requests are served, once the
+        // chunked response ends.
+        if (connection->streaming)
+            break;
+
+        if (!response.keep_alive)
+            _close(connection.get());
+    }
+
+    connection->dispatching = false;
+
+    return offset;
+}
+
+template <typename tcp_t, typename conn_data_t>
+void server_t<tcp_t, conn_data_t>::_reset_idle_timer(
+    shared_ptr<connection_t> connection
+)
+{
+    if (this->idle_timeout == 0)
+        return;
+
+    auto *timers = connection->conn.tcp_instance->timers;
+
+    typename tcp_t::clock_t::interval_t delay(this->idle_timeout * 1000000);
+
+    if (connection->has_timer) {
+        connection->idle_timer = timers->reschedule(
+            connection->idle_timer, delay
+        );
+    } else {
+        connection->has_timer  = true;
+        connection->idle_timer = timers->schedule(
+            delay,
+            [connection]()
+            {
+                connection->has_timer = false;
+
+                if (!connection->closing) {
+                    HTTP_DEBUG("Closes an idle connection");
+
+                    if (connection->h2 != nullptr)
+                        _h2_goaway(connection, H2_NO_ERROR);
+
+                    _close(connection.get());
+                }
+            }
+        );
+    }
+}
+
+template <typename tcp_t, typename conn_data_t>
+void server_t<tcp_t, conn_data_t>::_release_timer(connection_t *connection)
+{
+    // The timer holds a reference to the connection state, which would never
+    // be released otherwise.
+    if (connection->has_timer) {
+        connection->conn.tcp_instance->timers->remove(connection->idle_timer);
+        connection->has_timer = false;
+    }
+
+    h2_session_t *h2 = connection->h2.get();
+
+    if (h2 != nullptr && h2->has_flush_timer) {
+        connection->conn.tcp_instance->timers->remove(h2->flush_timer);
+        h2->has_flush_timer = false;
+    }
+}
+
+template <typename tcp_t, typename conn_data_t>
+template <typename writer_t>
+void server_t<tcp_t, conn_data_t>::_send(
+    shared_ptr<connection_t> connection, size_t len, writer_t writer,
+    function<void()> acked
+)
+{
+    connection->n_unacked++;
+
+    #ifdef USE_PRECOMPUTED_CHECKSUMS
+        typename tcp_t::writer_sum_t tcp_writer = move(writer);
+    #else
+        typename tcp_t::writer_t tcp_writer = move(writer);
+    #endif /* USE_PRECOMPUTED_CHECKSUMS */
+
+    connection->conn.send(
+        len, tcp_writer,
+        [connection, acked]()
+        {
+            const hooks_t &hooks = connection->server->hooks;
+
+            if (acked)
+                acked();
+
+            // The data of the responses can be released once the connection
+            // is closed and all of its responses have been acknowledged.
+            if (
+                   --connection->n_unacked == 0 && connection->closed
+                && hooks.released
+            )
+                hooks.released(connection.get());
+        }
+    );
+}
+
+template <typename tcp_t, typename conn_data_t>
+void server_t<tcp_t, conn_data_t>::_send_string(
+    shared_ptr<connection_t> connection, string message
+)
+{
+    size_t len = message.size();
+
+    _send(
+        connection, len,
+        [message](size_t offset, cursor_t out)
+        {
+            size_t size = out.size();
+
+            out.write(message.data() + offset, size);
+
+            #ifdef USE_PRECOMPUTED_CHECKSUMS
+                return partial_sum_t(message.data() + offset, size);
+            #endif /* USE_PRECOMPUTED_CHECKSUMS */
+        }
+    );
+}
+
+template <typename tcp_t, typename conn_data_t>
+inline void server_t<tcp_t, conn_data_t>::_on_responded(
+    connection_t *connection, const http_request_t *request,
+    unsigned int status, size_t len
+)
+{
+    const hooks_t &hooks = connection->server->hooks;
+
+    if (hooks.responded)
+        hooks.responded(connection, request, status, len);
+}
+
+template <typename tcp_t, typename conn_data_t>
+inline unsigned int server_t<tcp_t, conn_data_t>::_status(const char *header)
+{
+    // Headers start with "HTTP/1.1 XXX".
+    return   (header[9]  - '0') * 100
+           + (header[10] - '0') * 10
+           + (header[11] - '0');
+}
+
+template <typename tcp_t, typename conn_data_t>
+void server_t<tcp_t, conn_data_t>::_close(connection_t *connection)
+{
+    connection->closing = true;
+    connection->pending.clear();
+
+    _release_timer(connection);
+
+    connection->conn.close();
+}
+
+template <typename tcp_t, typename conn_data_t>
+template <typename body_t>
+void server_t<tcp_t, conn_data_t>::response_t::send_static(
+    const body_t *body, const static_response_t *response
+)
+{
+    if (this->stream_id != 0) {
+        this->_h2_send(
+            response->header, response->header_len,
+            response->len - response->header_len, _content_writer(body, 0)
+        );
+        return;
+    }
+
+    _send(
+        this->connection, response->len,
+        [body, response](size_t offset, cursor_t out)
+        {
+            #ifdef USE_PRECOMPUTED_CHECKSUMS
+                partial_sum_t partial_sum = response_sum(
+                    body, response, offset, offset + out.size()
+                );
+            #endif /* USE_PRECOMPUTED_CHECKSUMS */
+
+            write_static_response(body, response, offset, out);
+
+            #ifdef USE_PRECOMPUTED_CHECKSUMS
+                return partial_sum;
+            #endif /* USE_PRECOMPUTED_CHECKSUMS */
+        }
+    );
+
+    _on_responded(
+        this->connection.get(), this->request, _status(response->header),
+        response->len
+    );
+}
+
+template <typename tcp_t, typename conn_data_t>
+template <typename body_t>
+void server_t<tcp_t, conn_data_t>::response_t::send(
+    string header, const body_t *body, size_t content_begin,
+    size_t content_len
+)
+{
+    if (this->stream_id != 0) {
+        this->_h2_send(
+            header.data(), header.size(), content_len,
+            _content_writer(body, content_begin)
+        );
+        return;
+    }
+
+    size_t header_len   = header.size();
+    size_t len          = header_len + content_len;
+
+    _on_responded(
+        this->connection.get(), this->request, _status(header.data()), len
+    );
+
+    _send(
+        this->connection, len,
+        [body, header, header_len, content_begin](
+            size_t offset, cursor_t out
+        )
+        {
+            size_t end = offset + out.size();
+
+            #ifdef USE_PRECOMPUTED_CHECKSUMS
+                partial_sum_t partial_sum = partial_sum_t::ZERO;
+            #endif /* USE_PRECOMPUTED_CHECKSUMS */
+
+            // Writes the HTTP header if required.
+            if (offset < header_len) {
+                size_t to_write = min(end, header_len) - offset;
+                out = out.write(header.data() + offset, to_write);
+
+                #ifdef USE_PRECOMPUTED_CHECKSUMS
+                    partial_sum = partial_sum_t(
+                        header.data() + offset, to_write
+                    );
+                #endif /* USE_PRECOMPUTED_CHECKSUMS */
+            }
+
+            // Writes the requested part of the content if required.
+            if (end > header_len) {
+                size_t content_offset =   content_begin
+                                        + max(offset, header_len) - header_len;
+
+                #ifdef USE_PRECOMPUTED_CHECKSUMS
+                    partial_sum = partial_sum.append(content_sum(
+                        body, content_offset, content_offset + out.size()
+                    ));
+                #endif /* USE_PRECOMPUTED_CHECKSUMS */
+
+                write_content(body, content_offset, out);
+            }
+
+            #ifdef USE_PRECOMPUTED_CHECKSUMS
+                return partial_sum;
+            #endif /* USE_PRECOMPUTED_CHECKSUMS */
+        }
+    );
+}
+
+template <typename tcp_t, typename conn_data_t>
+void server_t<tcp_t, conn_data_t>::response_t::send(string message)
+{
+    if (this->stream_id != 0) {
+        auto shared = make_shared<const string>(move(message));
+
+        const char  *header     = shared->data();
+        const char  *header_end = strstr(header, "\r\n\r\n");
+        size_t      header_len  = header_end != nullptr
+                                  ? header_end - header + 4 : shared->size();
+
+        this->_h2_send(
+            header, header_len, shared->size() - header_len,
+            _string_writer(shared, header_len)
+        );
+        return;
+    }
+
+    _on_responded(
+        this->connection.get(), this->request, _status(message.data()),
+        message.size()
+    );
+
+    _send_string(this->connection, move(message));
+}
+
+template <typename tcp_t, typename conn_data_t>
+void server_t<tcp_t, conn_data_t>::response_t::send_not_found(void)
+{
+    this->send_static(
+        (const static_body_t *) nullptr,
+        &this->connection->server->not_found[this->keep_alive]
+    );
+}
+
+template <typename tcp_t, typename conn_data_t>
+void server_t<tcp_t, conn_data_t>::response_t::begin_chunked(
+    const char *status, const char *headers
+)
+{
+    connection_t *connection = this->connection.get();
+
+    assert(!connection->streaming);
+
+    // HTTP/2 frames the chunks in DATA frames, and the stream ends with the
+    // response.
+    if (this->stream_id != 0) {
+        char header[MAX_CHUNKED_HEADER_LEN];
+        size_t header_len = snprintf(
+            header, sizeof (header), "HTTP/1.1 %s\r\n%s\r\n", status, headers
+        );
+
+        assert(header_len < sizeof (header));
+
+        this->status = _status(header);
+        this->len    = _h2_send_headers(
+            this->connection, this->stream_id, header, header_len, false
+        );
+        return;
+    }
+
+    // Without framing, the end of the response is the end of the connection.
+    this->chunked = this->request->minor_version != '0';
+    if (!this->chunked)
+        this->keep_alive = false;
+
+    char header[MAX_CHUNKED_HEADER_LEN];
+    size_t header_len = snprintf(
+        header, sizeof (header),
+        "HTTP/1.1 %s\r\n"
+        "%s"
+        "%s"
+        "Connection: %s\r\n"
+        "\r\n",
+        status, headers,
+        this->chunked ? "Transfer-Encoding: chunked\r\n" : "",
+        this->keep_alive ? "keep-alive" : "close"
+    );
+
+    assert(header_len < sizeof (header));
+
+    this->status = _status(header);
+    this->len    = header_len;
+
+    connection->streaming = true;
+
+    _send_string(this->connection, string(header, header_len));
+}
+
+template <typename tcp_t, typename conn_data_t>
+void server_t<tcp_t, conn_data_t>::response_t::send_chunk(string data)
+{
+    connection_t *connection = this->connection.get();
+
+    assert(this->stream_id != 0 || connection->streaming);
+
+    if (
+           data.empty() || connection->closing
+        || !connection->conn.can_send()
+    )
+        return;
+
+    if (this->stream_id != 0) {
+        size_t size = data.size();
+
+        this->len += size;
+
+        connection->server->_reset_idle_timer(this->connection);
+
+        _h2_queue_data(
+            this->connection, this->stream_id, size,
+            _string_writer(make_shared<const string>(move(data)), 0), false
+        );
+        return;
+    }
+
+    if (this->chunked) {
+        char size_line[32];
+        size_t size_line_len = snprintf(
+            size_line, sizeof (size_line), "%zx\r\n", data.size()
+        );
+
+        data.insert(0, size_line, size_line_len);
+        data += "\r\n";
+    }
+
+    this->len += data.size();
+
+    // A connection sending a long response is not idle.
+    connection->server->_reset_idle_timer(this->connection);
+
+    _send_string(this->connection, move(data));
+}
+
+template <typename tcp_t, typename conn_data_t>
+void server_t<tcp_t, conn_data_t>::response_t::end_chunked(void)
+{
+    connection_t *connection = this->connection.get();
+
+    if (this->stream_id != 0) {
+        if (connection->closing || !connection->conn.can_send())
+            return;
+
+        // Ends the stream with an empty DATA frame.
+        _h2_queue_data(
+            this->connection, this->stream_id, 0, nullptr, true
+        );
+
+        _on_responded(
+            connection,
+              connection->h2->dispatching == this->stream_id
+            ? this->request : nullptr,
+            this->status, this->len
+        );
+        return;
+    }
+
+    assert(connection->streaming);
+
+    connection->streaming = false;
+
+    if (connection->closing || !connection->conn.can_send())
+        return;
+
+    if (this->chunked) {
+        static const char last_chunk[] = "0\r\n\r\n";
+
+        this->len += sizeof (last_chunk) - 1;
+        _send_string(
+            this->connection, string(last_chunk, sizeof (last_chunk) - 1)
+        );
+    }
+
+    // The request is only available when the response ends in its handler.
+    _on_responded(
+        connection,
+        connection->dispatching ? this->request : nullptr,
+        this->status, this->len
+    );
+
+    // When the response ends in its handler, the connection is closed, or the
+    // next requests are served, once the handler returns.
+    if (connection->dispatching)
+        return;
+
+    if (!this->keep_alive)
+        _close(connection);
+    else if (!connection->pending.empty())
+        connection->server->_serve_pending(this->connection);
+}
+
+template <typename tcp_t, typename conn_data_t>
+void server_t<tcp_t, conn_data_t>::response_t::_h2_send(
+    const char *header, size_t header_len, size_t content_len,
+    data_writer_t writer
+)
+{
+    connection_t *connection = this->connection.get();
+
+    if (connection->closing || !connection->conn.can_send())
+        return;
+
+    size_t len = _h2_send_headers(
+        this->connection, this->stream_id, header, header_len,
+        content_len == 0
+    );
+
+    if (content_len > 0) {
+        _h2_queue_data(
+            this->connection, this->stream_id, content_len, move(writer), true
+        );
+    }
+
+    _on_responded(
+        connection, this->request, _status(header), len + content_len
+    );
+}
+
+template <typename tcp_t, typename conn_data_t>
+typename server_t<tcp_t, conn_data_t>::data_writer_t
+server_t<tcp_t, conn_data_t>::_string_writer(
+    shared_ptr<const string> str, size_t begin
+)
+{
+    return [str, begin](size_t offset, cursor_t out)
+    {
+        const char  *data = str->data() + begin + offset;
+        size_t      size  = out.size();
+
+        out.write(data, size);
+
+        #ifdef USE_PRECOMPUTED_CHECKSUMS
+            return partial_sum_t(data, size);
+        #endif /* USE_PRECOMPUTED_CHECKSUMS */
+    };
+}
+
+template <typename tcp_t, typename conn_data_t>
+template <typename body_t>
+typename server_t<tcp_t, conn_data_t>::data_writer_t
+server_t<tcp_t, conn_data_t>::_content_writer(
+    const body_t *body, size_t begin
+)
+{
+    return [body, begin](size_t offset, cursor_t out)
+    {
+        size_t content_offset = begin + offset;
+
+        #ifdef USE_PRECOMPUTED_CHECKSUMS
+            partial_sum_t partial_sum = content_sum(
+                body, content_offset, content_offset + out.size()
+            );
+        #endif /* USE_PRECOMPUTED_CHECKSUMS */
+
+        write_content(body, content_offset, out);
+
+        #ifdef USE_PRECOMPUTED_CHECKSUMS
+            return partial_sum;
+        #endif /* USE_PRECOMPUTED_CHECKSUMS */
+    };
+}
+
+template <typename tcp_t, typename conn_data_t>
+void server_t<tcp_t, conn_data_t>::_h2_start(
+    shared_ptr<connection_t> connection
+)
+{
+    HTTP_DEBUG("Switches a connection to HTTP/2");
+
+    connection->h2.reset(new h2_session_t());
+
+    h2_session_t *h2 = connection->h2.get();
+    h2->preface         = false;
+    h2->window          = h2_settings_t::DEFAULT_WINDOW_SIZE;
+    h2->last_stream_id  = 0;
+    h2->continued       = false;
+    h2->queued          = 0;
+    h2->has_flush_timer = false;
+    h2->goaway          = false;
+    h2->dispatching     = 0;
+
+    // The strings of the requests reference the copies of their fields, which
+    // must never be reallocated.
+    h2->fields.reserve(H2_MAX_HEADER_BLOCK);
+
+    string settings;
+    h2_settings_t::append(
+        h2_settings_t::MAX_CONCURRENT_STREAMS, H2_MAX_STREAMS, &settings
+    );
+
+    string frame;
+    h2_frame_header_t::append(
+        h2_frame_header_t::SETTINGS, 0, 0, settings.data(), settings.size(),
+        &frame
+    );
+
+    _send_string(connection, move(frame));
+}
+
+template <typename tcp_t, typename conn_data_t>
+bool server_t<tcp_t, conn_data_t>::_h2_upgrade(
+    shared_ptr<connection_t> connection, const http_request_t *request
+)
+{
+    string settings;
+
+    if (
+           request->minor_version != '1'
+        || !request->upgrade.equals_nocase("h2c")
+        || !h2_settings_t::decode_header(request->http2_settings, &settings)
+    )
+        return false;
+
+    static const char switching[] =
+        "HTTP/1.1 101 Switching Protocols\r\n"
+        "Connection: Upgrade\r\n"
+        "Upgrade: h2c\r\n"
+        "\r\n";
+
+    _send_string(connection, string(switching, sizeof (switching) - 1));
+
+    _h2_start(connection);
+
+    h2_session_t *h2 = connection->h2.get();
+
+    h2_error_t error = h2->settings.apply(settings.data(), settings.size());
+    if (UNLIKELY(error != H2_NO_ERROR)) {
+        _h2_fail(connection, error);
+        return true;
+    }
+
+    h2->encoder.set_max_table_size(h2->settings.header_table_size);
+
+    // The request is the first request of the stream 1, which is half-closed
+    // by the client.
+    h2->last_stream_id = 1;
+    h2->streams[1] = { h2->settings.initial_window_size, { }, false };
+
+    this->_h2_dispatch(connection, 1, request, true);
+
+    return true;
+}
+
+template <typename tcp_t, typename conn_data_t>
+size_t server_t<tcp_t, conn_data_t>::_h2_receive(
+    shared_ptr<connection_t> connection, const char *buffer, size_t size
+)
+{
+    h2_session_t *h2 = connection->h2.get();
+
+    size_t offset = 0;
+
+    if (!h2->preface) {
+        size_t n = min(size, H2_PREFACE_LEN);
+
+        if (UNLIKELY(memcmp(buffer, H2_PREFACE, n) != 0)) {
+            HTTP_ERROR("Invalid HTTP/2 connection preface");
+            _h2_fail(connection, H2_PROTOCOL_ERROR);
+            return 0;
+        }
+
+        if (n < H2_PREFACE_LEN)
+            return 0;
+
+        h2->preface = true;
+        offset      = H2_PREFACE_LEN;
+    }
+
+    while (
+           !connection->closing
+        && size - offset >= h2_frame_header_t::SIZE
+    ) {
+        h2_frame_header_t hdr = h2_frame_header_t::read(buffer + offset);
+
+        // The server never raises SETTINGS_MAX_FRAME_SIZE.
+        if (UNLIKELY(hdr.length > h2_settings_t::MIN_FRAME_SIZE)) {
+            HTTP_ERROR("HTTP/2 frame too large");
+            _h2_fail(connection, H2_FRAME_SIZE_ERROR);
+            break;
+        }
+
+        size_t frame_size = h2_frame_header_t::SIZE + hdr.length;
+
+        if (size - offset < frame_size)
+            break;
+
+        this->_h2_on_frame(
+            connection, hdr, buffer + offset + h2_frame_header_t::SIZE
+        );
+
+        offset += frame_size;
+    }
+
+    return offset;
+}
+
+template <typename tcp_t, typename conn_data_t>
+void server_t<tcp_t, conn_data_t>::_h2_on_frame(
+    shared_ptr<connection_t> connection, const h2_frame_header_t &hdr,
+    const char *payload
+)
+{
+    h2_session_t *h2 = connection->h2.get();
+
+    // A header block can't be interleaved with other frames.
+    if (
+           UNLIKELY(h2->continued)
+        && (   hdr.type != h2_frame_header_t::CONTINUATION
+            || hdr.stream_id != h2->continued_id)
+    ) {
+        _h2_fail(connection, H2_PROTOCOL_ERROR);
+        return;
+    }
+
+    switch (hdr.type) {
+    case h2_frame_header_t::DATA:
+        _h2_on_data(connection, hdr);
+        break;
+
+    case h2_frame_header_t::HEADERS:
+        this->_h2_on_headers(connection, hdr, payload);
+        break;
+
+    case h2_frame_header_t::CONTINUATION:
+        if (UNLIKELY(!h2->continued)) {
+            _h2_fail(connection, H2_PROTOCOL_ERROR);
+            return;
+        }
+
+        if (UNLIKELY(
+               h2->header_block.size() + hdr.length > H2_MAX_HEADER_BLOCK
+        )) {
+            HTTP_ERROR("HTTP/2 header block too large");
+            _h2_fail(connection, H2_PROTOCOL_ERROR);
+            return;
+        }
+
+        h2->header_block.append(payload, hdr.length);
+
+        if (hdr.flags & h2_frame_header_t::END_HEADERS) {
+            h2->continued = false;
+            this->_h2_on_header_block(
+                connection, hdr.stream_id, h2->header_block.data(),
+                h2->header_block.size()
+            );
+        }
+        break;
+
+    case h2_frame_header_t::PRIORITY:
+        // Streams are served in turn, priorities are ignored.
+        if (UNLIKELY(hdr.stream_id == 0))
+            _h2_fail(connection, H2_PROTOCOL_ERROR);
+        break;
+
+    case h2_frame_header_t::RST_STREAM:
+        if (UNLIKELY(hdr.stream_id == 0))
+            _h2_fail(connection, H2_PROTOCOL_ERROR);
+        else if (UNLIKELY(hdr.length != 4))
+            _h2_fail(connection, H2_FRAME_SIZE_ERROR);
+        else
+            _h2_end_stream(connection.get(), hdr.stream_id);
+        break;
+
+    case h2_frame_header_t::SETTINGS:
+        _h2_on_settings(connection, hdr, payload);
+        break;
+
+    case h2_frame_header_t::PUSH_PROMISE:
+        // Clients can't push streams.
+        _h2_fail(connection, H2_PROTOCOL_ERROR);
+        break;
+
+    case h2_frame_header_t::PING:
+        if (UNLIKELY(hdr.stream_id != 0))
+            _h2_fail(connection, H2_PROTOCOL_ERROR);
+        else if (UNLIKELY(hdr.length != 8))
+            _h2_fail(connection, H2_FRAME_SIZE_ERROR);
+        else if (!(hdr.flags & h2_frame_header_t::ACK)) {
+            string frame;
+            h2_frame_header_t::append(
+                h2_frame_header_t::PING, h2_frame_header_t::ACK, 0, payload,
+                hdr.length, &frame
+            );
+            _send_string(connection, move(frame));
+        }
+        break;
+
+    case h2_frame_header_t::GOAWAY:
+        if (UNLIKELY(hdr.stream_id != 0))
+            _h2_fail(connection, H2_PROTOCOL_ERROR);
+        else if (UNLIKELY(hdr.length < 8))
+            _h2_fail(connection, H2_FRAME_SIZE_ERROR);
+        else {
+            // The client doesn't open new streams, the connection is closed
+            // once the open ones have been responded to.
+            h2->goaway = true;
+            if (h2->streams.empty())
+                _close(connection.get());
+        }
+        break;
+
+    case h2_frame_header_t::WINDOW_UPDATE:
+        _h2_on_window_update(connection, hdr, payload);
+        break;
+
+    default:
+        // Unknown frames are ignored.
+        break;
+    }
+}
+
+template <typename tcp_t, typename conn_data_t>
+void server_t<tcp_t, conn_data_t>::_h2_on_headers(
+    shared_ptr<connection_t> connection, const h2_frame_header_t &hdr,
+    const char *payload
+)
+{
+    h2_session_t *h2 = connection->h2.get();
+
+    // Clients open streams with odd identifiers.
+    if (UNLIKELY(hdr.stream_id == 0 || hdr.stream_id % 2 == 0)) {
+        _h2_fail(connection, H2_PROTOCOL_ERROR);
+        return;
+    }
+
+    const char  *block  = payload;
+    size_t      size    = hdr.length;
+
+    if (hdr.flags & h2_frame_header_t::PADDED) {
+        size_t padding = size > 0 ? (uint8_t) block[0] : 0;
+
+        if (UNLIKELY(size == 0 || padding >= size)) {
+            _h2_fail(connection, H2_PROTOCOL_ERROR);
+            return;
+        }
+
+        block++;
+        size -= padding + 1;
+    }
+
+    // Skips the stream dependency and the weight.
+    if (hdr.flags & h2_frame_header_t::PRIORITY_FLAG) {
+        if (UNLIKELY(size < 5)) {
+            _h2_fail(connection, H2_FRAME_SIZE_ERROR);
+            return;
+        }
+
+        block += 5;
+        size  -= 5;
+    }
+
+    if (hdr.flags & h2_frame_header_t::END_HEADERS) {
+        this->_h2_on_header_block(connection, hdr.stream_id, block, size);
+    } else {
+        h2->continued       = true;
+        h2->continued_id    = hdr.stream_id;
+        h2->header_block.assign(block, size);
+    }
+}
+
+template <typename tcp_t, typename conn_data_t>
+void server_t<tcp_t, conn_data_t>::_h2_on_header_block(
+    shared_ptr<connection_t> connection, uint32_t stream_id,
+    const char *block, size_t size
+)
+{
+    h2_session_t *h2 = connection->h2.get();
+
+    http_request_t  request = { };
+    str_ref_t       method, path;
+    bool            too_large = false;
+
+    // Copies the values of the fields of interest, as the decoder only keeps
+    // them during the callback.
+    h2->fields.clear();
+
+    bool decoded = h2->decoder.decode(
+        block, size,
+        [h2, &request, &method, &path, &too_large](
+            str_ref_t name, str_ref_t value
+        )
+        {
+            str_ref_t *field = _h2_field(name, &request, &method, &path);
+
+            if (field == nullptr)
+                return true;
+
+            string &fields = h2->fields;
+
+            if (UNLIKELY(fields.size() + value.len > fields.capacity())) {
+                too_large = true;
+                return false;
+            }
+
+            *field = str_ref_t(fields.data() + fields.size(), value.len);
+            fields.append(value.data, value.len);
+
+            return true;
+        }
+    );
+
+    // The state of the decoder is shared by all the streams.
+    if (UNLIKELY(!decoded)) {
+        if (too_large)
+            HTTP_ERROR("HTTP/2 header block too large");
+        else
+            HTTP_ERROR("Invalid HTTP/2 header block");
+
+        _h2_fail(connection, H2_COMPRESSION_ERROR);
+        return;
+    }
+
+    // Ignores the trailers of open streams, and the streams opened after a
+    // GOAWAY frame.
+    if (stream_id <= h2->last_stream_id || h2->goaway)
+        return;
+
+    h2->last_stream_id = stream_id;
+
+    if (UNLIKELY(h2->streams.size() >= H2_MAX_STREAMS)) {
+        _h2_reset_stream(connection, stream_id, H2_REFUSED_STREAM);
+        return;
+    }
+
+    h2->streams[stream_id] = { h2->settings.initial_window_size, { }, false };
+
+    request.major_version   = '2';
+    request.minor_version   = '0';
+    request.keep_alive      = true;
+
+    // The path is given without its leading '/', as for HTTP/1 requests.
+    bool valid =    method.equals_nocase("GET")
+                 && path.len > 0 && path.data[0] == '/'
+                 && path.len <= http_parser_t::MAX_URI_LEN;
+
+    if (valid) {
+        const char *query = (const char *) memchr(path.data, '?', path.len);
+
+        if (query == nullptr) {
+            request.path  = str_ref_t(path.data + 1, path.len - 1);
+            request.query = str_ref_t();
+        } else {
+            request.path  = str_ref_t(path.data + 1, query - path.data - 1);
+            request.query = str_ref_t(
+                query + 1, path.data + path.len - query - 1
+            );
+        }
+    } else {
+        HTTP_ERROR("400 Bad Request (invalid HTTP/2 request)");
+    }
+
+    connection->n_requests++;
+
+    this->_h2_dispatch(connection, stream_id, &request, valid);
+}
+
+template <typename tcp_t, typename conn_data_t>
+void server_t<tcp_t, conn_data_t>::_h2_dispatch(
+    shared_ptr<connection_t> connection, uint32_t stream_id,
+    const http_request_t *request, bool valid
+)
+{
+    h2_session_t *h2 = connection->h2.get();
+
+    response_t response = {
+        connection, valid ? request : nullptr, true, false, 0, 0, stream_id
+    };
+
+    h2->dispatching = stream_id;
+
+    if (valid) {
+        const handler_t *handler = this->router.find(
+            request->path.data, request->path.len
+        );
+
+        if (handler == nullptr)
+            handler = &this->fallback;
+
+        (*handler)(request, &response);
+    } else {
+        response.send_static(
+            (const static_body_t *) nullptr, &this->bad_request
+        );
+    }
+
+    h2->dispatching = 0;
+
+    // Lets the client know that no more streams will be served. The
+    // connection is closed once the open streams have been responded to.
+    if (
+           this->max_requests != 0 && !h2->goaway && !connection->closing
+        && connection->n_requests >= this->max_requests
+    ) {
+        _h2_goaway(connection, H2_NO_ERROR);
+
+        if (h2->streams.empty())
+            _close(connection.get());
+    }
+}
+
+template <typename tcp_t, typename conn_data_t>
+void server_t<tcp_t, conn_data_t>::_h2_on_data(
+    shared_ptr<connection_t> connection, const h2_frame_header_t &hdr
+)
+{
+    if (UNLIKELY(hdr.stream_id == 0)) {
+        _h2_fail(connection, H2_PROTOCOL_ERROR);
+        return;
+    }
+
+    if (hdr.length == 0)
+        return;
+
+    // Request bodies are ignored. Their credit is immediately given back to
+    // the client.
+    uint8_t increment[4];
+    h2_frame_header_t::write_uint32(hdr.length, increment);
+
+    string frames;
+    h2_frame_header_t::append(
+        h2_frame_header_t::WINDOW_UPDATE, 0, 0, (const char *) increment, 4,
+        &frames
+    );
+
+    if (!(hdr.flags & h2_frame_header_t::END_STREAM)) {
+        h2_frame_header_t::append(
+            h2_frame_header_t::WINDOW_UPDATE, 0, hdr.stream_id,
+            (const char *) increment, 4, &frames
+        );
+    }
+
+    _send_string(connection, move(frames));
+}
+
+template <typename tcp_t, typename conn_data_t>
+void server_t<tcp_t, conn_data_t>::_h2_on_settings(
+    shared_ptr<connection_t> connection, const h2_frame_header_t &hdr,
+    const char *payload
+)
+{
+    h2_session_t *h2 = connection->h2.get();
+
+    if (UNLIKELY(hdr.stream_id != 0)) {
+        _h2_fail(connection, H2_PROTOCOL_ERROR);
+        return;
+    }
+
+    if (hdr.flags & h2_frame_header_t::ACK) {
+        if (UNLIKELY(hdr.length != 0))
+            _h2_fail(connection, H2_FRAME_SIZE_ERROR);
+        return;
+    }
+
+    uint32_t old_window = h2->settings.initial_window_size;
+
+    h2_error_t error = h2->settings.apply(payload, hdr.length);
+    if (UNLIKELY(error != H2_NO_ERROR)) {
+        _h2_fail(connection, error);
+        return;
+    }
+
+    h2->encoder.set_max_table_size(h2->settings.header_table_size);
+
+    // A new initial window size changes the windows of the open streams.
+    int64_t delta = (int64_t) h2->settings.initial_window_size - old_window;
+
+    if (delta != 0) {
+        for (auto &entry : h2->streams) {
+            h2_stream_t &stream = entry.second;
+
+            stream.window += delta;
+
+            if (UNLIKELY(stream.window > h2_settings_t::MAX_WINDOW_SIZE)) {
+                _h2_fail(connection, H2_FLOW_CONTROL_ERROR);
+                return;
+            }
+
+            if (stream.window > 0)
+                _h2_ready(h2, entry.first, &stream);
+        }
+    }
+
+    string frame;
+    h2_frame_header_t::append(
+        h2_frame_header_t::SETTINGS, h2_frame_header_t::ACK, 0, nullptr, 0,
+        &frame
+    );
+    _send_string(connection, move(frame));
+
+    _h2_flush(connection);
+}
+
+template <typename tcp_t, typename conn_data_t>
+void server_t<tcp_t, conn_data_t>::_h2_on_window_update(
+    shared_ptr<connection_t> connection, const h2_frame_header_t &hdr,
+    const char *payload
+)
+{
+    h2_session_t *h2 = connection->h2.get();
+
+    if (UNLIKELY(hdr.length != 4)) {
+        _h2_fail(connection, H2_FRAME_SIZE_ERROR);
+        return;
+    }
+
+    int64_t increment = h2_frame_header_t::read_uint32(
+        (const uint8_t *) payload
+    ) & 0x7FFFFFFF;
+
+    if (hdr.stream_id == 0) {
+        h2->window += increment;
+
+        if (UNLIKELY(
+               increment == 0 || h2->window > h2_settings_t::MAX_WINDOW_SIZE
+        )) {
+            _h2_fail(
+                connection,
+                increment == 0 ? H2_PROTOCOL_ERROR : H2_FLOW_CONTROL_ERROR
+            );
+            return;
+        }
+    } else {
+        auto it = h2->streams.find(hdr.stream_id);
+
+        // The stream could have been closed while the frame was sent.
+        if (it == h2->streams.end())
+            return;
+
+        h2_stream_t &stream = it->second;
+
+        stream.window += increment;
+
+        if (UNLIKELY(
+               increment == 0
+            || stream.window > h2_settings_t::MAX_WINDOW_SIZE
+        )) {
+            _h2_reset_stream(
+                connection, hdr.stream_id,
+                increment == 0 ? H2_PROTOCOL_ERROR : H2_FLOW_CONTROL_ERROR
+            );
+            return;
+        }
+
+        if (stream.window > 0)
+            _h2_ready(h2, hdr.stream_id, &stream);
+    }
+
+    _h2_flush(connection);
+}
+
+template <typename tcp_t, typename conn_data_t>
+inline str_ref_t *server_t<tcp_t, conn_data_t>::_h2_field(
+    str_ref_t name, http_request_t *request, str_ref_t *method,
+    str_ref_t *path
+)
+{
+    #define MATCH_FIELD(NAME, FIELD)                                           \
+        do {                                                                   \
+            if (memcmp(name.data, NAME, name.len) == 0)                        \
+                return FIELD;                                                  \
+        } while (0)
+
+    // HTTP/2 field names are in lowercase. Only compares the names which have
+    // the same length.
+    switch (name.len) {
+    case sizeof ("host") - 1:
+        MATCH_FIELD("host", &request->host);
+        break;
+    case sizeof (":path") - 1:
+        MATCH_FIELD(":path", path);
+        MATCH_FIELD("range", &request->range);
+        break;
+    case sizeof (":method") - 1:
+        MATCH_FIELD(":method", method);
+        break;
+    case sizeof ("if-range") - 1:
+        MATCH_FIELD("if-range", &request->if_range);
+        break;
+    case sizeof (":authority") - 1:
+        MATCH_FIELD(":authority", &request->host);
+        break;
+    case sizeof ("if-none-match") - 1:
+        MATCH_FIELD("if-none-match", &request->if_none_match);
+        break;
+    case sizeof ("accept-encoding") - 1:
+        MATCH_FIELD("accept-encoding", &request->accept_encoding);
+        break;
+    case sizeof ("if-modified-since") - 1:
+        MATCH_FIELD("if-modified-since", &request->if_modified_since);
+        break;
+    }
+
+    #undef MATCH_FIELD
+
+    return nullptr;
+}
+
+template <typename tcp_t, typename conn_data_t>
+inline bool server_t<tcp_t, conn_data_t>::_h2_is_connection_field(
+    const string &name
+)
+{
+    return    name == "connection" || name == "keep-alive"
+           || name == "proxy-connection" || name == "transfer-encoding"
+           || name == "upgrade";
+}
+
+template <typename tcp_t, typename conn_data_t>
+size_t server_t<tcp_t, conn_data_t>::_h2_send_headers(
+    shared_ptr<connection_t> connection, uint32_t stream_id,
+    const char *header, size_t header_len, bool end_stream
+)
+{
+    h2_session_t *h2 = connection->h2.get();
+
+    if (h2->streams.find(stream_id) == h2->streams.end())
+        return 0;
+
+    string block;
+    h2->encoder.begin_block(&block);
+    h2->encoder.encode_status(_status(header), &block);
+
+    // Encodes the header lines which follow the status line.
+
+    const char *end  = header + header_len;
+    const char *line = (const char *) memchr(header, '\n', header_len);
+
+    for (line = line != nullptr ? line + 1 : end; line < end;) {
+        const char *line_end = (const char *) memchr(line, '\n', end - line);
+        if (line_end == nullptr)
+            line_end = end;
+
+        size_t len = line_end - line;
+        if (len > 0 && line[len - 1] == '\r')
+            len--;
+
+        const char *colon = (const char *) memchr(line, ':', len);
+
+        if (colon != nullptr && colon > line) {
+            string &name = h2->name_buffer;
+            name.assign(line, colon - line);
+            for (char &c : name)
+                c = tolower(c);
+
+            const char *value     = colon + 1;
+            const char *value_end = line + len;
+            while (value < value_end && (*value == ' ' || *value == '\t'))
+                value++;
+
+            if (!_h2_is_connection_field(name)) {
+                h2->encoder.encode(
+                    str_ref_t(name.data(), name.size()),
+                    str_ref_t(value, value_end - value), &block
+                );
+            }
+        }
+
+        line = line_end + 1;
+    }
+
+    // Splits the block in frames of at most the maximum frame size of the
+    // client.
+
+    string frames;
+
+    size_t  max_frame   = h2->settings.max_frame_size;
+    size_t  offset      = 0;
+    uint8_t type        = h2_frame_header_t::HEADERS;
+    uint8_t flags       = end_stream ? h2_frame_header_t::END_STREAM : 0;
+
+    do {
+        size_t n = min(block.size() - offset, max_frame);
+
+        if (offset + n == block.size())
+            flags |= h2_frame_header_t::END_HEADERS;
+
+        h2_frame_header_t::append(
+            type, flags, stream_id, block.data() + offset, n, &frames
+        );
+
+        offset  += n;
+        type    =  h2_frame_header_t::CONTINUATION;
+        flags   =  0;
+    } while (offset < block.size());
+
+    size_t len = frames.size();
+
+    _send_string(connection, move(frames));
+
+    if (end_stream)
+        _h2_end_stream(connection.get(), stream_id);
+
+    return len;
+}
+
+template <typename tcp_t, typename conn_data_t>
+void server_t<tcp_t, conn_data_t>::_h2_queue_data(
+    shared_ptr<connection_t> connection, uint32_t stream_id, size_t len,
+    data_writer_t writer, bool end_stream
+)
+{
+    h2_session_t *h2 = connection->h2.get();
+
+    auto it = h2->streams.find(stream_id);
+
+    if (it == h2->streams.end())
+        return;
+
+    h2_stream_t &stream = it->second;
+
+    stream.queued.push_back({ len, 0, move(writer), end_stream });
+
+    _h2_ready(h2, stream_id, &stream);
+
+    _h2_flush(connection);
+}
+
+template <typename tcp_t, typename conn_data_t>
+inline void server_t<tcp_t, conn_data_t>::_h2_ready(
+    h2_session_t *h2, uint32_t stream_id, h2_stream_t *stream
+)
+{
+    if (!stream->ready && !stream->queued.empty()) {
+        stream->ready = true;
+        h2->ready.push_back(stream_id);
+    }
+}
+
+template <typename tcp_t, typename conn_data_t>
+void server_t<tcp_t, conn_data_t>::_h2_flush(
+    shared_ptr<connection_t> connection
+)
+{
+    h2_session_t *h2 = connection->h2.get();
+
+    // After an upgrade, the response of the first request waits for the
+    // preface and the SETTINGS frame of the client, which some clients must
+    // receive before large amounts of data.
+    if (UNLIKELY(!h2->preface))
+        return;
+
+    while (
+           !h2->ready.empty() && h2->queued < H2_MAX_QUEUED
+        && !connection->closing && connection->conn.can_send()
+    ) {
+        uint32_t stream_id = h2->ready.front();
+
+        auto it = h2->streams.find(stream_id);
+
+        // The stream has been reset.
+        if (it == h2->streams.end()) {
+            h2->ready.pop_front();
+            continue;
+        }
+
+        h2_stream_t &stream = it->second;
+        h2_data_t   &data   = stream.queued.front();
+
+        size_t  remaining   = data.len - data.sent;
+        int64_t window      = min(stream.window, h2->window);
+
+        if (remaining > 0 && window <= 0) {
+            // Every stream waits for a WINDOW_UPDATE of the connection.
+            if (h2->window <= 0)
+                break;
+
+            // The stream waits for its own WINDOW_UPDATE.
+            h2->ready.pop_front();
+            stream.ready = false;
+            continue;
+        }
+
+        size_t len = min(
+            min(remaining, (size_t) H2_QUANTUM),
+            min(H2_MAX_QUEUED - h2->queued, (size_t) max(window, (int64_t) 0))
+        );
+
+        _h2_send_data(connection, stream_id, &data, len);
+
+        h2->ready.pop_front();
+
+        if (data.sent == data.len) {
+            bool end_stream = data.end_stream;
+            stream.queued.pop_front();
+
+            if (end_stream) {
+                _h2_end_stream(connection.get(), stream_id);
+                continue;
+            }
+        }
+
+        // Serves the other ready streams before sending more.
+        stream.ready = false;
+        _h2_ready(h2, stream_id, &stream);
+    }
+}
+
+template <typename tcp_t, typename conn_data_t>
+void server_t<tcp_t, conn_data_t>::_h2_schedule_flush(
+    shared_ptr<connection_t> connection
+)
+{
+    h2_session_t *h2 = connection->h2.get();
+
+    typename tcp_t::clock_t::interval_t delay(0);
+
+    h2->has_flush_timer = true;
+    h2->flush_timer     = connection->conn.tcp_instance->timers->schedule(
+        delay,
+        [connection]()
+        {
+            connection->h2->has_flush_timer = false;
+            _h2_flush(connection);
+        }
+    );
+}
+
+template <typename tcp_t, typename conn_data_t>
+void server_t<tcp_t, conn_data_t>::_h2_send_data(
+    shared_ptr<connection_t> connection, uint32_t stream_id,
+    h2_data_t *data, size_t len
+)
+{
+    constexpr size_t header_size = h2_frame_header_t::SIZE;
+
+    h2_session_t *h2 = connection->h2.get();
+
+    size_t frame_size   = h2->settings.max_frame_size;
+    size_t frame_total  = header_size + frame_size;
+    size_t n_frames     = len > 0 ? (len + frame_size - 1) / frame_size : 1;
+    size_t size         = len + n_frames * header_size;
+    size_t begin        = data->sent;
+
+    // The frame headers are computed when the TCP layer writes the segments.
+    data_writer_t writer = data->writer;
+    bool end_stream      = data->end_stream && begin + len == data->len;
+
+    data->sent                                  += len;
+    h2->streams.find(stream_id)->second.window  -= len;
+    h2->window                                  -= len;
+    h2->queued                                  += size;
+
+    _send(
+        connection, size,
+        [
+            writer, stream_id, len, frame_size, frame_total, n_frames, begin,
+            end_stream
+        ](size_t offset, cursor_t out)
+        {
+            size_t end = offset + out.size();
+
+            #ifdef USE_PRECOMPUTED_CHECKSUMS
+                partial_sum_t partial_sum = partial_sum_t::ZERO;
+            #endif /* USE_PRECOMPUTED_CHECKSUMS */
+
+            while (offset < end) {
+                size_t frame_begin  = offset - offset % frame_total;
+                size_t frame        = frame_begin / frame_total;
+                size_t frame_offset = offset - frame_begin;
+                size_t payload_len  = min(frame_size, len - frame * frame_size);
+                size_t to_write;
+
+                if (frame_offset < header_size) {
+                    bool last = end_stream && frame == n_frames - 1;
+
+                    h2_frame_header_t hdr = {
+                        (uint32_t) payload_len, h2_frame_header_t::DATA,
+                        (uint8_t) (last ? h2_frame_header_t::END_STREAM : 0),
+                        stream_id
+                    };
+
+                    char header[header_size];
+                    hdr.write(header);
+
+                    to_write = min(header_size - frame_offset, end - offset);
+                    out      = out.write(header + frame_offset, to_write);
+
+                    #ifdef USE_PRECOMPUTED_CHECKSUMS
+                        partial_sum = partial_sum.append(
+                            partial_sum_t(header + frame_offset, to_write)
+                        );
+                    #endif /* USE_PRECOMPUTED_CHECKSUMS */
+                } else {
+                    size_t payload_offset = frame_offset - header_size;
+                    size_t data_offset    =   begin + frame * frame_size
+                                            + payload_offset;
+
+                    to_write = min(payload_len - payload_offset, end - offset);
+
+                    #ifdef USE_PRECOMPUTED_CHECKSUMS
+                        partial_sum = partial_sum.append(
+                            writer(data_offset, out.take(to_write))
+                        );
+                    #else
+                        writer(data_offset, out.take(to_write));
+                    #endif /* USE_PRECOMPUTED_CHECKSUMS */
+
+                    out = out.drop(to_write);
+                }
+
+                offset += to_write;
+            }
+
+            #ifdef USE_PRECOMPUTED_CHECKSUMS
+                return partial_sum;
+            #endif /* USE_PRECOMPUTED_CHECKSUMS */
+        },
+        [connection, size]()
+        {
+            h2_session_t *h2 = connection->h2.get();
+
+            h2->queued -= size;
+
+            // Doesn't send from the acknowledgement, while the TCP layer
+            // processes the received segment.
+            if (
+                   !connection->closing && !h2->ready.empty()
+                && !h2->has_flush_timer
+            )
+                _h2_schedule_flush(connection);
+        }
+    );
+}
+
+template <typename tcp_t, typename conn_data_t>
+void server_t<tcp_t, conn_data_t>::_h2_end_stream(
+    connection_t *connection, uint32_t stream_id
+)
+{
+    h2_session_t *h2 = connection->h2.get();
+
+    h2->streams.erase(stream_id);
+
+    if (h2->goaway && h2->streams.empty() && !connection->closing)
+        _close(connection);
+}
+
+template <typename tcp_t, typename conn_data_t>
+void server_t<tcp_t, conn_data_t>::_h2_reset_stream(
+    shared_ptr<connection_t> connection, uint32_t stream_id, h2_error_t error
+)
+{
+    uint8_t payload[4];
+    h2_frame_header_t::write_uint32(error, payload);
+
+    string frame;
+    h2_frame_header_t::append(
+        h2_frame_header_t::RST_STREAM, 0, stream_id, (const char *) payload,
+        sizeof (payload), &frame
+    );
+    _send_string(connection, move(frame));
+
+    _h2_end_stream(connection.get(), stream_id);
+}
+
+template <typename tcp_t, typename conn_data_t>
+void server_t<tcp_t, conn_data_t>::_h2_goaway(
+    shared_ptr<connection_t> connection, h2_error_t error
+)
+{
+    h2_session_t *h2 = connection->h2.get();
+
+    uint8_t payload[8];
+    h2_frame_header_t::write_uint32(h2->last_stream_id, payload);
+    h2_frame_header_t::write_uint32(error, payload + 4);
+
+    string frame;
+    h2_frame_header_t::append(
+        h2_frame_header_t::GOAWAY, 0, 0, (const char *) payload,
+        sizeof (payload), &frame
+    );
+    _send_string(connection, move(frame));
+
+    h2->goaway = true;
+}
+
+template <typename tcp_t, typename conn_data_t>
+void server_t<tcp_t, conn_data_t>::_h2_fail(
+    shared_ptr<connection_t> connection, h2_error_t error
+)
+{
+    if (connection->closing)
+        return;
+
+    HTTP_DEBUG("HTTP/2 connection error (0x%x)", (unsigned int) error);
+
+    _h2_goaway(connection, error);
+    _close(connection.get());
+}
+
+#undef HTTP_COLOR
+#undef HTTP_DEBUG
+#undef HTTP_ERROR
+#undef HTTP_DIE
+
+} } /* namespace rusty::http */
+
+#endif /* __RUSTY_HTTP_SERVER_HPP__ */
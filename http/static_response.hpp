@@ -0,0 +1,342 @@
+//
+// HTTP responses which never change, with the checksums of their segments
+// precomputed.
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// A static response is a precomputed header followed by the content of a
+// body, which can be shared by several responses (e.g. the 'keep-alive' and
+// the 'close' responses of a same resource).
+//
+// The functions of this file accept any body type with the fields of
+// 'static_body_t', so an application can serve its own resource type without
+// copying it.
+//
+
+#ifndef __RUSTY_HTTP_STATIC_RESPONSE_HPP__
+#define __RUSTY_HTTP_STATIC_RESPONSE_HPP__
+
+#include <algorithm>            // max(), min()
+#include <cassert>
+#include <cstring>              // memcpy()
+
+#include <sys/mman.h>           // madvise()
+
+#include <tmc/mem.h>            // tmc_mem_prefetch()
+
+#include "net/checksum.hpp"     // partial_sum_t, precomputed_sums_t
+#include "util/macros.hpp"      // LIKELY(), UNLIKELY()
+
+using namespace std;
+
+using namespace rusty::net;
+
+namespace rusty {
+namespace http {
+
+// Streamed bodies are read ahead by windows of this size, one window ahead of
+// the transmitted data. Must be a multiple of the page size.
+static constexpr size_t STREAM_READAHEAD        = 2 * 1024 * 1024;
+
+// Segment sizes for which the checksums of the segments of the responses are
+// precomputed: the MSS of Ethernet frames and of jumbo frames.
+static constexpr size_t SEGMENT_SIZES[]         = { 1460, 8960 };
+static constexpr size_t N_SEGMENT_SIZES         =   sizeof (SEGMENT_SIZES)
+                                                  / sizeof (SEGMENT_SIZES[0]);
+
+// Body of one or several static responses.
+struct static_body_t {
+    const char                      *content;
+    size_t                          content_len;
+
+    #ifdef USE_PRECOMPUTED_CHECKSUMS
+        precomputed_sums_t              precomputed_sums;
+    #endif /* USE_PRECOMPUTED_CHECKSUMS */
+
+    // Set if the content is a memory mapping of a file, which is read from
+    // the page cache when sent. Streamed bodies have no precomputed checksums.
+    bool                            streamed;
+};
+
+// Precomputed HTTP header of a static response.
+struct static_response_t {
+    const char                      *header;
+    size_t                          header_len;
+
+    // Size of the header and of the content.
+    size_t                          len;
+
+    #ifdef USE_PRECOMPUTED_CHECKSUMS
+        // Partial sums of the segments of the response (header and content)
+        // for each size of 'SEGMENT_SIZES'. The 'i'th sum of 'segment_sums[j]'
+        // covers the bytes [i * SEGMENT_SIZES[j], (i + 1) * SEGMENT_SIZES[j][.
+        //
+        // 'nullptr' for the responses with the content of streamed bodies.
+        const partial_sum_t             *segment_sums[N_SEGMENT_SIZES];
+    #endif /* USE_PRECOMPUTED_CHECKSUMS */
+};
+
+// Initializes the response with the given header, followed by the content of
+// the body unless 'header_only' is set, and precomputes the checksums of its
+// segments.
+//
+// The header is not copied and must outlive the response. The segment
+// checksums must be released with 'free_static_response()'.
+template <typename body_t>
+static void init_static_response(
+    const body_t *body, const char *header, size_t header_len,
+    bool header_only, static_response_t *response
+);
+
+// Releases the segment checksums of a response initialized by
+// 'init_static_response()'.
+static void free_static_response(const static_response_t *response);
+
+// Writes the bytes [offset, offset + out.size()[ of the response in the
+// cursor.
+//
+// 'body' can be 'nullptr' for header-only responses.
+template <typename body_t, typename cursor_t>
+static inline void write_static_response(
+    const body_t *body, const static_response_t *response, size_t offset,
+    cursor_t out
+);
+
+// Writes the bytes [begin, begin + out.size()[ of the content of the body in
+// the cursor.
+template <typename body_t, typename cursor_t>
+static inline void write_content(
+    const body_t *body, size_t begin, cursor_t out
+);
+
+#ifdef USE_PRECOMPUTED_CHECKSUMS
+    // Returns the partial sum of the bytes [begin, end[ of the response.
+    //
+    // Uses the precomputed sum when the bytes are one of the precomputed
+    // segments.
+    template <typename body_t>
+    static inline partial_sum_t response_sum(
+        const body_t *body, const static_response_t *response, size_t begin,
+        size_t end
+    );
+
+    // Returns the partial sum of the bytes [begin, end[ of the content.
+    template <typename body_t>
+    static inline partial_sum_t content_sum(
+        const body_t *body, size_t begin, size_t end
+    );
+#endif /* USE_PRECOMPUTED_CHECKSUMS */
+
+// Hints the kernel to read the next window of a streamed body when the bytes
+// [begin, end[ of its content start a new window. Does nothing for the other
+// bodies.
+template <typename body_t>
+static inline void readahead(const body_t *body, size_t begin, size_t end);
+
+#ifdef USE_PRECOMPUTED_CHECKSUMS
+    // Computes the partial sum of the bytes [begin, end[ of the response.
+    template <typename body_t>
+    static partial_sum_t _compute_response_sum(
+        const body_t *body, const static_response_t *response, size_t begin,
+        size_t end
+    );
+#endif /* USE_PRECOMPUTED_CHECKSUMS */
+
+template <typename body_t>
+static void init_static_response(
+    const body_t *body, const char *header, size_t header_len,
+    bool header_only, static_response_t *response
+)
+{
+    response->header        = header;
+    response->header_len    = header_len;
+    response->len           = header_len;
+
+    if (!header_only)
+        response->len += body->content_len;
+
+    #ifdef USE_PRECOMPUTED_CHECKSUMS
+        for (size_t i = 0; i < N_SEGMENT_SIZES; i++) {
+            if (!header_only && body->streamed) {
+                response->segment_sums[i] = nullptr;
+                continue;
+            }
+
+            size_t seg_size = SEGMENT_SIZES[i];
+            size_t n_segs   = (response->len + seg_size - 1) / seg_size;
+
+            partial_sum_t *sums = new partial_sum_t[n_segs];
+
+            for (size_t j = 0; j < n_segs; j++) {
+                size_t begin = j * seg_size,
+                       end   = min(begin + seg_size, response->len);
+
+                sums[j] = _compute_response_sum(body, response, begin, end);
+            }
+
+            response->segment_sums[i] = sums;
+        }
+    #endif /* USE_PRECOMPUTED_CHECKSUMS */
+}
+
+static void free_static_response(const static_response_t *response)
+{
+    #ifdef USE_PRECOMPUTED_CHECKSUMS
+        for (size_t i = 0; i < N_SEGMENT_SIZES; i++)
+            delete[] response->segment_sums[i];
+    #endif /* USE_PRECOMPUTED_CHECKSUMS */
+}
+
+template <typename body_t, typename cursor_t>
+static inline void write_static_response(
+    const body_t *body, const static_response_t *response, size_t offset,
+    cursor_t out
+)
+{
+    size_t end = offset + out.size();
+
+    assert(end <= response->len);
+
+    // Writes the HTTP header if required.
+    if (offset < response->header_len) {
+        size_t to_write = min(end, response->header_len) - offset;
+        out = out.write(response->header + offset, to_write);
+    }
+
+    // Writes the content if required.
+    if (end > response->header_len) {
+        size_t content_offset =   max(offset, response->header_len)
+                                - response->header_len;
+
+        assert(
+               content_offset + out.size()
+            == end - response->header_len
+        );
+
+        write_content(body, content_offset, out);
+    }
+}
+
+template <typename body_t, typename cursor_t>
+static inline void write_content(
+    const body_t *body, size_t begin, cursor_t out
+)
+{
+    size_t size = out.size();
+
+    readahead(body, begin, begin + size);
+    tmc_mem_prefetch(body->content + begin, size);
+
+    out.write(body->content + begin, size);
+}
+
+#ifdef USE_PRECOMPUTED_CHECKSUMS
+    template <typename body_t>
+    static inline partial_sum_t response_sum(
+        const body_t *body, const static_response_t *response, size_t begin,
+        size_t end
+    )
+    {
+        // Segments are usually MSS-sized and MSS-aligned, except for the last
+        // segment of the response, which can be shorter.
+
+        size_t size = end - begin;
+
+        // The responses of streamed bodies have no precomputed segment.
+        if (UNLIKELY(response->segment_sums[0] == nullptr))
+            return _compute_response_sum(body, response, begin, end);
+
+        for (size_t i = 0; i < N_SEGMENT_SIZES; i++) {
+            size_t seg_size = SEGMENT_SIZES[i];
+
+            if (
+                   begin % seg_size == 0
+                && (    size == seg_size
+                     || (end == response->len && size < seg_size))
+            )
+                return response->segment_sums[i][begin / seg_size];
+        }
+
+        return _compute_response_sum(body, response, begin, end);
+    }
+
+    template <typename body_t>
+    static inline partial_sum_t content_sum(
+        const body_t *body, size_t begin, size_t end
+    )
+    {
+        if (UNLIKELY(body->streamed))
+            return partial_sum_t(body->content + begin, end - begin);
+
+        body->precomputed_sums.prefetch(begin, end);
+        return body->precomputed_sums.sum(begin, end);
+    }
+#endif /* USE_PRECOMPUTED_CHECKSUMS */
+
+template <typename body_t>
+static inline void readahead(const body_t *body, size_t begin, size_t end)
+{
+    if (LIKELY(!body->streamed))
+        return;
+
+    // First window boundary in [begin, end[, if any.
+    size_t boundary =   (begin + STREAM_READAHEAD - 1) / STREAM_READAHEAD
+                      * STREAM_READAHEAD;
+
+    if (boundary >= end)
+        return;
+
+    size_t ahead = boundary + STREAM_READAHEAD;
+
+    if (ahead < body->content_len) {
+        madvise(
+            (void *) (body->content + ahead),
+            min(STREAM_READAHEAD, body->content_len - ahead), MADV_WILLNEED
+        );
+    }
+}
+
+#ifdef USE_PRECOMPUTED_CHECKSUMS
+    template <typename body_t>
+    static partial_sum_t _compute_response_sum(
+        const body_t *body, const static_response_t *response, size_t begin,
+        size_t end
+    )
+    {
+        partial_sum_t sum = partial_sum_t::ZERO;
+
+        size_t header_len = response->header_len;
+
+        if (begin < header_len) {
+            size_t header_end = min(end, header_len);
+            sum = partial_sum_t(response->header + begin, header_end - begin);
+        }
+
+        if (end > header_len) {
+            size_t content_begin = max(begin, header_len) - header_len;
+            sum = sum.append(
+                content_sum(body, content_begin, end - header_len)
+            );
+        }
+
+        return sum;
+    }
+#endif /* USE_PRECOMPUTED_CHECKSUMS */
+
+} } /* namespace rusty::http */
+
+#endif /* __RUSTY_HTTP_STATIC_RESPONSE_HPP__ */
@@ -306,12 +306,14 @@ struct arp_t {
 
                 _cache_update(msg->sha, msg->spa);
 
-                if (msg->tpa == this->proto->addr) {
+                if (this->proto->is_local_addr(msg->tpa)) {
                     // Someone is asking for our Ethernet address.
-                    // Sends an ARP reply with our protocol address to the host
-                    // which sent the request.
+                    // Sends an ARP reply with the requested protocol address
+                    // to the host which sent the request.
 
-                    send_message(ARPOP_REPLY_NET, msg->sha, msg->spa);
+                    send_message(
+                        ARPOP_REPLY_NET, msg->sha, msg->spa, msg->tpa
+                    );
                 }
             } else if (msg->hdr.op == ARPOP_REPLY_NET) {
                 ARP_DEBUG(
@@ -329,9 +331,20 @@ struct arp_t {
     }
 
     // Creates and push an ARP message to the data-link layer (L2).
+    //
+    // 'spa' is the local protocol address which will be advertised. Uses the
+    // primary address of the protocol layer by default.
     void send_message(
         net_t<uint16_t> op, net_t<data_link_addr_t> tha, net_t<proto_addr_t> tpa
     )
+    {
+        send_message(op, tha, tpa, this->proto->addr);
+    }
+
+    void send_message(
+        net_t<uint16_t> op, net_t<data_link_addr_t> tha, net_t<proto_addr_t> tpa,
+        net_t<proto_addr_t> spa
+    )
     {
         #ifndef NDEBUG
             if (op == ARPOP_REQUEST_NET) {
@@ -353,8 +366,9 @@ struct arp_t {
         #endif
 
         this->data_link->send_arp_payload(
-            tha, sizeof (message_t), [this, op, tha, tpa](cursor_t cursor) {
-                _write_message(cursor, op, tha, tpa);
+            tha, sizeof (message_t),
+            [this, op, tha, tpa, spa](cursor_t cursor) {
+                _write_message(cursor, op, tha, tpa, spa);
             }
         );
     }
@@ -592,11 +606,11 @@ private:
     // NOTE: inline ?
     cursor_t _write_message(
         cursor_t cursor, net_t<uint16_t> op, net_t<data_link_addr_t> tha,
-        net_t<proto_addr_t> tpa
+        net_t<proto_addr_t> tpa, net_t<proto_addr_t> spa
     )
     {
         return cursor.template write_with<message_t>(
-            [this, op, tha, tpa](message_t *msg) {
+            [this, op, tha, tpa, spa](message_t *msg) {
                 msg->hdr.hrd = DATA_LINK_TYPE_NET;
                 msg->hdr.pro = PROTO_TYPE_NET;
 
@@ -606,7 +620,7 @@ private:
                 msg->hdr.op = op;
 
                 msg->sha = this->data_link->addr;
-                msg->spa = this->proto->addr;
+                msg->spa = spa;
                 msg->tha = tha;
                 msg->tpa = tpa;
             }
@@ -205,9 +205,9 @@ partial_sum_t precomputed_sums_t::sum(size_t begin, size_t end) const
     // Adds the included last byte of the first 16 bits word.
     if (end & 0x1) {
         #if __BYTE_ORDER == __LITTLE_ENDIAN
-            sum += ((const char *) this->data)[end - 1];
+            sum += ((const uint8_t *) this->data)[end - 1];
         #elif __BYTE_ORDER == __BIG_ENDIAN
-            sum += ((const char *) this->data)[end - 1] << 8;
+            sum += ((const uint8_t *) this->data)[end - 1] << 8;
         #else
             #error "Please set __BYTE_ORDER in <bits/endian.h>"
         #endif
@@ -216,9 +216,9 @@ partial_sum_t precomputed_sums_t::sum(size_t begin, size_t end) const
     // Removes the non-included first byte.
     if (begin & 0x1) {
         #if __BYTE_ORDER == __LITTLE_ENDIAN
-            sum += (uint16_t) ~((const char *) this->data)[begin - 1];
+            sum += (uint16_t) ~((const uint8_t *) this->data)[begin - 1];
         #elif __BYTE_ORDER == __BIG_ENDIAN
-            sum += (uint16_t) ~((const char *) this->data)[begin - 1] << 8;
+            sum += (uint16_t) ~((const uint8_t *) this->data)[begin - 1] << 8;
         #else
             #error "Please set __BYTE_ORDER in <bits/endian.h>"
         #endif
@@ -247,7 +247,7 @@ partial_sum_t precomputed_sums_t::sum(size_t begin, size_t end) const
 const uint16_t *
 precomputed_sums_t::_precompute_table(const void *_data, size_t _size)
 {
-    size_t size_table = _size / 2 + 1;
+    size_t size_table = table_size(_size);
 
     uint16_t *table = new uint16_t[size_table];
 
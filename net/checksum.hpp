@@ -141,6 +141,25 @@ struct precomputed_sums_t {
     {
     }
 
+    // Uses a table which has already been computed for the buffer, such as a
+    // table loaded from a file.
+    //
+    // The table must contain 'table_size(_size)' entries.
+    //
+    // Complexity: O(1).
+    precomputed_sums_t(
+        const void *_data, size_t _size, const uint16_t *_table
+    ) : data(_data), size(_size), table(_table)
+    {
+    }
+
+    // Returns the number of entries of the table of a buffer of 'data_size'
+    // bytes.
+    static inline size_t table_size(size_t data_size)
+    {
+        return data_size / 2 + 1;
+    }
+
     // Returns the partial sum of the data in the buffer which starts at 'begin'
     // (inclusive) and which stops at 'end' (excluded).
     partial_sum_t sum(size_t begin, size_t end) const;
@@ -215,7 +215,7 @@ static inline T _change_endian(T value)
     #if __BYTE_ORDER == __LITTLE_ENDIAN
         uint8_t *value_bytes = (uint8_t *) &value;
 
-        for (int i = 0; i < sizeof (T) / 2; i++) {
+        for (size_t i = 0; i < sizeof (T) / 2; i++) {
             swap<uint8_t>(
                 value_bytes[i], value_bytes[sizeof (T) - 1 - i]
             );
@@ -239,7 +239,6 @@ namespace std {
 
 using namespace rusty::net;
 
-template <>
 template <typename host_t>
 struct equal_to<net_t<host_t>> {
     inline bool operator()(const net_t<host_t>& a, const net_t<host_t>& b) const
@@ -248,7 +247,6 @@ struct equal_to<net_t<host_t>> {
     }
 };
 
-template <>
 template <typename host_t>
 struct hash<net_t<host_t>> {
     inline size_t operator()(const net_t<host_t> &value) const
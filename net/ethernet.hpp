@@ -22,6 +22,7 @@
 #define __RUSTY_NET_ETHERNET_HPP__
 
 #include <cinttypes>
+#include <cstddef>            // offsetof()
 #include <cstring>
 #include <functional>
 
@@ -117,6 +118,9 @@ struct ethernet_t {
 
     static constexpr size_t         HEADER_SIZE     = sizeof (header_t);
 
+    // Maximum number of frames given to 'receive_frames()'.
+    static constexpr size_t         MAX_BURST_SIZE  = 64;
+
     // 'arp_t' requires the following static fields:
     static constexpr uint16_t       ARP_TYPE        = ARPHRD_ETHER;
     static constexpr size_t         ADDR_LEN        = ETH_ALEN;
@@ -151,13 +155,13 @@ struct ethernet_t {
     }
 
     // Creates an Ethernet environment for the given physical layer
-    // instance, Ethernet address and IPv4 address.
+    // instance, Ethernet address and IPv4 addresses.
     //
     // Does the same thing as creating the environment with 'ethernet_t()' and
     // then calling 'init()'.
     ethernet_t(
         phys_t *_phys, timer_manager_t *_timers, net_t<addr_t> _addr,
-        net_t<typename ipv4_ethernet_t::addr_t> ipv4_addr,
+        vector<net_t<typename ipv4_ethernet_t::addr_t>> ipv4_addrs,
         vector<typename arp_ethernet_ipv4_t::static_entry_t> static_arp_entries
             = vector<typename arp_ethernet_ipv4_t::static_entry_t>(),
         alloc_t _alloc = alloc_t()
@@ -165,14 +169,16 @@ struct ethernet_t {
     {
         max_payload_size = _max_payload_size();
         arp.init(this, _timers, &ipv4, static_arp_entries);
-        ipv4.init(this, &arp, ipv4_addr, _timers);
+        ipv4.init(this, &arp, ipv4_addrs, _timers);
     }
 
     // Initializes an Ethernet environment for the given physical layer
-    // instance, Ethernet address and IPv4 address.
+    // instance, Ethernet address and IPv4 addresses.
+    //
+    // The first IPv4 address is the primary address of the instance.
     void init(
         phys_t *_phys, timer_manager_t *_timers, net_t<addr_t> _addr,
-        net_t<typename ipv4_ethernet_t::addr_t> ipv4_addr,
+        vector<net_t<typename ipv4_ethernet_t::addr_t>> ipv4_addrs,
         vector<typename arp_ethernet_ipv4_t::static_entry_t> static_arp_entries
             = vector<typename arp_ethernet_ipv4_t::static_entry_t>()
     )
@@ -181,7 +187,7 @@ struct ethernet_t {
         max_payload_size = _max_payload_size();
         addr             = _addr;
         arp.init(this, _timers, &ipv4, static_arp_entries);
-        ipv4.init(this, &arp, ipv4_addr, _timers);
+        ipv4.init(this, &arp, ipv4_addrs, _timers);
     }
 
     // Processes an Ethernet frame. The cursor must begin at the Ethernet layer
@@ -238,6 +244,87 @@ struct ethernet_t {
         });
     }
 
+    // Processes a burst of at most 'MAX_BURST_SIZE' Ethernet frames.
+    //
+    // A first pass classifies the whole burst: a frame takes the fast path if
+    // it is an IPv4 frame addressed to the instance's hardware address. This
+    // pass compares the headers to the expected values with 64 bits words
+    // and doesn't branch on their content.
+    //
+    // Fast path frames are then given as a burst to the IPv4 layer. Other
+    // frames (ARP, broadcast, invalid ...) fall back to 'receive_frame()',
+    // which also reports errors. As the classification only depends on
+    // fields which are identical for all the frames of a flow, frames of the
+    // same flow keep their order.
+    //
+    // The content of the 'frames' array is undefined once the method returns.
+    //
+    // This method is typically called by the physical layer when it receives
+    // a burst of packets.
+    void receive_frames(cursor_t *frames, size_t n_frames)
+    {
+        assert(n_frames <= MAX_BURST_SIZE);
+
+        //
+        // Classification pass.
+        //
+
+        // Masks and expected values of the first 8 bytes of the header
+        // (destination and 2 bytes of the source address), in memory order.
+        uint64_t dhost_mask = 0, dhost_word = 0;
+        memset(&dhost_mask, 0xFF, sizeof (addr_t));
+        memcpy(&dhost_word, &this->addr, sizeof (addr_t));
+
+        uint64_t fast_mask = 0;
+
+        for (size_t i = 0; i < n_frames; i++) {
+            if (UNLIKELY(!frames[i].can_in_place(HEADER_SIZE)))
+                continue;
+
+            const char *hdr;
+            frames[i].in_place(&hdr, HEADER_SIZE);
+
+            uint64_t word;
+            uint16_t type;
+            memcpy(&word, hdr, sizeof (word));
+            memcpy(&type, hdr + offsetof(header_t, type), sizeof (type));
+
+            uint64_t diff =   ((word ^ dhost_word) & dhost_mask)
+                            | (uint16_t) (type ^ ETHERTYPE_IP_NET.net);
+
+            fast_mask |= (uint64_t) (diff == 0) << i;
+        }
+
+        //
+        // Dispatch.
+        //
+
+        // Moves fast path payloads at the beginning of the array.
+        size_t n_fast = 0;
+
+        for (size_t i = 0; i < n_frames; i++) {
+            if (LIKELY(fast_mask & ((uint64_t) 1 << i)))
+                frames[n_fast++] = frames[i].drop(HEADER_SIZE);
+            else
+                this->receive_frame(frames[i]);
+        }
+
+        if (LIKELY(n_fast > 0)) {
+            ETH_DEBUG("Receives a burst of %zu IPv4 frames", n_fast);
+            ipv4.receive_datagrams(frames, n_fast);
+        }
+    }
+
+    // Notifies the upper layers that the physical layer has processed a burst
+    // of received frames.
+    //
+    // This method is typically called by the physical layer after a call to
+    // 'receive_frame()' for each frame of the burst.
+    inline void end_receive_burst(void)
+    {
+        ipv4.end_receive_burst();
+    }
+
     // Creates an Ethernet frame with the given destination and Ethernet type,
     // and writes its payload with the given 'payload_writer'. The frame is then
     // transmitted to physical layer.
@@ -263,6 +350,42 @@ struct ethernet_t {
         });
     }
 
+    // Sends 'n_payloads' Ethernet frames with the same destination and Ethernet
+    // type as a single burst of the physical layer.
+    //
+    // Every payload is 'payload_size' bytes long, except the last one which is
+    // 'last_payload_size' bytes long. 'payload_writer' is called with the index
+    // of the frame in the burst.
+    //
+    // The header is only built once and copied in front of every frame.
+    void send_payloads(
+        net_t<addr_t> dst, net_t<uint16_t> ether_type, size_t n_payloads,
+        size_t payload_size, size_t last_payload_size,
+        function<void(size_t, cursor_t)> payload_writer
+    )
+    {
+        assert(payload_size <= max_payload_size);
+        assert(last_payload_size <= payload_size);
+
+        ETH_DEBUG(
+            "Sends %zu ethernet frames of %zu bytes to %s with type 0x%x",
+            n_payloads, HEADER_SIZE + payload_size, addr_t::to_alpha(dst),
+            ether_type.host()
+        );
+
+        header_t hdr;
+        hdr.dhost = dst;
+        hdr.shost = addr;
+        hdr.type  = ether_type;
+
+        this->phys->send_packets(
+        n_payloads, HEADER_SIZE + payload_size, HEADER_SIZE + last_payload_size,
+        [&hdr, &payload_writer](size_t i, cursor_t cursor) {
+            cursor = cursor.write(&hdr);
+            payload_writer(i, cursor);
+        });
+    }
+
     // Equivalent to 'send_payload()' with 'ether_type' equals to
     // 'ETHERTYPE_ARP_NET'.
     //
@@ -289,6 +412,20 @@ struct ethernet_t {
         send_payload(dst, ETHERTYPE_IP_NET, payload_size, payload_writer);
     }
 
+    // Equivalent to 'send_payloads()' with 'ether_type' equals to
+    // 'ETHERTYPE_IP_NET'.
+    inline void send_ip_payloads(
+        net_t<addr_t> dst, size_t n_payloads, size_t payload_size,
+        size_t last_payload_size,
+        function<void(size_t, cursor_t)> payload_writer
+    )
+    {
+        send_payloads(
+            dst, ETHERTYPE_IP_NET, n_payloads, payload_size, last_payload_size,
+            payload_writer
+        );
+    }
+
 private:
 
     // Writes the Ethernet header starting at the given buffer cursor.
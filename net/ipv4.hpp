@@ -22,8 +22,10 @@
 #define __RUSTY_NET_IPV4_HPP__
 
 #include <algorithm>            // min()
+#include <cstddef>              // offsetof()
 #include <cstring>
 #include <functional>           // equal_to, hash
+#include <unordered_set>
 #include <vector>
 
 #include <arpa/inet.h>          // inet_ntoa()
@@ -138,6 +140,14 @@ struct ipv4_t {
     // Upper layer protocol type.
     typedef tcp_t<this_t, alloc_t>                  tcp_ipv4_t;
 
+    // Types related to the 'addrs' hash set.
+    typedef typename alloc_t::template rebind<net_t<addr_t>>::other
+                                                    addrs_alloc_t;
+    typedef unordered_set<
+                net_t<addr_t>, hash<net_t<addr_t>>, equal_to<net_t<addr_t>>,
+                addrs_alloc_t
+            >                                       addrs_t;
+
     //
     // Static fields
     //
@@ -151,6 +161,10 @@ struct ipv4_t {
     // Header size in 32 bit words.
     static constexpr size_t     HEADER_LEN  = HEADER_SIZE / sizeof (uint32_t);
 
+    // Wildcard address (0.0.0.0). Used to bind a TCP listener to every local
+    // address.
+    static const net_t<addr_t>  ANY_ADDR;
+
     //
     // Fields
     //
@@ -162,9 +176,16 @@ struct ipv4_t {
     // Upper protocol instances
     tcp_ipv4_t                          tcp;
 
-    // Instance's IPv4 address
+    // Instance's primary IPv4 address.
+    //
+    // Used as the source address of datagrams which are not related to any
+    // local address (i.e. ARP requests).
     net_t<addr_t>                       addr;
 
+    // Set of every IPv4 address the instance answers to, including the
+    // primary address.
+    addrs_t                             addrs;
+
     // Maximum payload size. Doesn't change after intialization.
     size_t                              max_payload_size;
 
@@ -180,40 +201,57 @@ struct ipv4_t {
     // Creates an IPv4 environment without initializing it.
     //
     // One must call 'init()' before using any other method.
-    ipv4_t(alloc_t _alloc = alloc_t()) : tcp(_alloc)
+    ipv4_t(alloc_t _alloc = alloc_t())
+        : tcp(_alloc),
+          addrs(0, hash<net_t<addr_t>>(), equal_to<net_t<addr_t>>(), _alloc)
     {
     }
 
     // Creates an IPv4 environment for the given data-link layer instance and
-    // IPv4 address.
+    // IPv4 addresses.
     //
     // Does the same thing as creating the environment with 'ipv4_t()' and then
     // calling 'init()'.
     ipv4_t(
         data_link_t *_data_link, arp_t<data_link_t, this_t, alloc_t> *_arp,
-        net_t<addr_t> _addr, timer_manager_t *_timers,
+        vector<net_t<addr_t>> _addrs, timer_manager_t *_timers,
         alloc_t _alloc = alloc_t()
-    ) : data_link(_data_link), arp(_arp), addr(_addr), tcp(_alloc)
+    ) : data_link(_data_link), arp(_arp), tcp(_alloc),
+        addrs(0, hash<net_t<addr_t>>(), equal_to<net_t<addr_t>>(), _alloc)
     {
+        _set_addrs(_addrs);
+
         // TCP must be initialized after max_payload_size
         max_payload_size = this->_max_payload_size();
         tcp.init(this, _timers);
     }
 
     // Initializes an IPv4 environment for the given data-link layer instance
-    // and IPv4 address).
+    // and IPv4 addresses.
+    //
+    // The first address of '_addrs' is the primary address of the instance.
     void init(
         data_link_t *_data_link, arp_t<data_link_t, this_t, alloc_t> *_arp,
-        net_t<addr_t> _addr, timer_manager_t *_timers
+        vector<net_t<addr_t>> _addrs, timer_manager_t *_timers
     )
     {
         data_link        = _data_link;
         arp              = _arp;
-        addr             = _addr;
+        _set_addrs(_addrs);
         max_payload_size = this->_max_payload_size();
         tcp.init(this, _timers);
     }
 
+    // Returns 'true' if the given address is one of the instance's addresses.
+    inline bool is_local_addr(net_t<addr_t> _addr) const
+    {
+        // Most instances only have a single address.
+        if (LIKELY(_addr == this->addr))
+            return true;
+
+        return this->addrs.find(_addr) != this->addrs.end();
+    }
+
     // Processes an IPv4 datagram wich starts at the given cursor (data-link
     // layer payload without headers).
     void receive_datagram(cursor_t cursor)
@@ -274,7 +312,7 @@ struct ipv4_t {
             ))
                 IGNORE_DATAGRAM("fragmented datagrams are not supported");
 
-            if (UNLIKELY(hdr->daddr != addr))
+            if (UNLIKELY(!this->is_local_addr(hdr->daddr)))
                 IGNORE_DATAGRAM("bad recipient");
 
             if (UNLIKELY(!checksum_t(hdr, HEADER_SIZE).is_valid()))
@@ -292,7 +330,7 @@ struct ipv4_t {
                     "Receives an IPv4 datagram from %s",
                     addr_t::to_alpha(hdr->saddr)
                 );
-                this->tcp.receive_segment(hdr->saddr, payload);
+                this->tcp.receive_segment(hdr->saddr, hdr->daddr, payload);
             } else {
                 IGNORE_DATAGRAM(
                     "unknown IPv4 protocol (%u)", (unsigned int) hdr->protocol
@@ -303,6 +341,142 @@ struct ipv4_t {
         });
     }
 
+    // Processes a burst of at most 64 IPv4 datagrams (data-link layer payloads
+    // without headers).
+    //
+    // A first pass classifies the whole burst: a datagram takes the fast path
+    // if it is an unfragmented IPv4 datagram without options, addressed to one
+    // of the local addresses, with a valid header checksum, a consistent total
+    // length, and a TCP segment whose header length fits in the datagram. This
+    // pass compares the headers to the expected values with 64 bits words and
+    // doesn't branch on their content, except to look up the secondary
+    // addresses when the datagram is not addressed to the primary one.
+    //
+    // Fast path segments are directly given to the TCP layer. Other datagrams
+    // fall back to 'receive_datagram()', which also reports errors.
+    //
+    // The content of the 'datagrams' array is undefined once the method
+    // returns.
+    void receive_datagrams(cursor_t *datagrams, size_t n_datagrams)
+    {
+        static constexpr size_t TCP_HEADER_SIZE = tcp_ipv4_t::HEADER_SIZE;
+        static constexpr size_t MIN_SIZE        = HEADER_SIZE + TCP_HEADER_SIZE;
+
+        assert(n_datagrams <= 64);
+
+        //
+        // Classification pass.
+        //
+
+        // Masks and expected values of the two first 64 bits words of the
+        // header, in memory order.
+        //
+        // The first word contains the version, the header length, the total
+        // length and the fragment offset. The second word contains the
+        // protocol and the source address.
+
+        static const uint8_t MASK_0[8]  = { 0xFF, 0, 0, 0, 0, 0, 0x3F, 0xFF };
+        static const uint8_t VALUE_0[8] = {
+            (IPVERSION << 4) | HEADER_LEN, 0, 0, 0, 0, 0, 0, 0
+        };
+        static const uint8_t MASK_1[8]  = { 0, 0xFF, 0, 0, 0, 0, 0, 0 };
+        static const uint8_t VALUE_1[8] = { 0, IPPROTO_TCP, 0, 0, 0, 0, 0, 0 };
+
+        uint64_t mask_0, value_0, mask_1, value_1;
+        memcpy(&mask_0,  MASK_0,  sizeof (mask_0));
+        memcpy(&value_0, VALUE_0, sizeof (value_0));
+        memcpy(&mask_1,  MASK_1,  sizeof (mask_1));
+        memcpy(&value_1, VALUE_1, sizeof (value_1));
+
+        uint64_t fast_mask = 0;
+
+        for (size_t i = 0; i < n_datagrams; i++) {
+            size_t size = datagrams[i].size();
+
+            if (UNLIKELY(!datagrams[i].can_in_place(MIN_SIZE)))
+                continue;
+
+            const char *hdr;
+            datagrams[i].in_place(&hdr, MIN_SIZE);
+
+            uint64_t word_0, word_1;
+            uint32_t daddr;
+            memcpy(&word_0, hdr,     sizeof (word_0));
+            memcpy(&word_1, hdr + 8, sizeof (word_1));
+            memcpy(&daddr,  hdr + offsetof(header_t, daddr), sizeof (daddr));
+
+            uint64_t diff =   ((word_0 ^ value_0) & mask_0)
+                            | ((word_1 ^ value_1) & mask_1);
+
+            const header_t *ip_hdr = (const header_t *) hdr;
+
+            // Most instances only have a single address.
+            bool is_local =    daddr == this->addr.net.value
+                            || (   this->addrs.size() > 1
+                                && this->is_local_addr(ip_hdr->daddr));
+
+            // Total length.
+            size_t total_size = ip_hdr->tot_len.host();
+            bool valid_size = total_size >= MIN_SIZE && total_size <= size;
+
+            // Ones' complement sum of the five 32 bits words of the header.
+            // A valid header sums to 0xFFFF.
+            uint32_t words[HEADER_LEN];
+            memcpy(words, hdr, HEADER_SIZE);
+
+            uint64_t sum = 0;
+            for (size_t j = 0; j < HEADER_LEN; j++)
+                sum += words[j];
+            sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+            sum = (sum & 0xFFFF) + (sum >> 16);
+            sum = (sum & 0xFFFF) + (sum >> 16);
+            sum = (sum & 0xFFFF) + (sum >> 16);
+
+            // TCP data offset (in the 4 high bits of the 13th byte). The
+            // header and its options must fit in the IPv4 payload. Meaningless
+            // if the total length is invalid.
+            uint8_t doff_byte = (uint8_t) hdr[HEADER_SIZE + 12];
+            size_t tcp_header_size = (doff_byte >> 4) * sizeof (uint32_t);
+            bool valid_doff =    tcp_header_size >= TCP_HEADER_SIZE
+                              && tcp_header_size <= total_size - HEADER_SIZE;
+
+            bool is_fast = (diff == 0) & is_local & valid_size
+                           & (sum == 0xFFFF) & valid_doff;
+
+            fast_mask |= (uint64_t) is_fast << i;
+        }
+
+        //
+        // Dispatch.
+        //
+
+        for (size_t i = 0; i < n_datagrams; i++) {
+            if (LIKELY(fast_mask & ((uint64_t) 1 << i))) {
+                datagrams[i].template read_with<header_t, void>(
+                [this](const header_t *hdr, cursor_t payload) {
+                    IPV4_DEBUG(
+                        "Receives an IPv4 datagram from %s",
+                        addr_t::to_alpha(hdr->saddr)
+                    );
+
+                    // The Ethernet frame could contain a small padding at its
+                    // end.
+                    payload = payload.take(hdr->tot_len.host() - HEADER_SIZE);
+
+                    this->tcp.receive_segment(hdr->saddr, hdr->daddr, payload);
+                });
+            } else
+                this->receive_datagram(datagrams[i]);
+        }
+    }
+
+    // Notifies the upper layers that the data-link layer has processed a burst
+    // of received datagrams.
+    inline void end_receive_burst(void)
+    {
+        tcp.end_receive_burst();
+    }
+
     // Creates and push an IPv4 datagram with its payload to the daya-link layer
     // (L2).
     //
@@ -311,16 +485,19 @@ struct ipv4_t {
     // corresponding data-link address. One should take care of not using memory
     // which could be deallocated before the 'payload_writer' execution.
     //
+    // 'src' must be one of the local addresses.
+    //
     // Returns 'true' if the 'payload_writer' execution has not been delayed.
     bool send_payload(
-        net_t<addr_t> dst, uint8_t protocol,
+        net_t<addr_t> src, net_t<addr_t> dst, uint8_t protocol,
         size_t payload_size, function<void(cursor_t)> payload_writer
     )
     {
         assert(payload_size >= 0 && payload_size <= max_payload_size);
+        assert(this->is_local_addr(src));
 
         return this->arp->with_data_link_addr(
-        dst, [this, dst, protocol, payload_size, payload_writer](
+        dst, [this, src, dst, protocol, payload_size, payload_writer](
             const net_t<data_link_addr_t> *data_link_dst
         ) {
             if (data_link_dst == nullptr) {
@@ -341,10 +518,11 @@ struct ipv4_t {
 
             this->data_link->send_ip_payload(
             *data_link_dst, datagram_size,
-            [this, dst, payload_writer, protocol, datagram_size, datagram_id]
+            [this, src, dst, payload_writer, protocol, datagram_size,
+             datagram_id]
             (cursor_t cursor) {
                 cursor = _write_header(
-                    cursor, datagram_size, datagram_id, protocol, dst
+                    cursor, datagram_size, datagram_id, protocol, src, dst
                 );
                 payload_writer(cursor);
             });
@@ -356,11 +534,106 @@ struct ipv4_t {
     // This method is typically called by the TCP instance when it wants to
     // send a TCP segment.
     inline void send_tcp_payload(
-        net_t<addr_t> dst, size_t payload_size,
+        net_t<addr_t> src, net_t<addr_t> dst, size_t payload_size,
         function<void(cursor_t)> payload_writer
     )
     {
-        send_payload(dst, IPPROTO_TCP, payload_size, payload_writer);
+        send_payload(src, dst, IPPROTO_TCP, payload_size, payload_writer);
+    }
+
+    // Sends 'n_payloads' datagrams with the same source, destination and
+    // protocol as a single burst of the data-link layer.
+    //
+    // Every payload is 'payload_size' bytes long, except the last one which is
+    // 'last_payload_size' bytes long. 'payload_writer' is called with the index
+    // of the datagram in the burst.
+    //
+    // The destination address is only resolved once. Headers are copied from a
+    // template whose sum is precomputed: only the identification field changes
+    // between two datagrams, and its sum is added to the template's sum to get
+    // the header checksum.
+    //
+    // Same delayed execution rules as 'send_payload()'.
+    bool send_payloads(
+        net_t<addr_t> src, net_t<addr_t> dst, uint8_t protocol,
+        size_t n_payloads, size_t payload_size, size_t last_payload_size,
+        function<void(size_t, cursor_t)> payload_writer
+    )
+    {
+        assert(n_payloads > 0);
+        assert(payload_size <= max_payload_size);
+        assert(last_payload_size <= payload_size);
+        assert(this->is_local_addr(src));
+
+        return this->arp->with_data_link_addr(
+        dst, [this, src, dst, protocol, n_payloads, payload_size,
+              last_payload_size, payload_writer](
+            const net_t<data_link_addr_t> *data_link_dst
+        ) {
+            if (data_link_dst == nullptr) {
+                IPV4_ERROR("Unreachable address: %s", addr_t::to_alpha(dst));
+                return;
+            }
+
+            size_t datagram_size      = HEADER_SIZE + payload_size,
+                   last_datagram_size = HEADER_SIZE + last_payload_size;
+
+            IPV4_DEBUG(
+                "Sends %zu IPv4 datagrams of %zu bytes to %s with protocol "
+                "%" PRIu16, n_payloads, datagram_size, addr_t::to_alpha(dst),
+                protocol
+            );
+
+            // lock
+            uint16_t first_datagram_id = current_datagram_id;
+            current_datagram_id += n_payloads;
+            // unlock
+
+            header_t hdr;
+            _init_header(&hdr, datagram_size, 0, protocol, src, dst);
+            partial_sum_t hdr_sum = partial_sum_t(&hdr, HEADER_SIZE);
+
+            header_t last_hdr = hdr;
+            last_hdr.tot_len = last_datagram_size;
+            partial_sum_t last_hdr_sum = partial_sum_t(&last_hdr, HEADER_SIZE);
+
+            this->data_link->send_ip_payloads(
+            *data_link_dst, n_payloads, datagram_size, last_datagram_size,
+            [n_payloads, &payload_writer, first_datagram_id, &hdr, hdr_sum,
+             &last_hdr, last_hdr_sum]
+            (size_t i, cursor_t cursor) {
+                bool is_last = i + 1 == n_payloads;
+
+                cursor = cursor.template write_with<header_t>(
+                [&](header_t *out) {
+                    *out = is_last ? last_hdr : hdr;
+                    out->id = first_datagram_id + (uint16_t) i;
+
+                    partial_sum_t id_sum(&out->id, sizeof (out->id));
+                    out->check = checksum_t(
+                        (is_last ? last_hdr_sum : hdr_sum).append(id_sum)
+                    );
+                });
+
+                payload_writer(i, cursor);
+            });
+        });
+    }
+
+    // Equivalent to 'send_payloads()' with 'protocol' equals to 'IPPROTO_TCP'.
+    //
+    // This method is typically called by the TCP instance when it wants to
+    // send a run of TCP segments.
+    inline void send_tcp_payloads(
+        net_t<addr_t> src, net_t<addr_t> dst, size_t n_payloads,
+        size_t payload_size, size_t last_payload_size,
+        function<void(size_t, cursor_t)> payload_writer
+    )
+    {
+        send_payloads(
+            src, dst, IPPROTO_TCP, n_payloads, payload_size, last_payload_size,
+            payload_writer
+        );
     }
 
     //
@@ -409,29 +682,48 @@ private:
     // Writes the IPv4 header starting at the given buffer cursor.
     cursor_t _write_header(
         cursor_t cursor, size_t datagram_size, uint16_t datagram_id,
-        uint8_t protocol, net_t<addr_t> dst
+        uint8_t protocol, net_t<addr_t> src, net_t<addr_t> dst
     )
     {
-        static const net_t<uint16_t> FRAG_OFF_NET = IP_DF; // Don't fragment.
-
         return cursor.template write_with<header_t>(
-        [this, datagram_size, datagram_id, protocol, dst](header_t *hdr) {
-            hdr->version  = IPVERSION;
-            hdr->ihl      = HEADER_LEN;
-            hdr->tos      = IPTOS_CLASS_DEFAULT;
-            hdr->tot_len  = datagram_size;
-            hdr->id       = datagram_id;
-            hdr->frag_off = FRAG_OFF_NET;
-            hdr->ttl      = IPDEFTTL;
-            hdr->protocol = protocol;
-            hdr->check    = checksum_t::ZERO;
-            hdr->saddr    = this->addr;
-            hdr->daddr    = dst;
-
-            hdr->check    = checksum_t(hdr, HEADER_SIZE);
+        [datagram_size, datagram_id, protocol, src, dst](header_t *hdr) {
+            _init_header(hdr, datagram_size, datagram_id, protocol, src, dst);
+            hdr->check = checksum_t(hdr, HEADER_SIZE);
         });
     }
 
+    // Initializes every field of the IPv4 header, with a zero checksum.
+    static inline void _init_header(
+        header_t *hdr, size_t datagram_size, uint16_t datagram_id,
+        uint8_t protocol, net_t<addr_t> src, net_t<addr_t> dst
+    )
+    {
+        static const net_t<uint16_t> FRAG_OFF_NET = IP_DF; // Don't fragment.
+
+        hdr->version  = IPVERSION;
+        hdr->ihl      = HEADER_LEN;
+        hdr->tos      = IPTOS_CLASS_DEFAULT;
+        hdr->tot_len  = datagram_size;
+        hdr->id       = datagram_id;
+        hdr->frag_off = FRAG_OFF_NET;
+        hdr->ttl      = IPDEFTTL;
+        hdr->protocol = protocol;
+        hdr->check    = checksum_t::ZERO;
+        hdr->saddr    = src;
+        hdr->daddr    = dst;
+    }
+
+    // Sets the primary address and the set of local addresses.
+    void _set_addrs(const vector<net_t<addr_t>> &_addrs)
+    {
+        assert(!_addrs.empty());
+
+        this->addr = _addrs[0];
+
+        this->addrs.clear();
+        this->addrs.insert(_addrs.begin(), _addrs.end());
+    }
+
     size_t _max_payload_size(void)
     {
         // IPv4 datagrams can't be larger than 65,535 bytes.
@@ -440,6 +732,10 @@ private:
     }
 };
 
+template <typename data_link_t, typename alloc_t>
+const net_t<typename ipv4_t<data_link_t, alloc_t>::addr_t>
+ipv4_t<data_link_t, alloc_t>::ANY_ADDR = { { INADDR_ANY } };
+
 #undef IPV4_COLOR
 #undef IPV4_DEBUG
 #undef IPV4_ERROR
@@ -33,6 +33,7 @@
 #include <tuple>
 #include <unordered_map>
 #include <utility>                  // pair, swap()
+#include <vector>
 
 #include <netinet/tcp.h>            // TCPOPT_EOL, TCPOPT_NOP, TCPOPT_MAXSEG
 
@@ -56,13 +57,13 @@ namespace net {
 // Each TCP connection is uniquely identified by the 4-tuple (remote address,
 // remote port, local address, local port).
 //
-// But as the destination address is unique for a TCP instance, each TCP Control
-// Block can be uniquely identified using the 3-tuple (remote address,
-// remote port, local port).
+// The local address is required as a TCP instance could answer to several
+// network addresses.
 template <typename addr_t, typename port_t>
 struct tcp_tcb_id_t {
     net_t<addr_t>   raddr;                      // Remote address
     net_t<port_t>   rport;                      // Remote port
+    net_t<addr_t>   laddr;                      // Local address
     net_t<port_t>   lport;                      // Local port
 
     friend inline bool operator==(
@@ -70,7 +71,8 @@ struct tcp_tcb_id_t {
         tcp_tcb_id_t<addr_t, port_t> b
     )
     {
-        return a.raddr == b.raddr && a.rport == b.rport && a.lport == b.lport;
+        return    a.raddr == b.raddr && a.rport == b.rport
+               && a.laddr == b.laddr && a.lport == b.lport;
     }
 
     friend inline bool operator!=(
@@ -82,6 +84,32 @@ struct tcp_tcb_id_t {
     }
 };
 
+// Identifies a port in the LISTEN state.
+//
+// The local address is the network layer wildcard address (i.e. 0.0.0.0 for
+// IPv4) when the port listens on every local address.
+template <typename addr_t, typename port_t>
+struct tcp_listen_id_t {
+    net_t<addr_t>   laddr;                      // Local address
+    net_t<port_t>   lport;                      // Local port
+
+    friend inline bool operator==(
+        tcp_listen_id_t<addr_t, port_t> a,
+        tcp_listen_id_t<addr_t, port_t> b
+    )
+    {
+        return a.laddr == b.laddr && a.lport == b.lport;
+    }
+
+    friend inline bool operator!=(
+        tcp_listen_id_t<addr_t, port_t> a,
+        tcp_listen_id_t<addr_t, port_t> b
+    )
+    {
+        return !(a == b);
+    }
+};
+
 // TCP transport layer able to process segment from and to the specified network
 // 'network_var_t' layer.
 template <typename network_var_t, typename alloc_t = allocator<char *>>
@@ -291,6 +319,9 @@ struct tcp_t {
     // Uniquely identifies a TCP Control Block.
     typedef tcp_tcb_id_t<addr_t, port_t>                tcb_id_t;
 
+    // Uniquely identifies a listening port.
+    typedef tcp_listen_id_t<addr_t, port_t>             listen_id_t;
+
     // Function given to 'conn_t::send()' which writes data into a transmission
     // buffer.
     //
@@ -323,6 +354,13 @@ struct tcp_t {
             return tcp_instance->_can_send(tcb_id);
         }
 
+        // Returns 'true' once the three-way handshake of the connection has
+        // been completed.
+        inline bool is_established(void)
+        {
+            return tcp_instance->_is_established(tcb_id);
+        }
+
         // Sends data to the remote TCP instance.
         //
         // The user must provides two function, one which will be called to
@@ -383,14 +421,18 @@ struct tcp_t {
     // The function is given the identifier of the new established connection.
     typedef function<conn_handlers_t(conn_t)>           new_conn_callback_t;
 
+    // Callback called on SYN/ACK segments which don't belong to any
+    // connection (see 'tcp_t::stray_syn_ack').
+    typedef function<void(tcb_id_t)>                    stray_callback_t;
+
     // Types related to the 'listens' hash table.
-    typedef pair<const net_t<port_t>, new_conn_callback_t>
+    typedef pair<const listen_id_t, new_conn_callback_t>
                                                         listens_pair_t;
     typedef typename alloc_t::template rebind<listens_pair_t>::other
                                                         listens_alloc_t;
     typedef unordered_map<
-                net_t<port_t>, new_conn_callback_t,
-                hash<net_t<port_t>>, equal_to<net_t<port_t>>,
+                listen_id_t, new_conn_callback_t,
+                hash<listen_id_t>, equal_to<listen_id_t>,
                 listens_alloc_t
             >                                           listens_t;
 
@@ -537,10 +579,24 @@ struct tcp_t {
                                 // This is the value is the minimum of the
                                 // received MSS option and the MSS allowed by
                                 // the driver.
+                                //
+                                // Remotes which don't support jumbo frames
+                                // advertise a smaller MSS and will thus only
+                                // receive standard sized frames.
 
             // Currently received duplicate ACKs segments.
             int         dupacks = 0;
 
+            // Set while retransmitting the data which was in flight when the
+            // last retransmission started, i.e. until 'recover' is
+            // acknowledged.
+            //
+            // An ACK which acknowledges new data before 'recover' is a partial
+            // ACK: the segment following the retransmitted one has been lost
+            // too (RFC 6582 page 6).
+            bool        in_recovery = false;
+            seq_t       recover;
+
             // Initializes 'rwnd', 'wl1', 'wl2', 'cwnd', 'size' and 'mss' from a
             // received SYN segment (with 'irs' being the Initial Received
             // Sequence number).
@@ -612,22 +668,36 @@ struct tcp_t {
             // if 'wl1 < seq || (wl1 == seq && wl2 <= ack)' (this prevents old
             // segments to update the window).
             //
-            // Returns 'true' if the window has been updated.
+            // Returns 'true' if the window size has been changed. A segment
+            // which announces the same window again doesn't change it, and can
+            // thus be a duplicate ACK (RFC 5681 page 4).
             bool update_rwnd(
                 seq_t seq, seq_t ack, win_size_t received_size
             )
             {
                 if (wl1 < seq || (wl1 == seq && wl2 <= ack)) {
+                    bool changed = rwnd != received_size;
+
                     rwnd = received_size;
                     _update_size();
                     wl1  = seq;
                     wl2  = ack;
 
-                    return true;
+                    return changed;
                 } else
                     return false;
             }
 
+            // Starts recovering from a loss, up to the currently sent data.
+            //
+            // Called when retransmitting after a timeout or a third duplicate
+            // ACK.
+            inline void start_recovery(void)
+            {
+                in_recovery = true;
+                recover     = next;
+            }
+
             // Returns 'true' if the transmission window is currently in the
             // slow start congestion control algorithm.
             //
@@ -658,19 +728,25 @@ struct tcp_t {
 
             void update_cwnd(size_t bytes_acked)
             {
+                size_t increment;
+
                 if (in_slow_start()) {
                     // Increases the congestion window by the number of bytes
                     // acked, as stated in RFC 5681 page 6.
-                    cwnd += min(bytes_acked, (size_t) mss);
+                    increment = min(bytes_acked, (size_t) mss);
                 } else { // In congestion avoidance.
                     // Increases the congestion window by one sender MSS per RTT
                     // using the approximation equation specified in RFC 5681
                     // page 7.
-                    cwnd += max(
+                    increment = max(
                         size_t(1), ((size_t) mss * (size_t) mss) / cwnd
                     );
                 }
 
+                // With jumbo frames, a few segments are enough to overflow the
+                // 16 bits window.
+                cwnd = min((size_t) cwnd + increment, (size_t) UINT16_MAX);
+
                 _update_size();
             }
 
@@ -697,7 +773,9 @@ struct tcp_t {
             // Recomputes 'size' from 'rwnd', 'cwnd' and 'dupacks'.
             inline void _update_size(void)
             {
-                size = min(rwnd, (win_size_t) (cwnd + dupacks * mss));
+                size = (win_size_t) min(
+                    (size_t) rwnd, (size_t) cwnd + (size_t) dupacks * mss
+                );
             }
         } tx_window;
 
@@ -792,8 +870,8 @@ struct tcp_t {
         // estimating the round trip time to the remote TCP.
         struct rtt_t {
             // Factor stated by RFC 6298 page 3.
-            static constexpr double ALPHA   = 1 / 8;
-            static constexpr double BETA    = 1 / 4;
+            static constexpr double ALPHA   = 1.0 / 8;
+            static constexpr double BETA    = 1.0 / 4;
 
             // Retranmission TimeOut. Based on the RTT.
             typename clock_t::interval_t        rto;
@@ -828,9 +906,14 @@ struct tcp_t {
                     // Measured RTT.
                     typename clock_t::interval_t rtt = now - entry->tx_time;
 
+                    // The entry is freed by 'pop_front()'.
+                    bool retransmitted = entry->retransmitted;
+
                     tcb->tx_history.pop_front();
 
-                    if (!entry->retransmitted)
+                    // Karn's algorithm: the ACK of a retransmitted segment
+                    // can't tell which transmission it acknowledges.
+                    if (retransmitted)
                         continue;
 
                     if (first) {
@@ -840,13 +923,16 @@ struct tcp_t {
                         first   = false;
                     } else {
                         // Subsequent measurements.
-                        rttvar  = rttvar * (1 - BETA) + (srtt - rtt) * BETA;
+                        typename clock_t::interval_t delta =
+                            rtt < srtt ? srtt - rtt : rtt - srtt;
+
+                        rttvar  = rttvar * (1 - BETA) + delta * BETA;
                         srtt    = srtt * (1 - ALPHA) + rtt * ALPHA;
                     }
 
                     // RTO can not be less than one second.
                     static const typename clock_t::interval_t ONE_SEC(1000000);
-                    rto = min(ONE_SEC, srtt + rttvar * 4);
+                    rto = max(ONE_SEC, srtt + rttvar * 4);
                 }
             }
         } rtt;
@@ -859,13 +945,18 @@ struct tcp_t {
         timer_id_t                              timer;
         bool                                    has_timer;
 
+        // Number of times the SYN (SYN-SENT) or the SYN/ACK (SYN-RECEIVED)
+        // segment has been retransmitted.
+        size_t                                  n_syn_retransmits;
+
         // Functions provided by the application layer to manage connection
         // events.
         conn_handlers_t                         conn_handlers;
 
         tcb_t(alloc_t _alloc = alloc_t())
             : out_of_order(_alloc), tx_queue_sent_unack(_alloc),
-              tx_queue_not_sent(_alloc), tx_history(_alloc)
+              tx_queue_not_sent(_alloc), tx_history(_alloc), has_timer(false),
+              n_syn_retransmits(0)
         {
         }
 
@@ -899,6 +990,63 @@ struct tcp_t {
                 hash<tcb_id_t>, equal_to<tcb_id_t>,
                 tcbs_alloc_t
             >                                           tcbs_t;
+
+    #ifdef TCP_RECEIVE_COALESCING
+        // Segment received during the current receive burst, waiting for the
+        // end of the burst to be processed (see 'end_receive_burst()').
+        //
+        // Contiguous data segments of a same connection are merged into the
+        // first segment of the run (the "head"), which is then processed as
+        // a single segment.
+        struct pending_seg_t {
+            tcb_id_t    tcb_id;
+
+            // Copy of the received header. The header of the head of a run
+            // gets the window and the PSH flag of the last merged segment.
+            header_t    hdr;
+
+            options_t   options;
+
+            // Options of the segment as received, which the options of a
+            // segment must repeat to be merged into the run.
+            cursor_t    raw_options;
+
+            cursor_t    payload;
+
+            // Index of the head of the run the segment belongs to. Is the
+            // index of the segment itself if the segment is a head.
+            size_t      head;
+
+            // Index of the next segment of the run. Undefined for the last
+            // segment of the run.
+            size_t      next;
+
+            // Fields only relevant for heads.
+
+            size_t      last;           // Index of the last segment of the run.
+            size_t      n_segs;         // Number of segments in the run.
+            size_t      payload_size;   // Total payload size of the run.
+
+            // 'false' if no other segment can be merged into the run.
+            bool        can_extend;
+
+            pending_seg_t(
+                tcb_id_t _tcb_id, const header_t *_hdr, options_t _options,
+                cursor_t _raw_options, cursor_t _payload, size_t _head,
+                bool _can_extend
+            ) : tcb_id(_tcb_id), hdr(*_hdr), options(_options),
+                raw_options(_raw_options), payload(_payload), head(_head),
+                last(_head), n_segs(1), payload_size(_payload.size()),
+                can_extend(_can_extend)
+            {
+            }
+        };
+
+        typedef typename alloc_t::template rebind<pending_seg_t>::other
+                                                        pending_segs_alloc_t;
+        typedef vector<pending_seg_t, pending_segs_alloc_t>
+                                                        pending_segs_t;
+    #endif /* TCP_RECEIVE_COALESCING */
     //
     // Static fields
     //
@@ -919,11 +1067,33 @@ struct tcp_t {
     // Maximum number of out of order segments which will be retained before
     // starting to drop them.
     //
+    // Segments following a loss are only retransmitted one by one (see
+    // 'in_recovery'), so the segments received after the hole must be kept
+    // until it is filled. A window of 64 KB holds at most 44 standard frames.
+    //
     // NOTE: current implementation is not efficient (quadradic against the
-    // number of out of order segments), but shouldn't be an issue as storing a
-    // large a number of out of order segments is not appealing (Linux use 3 as
-    // default value).
-    static constexpr size_t                     MAX_OUT_OF_ORDER_SEGS = 3;
+    // number of out of order segments), but segments are only stored after a
+    // loss.
+    static constexpr size_t                     MAX_OUT_OF_ORDER_SEGS = 64;
+
+    // Number of retransmissions of the SYN or SYN/ACK segment after which the
+    // connection is reset.
+    //
+    // As the RTO doubles after each retransmission, a connection is given up
+    // after 31 seconds without an answer.
+    static constexpr size_t                     MAX_SYN_RETRANSMITS = 4;
+
+    // Maximum number of bytes of an entry of the transmission queue.
+    //
+    // Sequence numbers can only be compared when they are less than 2^31
+    // apart. Larger data is queued as several entries.
+    static constexpr size_t                     MAX_TX_ENTRY_SIZE = 1 << 30;
+
+    #ifdef TCP_RECEIVE_COALESCING
+        // Maximum number of received segments which can be merged into a
+        // single segment.
+        static constexpr size_t                 MAX_COALESCED_SEGS = 16;
+    #endif /* TCP_RECEIVE_COALESCING */
 
     //
     // Fields
@@ -939,15 +1109,35 @@ struct tcp_t {
     // Ports which are in the LISTEN state, passively waiting for client
     // connections.
     //
-    // Each open port maps to a callback function provided by the application to
-    // handle new connections.
+    // Each open port, bound to a local address or to the wildcard address,
+    // maps to a callback function provided by the application to handle new
+    // connections.
     listens_t       listens;
 
     // TCP Control Blocks for active connections.
     tcbs_t          tcbs;
 
+    // Called with the identifier of the connection when a SYN/ACK segment is
+    // received for a connection which doesn't exist, before responding to it
+    // with a RST segment. Can be empty.
+    //
+    // When each worker runs its own TCP instance, this happens when the
+    // remote answers a connection opened by another worker and that the driver
+    // steers the flow to this worker.
+    stray_callback_t stray_syn_ack;
+
+    #ifdef TCP_RECEIVE_COALESCING
+        // Segments received during the current receive burst, in their
+        // arrival order.
+        pending_segs_t  pending_segs;
+    #endif /* TCP_RECEIVE_COALESCING */
+
     // Maximum segment size (TCP segment payload, without headers but with
     // options) that this TCP instance can emit.
+    //
+    // Advertised in the MSS option of SYN segments. Each connection uses the
+    // minimum of this value and of the MSS advertised by the remote (see
+    // 'tx_window_t::init_from_syn()').
     mss_t           mss;
 
     //
@@ -959,8 +1149,11 @@ struct tcp_t {
     // One must call 'init()' before using any other method.
     tcp_t(alloc_t _alloc = alloc_t())
       : alloc(_alloc),
-        listens(0, hash<net_t<port_t>>(), equal_to<net_t<port_t>>(), _alloc),
+        listens(0, hash<listen_id_t>(), equal_to<listen_id_t>(), _alloc),
         tcbs(0, hash<tcb_id_t>(), equal_to<tcb_id_t>(), _alloc)
+    #ifdef TCP_RECEIVE_COALESCING
+        , pending_segs(_alloc)
+    #endif /* TCP_RECEIVE_COALESCING */
     {
     }
 
@@ -972,8 +1165,11 @@ struct tcp_t {
         network_t *_network, timer_manager_t *_timers,
         alloc_t _alloc = alloc_t()
     ) : network(_network), timers(_timers), alloc(_alloc),
-        listens(0, hash<net_t<port_t>>(), equal_to<net_t<port_t>>(), _alloc),
+        listens(0, hash<listen_id_t>(), equal_to<listen_id_t>(), _alloc),
         tcbs(0, hash<tcb_id_t>(), equal_to<tcb_t>(), _alloc),
+    #ifdef TCP_RECEIVE_COALESCING
+        pending_segs(_alloc),
+    #endif /* TCP_RECEIVE_COALESCING */
         mss(_network->max_payload_size - HEADER_SIZE)
     {
     }
@@ -1014,11 +1210,14 @@ struct tcp_t {
             );                                                                 \
         } while (0)
 
-    // Processes a TCP segment from the given network address. The segment must
-    // start at the given cursor (network layer payload without headers).
+    // Processes a TCP segment from the given network address to the given
+    // local network address. The segment must start at the given cursor
+    // (network layer payload without headers).
     //
     // Usually called by the network layer.
-    void receive_segment(net_t<addr_t> saddr, cursor_t cursor)
+    void receive_segment(
+        net_t<addr_t> saddr, net_t<addr_t> daddr, cursor_t cursor
+    )
     {
         size_t seg_size = cursor.size();
 
@@ -1030,13 +1229,13 @@ struct tcp_t {
         // Computes the pseudo-header sum before reading the header and the
         // payload.
         partial_sum_t partial_sum = network_t::tcp_pseudo_header_sum(
-            saddr, this->network->addr, net_t<seg_size_t>(seg_size)
+            saddr, daddr, net_t<seg_size_t>(seg_size)
         );
 
         cursor.template read_with<header_t, void>(
-        [this, saddr, seg_size, &partial_sum]
+        [this, saddr, daddr, seg_size, &partial_sum]
         (const header_t *hdr, cursor_t payload) {
-            tcb_id_t tcb_id = { saddr, hdr->sport, hdr->dport };
+            tcb_id_t tcb_id = { saddr, hdr->sport, daddr, hdr->dport };
 
             //
             // Checks and processes the TCP header.
@@ -1060,6 +1259,12 @@ struct tcp_t {
             // Processes TCP options.
             //
 
+            #ifdef TCP_RECEIVE_COALESCING
+                cursor_t raw_options = payload.take(
+                    hdr->doff * sizeof (uint32_t) - HEADER_SIZE
+                );
+            #endif /* TCP_RECEIVE_COALESCING */
+
             _parse_options_status_t status;
             options_t options = _parse_options(hdr, &payload, &status);
 
@@ -1080,38 +1285,53 @@ struct tcp_t {
             // Processes the TCP message.
             //
 
-            // Processes the segment with the handler corresponding to the
-            // current state of the TCP connection.
-            //
-            // The two LISTEN and CLOSED states are handled separatly as there
-            // is no TCB for them.
+            #ifdef TCP_RECEIVE_COALESCING
+                this->_coalesce_segment(
+                    tcb_id, hdr, options, raw_options, payload
+                );
+            #else
+                this->_process_segment(tcb_id, hdr, options, payload);
+            #endif /* TCP_RECEIVE_COALESCING */
+        });
+    }
 
-            TCP_TCB_DEBUG("Segment received");
+    // Processes the segments which have been delayed by the receive coalescing
+    // stage.
+    //
+    // Must be called by the network layer once all the segments of a receive
+    // burst have been given to 'receive_segment()'.
+    void end_receive_burst(void)
+    {
+        #ifdef TCP_RECEIVE_COALESCING
+            for (size_t i = 0; i < this->pending_segs.size(); i++) {
+                const pending_seg_t *seg = &this->pending_segs[i];
 
-            auto tcb_it = this->tcbs.find(tcb_id);
+                // Merged into a previous segment.
+                if (seg->head != i)
+                    continue;
 
-            if (tcb_it == this->tcbs.end()) {
-                // No existing TCB for the connection.
+                cursor_t payload = seg->payload;
 
-                auto listen_it = this->listens.find(hdr->dport);
+                if (seg->n_segs > 1) {
+                    // Only used by TCP_TCB_DEBUG(), which could be disabled.
+                    tcb_id_t tcb_id = seg->tcb_id;
+                    (void) tcb_id;
 
-                if (LIKELY(listen_it != this->listens.end())) {
-                    this->_handle_listen_state(
-                        hdr, tcb_id, options, payload, &listen_it->second
+                    TCP_TCB_DEBUG(
+                        "%zu segments coalesced into a %zu bytes segment",
+                        seg->n_segs, seg->payload_size
                     );
-                } else
-                    this->_handle_closed_state(saddr, hdr, payload);
-            } else {
-                tcb_t *tcb = &tcb_it->second;
 
-                if (tcb->in_state(tcb_t::SYN_SENT)) {
-                    this->_handle_syn_sent_state(
-                        hdr, options, payload, tcb_id, tcb
-                    );
-                } else
-                    this->_handle_other_states(hdr, payload, tcb_id, tcb);
+                    payload = this->_coalesced_payload(i);
+                }
+
+                this->_process_segment(
+                    seg->tcb_id, &seg->hdr, seg->options, payload
+                );
             }
-        });
+
+            this->pending_segs.clear();
+        #endif /* TCP_RECEIVE_COALESCING */
     }
 
     #define TCP_TCB_STATE_CHANGE(FROM, TO)                                     \
@@ -1121,24 +1341,300 @@ struct tcp_t {
     // Server sockets.
     //
 
-    // Starts listening for TCP connections on the given port.
+    // Starts listening for TCP connections on the given port, on every local
+    // address.
     //
     // If the port was already in the listen state, replaces the previous
     // callback function.
     void listen(port_t port, new_conn_callback_t new_conn_callback)
     {
-        assert(this->listens.find(port) == this->listens.end());
+        this->listen(network_t::ANY_ADDR, port, new_conn_callback);
+    }
 
-        this->listens.emplace(port, new_conn_callback);
+    // Starts listening for TCP connections on the given local address and
+    // port.
+    //
+    // Connections to a port bound to a specific address are dispatched to its
+    // callback before the ones of the same port bound to the wildcard address.
+    void listen(
+        net_t<addr_t> laddr, port_t port, new_conn_callback_t new_conn_callback
+    )
+    {
+        assert(
+               laddr == network_t::ANY_ADDR
+            || this->network->is_local_addr(laddr)
+        );
+
+        listen_id_t listen_id = { laddr, port };
+        this->listens[listen_id] = new_conn_callback;
 
         TCP_DEBUG(
-            "State change for local port %" PRIu16 ": from CLOSED to LISTEN",
-            port
+            "State change for local port %" PRIu16 " on %s: from CLOSED to "
+            "LISTEN", port, network_t::addr_t::to_alpha(laddr)
+        );
+    }
+
+    //
+    // Client sockets.
+    //
+
+    // Opens a connection from the given local address and port to the given
+    // remote address and port (active open) by sending a SYN segment.
+    //
+    // The connection is in the SYN-SENT state when the function returns. The
+    // data given to 'send()' is queued until the connection is established.
+    // The 'reset()' handler is called if the remote refuses the connection or
+    // doesn't answer after 'MAX_SYN_RETRANSMITS' retransmissions.
+    //
+    // Returns 'false' without sending anything if the 4-tuple already
+    // identifies a connection.
+    bool connect(
+        net_t<addr_t> laddr, port_t lport, net_t<addr_t> raddr, port_t rport,
+        conn_handlers_t conn_handlers, conn_t *conn
+    )
+    {
+        assert(this->network->is_local_addr(laddr));
+
+        tcb_id_t tcb_id = { raddr, rport, laddr, lport };
+
+        auto p = this->tcbs.emplace(
+            piecewise_construct, forward_as_tuple(tcb_id),
+            forward_as_tuple(this->alloc)
         );
+
+        if (UNLIKELY(!p.second)) {
+            TCP_TCB_ERROR("Can't connect: the connection already exists");
+            return false;
+        }
+
+        TCP_TCB_STATE_CHANGE("CLOSED", "SYN-SENT");
+
+        tcb_t *tcb = &p.first->second;
+
+        seq_t iss = _get_current_tcp_seq(); // Initial Sender Sequence number.
+
+        tcb->state = tcb_t::SYN_SENT;
+
+        // The receiver window is initialized with the remote's SYN segment.
+        tcb->rx_window.size = INITIAL_WND_SIZE;
+
+        tcb->tx_window.unack = iss;
+        tcb->tx_window.next  = iss + seq_t(1);
+
+        tcb->conn_handlers = conn_handlers;
+
+        this->_send_syn_segment(tcb_id, tcb, iss);
+
+        this->_schedule_retransmission_timer(tcb_id, tcb);
+
+        *conn = { this, tcb_id };
+        return true;
     }
 
 private:
 
+    // Returns the callback of the port in the LISTEN state which matches the
+    // given local address and port, or 'nullptr' if there is no such port.
+    const new_conn_callback_t *_find_listen(
+        net_t<addr_t> laddr, net_t<port_t> lport
+    ) const
+    {
+        listen_id_t listen_id = { laddr, lport };
+        auto it = this->listens.find(listen_id);
+
+        if (it != this->listens.end())
+            return &it->second;
+
+        listen_id.laddr = network_t::ANY_ADDR;
+        it = this->listens.find(listen_id);
+
+        if (LIKELY(it != this->listens.end()))
+            return &it->second;
+        else
+            return nullptr;
+    }
+
+    // Processes a received segment whose header, checksum and options have been
+    // validated.
+    //
+    // Processes the segment with the handler corresponding to the current
+    // state of the TCP connection.
+    //
+    // The two LISTEN and CLOSED states are handled separatly as there is no
+    // TCB for them.
+    void _process_segment(
+        tcb_id_t tcb_id, const header_t *hdr, options_t options,
+        cursor_t payload
+    )
+    {
+        TCP_TCB_DEBUG("Segment received");
+
+        auto tcb_it = this->tcbs.find(tcb_id);
+
+        if (tcb_it == this->tcbs.end()) {
+            // No existing TCB for the connection.
+
+            const new_conn_callback_t *new_conn_callback =
+                this->_find_listen(tcb_id.laddr, hdr->dport);
+
+            if (LIKELY(new_conn_callback != nullptr)) {
+                this->_handle_listen_state(
+                    hdr, tcb_id, options, payload, new_conn_callback
+                );
+            } else {
+                if (
+                       hdr->flags.syn && hdr->flags.ack
+                    && this->stray_syn_ack != nullptr
+                )
+                    this->stray_syn_ack(tcb_id);
+
+                this->_handle_closed_state(tcb_id, hdr, payload);
+            }
+        } else {
+            tcb_t *tcb = &tcb_it->second;
+
+            if (tcb->in_state(tcb_t::SYN_SENT)) {
+                this->_handle_syn_sent_state(
+                    hdr, options, payload, tcb_id, tcb
+                );
+            } else
+                this->_handle_other_states(hdr, payload, tcb_id, tcb);
+        }
+    }
+
+    #ifdef TCP_RECEIVE_COALESCING
+
+    // Delays the processing of a validated segment until the end of the
+    // current receive burst.
+    //
+    // Merges the segment into the run of the previous pending segment of the
+    // same connection if both only carry data (ACK and optionally PSH), with
+    // exactly the same options (usually none, or an identical timestamp), and
+    // if the segment immediately follows the run in the sequence space with
+    // the same acknowledgment number. A PSH flag terminates the run.
+    //
+    // The checksum of each segment has already been verified, so the merged
+    // segment is not summed again.
+    void _coalesce_segment(
+        tcb_id_t tcb_id, const header_t *hdr, options_t options,
+        cursor_t raw_options, cursor_t payload
+    )
+    {
+        size_t index = this->pending_segs.size();
+
+        bool is_data =    hdr->flags.ack && !hdr->flags.syn
+                       && !hdr->flags.fin && !hdr->flags.rst
+                       && !hdr->flags.urg
+                       && options.mss == options_t::NO_MSS_OPTION
+                       && !payload.empty();
+
+        if (is_data) {
+            // Searches for the last pending segment of the connection.
+            for (size_t i = index; i-- > 0;) {
+                if (this->pending_segs[i].tcb_id != tcb_id)
+                    continue;
+
+                size_t head_index = this->pending_segs[i].head;
+                pending_seg_t *head = &this->pending_segs[head_index];
+
+                seq_t end_of_run =    head->hdr.seq.host()
+                                    + seq_t(head->payload_size);
+
+                if (
+                       head->can_extend
+                    && head->n_segs < MAX_COALESCED_SEGS
+                    && hdr->seq.host() == end_of_run
+                    && hdr->ack == head->hdr.ack
+                    && head->payload_size + payload.size() <= UINT16_MAX
+                    && _same_options(raw_options, head->raw_options)
+                ) {
+                    this->pending_segs.emplace_back(
+                        tcb_id, hdr, options, raw_options, payload, head_index,
+                        false
+                    );
+
+                    // 'emplace_back()' could have moved the segments.
+                    head = &this->pending_segs[head_index];
+
+                    this->pending_segs[head->last].next = index;
+                    head->last = index;
+                    ++head->n_segs;
+                    head->payload_size += payload.size();
+
+                    head->hdr.window = hdr->window;
+                    if (hdr->flags.psh) {
+                        head->hdr.flags.psh = 1;
+                        head->can_extend    = false;
+                    }
+
+                    return;
+                }
+
+                break;
+            }
+        }
+
+        this->pending_segs.emplace_back(
+            tcb_id, hdr, options, raw_options, payload, index,
+            is_data && !hdr->flags.psh
+        );
+    }
+
+    // Returns 'true' if both segments carry the same option bytes.
+    static bool _same_options(cursor_t a, cursor_t b)
+    {
+        if (a.size() != b.size())
+            return false;
+        else if (a.empty())
+            return true;
+
+        // Options take at most 40 bytes (a 15 words data offset).
+        char a_data[40], b_data[40];
+        assert(a.size() <= sizeof (a_data));
+
+        a.read(a_data, a.size());
+        b.read(b_data, b.size());
+
+        return memcmp(a_data, b_data, a.size()) == 0;
+    }
+
+    // Returns a cursor over the payloads of the run which starts at the given
+    // pending segment.
+    //
+    // Complexity: O(n) where 'n' is the number of segments in the run.
+    cursor_t _coalesced_payload(size_t head_index)
+    {
+        const pending_seg_t *head = &this->pending_segs[head_index];
+
+        assert(head->n_segs <= MAX_COALESCED_SEGS);
+
+        size_t indexes[MAX_COALESCED_SEGS];
+        size_t n_indexes = 0;
+
+        for (size_t i = head_index; ; i = this->pending_segs[i].next) {
+            indexes[n_indexes++] = i;
+
+            if (i == head->last)
+                break;
+        }
+
+        assert(n_indexes == head->n_segs);
+
+        // Builds the chain from its end, so each payload is only walked once.
+
+        cursor_t payload = this->pending_segs[indexes[n_indexes - 1]].payload;
+
+        for (size_t j = n_indexes - 1; j-- > 0;) {
+            payload = this->pending_segs[indexes[j]].payload.append(
+                payload, this->alloc
+            );
+        }
+
+        return payload;
+    }
+
+    #endif /* TCP_RECEIVE_COALESCING */
+
     // Vector type used in the call to '_send_data_segment()'.
     typedef vector<typename tcb_t::tx_queue_entry_t, alloc_t>   to_send_vec_t;
 
@@ -1164,6 +1660,20 @@ private:
         );
     }
 
+    // Returns 'true' once the connection left the SYN-SENT and SYN-RECEIVED
+    // states.
+    //
+    // See 'conn_t::is_established()'.
+    inline bool _is_established(tcb_id_t tcb_id)
+    {
+        auto tcb_it = this->tcbs.find(tcb_id);
+        assert(tcb_it != this->tcbs.end());
+
+        return !tcb_it->second.in_state(
+            tcb_t::SYN_SENT | tcb_t::SYN_RECEIVED
+        );
+    }
+
     // Sends data to the remote TCP instance.
     //
     // See 'conn_t::send()'.
@@ -1202,6 +1712,27 @@ private:
         if (length <= 0)
             return;
 
+        if (UNLIKELY(length > MAX_TX_ENTRY_SIZE)) {
+            // Queues the data by parts. The callback is called once the last
+            // part has been acknowledged.
+            for (size_t begin = 0; begin < length; begin += MAX_TX_ENTRY_SIZE) {
+                size_t size = min(MAX_TX_ENTRY_SIZE, length - begin);
+
+                writer_sum_t part_writer =
+                    [writer, begin](size_t offset, cursor_t out)
+                    {
+                        return writer(begin + offset, out);
+                    };
+
+                this->_send(
+                    tcb_id, size, part_writer,
+                    begin + size == length ? acked_callback : []() { }
+                );
+            }
+
+            return;
+        }
+
         // First sequence number that is outside of the transmission window.
         seq_t end_of_win = tcb->tx_window.end();
 
@@ -1212,10 +1743,16 @@ private:
         if (
                tcb->in_state(tcb_t::SYN_RECEIVED | tcb_t::SYN_SENT)
             || end_of_win <= tcb->tx_window.next
+            || !tcb->tx_queue_not_sent.empty()
         ) {
             // If not in a transmitting state, or if the transmission window has
             // no free sequence number, just en-queues the transmission of the
             // data.
+            //
+            // The queue can still hold data when the window has just been
+            // opened by an acknowledgment and the application sends from
+            // the handler of the payload of the same segment. The queued data
+            // will be sent once the segment has been processed.
 
             if (tcb->tx_queue_not_sent.empty())
                 entry.begin = tcb->tx_window.next;
@@ -1247,47 +1784,12 @@ private:
             // or not in the data to transmit.
             seq_t end_of_transmission = min(end_of_win, entry.end);
 
-            // Divides the data in TCP segments.
-            do {
-                // First sequence number that can't be send in this segment.
-                seq_t end_of_seg = min(
-                    end_of_transmission,
-                    tcb->tx_window.next + (seq_t) tcb->tx_window.mss
-                );
-
-                size_t payload_size = (end_of_seg - tcb->tx_window.next).value,
-                       offset       = (tcb->tx_window.next - entry.begin).value;
-
-                assert(payload_size <= tcb->tx_window.mss);
-                assert(payload_size <= tcb->tx_window.ready());
-
-                function<partial_sum_t(cursor_t)> payload_writer =
-                    [writer, offset](cursor_t cursor)
-                    {
-                        return writer(offset, cursor);
-                    };
-
-                TCP_TCB_DEBUG(
-                    "Sends data segment "
-                    "(<SEQ=%u><ACK=%u><CTL=ACK><%zu bytes payload>)",
-                    tcb->tx_window.next.value, tcb->rx_window.next.value,
-                    payload_size
-                );
-
-                this->_send_ack_segment(
-                    tcb_id, tcb, tcb->tx_window.next, tcb->rx_window.next,
-                    payload_writer, payload_size
-                );
-
-                // Updates the transmission windows.
-                tcb->tx_window.next += (seq_t) payload_size;
-
-                // Updates the transmission history.
-                typename tcb_t::tx_history_entry_t segment(tcb->tx_window.next);
-                tcb->tx_history.push_back(segment);
-            } while (end_of_transmission > tcb->tx_window.next);
-
-            tcb->rx_window.acked = tcb->rx_window.next;
+            // 'entry.begin' is 'tx_window.next': the offsets in the stream are
+            // the offsets in the entry.
+            this->_send_data_segments(
+                tcb_id, tcb, (end_of_transmission - tcb->tx_window.next).value,
+                false, writer
+            );
 
             if (!tcb->has_timer)
                 this->_schedule_retransmission_timer(tcb_id, tcb);
@@ -1389,7 +1891,7 @@ private:
             IGNORE_SEGMENT("RST segment received while in LISTEN state");
         } else if (UNLIKELY(hdr->flags.ack)) {
             // There is nothing to be acknowledged in the LISTEN state.
-            return this->_respond_with_rst_segment(tcb_id.raddr, hdr, payload);
+            return this->_respond_with_rst_segment(tcb_id, hdr, payload);
         } else if (LIKELY(hdr->flags.syn)) {
             // SYN segment.
             //
@@ -1487,13 +1989,10 @@ private:
                 // The segment doesn't not acknowledge something we sent,
                 // probably a segment from an older connection.
 
-                IGNORE_SEGMENT("unexpected ack number");
+                if (!hdr->flags.rst)
+                    this->_respond_with_rst_segment(tcb_id, hdr, payload);
 
-                if (!hdr->flags.rst) {
-                    return this->_respond_with_rst_segment(
-                        tcb_id.raddr, hdr, payload
-                    );
-                }
+                IGNORE_SEGMENT("unexpected ack number");
             } else if (UNLIKELY(hdr->flags.rst))
                 this->_reset_tcb(tcb_id, tcb);
             else if (LIKELY(hdr->flags.syn)) {
@@ -1507,10 +2006,17 @@ private:
                 seq_t irs = hdr->seq.host(); // Initial Receiver Sequence
                                              // number.
 
-                tcb->rx_window.next = irs + seq_t(1);
+                tcb->rx_window.next  = irs + seq_t(1);
+                tcb->rx_window.acked = irs;  // The SYN must be acknowledged.
 
+                // Our SYN has been acknowledged. Stops its retransmission timer
+                // before sending the pending data.
+
+                tcb->tx_window.unack = ack;
                 tcb->tx_window.init_from_syn(this, hdr, irs, options);
 
+                this->_unschedule_timer(tcb);
+
                 size_t payload_size = payload.size();
                 if (payload_size > 0) {
                     this->_handle_in_order_payload(
@@ -1563,13 +2069,13 @@ private:
     //
 
     void _handle_closed_state(
-        net_t<addr_t> saddr, const header_t *hdr, cursor_t payload
+        tcb_id_t tcb_id, const header_t *hdr, cursor_t payload
     )
     {
         if (LIKELY(!hdr->flags.rst)) {
             // Any RST segment received while in the CLOSED state should be
             // ignored to avoid infinite loops.
-            this->_respond_with_rst_segment(saddr, hdr, payload);
+            this->_respond_with_rst_segment(tcb_id, hdr, payload);
         }
     }
 
@@ -1607,7 +2113,7 @@ private:
 
             this->_reset_tcb(tcb_id, tcb);
 
-            return this->_respond_with_rst_segment(tcb_id.raddr, hdr, payload);
+            return this->_respond_with_rst_segment(tcb_id, hdr, payload);
         }
 
         if (UNLIKELY(!hdr->flags.ack)) {
@@ -1632,7 +2138,7 @@ private:
                 tcb->state = tcb_t::ESTABLISHED;
             } else {
                 return this->_respond_with_rst_segment(
-                    tcb_id.raddr, hdr, payload
+                    tcb_id, hdr, payload
                 );
             }
         }
@@ -1672,6 +2178,17 @@ private:
                     // been acknowledged.
                     this->_unschedule_timer(tcb);
                 }
+
+                if (tcb->tx_window.in_recovery) {
+                    if (ack < tcb->tx_window.recover) {
+                        // Partial ACK. The retransmission timer has been
+                        // restarted above. Retransmits the first unacknowledged
+                        // segment without waiting for it to expire, as
+                        // specified in RFC 6582 page 6.
+                        this->_retransmit(tcb_id, tcb);
+                    } else
+                        tcb->tx_window.in_recovery = false;
+                }
             } else if (ack > tcb->tx_window.next) {
                 // Acknowledgement of something not yet send.
                 return this->_respond_with_ack_segment(tcb_id, tcb);
@@ -1695,9 +2212,17 @@ private:
                 ) {
                     tcb->tx_window.receive_duplicate_ack();
 
-                    if (tcb->tx_window.dupacks == 3) {
+                    // The duplicate ACKs of a loss which is already being
+                    // recovered don't trigger another retransmission (RFC 6582
+                    // page 5).
+                    if (
+                           tcb->tx_window.dupacks == 3
+                        && !tcb->tx_window.in_recovery
+                    ) {
                         TCP_TCB_ERROR("Third duplicate ack");
 
+                        tcb->tx_window.start_recovery();
+
                         // Restarts the retransmission timer.
                         this->_reschedule_timer(tcb, tcb->rtt.rto);
 
@@ -1746,12 +2271,22 @@ private:
         // Processes the segment text and updates the reception window.
         //
 
+        // RFC 5681 page 10: an out of order segment is immediately acknowledged
+        // with a duplicate ACK, so the sender can detect the loss without
+        // waiting for its retransmission timer.
+        bool is_out_of_order = false;
+
         if (
             tcb->in_state(
                 tcb_t::ESTABLISHED | tcb_t::FIN_WAIT_1 | tcb_t::FIN_WAIT_2
             ) && !payload.empty()
-        )
+        ) {
+            is_out_of_order = !tcb->rx_window.contains_next(
+                seq, payload.size()
+            );
+
             this->_handle_payload(seq, payload, tcb);
+        }
 
         //
         // Processes the FIN control bit and acknowledges the received segment.
@@ -1838,10 +2373,11 @@ private:
         // Acknowledges any received data and/or the FIN control bit.
         //
         // Checks that there is still something to acknowledge (data segments
-        // contains an acknowledgement number).
+        // contains an acknowledgement number), unless the segment was out of
+        // order.
         //
 
-        if (tcb->rx_window.acked < tcb->rx_window.next)
+        if (tcb->rx_window.acked < tcb->rx_window.next || is_out_of_order)
             this->_respond_with_ack_segment(tcb_id, tcb);
     }
 
@@ -1854,13 +2390,13 @@ private:
         if (tcb->in_state(tcb_t::SYN_SENT)) {
             TCP_TCB_DEBUG("Retransmits a SYN segment");
 
-            this->_send_syn_ack_segment(
-                tcb_id, tcb, tcb->tx_window.unack, tcb->rx_window.next
-            );
+            this->_send_syn_segment(tcb_id, tcb, tcb->tx_window.unack);
         } else if (tcb->in_state(tcb_t::SYN_RECEIVED)) {
             TCP_TCB_DEBUG("Retransmits a SYN/ACK segment");
 
-            // TODO: sends a SYN segment.
+            this->_send_syn_ack_segment(
+                tcb_id, tcb, tcb->tx_window.unack, tcb->rx_window.next
+            );
         } else if (
             tcb->in_state(tcb_t::FIN_WAIT_1 | tcb_t::CLOSING | tcb_t::LAST_ACK)
             && tcb->tx_history.empty()
@@ -2076,9 +2612,22 @@ private:
 
                 TCP_TCB_DEBUG("Retransmission timeout");
 
+                if (tcb->in_state(tcb_t::SYN_SENT | tcb_t::SYN_RECEIVED)) {
+                    if (tcb->n_syn_retransmits == MAX_SYN_RETRANSMITS) {
+                        TCP_TCB_ERROR(
+                            "Connection reset: no answer to the SYN segment"
+                        );
+                        return this->_reset_tcb(tcb_id, tcb);
+                    }
+
+                    ++tcb->n_syn_retransmits;
+                }
+
                 // RFC 5681 page 5: reuses the slow start algorithm.
                 tcb->tx_window.reset_cwnd();
 
+                tcb->tx_window.start_recovery();
+
                 // RFC 6298 page 5: doubles the timeout delay after a timeout.
                 tcb->rtt.rto *= 2;
 
@@ -2248,6 +2797,22 @@ private:
     // Segment helpers
     //
 
+    // Sends a SYN segment.
+    //
+    // <SEQ=seq><CTL=SYN>
+    void _send_syn_segment(
+        tcb_id_t tcb_id, const tcb_t *tcb, net_t<seq_t> seq
+    )
+    {
+        net_t<seq_t> ack;
+        ack.net = 0;
+
+        options_t options = { (typename options_t::mss_option_t) this->mss };
+        this->_send_segment(
+            tcb_id, seq, ack, _SYN_FLAGS, tcb->rx_window.size, options
+        );
+    }
+
     // Sends a SYN/ACK segment.
     //
     // <SEQ=seq><ACK=ack><CTL=SYN,ACK>
@@ -2425,59 +2990,49 @@ private:
 
         assert(end_of_transmission > tcb->tx_window.next);
 
-        auto to_send_it = to_send->begin();
-
-        do {
-            // First sequence number that can't be send in this segment or
-            // which is not in the data to send.
-            seq_t end_of_seg = min(
-                end_of_transmission,
-                tcb->tx_window.next + (seq_t) tcb->tx_window.mss
-            );
-
-            size_t payload_size = (end_of_seg - tcb->tx_window.next).value;
-            assert(payload_size > 0);
-            assert(payload_size <= tcb->tx_window.mss);
-            assert(payload_size <= tcb->tx_window.ready());
+        bool has_fin =    tcb->in_state(tcb_t::FIN_WAIT_1 | tcb_t::LAST_ACK)
+                       && tcb->tx_queue_not_sent.empty();
 
-            assert(to_send_it != to_send->end());
-
-            // Finds the first entry that will be sent in this segement.
-            for (; to_send_it->end <= tcb->tx_window.next; ++to_send_it)
-                ;
+        // Creates a function which writes the content of the transmission
+        // queue entries which overlap a segment into a single network buffer.
+        seq_t start_seq = tcb->tx_window.next;
+        writer_sum_t stream_writer =
+            [to_send, start_seq](size_t offset, cursor_t cursor)
+            {
+                seq_t         seq = start_seq + seq_t(offset);
+                partial_sum_t partial_sum = partial_sum_t::ZERO;
 
-            // Finds the first entry that will not be sent in this segment.
-            auto to_send_end_it = to_send_it + 1;
-            for (
-                ;
-                   to_send_end_it != to_send->end()
-                && to_send_end_it->end <= end_of_seg;
-                ++to_send_end_it
-            )
-                ;
+                for (const auto &entry : *to_send) {
+                    if (cursor.empty())
+                        break;
+                    else if (entry.end <= seq)
+                        continue;
 
-            bool has_fin =    tcb->in_state(tcb_t::FIN_WAIT_1 | tcb_t::LAST_ACK)
-                           && tcb->tx_queue_not_sent.empty();
+                    assert(entry.begin <= seq);
 
-            this->_send_data_segment(
-                tcb_id, tcb, tcb->tx_window.next,/* to_send, n_entries, */
-                to_send, to_send_it, to_send_end_it,
-                payload_size, has_fin
-            );
+                    size_t entry_offset = (seq - entry.begin).value,
+                           length       = min<size_t>(
+                                              (entry.end - seq).value,
+                                              cursor.size()
+                                          );
 
-            // Updates the transmission windows.
+                    partial_sum = partial_sum.append(
+                        entry.writer(entry_offset, cursor.take(length))
+                    );
+                    cursor = cursor.drop(length);
 
-            tcb->tx_window.next += (seq_t) payload_size;
+                    seq += seq_t(length);
+                }
 
-            tcb->rx_window.acked = tcb->rx_window.next;
+                assert(cursor.empty());
 
-            // Updates the transmission history.
-            typename tcb_t::tx_history_entry_t segment(tcb->tx_window.next);
-            tcb->tx_history.push_back(segment);
+                return partial_sum;
+            };
 
-            if (has_fin)
-                ++tcb->tx_window.next; // Transmitted FIN control bit.
-        } while (end_of_transmission > tcb->tx_window.next);
+        this->_send_data_segments(
+            tcb_id, tcb, (end_of_transmission - tcb->tx_window.next).value,
+            has_fin, stream_writer
+        );
 
         if (!tcb->has_timer)
             this->_schedule_retransmission_timer(tcb_id, tcb);
@@ -2502,8 +3057,9 @@ private:
 
         // Creates a function which writes the content of multiple transmission
         // queue entries into a single network buffer.
+        seq_t start_seq = seq;
         function<partial_sum_t(cursor_t)> payload_writer =
-            [this, start_seq = seq, to_send, begin, end](cursor_t cursor)
+            [this, start_seq, to_send, begin, end](cursor_t cursor)
             {
                 assert(to_send->size() > 0);
 
@@ -2558,6 +3114,128 @@ private:
         }
     }
 
+    // Sends the 'size' next bytes of the transmission stream, starting at
+    // SND.NXT, as a run of MSS-sized segments given at once to the network
+    // layer (a "super-segment").
+    //
+    // 'stream_writer' is called for each segment with the offset of the
+    // segment's payload relative to SND.NXT. The FIN control bit is set in the
+    // last segment if 'has_fin' is 'true'.
+    //
+    // Segment headers are copied from a template whose sum is precomputed, so
+    // that only the sequence number and the payload are summed per segment.
+    //
+    // Updates the transmission window, the transmission history and the
+    // 'acked' field of the received window.
+    //
+    // <SEQ=SND.NXT + i * MSS><ACK=RCV.NXT><CTL=ACK><payload>.
+    void _send_data_segments(
+        tcb_id_t tcb_id, tcb_t *tcb, size_t size, bool has_fin,
+        writer_sum_t stream_writer
+    )
+    {
+        assert(size > 0);
+        assert(size <= tcb->tx_window.ready());
+
+        seq_t  first_seq = tcb->tx_window.next;
+        size_t mss       = tcb->tx_window.mss,
+               n_segs    = (size + mss - 1) / mss,
+               last_size = size - (n_segs - 1) * mss;
+
+        TCP_TCB_DEBUG(
+            "Sends %zu data segments "
+            "(<SEQ=%u><ACK=%u><CTL=ACK%s><%zu bytes payload>)",
+            n_segs, first_seq.value, tcb->rx_window.next.value,
+            has_fin ? ",FIN" : "", size
+        );
+
+        #ifdef TCP_SUPER_SEGMENTS
+            // Header templates, with a zero sequence number and checksum.
+
+            header_t hdr;
+            _init_header(
+                &hdr, tcb_id.lport, tcb_id.rport, seq_t(0), tcb->rx_window.next,
+                _ACK_FLAGS, tcb->rx_window.size, 0
+            );
+
+            header_t last_hdr = hdr;
+            if (has_fin)
+                last_hdr.flags = _FIN_ACK_FLAGS;
+
+            // Sums of the templates and of the pseudo headers.
+
+            partial_sum_t hdr_sum =
+                network_t::tcp_pseudo_header_sum(
+                    tcb_id.laddr, tcb_id.raddr,
+                    net_t<seg_size_t>(HEADER_SIZE + mss)
+                ).append(partial_sum_t(&hdr, HEADER_SIZE));
+
+            partial_sum_t last_hdr_sum =
+                network_t::tcp_pseudo_header_sum(
+                    tcb_id.laddr, tcb_id.raddr,
+                    net_t<seg_size_t>(HEADER_SIZE + last_size)
+                ).append(partial_sum_t(&last_hdr, HEADER_SIZE));
+
+            this->network->send_tcp_payloads(
+            tcb_id.laddr, tcb_id.raddr, n_segs, HEADER_SIZE + mss,
+            HEADER_SIZE + last_size,
+            [n_segs, first_seq, mss, stream_writer, hdr, hdr_sum, last_hdr,
+             last_hdr_sum]
+            (size_t i, cursor_t cursor) {
+                bool   is_last = i + 1 == n_segs;
+                size_t offset  = i * mss;
+
+                partial_sum_t payload_sum =
+                    stream_writer(offset, cursor.drop(HEADER_SIZE));
+
+                cursor.template write_with<header_t>(
+                [&](header_t *out) {
+                    *out     = is_last ? last_hdr : hdr;
+                    out->seq = first_seq + seq_t(offset);
+
+                    partial_sum_t seq_sum(&out->seq, sizeof (out->seq));
+                    out->check = checksum_t(
+                        (is_last ? last_hdr_sum : hdr_sum).append(seq_sum)
+                                                          .append(payload_sum)
+                    );
+                });
+            });
+        #else
+            // Sends the segments one by one.
+            for (size_t i = 0; i < n_segs; i++) {
+                bool   is_last = i + 1 == n_segs;
+                size_t offset  = i * mss;
+
+                this->_send_segment(
+                    tcb_id, first_seq + seq_t(offset), tcb->rx_window.next,
+                    is_last && has_fin ? _FIN_ACK_FLAGS : _ACK_FLAGS,
+                    tcb->rx_window.size, EMPTY_OPTIONS,
+                    [stream_writer, offset](cursor_t cursor)
+                    {
+                        return stream_writer(offset, cursor);
+                    },
+                    is_last ? last_size : mss
+                );
+            }
+        #endif /* TCP_SUPER_SEGMENTS */
+
+        // Updates the transmission window and history as if the segments were
+        // sent one by one.
+
+        for (size_t i = 0; i < n_segs; i++) {
+            tcb->tx_window.next +=
+                (seq_t) (i + 1 == n_segs ? last_size : mss);
+
+            typename tcb_t::tx_history_entry_t segment(tcb->tx_window.next);
+            tcb->tx_history.push_back(segment);
+        }
+
+        if (has_fin)
+            ++tcb->tx_window.next; // Transmitted FIN control bit.
+
+        tcb->rx_window.acked = tcb->rx_window.next;
+    }
+
     // Responds to a received segment (and its payload) with a RST segment.
     //
     // RFC 793 (page 65) defines that RST messages which respond to segments
@@ -2571,8 +3249,11 @@ private:
     // ACK number as sequence number:
     //
     //     <SEQ=SEG.ACK><CTL=RST>
+    //
+    // 'tcb_id' identifies the connection the received segment belongs to, even
+    // if there is no TCB for it.
     void _respond_with_rst_segment(
-        net_t<addr_t> saddr, const header_t *hdr, cursor_t payload
+        tcb_id_t tcb_id, const header_t *hdr, cursor_t payload
     )
     {
         net_t<seq_t> seq;
@@ -2602,20 +3283,18 @@ private:
             );
         }
 
-        this->_send_segment(
-            hdr->dport, saddr, hdr->sport, seq, ack, flags, 0, EMPTY_OPTIONS
-        );
+        this->_send_segment(tcb_id, seq, ack, flags, 0, EMPTY_OPTIONS);
     }
 
     // Pushes the given segment with its payload to the network layer.
     void _send_segment(
-        net_t<port_t> sport, net_t<addr_t> daddr, net_t<port_t> dport,
+        net_t<addr_t> saddr, net_t<port_t> sport,
+        net_t<addr_t> daddr, net_t<port_t> dport,
         net_t<seq_t> seq, net_t<seq_t> ack, flags_t flags,
         net_t<win_size_t> window, options_t options,
         function<partial_sum_t(cursor_t)> payload_writer, size_t payload_size
     )
     {
-        net_t<addr_t> saddr = this->network->addr;
         size_t seg_size = HEADER_SIZE + options.size() + payload_size;
 
         assert(seg_size - HEADER_SIZE <= this->mss);
@@ -2627,7 +3306,7 @@ private:
             );
 
         this->network->send_tcp_payload(
-        daddr, seg_size,
+        saddr, daddr, seg_size,
         [sport, daddr, dport, seq, ack, flags, window, options, payload_writer,
          pseudo_hdr_sum]
         (cursor_t cursor) {
@@ -2660,21 +3339,8 @@ private:
     )
     {
         this->_send_segment(
-            tcb_id.lport, tcb_id.raddr, tcb_id.rport, seq, ack, flags, window,
-            options, payload_writer, payload_size
-        );
-    }
-
-    // Pushes the given segment with an empty payload to the network layer.
-    inline void _send_segment(
-        net_t<port_t> sport, net_t<addr_t> daddr, net_t<port_t> dport,
-        net_t<seq_t> seq, net_t<seq_t> ack, flags_t flags,
-        net_t<win_size_t> window, options_t options
-    )
-    {
-        this->_send_segment(
-            sport, daddr, dport, seq, ack, flags, window, options,
-            [](cursor_t cursor) { return partial_sum_t::ZERO; }, 0
+            tcb_id.laddr, tcb_id.lport, tcb_id.raddr, tcb_id.rport, seq, ack,
+            flags, window, options, payload_writer, payload_size
         );
     }
 
@@ -2685,8 +3351,8 @@ private:
     )
     {
         this->_send_segment(
-            tcb_id.lport, tcb_id.raddr, tcb_id.rport, seq, ack, flags, window,
-            options
+            tcb_id, seq, ack, flags, window, options,
+            [](cursor_t cursor) { return partial_sum_t::ZERO; }, 0
         );
     }
 
@@ -2699,6 +3365,13 @@ private:
         net_t<win_size_t> window, size_t options_size, partial_sum_t partial_sum
     );
 
+    // Initializes every field of the TCP header, with a zero checksum.
+    static inline void _init_header(
+        header_t *hdr, net_t<port_t> sport, net_t<port_t> dport,
+        net_t<seq_t> seq, net_t<seq_t> ack, flags_t flags,
+        net_t<win_size_t> window, size_t options_size
+    );
+
     #undef TCP_TCB_STATE_CHANGE
     #undef TCP_TCB_ERROR
     #undef TCP_TCB_DEBUG
@@ -2790,16 +3463,7 @@ tcp_t<network_t, alloc_t>::_write_header(
     return cursor.template write_with<header_t>(
     [sport, dport, seq, ack, flags, window, options_size, partial_sum]
     (header_t *hdr) {
-        hdr->sport   = sport;
-        hdr->dport   = dport;
-        hdr->seq     = seq;
-        hdr->ack     = ack;
-        hdr->res     = 0;
-        hdr->doff    = (HEADER_SIZE + options_size) / sizeof (uint32_t);
-        hdr->flags   = flags;
-        hdr->window  = window;
-        hdr->check   = checksum_t::ZERO;
-        hdr->urg_ptr = 0;
+        _init_header(hdr, sport, dport, seq, ack, flags, window, options_size);
 
         hdr->check = checksum_t(
             partial_sum_t(hdr, HEADER_SIZE).append(partial_sum)
@@ -2807,6 +3471,25 @@ tcp_t<network_t, alloc_t>::_write_header(
     });
 }
 
+template <typename network_t, typename alloc_t>
+inline void tcp_t<network_t, alloc_t>::_init_header(
+    header_t *hdr, net_t<port_t> sport, net_t<port_t> dport,
+    net_t<seq_t> seq, net_t<seq_t> ack, flags_t flags, net_t<uint16_t> window,
+    size_t options_size
+)
+{
+    hdr->sport   = sport;
+    hdr->dport   = dport;
+    hdr->seq     = seq;
+    hdr->ack     = ack;
+    hdr->res     = 0;
+    hdr->doff    = (HEADER_SIZE + options_size) / sizeof (uint32_t);
+    hdr->flags   = flags;
+    hdr->window  = window;
+    hdr->check   = checksum_t::ZERO;
+    hdr->urg_ptr = 0;
+}
+
 template <typename network_t, typename alloc_t>
 typename tcp_t<network_t, alloc_t>::options_t
 tcp_t<network_t, alloc_t>::_parse_options(
@@ -2823,8 +3506,10 @@ tcp_t<network_t, alloc_t>::_parse_options(
     if (options_size <= 0)
         return options;
 
+    flags_t flags = hdr->flags;
+
     *payload = payload->read_with(
-    [flags = hdr->flags, status, &options, options_size]
+    [flags, status, &options, options_size]
     (const char *data_char) mutable {
         const uint8_t *data = (const uint8_t *) data_char;
         const uint8_t *end  = data + options_size;
@@ -2923,23 +3608,22 @@ tcp_t<network_t, alloc_t>::_get_current_tcp_seq(void)
 
 namespace std {
 
-// 'std::hash<>' and 'std::equal_to<>' instances are required for TCB
-// identifiers to be used in unordered containers.
+// 'std::hash<>' and 'std::equal_to<>' instances are required for TCB and
+// listening port identifiers to be used in unordered containers.
 
 using namespace rusty::net;
 
-template <>
 template <typename addr_t, typename port_t>
 struct hash<tcp_tcb_id_t<addr_t, port_t>> {
     inline size_t operator()(const tcp_tcb_id_t<addr_t, port_t> &tcb_id) const
     {
         return   hash<net_t<addr_t>>()(tcb_id.raddr)
                + hash<net_t<port_t>>()(tcb_id.rport)
+               + hash<net_t<addr_t>>()(tcb_id.laddr)
                + hash<net_t<port_t>>()(tcb_id.lport);
     }
 };
 
-template <>
 template <typename addr_t, typename port_t>
 struct equal_to<tcp_tcb_id_t<addr_t, port_t>> {
     inline bool operator()(
@@ -2951,6 +3635,28 @@ struct equal_to<tcp_tcb_id_t<addr_t, port_t>> {
     }
 };
 
+template <typename addr_t, typename port_t>
+struct hash<tcp_listen_id_t<addr_t, port_t>> {
+    inline size_t operator()(
+        const tcp_listen_id_t<addr_t, port_t> &listen_id
+    ) const
+    {
+        return   hash<net_t<addr_t>>()(listen_id.laddr)
+               + hash<net_t<port_t>>()(listen_id.lport);
+    }
+};
+
+template <typename addr_t, typename port_t>
+struct equal_to<tcp_listen_id_t<addr_t, port_t>> {
+    inline bool operator()(
+        const tcp_listen_id_t<addr_t, port_t>& a,
+        const tcp_listen_id_t<addr_t, port_t>& b
+    ) const
+    {
+        return a == b;
+    }
+};
+
 } /* namespace std */
 
 #endif /* __RUSTY_NET_TCP_HPP__ */